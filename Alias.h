@@ -0,0 +1,422 @@
+// Alias and escape analysis of pointer parameters, after the other passes.
+// Aliasing follows the M64 types, like the loop optimizations: a pointer to T can only point to a T,
+// so it can only overlap an object whose type contains T, or is contained in T.
+// Pointer casts break this: in a function that can see a cast pointer (see MarkPointerCasts),
+// or that is called with one, any two pointers can overlap.
+// An extern function can keep any pointer, so nothing is restrict in a function that can call one.
+//
+// A parameter p: @T is written as restrict when no other pointer the function can reach
+// points to a type that overlaps T, and p itself is never changed.
+// It is written as const when nothing is written through it and it does not escape:
+// it is only dereferenced, or passed to a const parameter of another function.
+
+#define AliasMaxSourceN 64
+// Pointers to structs that point to themselves are followed this deep.
+#define AliasMaxTypeDepth 8
+
+typedef struct tdef AliasAnalysis
+{
+	ParseInput *input;
+
+	// Types that the pointers of the function, other than the analyzed parameter, can point to.
+	VarType *sources[AliasMaxSourceN];
+	size_t source_n;
+	bool too_many_sources;
+
+	// The parameter being analyzed.
+	Token name;
+	bool written_through;
+	bool escapes;
+
+	size_t restrict_n;
+	size_t const_n;
+} AliasAnalysis;
+
+static void
+func AddAliasSource(AliasAnalysis *alias, VarType *type)
+{
+	if(alias->source_n == AliasMaxSourceN)
+	{
+		alias->too_many_sources = true;
+		return;
+	}
+	alias->sources[alias->source_n] = type;
+	alias->source_n++;
+}
+
+static void
+func CollectPointedTypes(AliasAnalysis *alias, VarType *type, size_t depth)
+{
+	// Every pointer inside a value of this type, and inside what those point to.
+	if(depth == AliasMaxTypeDepth)
+	{
+		alias->too_many_sources = true;
+		return;
+	}
+
+	switch(type->id)
+	{
+		case ArrayTypeId:
+		{
+			CollectPointedTypes(alias, ((ArrayType *)type)->element_type, depth);
+			break;
+		}
+		case PointerTypeId:
+		{
+			VarType *pointed_type = ((PointerType *)type)->pointed_type;
+			AddAliasSource(alias, pointed_type);
+			CollectPointedTypes(alias, pointed_type, depth + 1);
+			break;
+		}
+		case StructTypeId:
+		{
+			StructDefinition *def = ((StructType *)type)->def;
+			for(StructVar *var = def->first_var; var; var = var->next)
+				CollectPointedTypes(alias, var->type, depth);
+			break;
+		}
+		default:
+		{
+			break;
+		}
+	}
+}
+
+static void
+func CollectCallSources(AliasAnalysis *alias, Expression *e)
+{
+	// Pointers returned by calls come from somewhere this function cannot see.
+	if((e->id == FuncCallExpressionId || e->id == OperatorCallExpressionId) && e->type && TypeHasPointer(e->type))
+		CollectPointedTypes(alias, e->type, 0);
+
+	Expression **child = 0;
+	for(size_t i = 0; (child = GetExpressionChild(e, i)) != 0; i++)
+		CollectCallSources(alias, *child);
+}
+
+static void
+func CollectCallSourcesInInstruction(AliasAnalysis *alias, Instruction *instruction)
+{
+	Expression **e = 0;
+	for(size_t i = 0; (e = GetInstructionExpression(instruction, i)) != 0; i++)
+		CollectCallSources(alias, *e);
+
+	for(Instruction *i = GetInstructionChild(instruction, 0); i; i = GetInstructionChild(instruction, i))
+		CollectCallSourcesInInstruction(alias, i);
+}
+
+static bool
+func CallsExtern(Expression *e)
+{
+	if(e->id == FuncCallExpressionId && ((FuncCallExpression *)e)->func_def->calls_extern)
+		return true;
+	if(e->id == OperatorCallExpressionId && ((OperatorCallExpression *)e)->def->calls_extern)
+		return true;
+
+	Expression **child = 0;
+	for(size_t i = 0; (child = GetExpressionChild(e, i)) != 0; i++)
+	{
+		if(CallsExtern(*child))
+			return true;
+	}
+	return false;
+}
+
+static bool
+func CallsExternInInstruction(Instruction *instruction)
+{
+	Expression **e = 0;
+	for(size_t i = 0; (e = GetInstructionExpression(instruction, i)) != 0; i++)
+	{
+		if(CallsExtern(*e))
+			return true;
+	}
+
+	for(Instruction *i = GetInstructionChild(instruction, 0); i; i = GetInstructionChild(instruction, i))
+	{
+		if(CallsExternInInstruction(i))
+			return true;
+	}
+	return false;
+}
+
+static void
+func MarkExternCalls(DefinitionList *def_list)
+{
+	// Sets calls_extern for every definition that can run an extern function through its calls.
+	// Generic instances can come after their callers, so this repeats until nothing changes.
+	bool changed = true;
+	while(changed)
+	{
+		changed = false;
+		for(DefinitionListElem *elem = def_list; elem; elem = elem->next)
+		{
+			Definition *definition = elem->definition;
+			bool *calls_extern = 0;
+			BlockInstruction *body = 0;
+			if(definition->id == FuncDefinitionId && !((FuncDefinition *)definition)->is_extern)
+			{
+				calls_extern = &((FuncDefinition *)definition)->calls_extern;
+				body = ((FuncDefinition *)definition)->body;
+			}
+			else if(definition->id == OperatorDefinitionId)
+			{
+				calls_extern = &((OperatorDefinition *)definition)->calls_extern;
+				body = ((OperatorDefinition *)definition)->body;
+			}
+
+			if(calls_extern && !*calls_extern && CallsExternInInstruction((Instruction *)body))
+			{
+				*calls_extern = true;
+				changed = true;
+			}
+		}
+	}
+}
+
+static bool
+func TypesOverlap(VarType *type1, VarType *type2)
+{
+	return TypeContains(type1, type2) || TypeContains(type2, type1);
+}
+
+static Expression *
+func SkipParens(Expression *e)
+{
+	while(e->id == ParenExpressionId)
+		e = ((ParenExpression *)e)->in;
+	return e;
+}
+
+static void
+func ScanPointerUses(AliasAnalysis *alias, Expression *e, bool is_dereferenced)
+{
+	// Any use of the parameter other than dereferencing it lets it escape.
+	switch(e->id)
+	{
+		case VarExpressionId:
+		{
+			if(!is_dereferenced && TokensEqual(((VarExpression *)e)->var.name, alias->name))
+				alias->escapes = true;
+			return;
+		}
+		case ParenExpressionId:
+		{
+			ScanPointerUses(alias, ((ParenExpression *)e)->in, is_dereferenced);
+			return;
+		}
+		case DereferenceExpressionId:
+		{
+			ScanPointerUses(alias, ((DereferenceExpression *)e)->pointer, true);
+			return;
+		}
+		case StructVarExpressionId:
+		{
+			Expression *base = ((StructVarExpression *)e)->base;
+			ScanPointerUses(alias, base, base->type->id == PointerTypeId);
+			return;
+		}
+		case ArrayIndexExpressionId:
+		{
+			ArrayIndexExpression *a = (ArrayIndexExpression *)e;
+			ScanPointerUses(alias, a->array, a->array->type->id == PointerTypeId);
+			ScanPointerUses(alias, a->index, false);
+			return;
+		}
+		case FuncCallExpressionId:
+		{
+			FuncCallExpression *call = (FuncCallExpression *)e;
+			FuncParam *param = call->func_def->header.first_param;
+			for(FuncCallArgument *arg = call->first_call_arg; arg; arg = arg->next)
+			{
+				ScanPointerUses(alias, arg->arg, param && param->is_const);
+				if(param)
+					param = param->next;
+			}
+			return;
+		}
+		default:
+		{
+			break;
+		}
+	}
+
+	Expression **child = 0;
+	for(size_t i = 0; (child = GetExpressionChild(e, i)) != 0; i++)
+		ScanPointerUses(alias, *child, false);
+}
+
+static void
+func ScanWriteTarget(AliasAnalysis *alias, Expression *target)
+{
+	// The first dereference from the outside is the pointer the write goes through.
+	Expression *e = SkipParens(target);
+	Expression *pointer = 0;
+	while(!pointer)
+	{
+		if(e->id == DereferenceExpressionId)
+		{
+			pointer = ((DereferenceExpression *)e)->pointer;
+		}
+		else if(e->id == StructVarExpressionId)
+		{
+			Expression *base = ((StructVarExpression *)e)->base;
+			if(base->type->id == PointerTypeId)
+				pointer = base;
+			else
+				e = SkipParens(base);
+		}
+		else if(e->id == ArrayIndexExpressionId)
+		{
+			Expression *array = ((ArrayIndexExpression *)e)->array;
+			if(array->type->id == PointerTypeId)
+				pointer = array;
+			else
+				e = SkipParens(array);
+		}
+		else
+		{
+			break;
+		}
+	}
+
+	pointer = pointer ? SkipParens(pointer) : 0;
+	if(pointer && pointer->id == VarExpressionId && TokensEqual(((VarExpression *)pointer)->var.name, alias->name))
+		alias->written_through = true;
+
+	ScanPointerUses(alias, target, false);
+}
+
+static void
+func ScanPointerUsesInInstruction(AliasAnalysis *alias, Instruction *instruction)
+{
+	switch(instruction->id)
+	{
+		case AndEqualsInstructionId:
+		{
+			AndEqualsInstruction *i = (AndEqualsInstruction *)instruction;
+			ScanWriteTarget(alias, i->left);
+			ScanPointerUses(alias, i->right, false);
+			break;
+		}
+		case AssignInstructionId:
+		{
+			AssignInstruction *i = (AssignInstruction *)instruction;
+			ScanWriteTarget(alias, i->left);
+			ScanPointerUses(alias, i->right, false);
+			break;
+		}
+		case IncrementInstructionId:
+		{
+			ScanWriteTarget(alias, ((IncrementInstruction *)instruction)->value);
+			break;
+		}
+		case BlockInstructionId:
+		{
+			for(Instruction *i = ((BlockInstruction *)instruction)->first; i; i = i->next)
+				ScanPointerUsesInInstruction(alias, i);
+			break;
+		}
+		case IfInstructionId:
+		{
+			IfInstruction *i = (IfInstruction *)instruction;
+			ScanPointerUses(alias, i->condition, false);
+			ScanPointerUsesInInstruction(alias, (Instruction *)i->body);
+			break;
+		}
+		case ForInstructionId:
+		{
+			ForInstruction *loop = (ForInstruction *)instruction;
+			if(loop->init)
+				ScanPointerUsesInInstruction(alias, loop->init);
+			ScanPointerUses(alias, loop->condition, false);
+			if(loop->update)
+				ScanPointerUsesInInstruction(alias, loop->update);
+			ScanPointerUsesInInstruction(alias, (Instruction *)loop->body);
+			break;
+		}
+		default:
+		{
+			Expression **e = 0;
+			for(size_t i = 0; (e = GetInstructionExpression(instruction, i)) != 0; i++)
+				ScanPointerUses(alias, *e, false);
+			break;
+		}
+	}
+}
+
+static void
+func AnalyzeFuncParams(AliasAnalysis *alias, FuncDefinition *def)
+{
+	for(FuncParam *param = def->header.first_param; param; param = param->next)
+	{
+		if(param->type->id != PointerTypeId)
+			continue;
+
+		VarType *pointed_type = ((PointerType *)param->type)->pointed_type;
+
+		alias->source_n = 0;
+		alias->too_many_sources = false;
+		CollectPointedTypes(alias, pointed_type, 1);
+		for(FuncParam *other = def->header.first_param; other; other = other->next)
+		{
+			if(other != param)
+				CollectPointedTypes(alias, other->type, 0);
+		}
+		CollectCallSourcesInInstruction(alias, (Instruction *)def->body);
+
+		// An extern function can reach the same memory as the parameter, through a pointer that C keeps.
+		bool overlaps = alias->too_many_sources || def->calls_extern || (def->sees_pointer_casts && alias->source_n > 0);
+		for(size_t i = 0; i < alias->source_n; i++)
+			overlaps |= TypesOverlap(pointed_type, alias->sources[i]);
+
+		alias->name = param->name;
+		alias->written_through = false;
+		alias->escapes = false;
+		ScanPointerUsesInInstruction(alias, (Instruction *)def->body);
+
+		bool is_changed = IsVarWritten((Instruction *)def->body, param->name);
+		param->is_restrict = (!overlaps && !is_changed);
+		param->is_const = (!alias->written_through && !alias->escapes && !is_changed);
+
+		alias->restrict_n += param->is_restrict;
+		alias->const_n += param->is_const;
+	}
+}
+
+static size_t
+func AnalyzeAliasing(ParseInput *input, DefinitionList *def_list, bool report)
+{
+	AliasAnalysis alias = {};
+	alias.input = input;
+
+	if(report)
+		printf("Aliasing:\n");
+
+	MarkPointerCasts(input, def_list);
+	MarkExternCalls(def_list);
+	// Functions only call earlier ones, so the const parameters of every callee are known.
+	for(DefinitionListElem *elem = def_list; elem; elem = elem->next)
+	{
+		Definition *definition = elem->definition;
+		if(definition->id != FuncDefinitionId || ((FuncDefinition *)definition)->is_extern)
+			continue;
+
+		FuncDefinition *def = (FuncDefinition *)definition;
+		size_t restrict_n = alias.restrict_n;
+		size_t const_n = alias.const_n;
+		AnalyzeFuncParams(&alias, def);
+
+		if(report && (alias.restrict_n != restrict_n || alias.const_n != const_n))
+		{
+			Atom *atom = &input->atoms.atoms[def->header.name.value];
+			printf("  %.*s: %zu restrict and %zu const pointer parameters\n",
+			       (int)atom->length, atom->text, alias.restrict_n - restrict_n, alias.const_n - const_n);
+		}
+	}
+
+	if(report)
+		printf("%zu restrict and %zu const pointer parameters.\n", alias.restrict_n, alias.const_n);
+
+	return alias.restrict_n;
+}
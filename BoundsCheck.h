@@ -0,0 +1,351 @@
+// Bounds checks for --bounds-check, after the other passes.
+// Every index into a [N]T array, or into the array a struct uses, is checked at runtime,
+// unless its value range proves it is in bounds. Indexing through a pointer has no size to check against.
+//
+// The ranges come from integer constants, from the variables of counting loops:
+// in `for i := a; i < b; i++` with i not written in the body, i is in [min(a), max(b) - 1],
+// and from variables that are never written after they are created.
+// Anything else has an unknown range and keeps its check.
+
+typedef struct tdef ValueRange
+{
+	bool known;
+	I64 min;
+	I64 max;
+} ValueRange;
+
+typedef struct tdef RangeVar
+{
+	Token name;
+	ValueRange range;
+} RangeVar;
+
+#define BoundsMaxRangeVarN 64
+
+typedef struct tdef BoundsChecker
+{
+	ParseInput *input;
+
+	// Loop variables of the enclosing loops, innermost last.
+	RangeVar vars[BoundsMaxRangeVarN];
+	size_t var_n;
+
+	size_t checked_n;
+	size_t proven_n;
+} BoundsChecker;
+
+static ArrayType *
+func GetIndexedArrayType(ArrayIndexExpression *e)
+{
+	VarType *type = e->array->type;
+	if(type->id == StructTypeId)
+		type = ((StructType *)type)->def->used_var->type;
+	return (type->id == ArrayTypeId) ? (ArrayType *)type : 0;
+}
+
+static ValueRange
+func MakeRange(I64 min, I64 max)
+{
+	// Values outside of 32 bits would have wrapped around.
+	ValueRange range = {};
+	if(min >= INT_MIN && max <= INT_MAX)
+	{
+		range.known = true;
+		range.min = min;
+		range.max = max;
+	}
+	return range;
+}
+
+static ValueRange
+func GetValueRange(BoundsChecker *checker, Expression *e)
+{
+	ValueRange unknown = {};
+	switch(e->id)
+	{
+		case IntegerConstantExpressionId:
+		{
+			I64 value = ((IntegerConstantExpression *)e)->value;
+			return MakeRange(value, value);
+		}
+		case ParenExpressionId:
+		{
+			return GetValueRange(checker, ((ParenExpression *)e)->in);
+		}
+		case VarExpressionId:
+		{
+			Token name = ((VarExpression *)e)->var.name;
+			for(size_t i = checker->var_n; i > 0; i--)
+			{
+				if(TokensEqual(checker->vars[i - 1].name, name))
+					return checker->vars[i - 1].range;
+			}
+			return unknown;
+		}
+		case NegativeExpressionId:
+		{
+			ValueRange value = GetValueRange(checker, ((NegativeExpression *)e)->value);
+			return value.known ? MakeRange(-value.max, -value.min) : unknown;
+		}
+		case AddExpressionId:
+		{
+			AddExpression *add = (AddExpression *)e;
+			ValueRange left = GetValueRange(checker, add->left);
+			ValueRange right = GetValueRange(checker, add->right);
+			if(!left.known || !right.known || !IsIntegerType(e->type))
+				return unknown;
+			return MakeRange(left.min + right.min, left.max + right.max);
+		}
+		case SubtractExpressionId:
+		{
+			SubtractExpression *sub = (SubtractExpression *)e;
+			ValueRange left = GetValueRange(checker, sub->left);
+			ValueRange right = GetValueRange(checker, sub->right);
+			if(!left.known || !right.known || !IsIntegerType(e->type))
+				return unknown;
+			return MakeRange(left.min - right.max, left.max - right.min);
+		}
+		case MultiplyExpressionId:
+		{
+			MultiplyExpression *mul = (MultiplyExpression *)e;
+			ValueRange left = GetValueRange(checker, mul->left);
+			ValueRange right = GetValueRange(checker, mul->right);
+			if(!left.known || !right.known || !IsIntegerType(e->type))
+				return unknown;
+
+			// Both sides fit in 32 bits, so none of the products overflow.
+			I64 products[4] = {left.min * right.min, left.min * right.max, left.max * right.min, left.max * right.max};
+			I64 min = products[0];
+			I64 max = products[0];
+			for(size_t i = 1; i < 4; i++)
+			{
+				if(products[i] < min)
+					min = products[i];
+				if(products[i] > max)
+					max = products[i];
+			}
+			return MakeRange(min, max);
+		}
+		default:
+		{
+			return unknown;
+		}
+	}
+}
+
+static bool
+func GetArraySize(ArrayType *type, I64 *size)
+{
+	if(!type->size || type->size->id != IntegerConstantExpressionId)
+		return false;
+	*size = ((IntegerConstantExpression *)type->size)->value;
+	return true;
+}
+
+static void
+func CheckBoundsInExpression(BoundsChecker *checker, Expression *e)
+{
+	Expression **child = 0;
+	for(size_t i = 0; (child = GetExpressionChild(e, i)) != 0; i++)
+		CheckBoundsInExpression(checker, *child);
+
+	if(e->id != ArrayIndexExpressionId)
+		return;
+
+	ArrayIndexExpression *a = (ArrayIndexExpression *)e;
+	ArrayType *type = GetIndexedArrayType(a);
+	if(!type)
+		return;
+
+	I64 size = 0;
+	ValueRange range = GetValueRange(checker, a->index);
+	if(GetArraySize(type, &size) && range.known && range.min >= 0 && range.max < size)
+	{
+		checker->proven_n++;
+	}
+	else
+	{
+		a->checked = true;
+		checker->checked_n++;
+	}
+}
+
+static ValueRange
+func GetLoopVarRange(BoundsChecker *checker, ForInstruction *loop, Token *name)
+{
+	ValueRange unknown = {};
+	if(!loop->init || loop->init->id != CreateVariableInstructionId || !loop->update || loop->update->id != IncrementInstructionId)
+		return unknown;
+
+	CreateVariableInstruction *init = (CreateVariableInstruction *)loop->init;
+	IncrementInstruction *update = (IncrementInstruction *)loop->update;
+	if(!init->init || !IsIntegerType(init->type) || !IsVarNamed(update->value, init->name))
+		return unknown;
+	if(!loop->condition || IsVarWritten((Instruction *)loop->body, init->name))
+		return unknown;
+
+	Expression *end = 0;
+	bool inclusive = false;
+	Expression *condition = loop->condition;
+	if(condition->id == LessThanExpressionId && IsVarNamed(((LessThanExpression *)condition)->left, init->name))
+	{
+		end = ((LessThanExpression *)condition)->right;
+	}
+	else if(condition->id == LessThanEqualExpressionId && IsVarNamed(((LessThanEqualExpression *)condition)->left, init->name))
+	{
+		end = ((LessThanEqualExpression *)condition)->right;
+		inclusive = true;
+	}
+	else if(condition->id == GreaterThanExpressionId && IsVarNamed(((GreaterThanExpression *)condition)->right, init->name))
+	{
+		end = ((GreaterThanExpression *)condition)->left;
+	}
+	if(!end)
+		return unknown;
+
+	ValueRange start_range = GetValueRange(checker, init->init);
+	ValueRange end_range = GetValueRange(checker, end);
+	if(!start_range.known || !end_range.known)
+		return unknown;
+
+	*name = init->name;
+	return MakeRange(start_range.min, inclusive ? end_range.max : end_range.max - 1);
+}
+
+static void decl CheckBoundsInBlock(BoundsChecker *, BlockInstruction *);
+
+static void
+func CheckBoundsInInstruction(BoundsChecker *checker, Instruction *instruction)
+{
+	Expression **e = 0;
+	for(size_t i = 0; (e = GetInstructionExpression(instruction, i)) != 0; i++)
+		CheckBoundsInExpression(checker, *e);
+
+	switch(instruction->id)
+	{
+		case BlockInstructionId:
+		{
+			CheckBoundsInBlock(checker, (BlockInstruction *)instruction);
+			break;
+		}
+		case IfInstructionId:
+		{
+			CheckBoundsInBlock(checker, ((IfInstruction *)instruction)->body);
+			break;
+		}
+		case ForInstructionId:
+		{
+			// The init, condition and update also run outside of the range of the loop variable.
+			ForInstruction *loop = (ForInstruction *)instruction;
+			if(loop->init)
+				CheckBoundsInInstruction(checker, loop->init);
+			if(loop->update)
+				CheckBoundsInInstruction(checker, loop->update);
+
+			Token name = {};
+			ValueRange range = GetLoopVarRange(checker, loop, &name);
+			bool pushed = (range.known && checker->var_n < BoundsMaxRangeVarN);
+			if(pushed)
+			{
+				checker->vars[checker->var_n].name = name;
+				checker->vars[checker->var_n].range = range;
+				checker->var_n++;
+			}
+
+			CheckBoundsInBlock(checker, loop->body);
+
+			if(pushed)
+				checker->var_n--;
+			break;
+		}
+		default:
+		{
+			break;
+		}
+	}
+}
+
+static bool
+func IsVarWrittenAfter(Instruction *instruction, Token name)
+{
+	for(Instruction *i = instruction->next; i; i = i->next)
+	{
+		if(IsVarWritten(i, name))
+			return true;
+	}
+	return false;
+}
+
+static void
+func CheckBoundsInBlock(BoundsChecker *checker, BlockInstruction *block)
+{
+	// Variables that keep their initial value, like the ones hoisted out of loops, have its range.
+	size_t var_n = checker->var_n;
+	for(Instruction *i = block->first; i; i = i->next)
+	{
+		CheckBoundsInInstruction(checker, i);
+
+		if(i->id != CreateVariableInstructionId || checker->var_n == BoundsMaxRangeVarN)
+			continue;
+
+		CreateVariableInstruction *create = (CreateVariableInstruction *)i;
+		if(!create->init || !IsIntegerType(create->type) || IsVarWrittenAfter(i, create->name))
+			continue;
+
+		ValueRange range = GetValueRange(checker, create->init);
+		if(range.known)
+		{
+			checker->vars[checker->var_n].name = create->name;
+			checker->vars[checker->var_n].range = range;
+			checker->var_n++;
+		}
+	}
+	checker->var_n = var_n;
+}
+
+static size_t
+func AddBoundsChecks(ParseInput *input, DefinitionList *def_list, bool report)
+{
+	BoundsChecker checker = {};
+	checker.input = input;
+
+	if(report)
+		printf("Bounds checks:\n");
+
+	for(DefinitionListElem *elem = def_list; elem; elem = elem->next)
+	{
+		Definition *definition = elem->definition;
+		BlockInstruction *body = 0;
+		Token name = {};
+		if(definition->id == FuncDefinitionId && !((FuncDefinition *)definition)->is_extern)
+		{
+			body = ((FuncDefinition *)definition)->body;
+			name = ((FuncDefinition *)definition)->header.name;
+		}
+		else if(definition->id == OperatorDefinitionId)
+		{
+			body = ((OperatorDefinition *)definition)->body;
+			name = ((OperatorDefinition *)definition)->name;
+		}
+
+		if(!body)
+			continue;
+
+		size_t checked_n = checker.checked_n;
+		size_t proven_n = checker.proven_n;
+		checker.var_n = 0;
+		CheckBoundsInBlock(&checker, body);
+
+		if(report && (checker.checked_n != checked_n || checker.proven_n != proven_n))
+		{
+			Atom *atom = &input->atoms.atoms[name.value];
+			printf("  %.*s: %zu indices checked, %zu proven in bounds\n",
+			       (int)atom->length, atom->text, checker.checked_n - checked_n, checker.proven_n - proven_n);
+		}
+	}
+
+	if(report)
+		printf("Checked %zu indices, %zu checks removed.\n", checker.checked_n, checker.proven_n);
+
+	return checker.checked_n;
+}
@@ -0,0 +1,122 @@
+// --build exe_file compiles the C output into an executable without writing a .c file:
+// the output is written into the standard input of the C compiler through a pipe.
+// The command is `<cc> -x c - <cflags> -o <exe_file>`, which gcc and clang understand,
+// with cc and cflags from --cc and --cflags, or from the M64_CC and M64_CFLAGS environment variables.
+//
+// A hash of the command and the C output is kept in <exe_file>.m64cache.
+// When it matches and the executable exists, the C compiler is not run again.
+// The output is hashed before the compiler starts, so it is complete in memory by then;
+// writing it takes a small fraction of the time the C compiler takes.
+
+#ifdef _WIN32
+#define M64OpenPipe(command) _popen(command, "wb")
+#define M64ClosePipe(pipe) _pclose(pipe)
+#else
+#define M64OpenPipe(command) popen(command, "w")
+#define M64ClosePipe(pipe) pclose(pipe)
+#endif
+
+#define BuildDefaultCC "cc"
+#define BuildDefaultCFlags "-O2 -lm"
+#define BuildMaxCommandLength 4096
+
+static U64
+func HashBuild(char *command, char *code, size_t code_size)
+{
+	U64 hash = 14695981039346656037ull;
+	for(char *at = command; *at; at++)
+	{
+		hash ^= (unsigned char)*at;
+		hash *= 1099511628211ull;
+	}
+	for(size_t i = 0; i < code_size; i++)
+	{
+		hash ^= (unsigned char)code[i];
+		hash *= 1099511628211ull;
+	}
+	return hash;
+}
+
+static bool
+func IsBuildCached(char *cache_path, char *exe_path, U64 hash)
+{
+	FILE *exe = fopen(exe_path, "rb");
+	if(!exe)
+		return false;
+	fclose(exe);
+
+	FILE *cache = fopen(cache_path, "r");
+	if(!cache)
+		return false;
+
+	unsigned long long cached_hash = 0;
+	bool matches = (fscanf(cache, "m64-build %llx", &cached_hash) == 1 && cached_hash == hash);
+	fclose(cache);
+	return matches;
+}
+
+static bool
+func BuildExecutable(Output *output, char *exe_path, char *cc, char *cflags, bool report)
+{
+	if(!cc)
+		cc = getenv("M64_CC");
+	if(!cc)
+		cc = BuildDefaultCC;
+	if(!cflags)
+		cflags = getenv("M64_CFLAGS");
+	if(!cflags)
+		cflags = BuildDefaultCFlags;
+
+	char command[BuildMaxCommandLength];
+	int command_length = snprintf(command, sizeof(command), "%s -x c - %s -o \"%s\"", cc, cflags, exe_path);
+	if(command_length < 0 || command_length >= (int)sizeof(command))
+	{
+		printf("Error: The C compiler command is longer than %i characters.\n", BuildMaxCommandLength - 1);
+		return false;
+	}
+
+	char cache_path[BuildMaxCommandLength];
+	snprintf(cache_path, sizeof(cache_path), "%s.m64cache", exe_path);
+
+	U64 hash = HashBuild(command, output->arena.memory, output->arena.used_size);
+	if(IsBuildCached(cache_path, exe_path, hash))
+	{
+		if(report)
+			printf("Build:\n<%s> is up to date, the C compiler was not run.\n", exe_path);
+		return true;
+	}
+
+	// A stale cache must not survive a failed build.
+	remove(cache_path);
+
+	if(report)
+		printf("Build:\n%s\n", command);
+
+	fflush(stdout);
+#ifndef _WIN32
+	// A compiler that exits early makes the write fail instead of ending this process.
+	signal(SIGPIPE, SIG_IGN);
+#endif
+	FILE *pipe = M64OpenPipe(command);
+	if(!pipe)
+	{
+		printf("Error: Cannot start the C compiler <%s>.\n", cc);
+		return false;
+	}
+
+	size_t written_size = fwrite(output->arena.memory, 1, output->arena.used_size, pipe);
+	int status = M64ClosePipe(pipe);
+	if(written_size != output->arena.used_size || status != 0)
+	{
+		printf("Error: The C compiler failed to build <%s>.\n", exe_path);
+		return false;
+	}
+
+	FILE *cache = fopen(cache_path, "w");
+	if(cache)
+	{
+		fprintf(cache, "m64-build %llx\n", (unsigned long long)hash);
+		fclose(cache);
+	}
+	return true;
+}
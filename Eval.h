@@ -0,0 +1,1079 @@
+// Compile-time evaluation of pure M64 code, before any other pass.
+// Calls and operations whose operands are all constants are run on the M64 tree
+// and replaced by their result, so they cost nothing at runtime.
+// Array sizes are evaluated the same way, so they can call earlier functions.
+//
+// Values are kept as ConstantScalar arrays, one scalar for each base type value,
+// so a struct or an array result becomes constant data in the output.
+// Anything that reads or writes through a pointer, or calls an extern function,
+// stops the evaluation and leaves the expression to run at runtime.
+
+// Limits for a single evaluated expression, to stay fast on loops that do not end.
+#define EvalMaxStepN (1024 * 1024)
+#define EvalMaxCallDepth 64
+#define EvalMaxParamN 32
+
+typedef struct tdef EvalVar
+{
+	U32 name;
+	VarType *type;
+	size_t offset;
+} EvalVar;
+
+typedef enum tdef EvalResult
+{
+	EvalNextResult,
+	EvalReturnResult,
+	EvalFailResult
+} EvalResult;
+
+typedef struct tdef Evaluator
+{
+	ParseInput *input;
+
+	// Scalars of every variable and temporary value, addressed by offset since it can move.
+	ConstantScalar *stack;
+	size_t stack_n;
+	size_t stack_max_n;
+
+	EvalVar *vars;
+	size_t var_n;
+	size_t var_max_n;
+	// Variables of the function being run start here.
+	size_t frame_var_at;
+	// Where a return instruction writes the result of the function being run.
+	size_t return_offset;
+
+	size_t step_n;
+	size_t call_depth;
+
+	size_t folded_call_n;
+	size_t folded_expression_n;
+	size_t folded_size_n;
+} Evaluator;
+
+static size_t
+func GetScalarCount(VarType *type)
+{
+	// 0 for types that cannot be evaluated.
+	switch(type->id)
+	{
+		case BaseTypeId:
+		{
+			return 1;
+		}
+		case StructTypeId:
+		{
+			size_t count = 0;
+			for(StructVar *var = ((StructType *)type)->def->first_var; var; var = var->next)
+			{
+				size_t var_count = GetScalarCount(var->type);
+				if(var_count == 0)
+					return 0;
+				count += var_count;
+			}
+			return count;
+		}
+		case ArrayTypeId:
+		{
+			ArrayType *array = (ArrayType *)type;
+			if(array->size->id != IntegerConstantExpressionId)
+				return 0;
+
+			I64 size = ((IntegerConstantExpression *)array->size)->value;
+			size_t element_count = GetScalarCount(array->element_type);
+			if(size <= 0 || element_count == 0)
+				return 0;
+			return (size_t)size * element_count;
+		}
+		default:
+		{
+			return 0;
+		}
+	}
+}
+
+static size_t
+func GetScalarOffset(StructDefinition *def, Token name)
+{
+	size_t offset = 0;
+	for(StructVar *var = def->first_var; var; var = var->next)
+	{
+		if(TokensEqual(var->name, name))
+			break;
+		offset += GetScalarCount(var->type);
+	}
+	return offset;
+}
+
+static BaseVarTypeId
+func GetBaseTypeId(VarType *type)
+{
+	return ((BaseType *)type)->base_id;
+}
+
+static ConstantScalar
+func NormalizeScalar(VarType *type, ConstantScalar value)
+{
+	// Wraps a value computed in 64 bits to what the M64 type holds.
+	switch(GetBaseTypeId(type))
+	{
+		case BoolBaseTypeId:    value.i = (value.i != 0); break;
+		case Int32BaseTypeId:   value.i = (I64)(I32)(U32)value.i; break;
+		case UInt32BaseTypeId:  value.i = (I64)(U32)value.i; break;
+		case Float32BaseTypeId: value.f = (double)(float)value.f; break;
+	}
+	return value;
+}
+
+static size_t
+func PushEvalScalars(Evaluator *ev, size_t count)
+{
+	if(ev->stack_n + count > ev->stack_max_n)
+	{
+		size_t max_n = 2 * (ev->stack_n + count) + 256;
+		ev->stack = (ConstantScalar *)realloc(ev->stack, max_n * sizeof(ConstantScalar));
+		ev->stack_max_n = max_n;
+	}
+
+	size_t offset = ev->stack_n;
+	memset(ev->stack + offset, 0, count * sizeof(ConstantScalar));
+	ev->stack_n += count;
+	return offset;
+}
+
+static void
+func AddEvalVar(Evaluator *ev, Token name, VarType *type, size_t offset)
+{
+	if(ev->var_n == ev->var_max_n)
+	{
+		ev->var_max_n = 2 * ev->var_max_n + 64;
+		ev->vars = (EvalVar *)realloc(ev->vars, ev->var_max_n * sizeof(EvalVar));
+	}
+
+	EvalVar *var = &ev->vars[ev->var_n];
+	ev->var_n++;
+	var->name = name.value;
+	var->type = type;
+	var->offset = offset;
+}
+
+static EvalVar *
+func GetEvalVar(Evaluator *ev, Token name)
+{
+	for(size_t i = ev->var_n; i > ev->frame_var_at; i--)
+	{
+		if(ev->vars[i - 1].name == name.value)
+			return &ev->vars[i - 1];
+	}
+	return 0;
+}
+
+static bool decl EvalExpression(Evaluator *, Expression *, size_t);
+
+static bool
+func EvalAddress(Evaluator *ev, Expression *e, size_t *offset)
+{
+	switch(e->id)
+	{
+		case VarExpressionId:
+		{
+			EvalVar *var = GetEvalVar(ev, ((VarExpression *)e)->var.name);
+			if(!var)
+				return false;
+			*offset = var->offset;
+			return true;
+		}
+		case ParenExpressionId:
+		{
+			return EvalAddress(ev, ((ParenExpression *)e)->in, offset);
+		}
+		case StructVarExpressionId:
+		{
+			StructVarExpression *s = (StructVarExpression *)e;
+			if(s->base->type->id != StructTypeId || !EvalAddress(ev, s->base, offset))
+				return false;
+			*offset += GetScalarOffset(((StructType *)s->base->type)->def, s->var_name);
+			return true;
+		}
+		case ArrayIndexExpressionId:
+		{
+			ArrayIndexExpression *a = (ArrayIndexExpression *)e;
+			VarType *array_type = a->array->type;
+			if(array_type->id == PointerTypeId || !EvalAddress(ev, a->array, offset))
+				return false;
+
+			if(array_type->id == StructTypeId)
+			{
+				StructDefinition *def = ((StructType *)array_type)->def;
+				*offset += GetScalarOffset(def, def->used_var->name);
+				array_type = def->used_var->type;
+			}
+			if(array_type->id != ArrayTypeId)
+				return false;
+
+			size_t base = *offset;
+			size_t index_offset = PushEvalScalars(ev, 1);
+			if(!EvalExpression(ev, a->index, index_offset))
+				return false;
+			I64 index = ev->stack[index_offset].i;
+			ev->stack_n = index_offset;
+
+			// Indexing out of bounds is left for runtime, where it is the program's problem.
+			ArrayType *array = (ArrayType *)array_type;
+			I64 size = ((IntegerConstantExpression *)array->size)->value;
+			if(index < 0 || index >= size)
+				return false;
+
+			*offset = base + (size_t)index * GetScalarCount(array->element_type);
+			return true;
+		}
+		default:
+		{
+			return false;
+		}
+	}
+}
+
+static bool
+func EvalBaseOperands(Evaluator *ev, Expression *left, Expression *right, ConstantScalar *values)
+{
+	if(left->type->id != BaseTypeId || right->type->id != BaseTypeId)
+		return false;
+
+	size_t offset = PushEvalScalars(ev, 2);
+	if(!EvalExpression(ev, left, offset) || !EvalExpression(ev, right, offset + 1))
+		return false;
+	values[0] = ev->stack[offset];
+	values[1] = ev->stack[offset + 1];
+	ev->stack_n = offset;
+	return true;
+}
+
+static bool
+func EvalCompare(Evaluator *ev, Expression *left, Expression *right, int *order)
+{
+	// order is negative, 0 or positive, like left - right.
+	ConstantScalar values[2];
+	if(!EvalBaseOperands(ev, left, right, values))
+		return false;
+
+	if(GetBaseTypeId(left->type) == Float32BaseTypeId)
+	{
+		// Every comparison with NaN is false, which no order gives.
+		if(values[0].f != values[0].f || values[1].f != values[1].f)
+			return false;
+		*order = (values[0].f < values[1].f) ? -1 : (values[0].f > values[1].f);
+	}
+	else
+	{
+		*order = (values[0].i < values[1].i) ? -1 : (values[0].i > values[1].i);
+	}
+	return true;
+}
+
+static bool
+func EvalCast(VarType *to, VarType *from, ConstantScalar value, ConstantScalar *result)
+{
+	BaseVarTypeId to_id = GetBaseTypeId(to);
+	bool from_float = (GetBaseTypeId(from) == Float32BaseTypeId);
+	if(to_id == Float32BaseTypeId)
+	{
+		result->f = from_float ? value.f : (double)value.i;
+	}
+	else if(to_id == Int32BaseTypeId || to_id == UInt32BaseTypeId)
+	{
+		if(from_float)
+		{
+			// Converting a float that does not fit is undefined in C, so it is not folded.
+			double min = (to_id == Int32BaseTypeId) ? -2147483649.0 : -1.0;
+			double max = (to_id == Int32BaseTypeId) ? 2147483648.0 : 4294967296.0;
+			if(!(value.f > min && value.f < max))
+				return false;
+			result->i = (I64)value.f;
+		}
+		else
+		{
+			result->i = value.i;
+		}
+	}
+	else
+	{
+		return false;
+	}
+
+	*result = NormalizeScalar(to, *result);
+	return true;
+}
+
+static EvalResult decl EvalBlock(Evaluator *, BlockInstruction *);
+
+static bool
+func EvalCall(Evaluator *ev, BlockInstruction *body, Token *param_names, VarType **param_types, Expression **args,
+              size_t param_n, VarType *return_type, size_t dest)
+{
+	if(!body || ev->call_depth >= EvalMaxCallDepth)
+		return false;
+
+	// Arguments are evaluated in the caller's frame, then become the callee's variables.
+	size_t param_offsets[EvalMaxParamN];
+	for(size_t i = 0; i < param_n; i++)
+	{
+		size_t count = GetScalarCount(param_types[i]);
+		if(count == 0)
+			return false;
+		param_offsets[i] = PushEvalScalars(ev, count);
+		if(!EvalExpression(ev, args[i], param_offsets[i]))
+			return false;
+	}
+
+	size_t frame_var_at = ev->frame_var_at;
+	size_t return_offset = ev->return_offset;
+	size_t var_n = ev->var_n;
+	ev->frame_var_at = var_n;
+	ev->return_offset = dest;
+	for(size_t i = 0; i < param_n; i++)
+		AddEvalVar(ev, param_names[i], param_types[i], param_offsets[i]);
+
+	ev->call_depth++;
+	EvalResult result = EvalBlock(ev, body);
+	ev->call_depth--;
+
+	ev->frame_var_at = frame_var_at;
+	ev->return_offset = return_offset;
+	ev->var_n = var_n;
+
+	// A function with a result has to reach a return.
+	if(result == EvalFailResult || (return_type && result != EvalReturnResult))
+		return false;
+	return true;
+}
+
+static bool
+func EvalExpression(Evaluator *ev, Expression *e, size_t dest)
+{
+	// Writes the value of e to the scalars at dest.
+	ev->step_n++;
+	if(ev->step_n > EvalMaxStepN)
+		return false;
+
+	size_t stack_n = ev->stack_n;
+	ConstantScalar *result = 0;
+	ConstantScalar value = {};
+	switch(e->id)
+	{
+		case IntegerConstantExpressionId:
+		{
+			value.i = ((IntegerConstantExpression *)e)->value;
+			value = NormalizeScalar(e->type, value);
+			result = &value;
+			break;
+		}
+		case FloatConstantExpressionId:
+		{
+			value.f = ((FloatConstantExpression *)e)->value;
+			value = NormalizeScalar(e->type, value);
+			result = &value;
+			break;
+		}
+		case BoolConstantExpressionId:
+		{
+			value.i = (((BoolConstantExpression *)e)->token.id == TrueTokenId);
+			result = &value;
+			break;
+		}
+		case ConstantDataExpressionId:
+		{
+			ConstantDataExpression *c = (ConstantDataExpression *)e;
+			memcpy(ev->stack + dest, c->values, c->value_n * sizeof(ConstantScalar));
+			return true;
+		}
+		case ParenExpressionId:
+		{
+			return EvalExpression(ev, ((ParenExpression *)e)->in, dest);
+		}
+		case VarExpressionId:
+		case StructVarExpressionId:
+		case ArrayIndexExpressionId:
+		{
+			size_t offset = 0;
+			size_t count = GetScalarCount(e->type);
+			if(count == 0 || !EvalAddress(ev, e, &offset))
+				return false;
+			memmove(ev->stack + dest, ev->stack + offset, count * sizeof(ConstantScalar));
+			ev->stack_n = stack_n;
+			return true;
+		}
+		case AddExpressionId:
+		case SubtractExpressionId:
+		case MultiplyExpressionId:
+		{
+			// All three have the left and right operands in the same place.
+			AddExpression *a = (AddExpression *)e;
+			ConstantScalar values[2];
+			if(e->type->id != BaseTypeId || !EvalBaseOperands(ev, a->left, a->right, values))
+				return false;
+
+			bool is_float = (GetBaseTypeId(e->type) == Float32BaseTypeId);
+			if(e->id == AddExpressionId)
+			{
+				if(is_float)
+					value.f = values[0].f + values[1].f;
+				else
+					value.i = (I64)((U64)values[0].i + (U64)values[1].i);
+			}
+			else if(e->id == SubtractExpressionId)
+			{
+				if(is_float)
+					value.f = values[0].f - values[1].f;
+				else
+					value.i = (I64)((U64)values[0].i - (U64)values[1].i);
+			}
+			else
+			{
+				if(is_float)
+					value.f = values[0].f * values[1].f;
+				else
+					value.i = (I64)((U64)values[0].i * (U64)values[1].i);
+			}
+			value = NormalizeScalar(e->type, value);
+			result = &value;
+			break;
+		}
+		case NegativeExpressionId:
+		{
+			Expression *in = ((NegativeExpression *)e)->value;
+			if(e->type->id != BaseTypeId || !EvalExpression(ev, in, dest))
+				return false;
+			value = ev->stack[dest];
+			if(GetBaseTypeId(e->type) == Float32BaseTypeId)
+				value.f = -value.f;
+			else
+				value.i = (I64)(0 - (U64)value.i);
+			value = NormalizeScalar(e->type, value);
+			result = &value;
+			break;
+		}
+		case LessThanExpressionId:
+		case LessThanEqualExpressionId:
+		case GreaterThanExpressionId:
+		{
+			// All three have the left and right operands in the same place.
+			LessThanExpression *c = (LessThanExpression *)e;
+			int order = 0;
+			if(!EvalCompare(ev, c->left, c->right, &order))
+				return false;
+
+			if(e->id == LessThanExpressionId)
+				value.i = (order < 0);
+			else if(e->id == LessThanEqualExpressionId)
+				value.i = (order <= 0);
+			else
+				value.i = (order > 0);
+			result = &value;
+			break;
+		}
+		case CastExpressionId:
+		{
+			CastExpression *c = (CastExpression *)e;
+			if(c->type->id != BaseTypeId || c->value->type->id != BaseTypeId)
+				return false;
+			if(!EvalExpression(ev, c->value, dest))
+				return false;
+			if(!EvalCast(c->type, c->value->type, ev->stack[dest], &value))
+				return false;
+			result = &value;
+			break;
+		}
+		case FuncCallExpressionId:
+		{
+			FuncCallExpression *call = (FuncCallExpression *)e;
+			FuncDefinition *def = call->func_def;
+			if(def->is_extern)
+				return false;
+
+			Token param_names[EvalMaxParamN];
+			VarType *param_types[EvalMaxParamN];
+			Expression *args[EvalMaxParamN];
+			size_t param_n = 0;
+			FuncCallArgument *arg = call->first_call_arg;
+			for(FuncParam *param = def->header.first_param; param && arg; param = param->next, arg = arg->next)
+			{
+				if(param_n == EvalMaxParamN)
+					return false;
+				param_names[param_n] = param->name;
+				param_types[param_n] = param->type;
+				args[param_n] = arg->arg;
+				param_n++;
+			}
+
+			if(!EvalCall(ev, def->body, param_names, param_types, args, param_n, def->header.return_type, dest))
+				return false;
+			ev->stack_n = stack_n;
+			return true;
+		}
+		case OperatorCallExpressionId:
+		{
+			OperatorCallExpression *call = (OperatorCallExpression *)e;
+			OperatorDefinition *def = call->def;
+			Token param_names[2] = {def->left_name, def->right_name};
+			VarType *param_types[2] = {def->left_type, def->right_type};
+			Expression *args[2] = {call->left, call->right};
+			if(!EvalCall(ev, def->body, param_names, param_types, args, 2, def->return_type, dest))
+				return false;
+			ev->stack_n = stack_n;
+			return true;
+		}
+		default:
+		{
+			return false;
+		}
+	}
+
+	ev->stack[dest] = *result;
+	ev->stack_n = stack_n;
+	return true;
+}
+
+static EvalResult
+func EvalInstruction(Evaluator *ev, Instruction *instruction)
+{
+	ev->step_n++;
+	if(ev->step_n > EvalMaxStepN)
+		return EvalFailResult;
+
+	switch(instruction->id)
+	{
+		case CreateVariableInstructionId:
+		{
+			CreateVariableInstruction *i = (CreateVariableInstruction *)instruction;
+			size_t count = GetScalarCount(i->type);
+			if(count == 0)
+				return EvalFailResult;
+
+			size_t offset = PushEvalScalars(ev, count);
+			if(i->init && !EvalExpression(ev, i->init, offset))
+				return EvalFailResult;
+			AddEvalVar(ev, i->name, i->type, offset);
+			return EvalNextResult;
+		}
+		case AssignInstructionId:
+		case AndEqualsInstructionId:
+		{
+			// Both have the left and right sides in the same place.
+			AssignInstruction *i = (AssignInstruction *)instruction;
+			size_t count = GetScalarCount(i->right->type);
+			if(count == 0)
+				return EvalFailResult;
+
+			size_t stack_n = ev->stack_n;
+			size_t value_offset = PushEvalScalars(ev, count);
+			size_t target = 0;
+			if(!EvalExpression(ev, i->right, value_offset) || !EvalAddress(ev, i->left, &target))
+				return EvalFailResult;
+
+			if(instruction->id == AssignInstructionId)
+			{
+				memmove(ev->stack + target, ev->stack + value_offset, count * sizeof(ConstantScalar));
+			}
+			else
+			{
+				if(i->left->type->id != BaseTypeId || GetBaseTypeId(i->left->type) == Float32BaseTypeId)
+					return EvalFailResult;
+				ev->stack[target].i &= ev->stack[value_offset].i;
+			}
+			ev->stack_n = stack_n;
+			return EvalNextResult;
+		}
+		case IncrementInstructionId:
+		{
+			Expression *value = ((IncrementInstruction *)instruction)->value;
+			size_t target = 0;
+			if(value->type->id != BaseTypeId || !EvalAddress(ev, value, &target))
+				return EvalFailResult;
+
+			ConstantScalar *scalar = &ev->stack[target];
+			if(GetBaseTypeId(value->type) == Float32BaseTypeId)
+				scalar->f += 1.0;
+			else
+				scalar->i = (I64)((U64)scalar->i + 1);
+			*scalar = NormalizeScalar(value->type, *scalar);
+			return EvalNextResult;
+		}
+		case FuncCallInstructionId:
+		{
+			Expression *call = (Expression *)((FuncCallInstruction *)instruction)->e;
+			size_t stack_n = ev->stack_n;
+			size_t count = call->type ? GetScalarCount(call->type) : 0;
+			if(call->type && count == 0)
+				return EvalFailResult;
+
+			size_t offset = PushEvalScalars(ev, count);
+			if(!EvalExpression(ev, call, offset))
+				return EvalFailResult;
+			ev->stack_n = stack_n;
+			return EvalNextResult;
+		}
+		case ReturnInstructionId:
+		{
+			Expression *value = ((ReturnInstruction *)instruction)->value;
+			if(value && !EvalExpression(ev, value, ev->return_offset))
+				return EvalFailResult;
+			return EvalReturnResult;
+		}
+		case BlockInstructionId:
+		{
+			return EvalBlock(ev, (BlockInstruction *)instruction);
+		}
+		case IfInstructionId:
+		{
+			IfInstruction *i = (IfInstruction *)instruction;
+			size_t offset = PushEvalScalars(ev, 1);
+			if(!EvalExpression(ev, i->condition, offset))
+				return EvalFailResult;
+			bool condition = (ev->stack[offset].i != 0);
+			ev->stack_n = offset;
+			return condition ? EvalBlock(ev, i->body) : EvalNextResult;
+		}
+		case ForInstructionId:
+		{
+			ForInstruction *i = (ForInstruction *)instruction;
+			size_t stack_n = ev->stack_n;
+			size_t var_n = ev->var_n;
+			EvalResult result = EvalInstruction(ev, i->init);
+			while(result == EvalNextResult)
+			{
+				size_t offset = PushEvalScalars(ev, 1);
+				if(!EvalExpression(ev, i->condition, offset))
+				{
+					result = EvalFailResult;
+					break;
+				}
+				bool condition = (ev->stack[offset].i != 0);
+				ev->stack_n = offset;
+				if(!condition)
+					break;
+
+				result = EvalBlock(ev, i->body);
+				if(result == EvalNextResult && i->update)
+					result = EvalInstruction(ev, i->update);
+			}
+			ev->stack_n = stack_n;
+			ev->var_n = var_n;
+			return result;
+		}
+		default:
+		{
+			return EvalFailResult;
+		}
+	}
+}
+
+static EvalResult
+func EvalBlock(Evaluator *ev, BlockInstruction *block)
+{
+	size_t stack_n = ev->stack_n;
+	size_t var_n = ev->var_n;
+	EvalResult result = EvalNextResult;
+	for(Instruction *i = block->first; i && result == EvalNextResult; i = i->next)
+		result = EvalInstruction(ev, i);
+
+	// A returned value is already written below the block's own scalars.
+	ev->stack_n = stack_n;
+	ev->var_n = var_n;
+	return result;
+}
+
+static bool
+func EvaluateConstant(Evaluator *ev, Expression *e, ConstantScalar *values, size_t value_n)
+{
+	// Runs e from scratch, the result is written to values.
+	ev->stack_n = 0;
+	ev->var_n = 0;
+	ev->frame_var_at = 0;
+	ev->call_depth = 0;
+	ev->step_n = 0;
+
+	size_t offset = PushEvalScalars(ev, value_n);
+	if(!EvalExpression(ev, e, offset))
+		return false;
+
+	for(size_t i = 0; i < value_n; i++)
+		values[i] = ev->stack[offset + i];
+	return true;
+}
+
+static bool
+func IsConstantLeaf(Expression *e)
+{
+	// Constants, and the way they are written in the source, like -1.0 and uint::0xFF000000.
+	switch(e->id)
+	{
+		case IntegerConstantExpressionId:
+		case FloatConstantExpressionId:
+		case BoolConstantExpressionId:
+		case ConstantDataExpressionId:
+			return true;
+		case CastExpressionId:
+			return IsConstantLeaf(((CastExpression *)e)->value);
+		case NegativeExpressionId:
+			return IsConstantLeaf(((NegativeExpression *)e)->value);
+		case ParenExpressionId:
+			return IsConstantLeaf(((ParenExpression *)e)->in);
+		default:
+			return false;
+	}
+}
+
+static bool
+func IsWritableConstant(VarType *type, ConstantScalar *values, size_t *at)
+{
+	// Infinity and NaN have no float constant in C.
+	if(type->id == BaseTypeId)
+	{
+		ConstantScalar value = values[*at];
+		(*at)++;
+		return (GetBaseTypeId(type) != Float32BaseTypeId || value.f - value.f == 0.0);
+	}
+
+	if(type->id == StructTypeId)
+	{
+		for(StructVar *var = ((StructType *)type)->def->first_var; var; var = var->next)
+		{
+			if(!IsWritableConstant(var->type, values, at))
+				return false;
+		}
+		return true;
+	}
+
+	ArrayType *array = (ArrayType *)type;
+	I64 size = ((IntegerConstantExpression *)array->size)->value;
+	for(I64 i = 0; i < size; i++)
+	{
+		if(!IsWritableConstant(array->element_type, values, at))
+			return false;
+	}
+	return true;
+}
+
+static Expression *
+func PushConstantExpression(MemoryArena *arena, VarType *type, ConstantScalar value)
+{
+	Token token = {};
+	switch(GetBaseTypeId(type))
+	{
+		case BoolBaseTypeId:
+		{
+			token.id = value.i ? TrueTokenId : FalseTokenId;
+			return (Expression *)PushBoolConstantExpression(arena, token, type);
+		}
+		case Float32BaseTypeId:
+		{
+			return (Expression *)PushFloatConstantExpression(arena, token, value.f, type);
+		}
+		case Int32BaseTypeId:
+		{
+			// -2147483648 would be the negation of a constant that does not fit in int.
+			if(value.i == INT_MIN)
+			{
+				Expression *e = (Expression *)PushIntegerConstantExpression(arena, token, INT_MIN + 1, type);
+				Expression *one = (Expression *)PushIntegerConstantExpression(arena, token, 1, type);
+				return (Expression *)PushParenExpression(arena, (Expression *)PushSubtractExpression(arena, e, one));
+			}
+			return (Expression *)PushIntegerConstantExpression(arena, token, value.i, type);
+		}
+		case UInt32BaseTypeId:
+		{
+			// Above INT_MAX a decimal constant would be a long in C.
+			Expression *e = (Expression *)PushIntegerConstantExpression(arena, token, value.i, type);
+			if(value.i > INT_MAX)
+				e = (Expression *)PushCastExpression(arena, type, e);
+			return e;
+		}
+	}
+	return 0;
+}
+
+static bool
+func FoldExpression(Evaluator *ev, Expression **slot, bool is_init)
+{
+	// Returns true if the expression is constant after folding.
+	// Struct and array values can only become constant data where they initialize a variable,
+	// elsewhere they are evaluated as part of the expression around them.
+	Expression *e = *slot;
+	if(IsConstantLeaf(e))
+		return true;
+	if(e->id == VarExpressionId || e->id == DereferenceExpressionId)
+		return false;
+
+	bool all_constant = true;
+	if(e->id == FuncCallExpressionId)
+	{
+		for(FuncCallArgument *arg = ((FuncCallExpression *)e)->first_call_arg; arg; arg = arg->next)
+		{
+			if(!FoldExpression(ev, &arg->arg, false))
+				all_constant = false;
+		}
+	}
+	else
+	{
+		Expression **child = 0;
+		for(size_t i = 0; (child = GetExpressionChild(e, i)) != 0; i++)
+		{
+			if(!FoldExpression(ev, child, false))
+				all_constant = false;
+		}
+	}
+	if(!all_constant)
+		return false;
+
+	size_t value_n = GetScalarCount(e->type);
+	if(value_n == 0)
+		return false;
+	if(e->type->id != BaseTypeId && !is_init)
+		return true;
+
+	ConstantScalar *values = ArenaPushArray(&ev->input->arena, value_n, ConstantScalar);
+	if(!EvaluateConstant(ev, e, values, value_n))
+		return false;
+
+	size_t at = 0;
+	if(!IsWritableConstant(e->type, values, &at))
+		return false;
+
+	Expression *constant = 0;
+	if(e->type->id == BaseTypeId)
+		constant = PushConstantExpression(&ev->input->arena, e->type, values[0]);
+	else
+		constant = (Expression *)PushConstantDataExpression(&ev->input->arena, e->type, values, value_n);
+
+	if(e->id == FuncCallExpressionId || e->id == OperatorCallExpressionId)
+		ev->folded_call_n++;
+	else
+		ev->folded_expression_n++;
+	*slot = constant;
+	return true;
+}
+
+static void
+func FoldType(Evaluator *ev, VarType *type)
+{
+	while(type->id == ArrayTypeId || type->id == PointerTypeId)
+	{
+		if(type->id == PointerTypeId)
+		{
+			type = ((PointerType *)type)->pointed_type;
+			continue;
+		}
+
+		ArrayType *array = (ArrayType *)type;
+		if(array->size->id != IntegerConstantExpressionId)
+		{
+			size_t folded_n = ev->folded_call_n + ev->folded_expression_n;
+			FoldExpression(ev, &array->size, false);
+			if(array->size->id == IntegerConstantExpressionId && ev->folded_call_n + ev->folded_expression_n != folded_n)
+				ev->folded_size_n++;
+		}
+		type = array->element_type;
+	}
+}
+
+static void
+func FoldInstruction(Evaluator *ev, Instruction *instruction)
+{
+	switch(instruction->id)
+	{
+		case CreateVariableInstructionId:
+		{
+			CreateVariableInstruction *i = (CreateVariableInstruction *)instruction;
+			FoldType(ev, i->type);
+			if(i->init)
+				FoldExpression(ev, &i->init, true);
+			break;
+		}
+		case FuncCallInstructionId:
+		{
+			// The call is kept for its effects, only its arguments are folded.
+			FuncCallExpression *call = ((FuncCallInstruction *)instruction)->e;
+			for(FuncCallArgument *arg = call->first_call_arg; arg; arg = arg->next)
+				FoldExpression(ev, &arg->arg, false);
+			break;
+		}
+		case BlockInstructionId:
+		{
+			for(Instruction *i = ((BlockInstruction *)instruction)->first; i; i = i->next)
+				FoldInstruction(ev, i);
+			break;
+		}
+		case IfInstructionId:
+		{
+			IfInstruction *i = (IfInstruction *)instruction;
+			FoldExpression(ev, &i->condition, false);
+			FoldInstruction(ev, (Instruction *)i->body);
+			break;
+		}
+		case ForInstructionId:
+		{
+			ForInstruction *i = (ForInstruction *)instruction;
+			FoldInstruction(ev, i->init);
+			FoldExpression(ev, &i->condition, false);
+			if(i->update)
+				FoldInstruction(ev, i->update);
+			FoldInstruction(ev, (Instruction *)i->body);
+			break;
+		}
+		default:
+		{
+			Expression **e = 0;
+			for(size_t i = 0; (e = GetInstructionExpression(instruction, i)) != 0; i++)
+				FoldExpression(ev, e, false);
+			break;
+		}
+	}
+}
+
+static bool
+func IsCompileTimeOnly(Definition *definition)
+{
+	// C functions cannot return arrays, so these only run in the compiler.
+	VarType *return_type = 0;
+	if(definition->id == FuncDefinitionId)
+		return_type = ((FuncDefinition *)definition)->header.return_type;
+	else if(definition->id == OperatorDefinitionId)
+		return_type = ((OperatorDefinition *)definition)->return_type;
+	return (return_type && return_type->id == ArrayTypeId);
+}
+
+static bool
+func CheckCompileTimeCalls(ParseInput *input, Expression *e)
+{
+	Definition *callee = 0;
+	if(e->id == FuncCallExpressionId)
+		callee = (Definition *)((FuncCallExpression *)e)->func_def;
+	else if(e->id == OperatorCallExpressionId)
+		callee = (Definition *)((OperatorCallExpression *)e)->def;
+
+	if(callee && IsCompileTimeOnly(callee))
+	{
+		Token name = (e->id == FuncCallExpressionId) ? ((FuncDefinition *)callee)->header.name : ((OperatorDefinition *)callee)->name;
+		Atom *atom = &input->atoms.atoms[name.value];
+		printf("Error: Call to <%.*s> could not be evaluated at compile time, its array result cannot be returned at runtime.\n",
+		       (int)atom->length, atom->text);
+		return false;
+	}
+
+	bool valid = true;
+	if(e->id == FuncCallExpressionId)
+	{
+		for(FuncCallArgument *arg = ((FuncCallExpression *)e)->first_call_arg; arg; arg = arg->next)
+			valid &= CheckCompileTimeCalls(input, arg->arg);
+	}
+	else
+	{
+		Expression **child = 0;
+		for(size_t i = 0; (child = GetExpressionChild(e, i)) != 0; i++)
+			valid &= CheckCompileTimeCalls(input, *child);
+	}
+	return valid;
+}
+
+static bool
+func CheckCompileTimeCallsInInstruction(ParseInput *input, Instruction *instruction)
+{
+	bool valid = true;
+	Expression **e = 0;
+	for(size_t i = 0; (e = GetInstructionExpression(instruction, i)) != 0; i++)
+		valid &= CheckCompileTimeCalls(input, *e);
+
+	switch(instruction->id)
+	{
+		case BlockInstructionId:
+		{
+			for(Instruction *i = ((BlockInstruction *)instruction)->first; i; i = i->next)
+				valid &= CheckCompileTimeCallsInInstruction(input, i);
+			break;
+		}
+		case IfInstructionId:
+		{
+			valid &= CheckCompileTimeCallsInInstruction(input, (Instruction *)((IfInstruction *)instruction)->body);
+			break;
+		}
+		case ForInstructionId:
+		{
+			ForInstruction *i = (ForInstruction *)instruction;
+			valid &= CheckCompileTimeCallsInInstruction(input, i->init);
+			if(i->update)
+				valid &= CheckCompileTimeCallsInInstruction(input, i->update);
+			valid &= CheckCompileTimeCallsInInstruction(input, (Instruction *)i->body);
+			break;
+		}
+		default:
+		{
+			break;
+		}
+	}
+	return valid;
+}
+
+static bool
+func EvaluateDefinitionList(ParseInput *input, DefinitionList *def_list, bool evaluate, bool report)
+{
+	// Returns false if a call to a compile-time only function is left for runtime.
+	Evaluator *ev = ArenaPushType(&input->arena, Evaluator);
+	*ev = (Evaluator){};
+	ev->input = input;
+
+	bool valid = true;
+	for(DefinitionListElem *elem = def_list; elem; elem = elem->next)
+	{
+		Definition *definition = elem->definition;
+		BlockInstruction *body = 0;
+		if(definition->id == FuncDefinitionId)
+		{
+			FuncDefinition *def = (FuncDefinition *)definition;
+			body = def->is_extern ? 0 : def->body;
+			if(evaluate)
+			{
+				for(FuncParam *param = def->header.first_param; param; param = param->next)
+					FoldType(ev, param->type);
+				if(def->header.return_type)
+					FoldType(ev, def->header.return_type);
+			}
+		}
+		else if(definition->id == OperatorDefinitionId)
+		{
+			OperatorDefinition *def = (OperatorDefinition *)definition;
+			body = def->body;
+			if(evaluate)
+			{
+				FoldType(ev, def->left_type);
+				FoldType(ev, def->right_type);
+				if(def->return_type)
+					FoldType(ev, def->return_type);
+			}
+		}
+		else if(definition->id == StructDefinitionId && evaluate)
+		{
+			for(StructVar *var = ((StructDefinition *)definition)->first_var; var; var = var->next)
+				FoldType(ev, var->type);
+		}
+
+		if(body)
+		{
+			if(evaluate)
+				FoldInstruction(ev, (Instruction *)body);
+			valid &= CheckCompileTimeCallsInInstruction(input, (Instruction *)body);
+		}
+	}
+
+	if(report && evaluate)
+	{
+		printf("Compile-time evaluation:\n");
+		printf("Evaluated %zu calls, %zu constant expressions and %zu array sizes.\n",
+		       ev->folded_call_n, ev->folded_expression_n, ev->folded_size_n);
+	}
+
+	free(ev->stack);
+	free(ev->vars);
+	return valid;
+}
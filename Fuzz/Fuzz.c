@@ -0,0 +1,547 @@
+// Parser fuzzer that looks for inputs whose parse cost grows faster than their size.
+//
+// Built with -DFUZZ_LIBFUZZER and -fsanitize=fuzzer it is a plain libFuzzer target.
+// Otherwise it has its own driver:
+//   Fuzz run <corpus_dir> [iteration_n] [seed files...]
+//   Fuzz check <corpus_dir>
+// "run" mutates the seeds and the corpus, and writes every superlinear case it finds
+// to the corpus after minimizing it. "check" re-measures every case in the corpus
+// and fails if any of them is still superlinear.
+//
+// A corpus case is a prefix, a unit and a suffix. The unit is repeated in place
+// to make the input larger, and the growth of the parse cost is measured against it.
+// Case files start with the line "#fuzz <prefix_length> <unit_length>".
+
+#define M64_NO_MAIN
+#include "../M64.c"
+
+#include <math.h>
+#include <stdint.h>
+#include <time.h>
+
+#ifdef _WIN32
+#define NullDevice "NUL"
+#else
+#include <dirent.h>
+#define NullDevice "/dev/null"
+#endif
+
+typedef struct tdef ParseCost
+{
+	double seconds;
+	size_t memory;
+} ParseCost;
+
+static double
+func GetSeconds()
+{
+	return (double)clock() / (double)CLOCKS_PER_SEC;
+}
+
+static ParseCost
+func MeasureParse(char *data, size_t size)
+{
+	char *code = malloc(size + 1);
+	memcpy(code, data, size);
+	code[size] = 0;
+
+	ParseCost cost = {};
+	double start = GetSeconds();
+
+	ParseInput input = {};
+	input.code = code;
+	input.code_size = strlen(code);
+	InitParseInput(&input);
+	ReadDefinitionList(&input);
+
+	cost.seconds = GetSeconds() - start;
+	cost.memory = input.arena.used_size + input.token_n * sizeof(Token) + input.literal_n * sizeof(Literal);
+
+	FreeParseInput(&input);
+	free(code);
+	return cost;
+}
+
+#ifdef FUZZ_LIBFUZZER
+
+// Budgets per input byte, above these the input is reported as a crash so that libFuzzer keeps it.
+#define MaxMicrosecondsPerByte 20.0
+#define MaxMemoryPerByte 4096
+
+int LLVMFuzzerInitialize(int *arg_n, char ***arg_v)
+{
+	freopen(NullDevice, "w", stdout);
+	return 0;
+}
+
+int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size)
+{
+	ParseCost cost = MeasureParse((char *)data, size);
+	size_t budget_size = (size < 256) ? 256 : size;
+	if(cost.seconds * 1000000.0 > MaxMicrosecondsPerByte * budget_size || cost.memory > MaxMemoryPerByte * budget_size)
+	{
+		fprintf(stderr, "Superlinear parse: %zu bytes, %.3f s, %zu bytes of memory\n", size, cost.seconds, cost.memory);
+		abort();
+	}
+	return 0;
+}
+
+#else
+
+typedef struct tdef FuzzCase
+{
+	char *data;
+	size_t prefix_length;
+	size_t unit_length;
+	size_t size;
+} FuzzCase;
+
+typedef struct tdef Growth
+{
+	// Exponents of cost against input size, 1 is linear.
+	double time_exponent;
+	double memory_exponent;
+	double seconds;
+	size_t size;
+	bool superlinear;
+} Growth;
+
+// Scaled inputs stop growing at either limit.
+#define ScaleMaxSize (1024 * 1024)
+#define ScaleMaxSeconds 0.25
+// Times below this are too noisy to fit an exponent to.
+#define ScaleMinSeconds 0.05
+// A parse faster than this per byte is not a problem, whatever its exponent.
+#define ScaleMinSecondsPerByte 1e-7
+#define SuperlinearExponent 1.5
+
+static char *
+func BuildScaledInput(FuzzCase *c, size_t repeat_n, size_t *size)
+{
+	size_t suffix_length = c->size - c->prefix_length - c->unit_length;
+	*size = c->prefix_length + repeat_n * c->unit_length + suffix_length;
+
+	char *data = malloc(*size + 1);
+	char *at = data;
+	memcpy(at, c->data, c->prefix_length);
+	at += c->prefix_length;
+	for(size_t i = 0; i < repeat_n; i++)
+	{
+		memcpy(at, c->data + c->prefix_length, c->unit_length);
+		at += c->unit_length;
+	}
+	memcpy(at, c->data + c->prefix_length + c->unit_length, suffix_length);
+	return data;
+}
+
+static ParseCost
+func MeasureScaled(FuzzCase *c, size_t repeat_n, size_t *size)
+{
+	// The best of three runs, to filter out scheduling noise.
+	char *data = BuildScaledInput(c, repeat_n, size);
+	ParseCost best = MeasureParse(data, *size);
+	for(int i = 0; i < 2 && best.seconds < ScaleMaxSeconds; i++)
+	{
+		ParseCost cost = MeasureParse(data, *size);
+		if(cost.seconds < best.seconds)
+			best.seconds = cost.seconds;
+	}
+
+	free(data);
+	return best;
+}
+
+static double
+func GetExponent(double cost1, double cost2, size_t size1, size_t size2)
+{
+	if(cost1 <= 0.0 || cost2 <= 0.0 || size2 <= size1)
+		return 1.0;
+	return log(cost2 / cost1) / log((double)size2 / (double)size1);
+}
+
+static Growth
+func MeasureGrowth(FuzzCase *c)
+{
+	// Double the unit count until the input is large or slow enough,
+	// then fit the exponent to the last point and the one two doublings before it.
+	Growth growth = {};
+	growth.time_exponent = 1.0;
+	growth.memory_exponent = 1.0;
+	if(c->unit_length == 0)
+	{
+		// Nothing to scale, the case only checks that the input parses without crashing.
+		growth.seconds = MeasureParse(c->data, c->size).seconds;
+		growth.size = c->size;
+		return growth;
+	}
+
+	ParseCost costs[64];
+	size_t sizes[64];
+	size_t point_n = 0;
+	// Start with the unit making up at least 1 KB, smaller inputs only measure overhead.
+	size_t repeat_n = 1;
+	while(repeat_n * c->unit_length < 1024)
+		repeat_n *= 2;
+	while(point_n < 64)
+	{
+		costs[point_n] = MeasureScaled(c, repeat_n, &sizes[point_n]);
+		point_n++;
+
+		if(sizes[point_n - 1] >= ScaleMaxSize || costs[point_n - 1].seconds >= ScaleMaxSeconds)
+			break;
+		repeat_n *= 2;
+	}
+
+	size_t last = point_n - 1;
+	size_t first = (last >= 2) ? last - 2 : 0;
+	growth.seconds = costs[last].seconds;
+	growth.size = sizes[last];
+	growth.memory_exponent = GetExponent((double)costs[first].memory, (double)costs[last].memory, sizes[first], sizes[last]);
+	if(costs[last].seconds >= ScaleMinSeconds && costs[last].seconds / sizes[last] >= ScaleMinSecondsPerByte)
+	{
+		growth.time_exponent = GetExponent(costs[first].seconds, costs[last].seconds, sizes[first], sizes[last]);
+	}
+
+	// Hitting the time limit with a small input is superlinear whatever the fit says.
+	bool slow_small_input = (costs[last].seconds >= ScaleMaxSeconds && sizes[last] < 64 * 1024);
+	growth.superlinear = (growth.time_exponent > SuperlinearExponent ||
+	                      growth.memory_exponent > SuperlinearExponent ||
+	                      slow_small_input);
+	return growth;
+}
+
+static unsigned int
+func Random(unsigned int *state)
+{
+	*state ^= *state << 13;
+	*state ^= *state >> 17;
+	*state ^= *state << 5;
+	return *state;
+}
+
+static char *FuzzDictionary[] =
+{
+	"func ", "struct ", "operator", "extern ", "return ", "if", "for", " to ", "use ",
+	"int", "uint", "float", "bool", "true", "false",
+	"(", ")", "{", "}", "[", "]", "@", "::", ":", ";", ",", ".", "=", "+", "-", "*", "/",
+	"<", ">", "<=", ">=", "==", "!=", "&&", "||", "!", "++", "$", "a", "b", "x", "0", "1.5",
+	"\n", " ", "\t", "#c_code {", "0x1F"
+};
+
+static FuzzCase
+func MutateCase(FuzzCase *base, unsigned int *state)
+{
+	// Splice a few dictionary words or byte changes into the base, then pick a new unit.
+	size_t max_size = base->size + 256;
+	char *data = malloc(max_size);
+	memcpy(data, base->data, base->size);
+	size_t size = base->size;
+
+	size_t dictionary_n = sizeof(FuzzDictionary) / sizeof(FuzzDictionary[0]);
+	int change_n = 1 + Random(state) % 4;
+	for(int i = 0; i < change_n; i++)
+	{
+		size_t at = (size > 0) ? Random(state) % (size + 1) : 0;
+		switch(Random(state) % 3)
+		{
+			case 0:
+			{
+				char *word = FuzzDictionary[Random(state) % dictionary_n];
+				size_t length = strlen(word);
+				if(size + length <= max_size)
+				{
+					memmove(data + at + length, data + at, size - at);
+					memcpy(data + at, word, length);
+					size += length;
+				}
+				break;
+			}
+			case 1:
+			{
+				if(at < size)
+				{
+					size_t length = 1 + Random(state) % 8;
+					if(at + length > size)
+						length = size - at;
+					memmove(data + at, data + at + length, size - at - length);
+					size -= length;
+				}
+				break;
+			}
+			default:
+			{
+				if(at < size)
+					data[at] = (char)(32 + Random(state) % 95);
+				break;
+			}
+		}
+	}
+
+	FuzzCase c = {};
+	c.data = data;
+	c.size = size;
+	if(size > 0)
+	{
+		c.prefix_length = Random(state) % size;
+		size_t max_unit_length = size - c.prefix_length;
+		if(max_unit_length > 64)
+			max_unit_length = 64;
+		c.unit_length = 1 + Random(state) % max_unit_length;
+	}
+	return c;
+}
+
+static bool
+func TryRemove(FuzzCase *c, size_t at, size_t length)
+{
+	// Keeps the removal only if the case stays superlinear.
+	FuzzCase smaller = *c;
+	smaller.data = malloc(c->size);
+	memcpy(smaller.data, c->data, at);
+	memcpy(smaller.data + at, c->data + at + length, c->size - at - length);
+	smaller.size = c->size - length;
+	if(at < c->prefix_length)
+		smaller.prefix_length -= length;
+	else if(at < c->prefix_length + c->unit_length)
+		smaller.unit_length -= length;
+
+	if(smaller.unit_length > 0 && MeasureGrowth(&smaller).superlinear)
+	{
+		free(c->data);
+		*c = smaller;
+		return true;
+	}
+
+	free(smaller.data);
+	return false;
+}
+
+static void
+func MinimizeCase(FuzzCase *c)
+{
+	// Remove chunks of halving size from each part, never crossing part boundaries.
+	for(size_t chunk = c->size / 2; chunk > 0; chunk /= 2)
+	{
+		bool removed = true;
+		while(removed)
+		{
+			removed = false;
+			size_t part_starts[3] = {0, c->prefix_length, c->prefix_length + c->unit_length};
+			size_t part_ends[3] = {c->prefix_length, c->prefix_length + c->unit_length, c->size};
+			for(int part = 2; part >= 0 && !removed; part--)
+			{
+				for(size_t at = part_starts[part]; at + chunk <= part_ends[part]; at += chunk)
+				{
+					if(TryRemove(c, at, chunk))
+					{
+						removed = true;
+						break;
+					}
+				}
+			}
+		}
+	}
+}
+
+static bool
+func ReadCaseFile(char *path, FuzzCase *c)
+{
+	FILE *file = fopen(path, "rb");
+	if(!file)
+		return false;
+
+	char *data = ReadFileToMemory(file);
+	size_t size = strlen(data);
+
+	FuzzCase result = {};
+	size_t prefix_length = 0;
+	size_t unit_length = 0;
+	char *newline = strchr(data, '\n');
+	if(strncmp(data, "#fuzz ", 6) == 0 && newline &&
+	   sscanf(data, "#fuzz %zu %zu", &prefix_length, &unit_length) == 2)
+	{
+		size_t header_length = newline + 1 - data;
+		result.data = data + header_length;
+		result.size = size - header_length;
+		if(prefix_length + unit_length > result.size)
+			return false;
+		result.prefix_length = prefix_length;
+		result.unit_length = unit_length;
+	}
+	else
+	{
+		// A plain source file is a seed without a unit.
+		result.data = data;
+		result.size = size;
+	}
+
+	*c = result;
+	return true;
+}
+
+static void
+func WriteCaseFile(char *corpus_dir, FuzzCase *c)
+{
+	U32 hash = HashText(c->data, c->size) ^ (U32)(c->prefix_length * 31 + c->unit_length);
+	char path[1024];
+	snprintf(path, sizeof(path), "%s/slow-%08x.fuzz", corpus_dir, hash);
+
+	FILE *file = fopen(path, "wb");
+	if(!file)
+	{
+		fprintf(stderr, "Cannot create file to write to <%s>\n", path);
+		return;
+	}
+
+	fprintf(file, "#fuzz %zu %zu\n", c->prefix_length, c->unit_length);
+	fwrite(c->data, 1, c->size, file);
+	fclose(file);
+	fprintf(stderr, "Saved <%s>\n", path);
+}
+
+#define MaxCaseN 1024
+
+typedef struct tdef CaseList
+{
+	FuzzCase cases[MaxCaseN];
+	char *paths[MaxCaseN];
+	size_t case_n;
+} CaseList;
+
+static void
+func AddCaseFile(CaseList *list, char *path)
+{
+	if(list->case_n < MaxCaseN && ReadCaseFile(path, &list->cases[list->case_n]))
+	{
+		list->paths[list->case_n] = strdup(path);
+		list->case_n++;
+	}
+}
+
+static void
+func ReadCorpus(CaseList *list, char *corpus_dir)
+{
+	char path[1024];
+#ifdef _WIN32
+	snprintf(path, sizeof(path), "%s\\*.fuzz", corpus_dir);
+	WIN32_FIND_DATAA found;
+	HANDLE find = FindFirstFileA(path, &found);
+	if(find == INVALID_HANDLE_VALUE)
+		return;
+	do
+	{
+		snprintf(path, sizeof(path), "%s\\%s", corpus_dir, found.cFileName);
+		AddCaseFile(list, path);
+	}
+	while(FindNextFileA(find, &found));
+	FindClose(find);
+#else
+	DIR *dir = opendir(corpus_dir);
+	if(!dir)
+		return;
+	struct dirent *entry;
+	while((entry = readdir(dir)) != 0)
+	{
+		size_t length = strlen(entry->d_name);
+		if(length > 5 && strcmp(entry->d_name + length - 5, ".fuzz") == 0)
+		{
+			snprintf(path, sizeof(path), "%s/%s", corpus_dir, entry->d_name);
+			AddCaseFile(list, path);
+		}
+	}
+	closedir(dir);
+#endif
+}
+
+static void
+func PrintGrowth(char *name, Growth growth)
+{
+	fprintf(stderr, "%s: %s, time exponent %.2f, memory exponent %.2f, %zu bytes in %.3f s\n",
+	        name, growth.superlinear ? "SUPERLINEAR" : "ok",
+	        growth.time_exponent, growth.memory_exponent, growth.size, growth.seconds);
+}
+
+static int
+func CheckCorpus(char *corpus_dir)
+{
+	CaseList *list = calloc(1, sizeof(CaseList));
+	ReadCorpus(list, corpus_dir);
+
+	int superlinear_n = 0;
+	for(size_t i = 0; i < list->case_n; i++)
+	{
+		Growth growth = MeasureGrowth(&list->cases[i]);
+		PrintGrowth(list->paths[i], growth);
+		if(growth.superlinear)
+			superlinear_n++;
+	}
+
+	fprintf(stderr, "%zu cases, %i superlinear\n", list->case_n, superlinear_n);
+	return (superlinear_n > 0) ? 1 : 0;
+}
+
+static int
+func RunFuzzer(char *corpus_dir, size_t iteration_n, char **seed_paths, int seed_n)
+{
+	CaseList *list = calloc(1, sizeof(CaseList));
+	ReadCorpus(list, corpus_dir);
+	for(int i = 0; i < seed_n; i++)
+		AddCaseFile(list, seed_paths[i]);
+
+	if(list->case_n == 0)
+	{
+		fprintf(stderr, "No seeds, give seed files or a corpus with cases in it.\n");
+		return -1;
+	}
+
+	unsigned int state = (unsigned int)time(0) | 1;
+	size_t found_n = 0;
+	for(size_t i = 0; i < iteration_n; i++)
+	{
+		FuzzCase *base = &list->cases[Random(&state) % list->case_n];
+		FuzzCase c = MutateCase(base, &state);
+		Growth growth = MeasureGrowth(&c);
+		// Measure twice before spending time on minimizing.
+		if(growth.superlinear && MeasureGrowth(&c).superlinear)
+		{
+			PrintGrowth("candidate", growth);
+			MinimizeCase(&c);
+			PrintGrowth("minimized", MeasureGrowth(&c));
+			WriteCaseFile(corpus_dir, &c);
+			found_n++;
+
+			if(list->case_n < MaxCaseN)
+			{
+				list->paths[list->case_n] = "found";
+				list->cases[list->case_n] = c;
+				list->case_n++;
+				continue;
+			}
+		}
+		free(c.data);
+	}
+
+	fprintf(stderr, "%zu iterations, %zu superlinear cases\n", iteration_n, found_n);
+	return 0;
+}
+
+int main(int arg_n, char **arg_v)
+{
+	if(arg_n >= 3 && strcmp(arg_v[1], "check") == 0)
+	{
+		freopen(NullDevice, "w", stdout);
+		return CheckCorpus(arg_v[2]);
+	}
+	else if(arg_n >= 3 && strcmp(arg_v[1], "run") == 0)
+	{
+		size_t iteration_n = (arg_n >= 4) ? (size_t)atol(arg_v[3]) : 1000;
+		freopen(NullDevice, "w", stdout);
+		return RunFuzzer(arg_v[2], iteration_n, arg_v + 4, (arg_n >= 4) ? arg_n - 4 : 0);
+	}
+
+	printf("Usage: Fuzz run [corpus_dir] [iteration_n] [seed files...]\n");
+	printf("       Fuzz check [corpus_dir]\n");
+	return -1;
+}
+
+#endif
@@ -0,0 +1,1078 @@
+// Inlining of small functions and operators on the M64 tree, before any output is written.
+// The body of the callee is placed right before the instruction that contains the call,
+// with its parameters and locals renamed, and the call is replaced by the returned value.
+// Only calls that are evaluated exactly once can be moved like this,
+// so calls in the condition and update of a for loop are left alone.
+
+// Functions above this cost are only inlined with the inline attribute.
+#define InlineMaxCost 40
+// Functions that the profile shows to be hot can be this large.
+#define InlineMaxHotCost 120
+
+typedef struct tdef InlineInfo
+{
+	Token name;
+	Token *param_names;
+	VarType **param_types;
+	size_t param_n;
+	VarType *return_type;
+	BlockInstruction *body;
+	bool is_inline;
+	bool is_hot;
+	bool is_cold;
+
+	size_t cost;
+	// Loads through pointers or calls anything, stores through pointers or calls anything.
+	bool reads_memory;
+	bool writes_memory;
+	// Why the callee cannot be inlined, 0 if it can.
+	char *blocker;
+
+	size_t call_n;
+	size_t inlined_call_n;
+} InlineInfo;
+
+typedef struct tdef InlineRename
+{
+	U32 from;
+	U32 to;
+} InlineRename;
+
+#define InlineMaxRenameN 256
+
+typedef struct tdef Inliner
+{
+	ParseInput *input;
+	size_t name_n;
+	size_t inlined_call_n;
+
+	// Instructions that go before the instruction being inlined into.
+	Instruction *first_hoisted;
+	Instruction *last_hoisted;
+	// What the instruction keeps in place before the call being inlined into it.
+	// The body of the callee goes before all of that, so it cannot write memory
+	// that a kept load reads, or use memory that a kept call can change.
+	bool keeps_load;
+	bool keeps_call;
+
+	InlineRename renames[InlineMaxRenameN];
+	size_t rename_n;
+
+	// Calls of packed operators are left to the x64 backend, see Packed.h.
+	bool keeps_packed;
+} Inliner;
+
+static Expression **
+func GetExpressionChild(Expression *expression, size_t index)
+{
+	switch(expression->id)
+	{
+		case AddExpressionId:
+		case GreaterThanExpressionId:
+		case LessThanExpressionId:
+		case LessThanEqualExpressionId:
+		case MultiplyExpressionId:
+		case SubtractExpressionId:
+		{
+			// These all start with the same left and right fields.
+			AddExpression *e = (AddExpression *)expression;
+			if(index == 0)
+				return &e->left;
+			if(index == 1)
+				return &e->right;
+			return 0;
+		}
+		case ArrayIndexExpressionId:
+		{
+			ArrayIndexExpression *e = (ArrayIndexExpression *)expression;
+			if(index == 0)
+				return &e->array;
+			if(index == 1)
+				return &e->index;
+			return 0;
+		}
+		case CastExpressionId:
+		{
+			CastExpression *e = (CastExpression *)expression;
+			return (index == 0) ? &e->value : 0;
+		}
+		case DereferenceExpressionId:
+		{
+			DereferenceExpression *e = (DereferenceExpression *)expression;
+			return (index == 0) ? &e->pointer : 0;
+		}
+		case FuncCallExpressionId:
+		{
+			FuncCallExpression *e = (FuncCallExpression *)expression;
+			FuncCallArgument *arg = e->first_call_arg;
+			for(size_t i = 0; arg && i < index; i++)
+				arg = arg->next;
+			return arg ? &arg->arg : 0;
+		}
+		case NegativeExpressionId:
+		{
+			NegativeExpression *e = (NegativeExpression *)expression;
+			return (index == 0) ? &e->value : 0;
+		}
+		case OperatorCallExpressionId:
+		{
+			OperatorCallExpression *e = (OperatorCallExpression *)expression;
+			if(index == 0)
+				return &e->left;
+			if(index == 1)
+				return &e->right;
+			return 0;
+		}
+		case ParenExpressionId:
+		{
+			ParenExpression *e = (ParenExpression *)expression;
+			return (index == 0) ? &e->in : 0;
+		}
+		case StructVarExpressionId:
+		{
+			StructVarExpression *e = (StructVarExpression *)expression;
+			return (index == 0) ? &e->base : 0;
+		}
+		default:
+		{
+			return 0;
+		}
+	}
+}
+
+static size_t
+func GetExpressionSize(ExpressionId id)
+{
+	switch(id)
+	{
+		case AddExpressionId:             return sizeof(AddExpression);
+		case ArrayIndexExpressionId:      return sizeof(ArrayIndexExpression);
+		case BoolConstantExpressionId:    return sizeof(BoolConstantExpression);
+		case CastExpressionId:            return sizeof(CastExpression);
+		case ConstantDataExpressionId:    return sizeof(ConstantDataExpression);
+		case DereferenceExpressionId:     return sizeof(DereferenceExpression);
+		case FloatConstantExpressionId:   return sizeof(FloatConstantExpression);
+		case FuncCallExpressionId:        return sizeof(FuncCallExpression);
+		case IntegerConstantExpressionId: return sizeof(IntegerConstantExpression);
+		case GreaterThanExpressionId:     return sizeof(GreaterThanExpression);
+		case LessThanExpressionId:        return sizeof(LessThanExpression);
+		case LessThanEqualExpressionId:   return sizeof(LessThanEqualExpression);
+		case MultiplyExpressionId:        return sizeof(MultiplyExpression);
+		case NegativeExpressionId:        return sizeof(NegativeExpression);
+		case OperatorCallExpressionId:    return sizeof(OperatorCallExpression);
+		case ParenExpressionId:           return sizeof(ParenExpression);
+		case StructVarExpressionId:       return sizeof(StructVarExpression);
+		case SubtractExpressionId:        return sizeof(SubtractExpression);
+		case VarExpressionId:             return sizeof(VarExpression);
+	}
+
+	return 0;
+}
+
+static Expression **
+func GetInstructionExpression(Instruction *instruction, size_t index)
+{
+	switch(instruction->id)
+	{
+		case AndEqualsInstructionId:
+		{
+			AndEqualsInstruction *i = (AndEqualsInstruction *)instruction;
+			if(index == 0)
+				return &i->left;
+			if(index == 1)
+				return &i->right;
+			return 0;
+		}
+		case AssignInstructionId:
+		{
+			AssignInstruction *i = (AssignInstruction *)instruction;
+			if(index == 0)
+				return &i->left;
+			if(index == 1)
+				return &i->right;
+			return 0;
+		}
+		case CreateVariableInstructionId:
+		{
+			CreateVariableInstruction *i = (CreateVariableInstruction *)instruction;
+			return (index == 0 && i->init) ? &i->init : 0;
+		}
+		case FuncCallInstructionId:
+		{
+			FuncCallInstruction *i = (FuncCallInstruction *)instruction;
+			return (index == 0) ? (Expression **)&i->e : 0;
+		}
+		case IfInstructionId:
+		{
+			IfInstruction *i = (IfInstruction *)instruction;
+			return (index == 0) ? &i->condition : 0;
+		}
+		case IncrementInstructionId:
+		{
+			IncrementInstruction *i = (IncrementInstruction *)instruction;
+			return (index == 0) ? &i->value : 0;
+		}
+		case ForInstructionId:
+		{
+			ForInstruction *i = (ForInstruction *)instruction;
+			return (index == 0) ? &i->condition : 0;
+		}
+		case ReturnInstructionId:
+		{
+			ReturnInstruction *i = (ReturnInstruction *)instruction;
+			return (index == 0 && i->value) ? &i->value : 0;
+		}
+		default:
+		{
+			return 0;
+		}
+	}
+}
+
+// Returns the instruction after previous among the ones nested in instruction, or the first one if previous is 0.
+// A block takes its children from its list, so they are not looked up by index.
+// The children of a for loop come in the order init, update, body.
+static Instruction *
+func GetInstructionChild(Instruction *instruction, Instruction *previous)
+{
+	switch(instruction->id)
+	{
+		case BlockInstructionId:
+		{
+			return previous ? previous->next : ((BlockInstruction *)instruction)->first;
+		}
+		case IfInstructionId:
+		{
+			return previous ? 0 : (Instruction *)((IfInstruction *)instruction)->body;
+		}
+		case ForInstructionId:
+		{
+			ForInstruction *i = (ForInstruction *)instruction;
+			if(!previous)
+				return i->init;
+			if(previous == i->init && i->update)
+				return i->update;
+			if(previous != (Instruction *)i->body)
+				return (Instruction *)i->body;
+			return 0;
+		}
+		default:
+		{
+			return 0;
+		}
+	}
+}
+
+static size_t
+func GetInstructionSize(InstructionId id)
+{
+	switch(id)
+	{
+		case AndEqualsInstructionId:      return sizeof(AndEqualsInstruction);
+		case AssignInstructionId:         return sizeof(AssignInstruction);
+		case BlockInstructionId:          return sizeof(BlockInstruction);
+		case CreateVariableInstructionId: return sizeof(CreateVariableInstruction);
+		case FuncCallInstructionId:       return sizeof(FuncCallInstruction);
+		case IfInstructionId:             return sizeof(IfInstruction);
+		case IncrementInstructionId:      return sizeof(IncrementInstruction);
+		case ForInstructionId:            return sizeof(ForInstruction);
+		case ReturnInstructionId:         return sizeof(ReturnInstruction);
+	}
+
+	return 0;
+}
+
+static size_t
+func GetExpressionCost(Expression *e)
+{
+	size_t cost = 1;
+	Expression **child = 0;
+	for(size_t i = 0; (child = GetExpressionChild(e, i)) != 0; i++)
+		cost += GetExpressionCost(*child);
+	return cost;
+}
+
+static size_t decl GetBlockCost(BlockInstruction *);
+
+static size_t
+func GetInstructionCost(Instruction *instruction)
+{
+	size_t cost = 1;
+	Expression **e = 0;
+	for(size_t i = 0; (e = GetInstructionExpression(instruction, i)) != 0; i++)
+		cost += GetExpressionCost(*e);
+
+	if(instruction->id == BlockInstructionId)
+	{
+		cost += GetBlockCost((BlockInstruction *)instruction);
+	}
+	else if(instruction->id == IfInstructionId)
+	{
+		cost += GetBlockCost(((IfInstruction *)instruction)->body);
+	}
+	else if(instruction->id == ForInstructionId)
+	{
+		ForInstruction *i = (ForInstruction *)instruction;
+		cost += GetInstructionCost(i->init) + GetBlockCost(i->body);
+		if(i->update)
+			cost += GetInstructionCost(i->update);
+	}
+	return cost;
+}
+
+static size_t
+func GetBlockCost(BlockInstruction *block)
+{
+	size_t cost = 0;
+	for(Instruction *i = block->first; i; i = i->next)
+		cost += GetInstructionCost(i);
+	return cost;
+}
+
+static size_t
+func CountLocals(Instruction *instruction)
+{
+	// The update of a for loop never creates a variable, so it adds nothing.
+	size_t local_n = (instruction->id == CreateVariableInstructionId);
+	for(Instruction *i = GetInstructionChild(instruction, 0); i; i = GetInstructionChild(instruction, i))
+		local_n += CountLocals(i);
+	return local_n;
+}
+
+static size_t
+func CountReturns(Instruction *instruction)
+{
+	size_t return_n = (instruction->id == ReturnInstructionId);
+	for(Instruction *i = GetInstructionChild(instruction, 0); i; i = GetInstructionChild(instruction, i))
+		return_n += CountReturns(i);
+	return return_n;
+}
+
+static Instruction *
+func GetLastInstruction(BlockInstruction *block)
+{
+	Instruction *last = block->first;
+	while(last && last->next)
+		last = last->next;
+	return last;
+}
+
+static void decl MarkInlineMemoryUses(InlineInfo *, Instruction *);
+
+static void
+func AnalyzeInlineInfo(InlineInfo *info)
+{
+	if(!info->body)
+	{
+		info->blocker = "extern";
+		return;
+	}
+
+	// Array parameters are pointers in C, a copy would change what the callee writes to.
+	bool has_array = (info->return_type && info->return_type->id == ArrayTypeId);
+	for(size_t i = 0; i < info->param_n; i++)
+		has_array |= (info->param_types[i]->id == ArrayTypeId);
+	if(has_array)
+	{
+		info->blocker = "array parameter or result";
+		return;
+	}
+
+	size_t return_n = CountReturns((Instruction *)info->body);
+	Instruction *last = GetLastInstruction(info->body);
+	bool ends_with_return = (last && last->id == ReturnInstructionId);
+	if(return_n > 1 || (return_n == 1 && !ends_with_return))
+	{
+		info->blocker = "returns before the end";
+		return;
+	}
+
+	if(info->param_n + CountLocals((Instruction *)info->body) > InlineMaxRenameN)
+	{
+		info->blocker = "too many variables";
+		return;
+	}
+
+	info->cost = GetBlockCost(info->body);
+	MarkInlineMemoryUses(info, (Instruction *)info->body);
+	if(info->is_cold && !info->is_inline)
+	{
+		info->blocker = "never called in the profile";
+	}
+	else if(info->cost > (info->is_hot ? InlineMaxHotCost : InlineMaxCost) && !info->is_inline)
+	{
+		info->blocker = "too large";
+	}
+}
+
+static InlineInfo *
+func GetInlineInfo(Inliner *inliner, Expression *call)
+{
+	MemoryArena *arena = &inliner->input->arena;
+	if(call->id == FuncCallExpressionId)
+	{
+		FuncDefinition *def = ((FuncCallExpression *)call)->func_def;
+		if(!def->inline_info)
+		{
+			InlineInfo *info = ArenaPushType(arena, InlineInfo);
+			*info = (InlineInfo){};
+			info->name = def->header.name;
+			for(FuncParam *param = def->header.first_param; param; param = param->next)
+				info->param_n++;
+
+			info->param_names = ArenaPushArray(arena, info->param_n, Token);
+			info->param_types = ArenaPushArray(arena, info->param_n, VarType *);
+			size_t i = 0;
+			for(FuncParam *param = def->header.first_param; param; param = param->next, i++)
+			{
+				info->param_names[i] = param->name;
+				info->param_types[i] = param->type;
+			}
+
+			info->return_type = def->header.return_type;
+			info->body = def->is_extern ? 0 : def->body;
+			info->is_inline = def->is_inline;
+			info->is_hot = def->is_hot;
+			info->is_cold = def->is_cold;
+			AnalyzeInlineInfo(info);
+			def->inline_info = info;
+		}
+		return def->inline_info;
+	}
+	else if(call->id == OperatorCallExpressionId)
+	{
+		OperatorDefinition *def = ((OperatorCallExpression *)call)->def;
+		if(!def->inline_info)
+		{
+			InlineInfo *info = ArenaPushType(arena, InlineInfo);
+			*info = (InlineInfo){};
+			info->name = def->name;
+			info->param_n = 2;
+			info->param_names = ArenaPushArray(arena, 2, Token);
+			info->param_types = ArenaPushArray(arena, 2, VarType *);
+			info->param_names[0] = def->left_name;
+			info->param_types[0] = def->left_type;
+			info->param_names[1] = def->right_name;
+			info->param_types[1] = def->right_type;
+
+			info->return_type = def->return_type;
+			info->body = def->body;
+			info->is_inline = def->is_inline;
+			AnalyzeInlineInfo(info);
+			if(inliner->keeps_packed && GetPackedInfo(inliner->input, def)->is_packed)
+				info->blocker = "one packed instruction in x64";
+			def->inline_info = info;
+		}
+		return def->inline_info;
+	}
+
+	return 0;
+}
+
+static void
+func AddInlineRename(Inliner *inliner, Token from, Token to)
+{
+	InlineRename *rename = &inliner->renames[inliner->rename_n];
+	inliner->rename_n++;
+	rename->from = from.value;
+	rename->to = to.value;
+}
+
+static Token
+func RenameInlineVar(Inliner *inliner, Token name)
+{
+	for(size_t i = 0; i < inliner->rename_n; i++)
+	{
+		if(inliner->renames[i].from == name.value)
+		{
+			name.value = inliner->renames[i].to;
+			break;
+		}
+	}
+	return name;
+}
+
+static Expression *
+func CloneExpression(Inliner *inliner, Expression *expression)
+{
+	MemoryArena *arena = &inliner->input->arena;
+	size_t size = GetExpressionSize(expression->id);
+	Expression *copy = (Expression *)ArenaPush(arena, size);
+	memcpy(copy, expression, size);
+
+	if(copy->id == FuncCallExpressionId)
+	{
+		FuncCallExpression *e = (FuncCallExpression *)copy;
+		FuncCallArgument **link = &e->first_call_arg;
+		for(FuncCallArgument *arg = e->first_call_arg; arg; arg = arg->next)
+		{
+			FuncCallArgument *arg_copy = ArenaPushType(arena, FuncCallArgument);
+			*arg_copy = *arg;
+			*link = arg_copy;
+			link = &arg_copy->next;
+		}
+	}
+	else if(copy->id == VarExpressionId)
+	{
+		VarExpression *e = (VarExpression *)copy;
+		e->var.name = RenameInlineVar(inliner, e->var.name);
+	}
+
+	Expression **child = 0;
+	for(size_t i = 0; (child = GetExpressionChild(copy, i)) != 0; i++)
+		*child = CloneExpression(inliner, *child);
+
+	return copy;
+}
+
+static BlockInstruction *decl CloneBlock(Inliner *, BlockInstruction *);
+
+static Instruction *
+func CloneInstruction(Inliner *inliner, Instruction *instruction)
+{
+	size_t size = GetInstructionSize(instruction->id);
+	Instruction *copy = (Instruction *)ArenaPush(&inliner->input->arena, size);
+	memcpy(copy, instruction, size);
+	copy->next = 0;
+
+	Expression **e = 0;
+	for(size_t i = 0; (e = GetInstructionExpression(copy, i)) != 0; i++)
+		*e = CloneExpression(inliner, *e);
+
+	switch(copy->id)
+	{
+		case BlockInstructionId:
+		{
+			BlockInstruction *block = CloneBlock(inliner, (BlockInstruction *)instruction);
+			((BlockInstruction *)copy)->first = block->first;
+			break;
+		}
+		case CreateVariableInstructionId:
+		{
+			CreateVariableInstruction *i = (CreateVariableInstruction *)copy;
+			i->name = RenameInlineVar(inliner, i->name);
+			break;
+		}
+		case IfInstructionId:
+		{
+			IfInstruction *i = (IfInstruction *)copy;
+			i->body = CloneBlock(inliner, i->body);
+			break;
+		}
+		case ForInstructionId:
+		{
+			ForInstruction *i = (ForInstruction *)copy;
+			i->init = CloneInstruction(inliner, i->init);
+			if(i->update)
+				i->update = CloneInstruction(inliner, i->update);
+			i->body = CloneBlock(inliner, i->body);
+			break;
+		}
+		default:
+		{
+			break;
+		}
+	}
+
+	return copy;
+}
+
+static BlockInstruction *
+func CloneBlock(Inliner *inliner, BlockInstruction *block)
+{
+	BlockInstruction *copy = ArenaPushType(&inliner->input->arena, BlockInstruction);
+	*copy = *block;
+	copy->i.next = 0;
+
+	Instruction **link = &copy->first;
+	for(Instruction *i = block->first; i; i = i->next)
+	{
+		*link = CloneInstruction(inliner, i);
+		link = &(*link)->next;
+	}
+
+	return copy;
+}
+
+static void
+func RenameLocals(Inliner *inliner, Instruction *instruction)
+{
+	// Every variable created in the body gets a new name, so it can live in the caller's scope.
+	if(instruction->id == CreateVariableInstructionId)
+	{
+		CreateVariableInstruction *i = (CreateVariableInstruction *)instruction;
+		AddInlineRename(inliner, i->name, CreateUniqueName(inliner->input, &inliner->name_n, i->name));
+	}
+
+	for(Instruction *i = GetInstructionChild(instruction, 0); i; i = GetInstructionChild(instruction, i))
+		RenameLocals(inliner, i);
+}
+
+static bool
+func IsVarWritten(Instruction *instruction, Token name);
+
+static Var *
+func GetWrittenVar(Expression *e)
+{
+	// The variable whose own storage an assignment to e changes, 0 if it writes through a pointer.
+	while(1)
+	{
+		if(e->id == VarExpressionId)
+		{
+			return &((VarExpression *)e)->var;
+		}
+		else if(e->id == ParenExpressionId)
+		{
+			e = ((ParenExpression *)e)->in;
+		}
+		else if(e->id == StructVarExpressionId)
+		{
+			StructVarExpression *s = (StructVarExpression *)e;
+			if(s->base->type->id == PointerTypeId)
+				return 0;
+			e = s->base;
+		}
+		else if(e->id == ArrayIndexExpressionId)
+		{
+			ArrayIndexExpression *a = (ArrayIndexExpression *)e;
+			if(a->array->type->id == PointerTypeId)
+				return 0;
+			e = a->array;
+		}
+		else
+		{
+			return 0;
+		}
+	}
+}
+
+static bool
+func IsVarWritten(Instruction *instruction, Token name)
+{
+	Expression *target = 0;
+	switch(instruction->id)
+	{
+		case AndEqualsInstructionId:
+			target = ((AndEqualsInstruction *)instruction)->left;
+			break;
+		case AssignInstructionId:
+			target = ((AssignInstruction *)instruction)->left;
+			break;
+		case IncrementInstructionId:
+			target = ((IncrementInstruction *)instruction)->value;
+			break;
+		default:
+		{
+			for(Instruction *i = GetInstructionChild(instruction, 0); i; i = GetInstructionChild(instruction, i))
+			{
+				if(IsVarWritten(i, name))
+					return true;
+			}
+			return false;
+		}
+	}
+
+	Var *var = GetWrittenVar(target);
+	return (var && TokensEqual(var->name, name));
+}
+
+static bool
+func HasCall(Expression *e)
+{
+	if(e->id == FuncCallExpressionId || e->id == OperatorCallExpressionId)
+		return true;
+
+	Expression **child = 0;
+	for(size_t i = 0; (child = GetExpressionChild(e, i)) != 0; i++)
+	{
+		if(HasCall(*child))
+			return true;
+	}
+	return false;
+}
+
+static bool
+func IsPointerLoad(Expression *e)
+{
+	switch(e->id)
+	{
+		case DereferenceExpressionId:
+			return true;
+		case StructVarExpressionId:
+			return (((StructVarExpression *)e)->base->type->id == PointerTypeId);
+		case ArrayIndexExpressionId:
+			return (((ArrayIndexExpression *)e)->array->type->id == PointerTypeId);
+		default:
+			return false;
+	}
+}
+
+static bool
+func UsesMemory(Expression *e)
+{
+	if(IsPointerLoad(e) || e->id == FuncCallExpressionId || e->id == OperatorCallExpressionId)
+		return true;
+
+	Expression **child = 0;
+	for(size_t i = 0; (child = GetExpressionChild(e, i)) != 0; i++)
+	{
+		if(UsesMemory(*child))
+			return true;
+	}
+	return false;
+}
+
+static void
+func MarkInlineMemoryUses(InlineInfo *info, Instruction *instruction)
+{
+	Expression **e = 0;
+	for(size_t i = 0; (e = GetInstructionExpression(instruction, i)) != 0; i++)
+	{
+		info->reads_memory |= UsesMemory(*e);
+		info->writes_memory |= HasCall(*e);
+	}
+
+	Expression *target = 0;
+	if(instruction->id == AndEqualsInstructionId)
+		target = ((AndEqualsInstruction *)instruction)->left;
+	else if(instruction->id == AssignInstructionId)
+		target = ((AssignInstruction *)instruction)->left;
+	else if(instruction->id == IncrementInstructionId)
+		target = ((IncrementInstruction *)instruction)->value;
+	if(target && !GetWrittenVar(target))
+		info->writes_memory = true;
+
+	for(Instruction *i = GetInstructionChild(instruction, 0); i; i = GetInstructionChild(instruction, i))
+		MarkInlineMemoryUses(info, i);
+}
+
+static bool
+func IsVarNamed(Expression *e, Token name)
+{
+	return (e->id == VarExpressionId && TokensEqual(((VarExpression *)e)->var.name, name));
+}
+
+static size_t
+func CountVarUses(Expression *e, Token name)
+{
+	size_t use_n = IsVarNamed(e, name) ? 1 : 0;
+	Expression **child = 0;
+	for(size_t i = 0; (child = GetExpressionChild(e, i)) != 0; i++)
+		use_n += CountVarUses(*child, name);
+	return use_n;
+}
+
+static void
+func HoistInstruction(Inliner *inliner, Instruction *instruction)
+{
+	instruction->next = 0;
+	if(inliner->last_hoisted)
+		inliner->last_hoisted->next = instruction;
+	else
+		inliner->first_hoisted = instruction;
+	inliner->last_hoisted = instruction;
+}
+
+static void
+func SetMissingOffsets(Instruction *first, Instruction *end, U32 offset)
+{
+	// Instructions made by a pass get the source offset of the statement they were made for,
+	// so the #line directives of the C output point there.
+	for(Instruction *i = first; i && i != end; i = i->next)
+	{
+		if(i->offset == 0)
+			i->offset = offset;
+	}
+}
+
+static Instruction *
+func PushInlineVariable(Inliner *inliner, Token name, VarType *type, Expression *init)
+{
+	CreateVariableInstruction *i = ArenaPushType(&inliner->input->arena, CreateVariableInstruction);
+	*i = (CreateVariableInstruction){};
+	i->i.id = CreateVariableInstructionId;
+	i->name = name;
+	i->type = type;
+	i->init = init;
+	return (Instruction *)i;
+}
+
+static Expression *
+func ExpandCall(Inliner *inliner, InlineInfo *info, Expression **args, bool result_used)
+{
+	// Returns the expression that replaces the call, 0 for calls without a result.
+	inliner->rename_n = 0;
+
+	Var var = {};
+	for(size_t i = 0; i < info->param_n; i++)
+	{
+		Expression *arg = args[i];
+		Token param = info->param_names[i];
+		if(arg->id == VarExpressionId && !IsVarWritten((Instruction *)info->body, param))
+		{
+			// The argument variable can stand in for a parameter that is only read.
+			AddInlineRename(inliner, param, ((VarExpression *)arg)->var.name);
+		}
+		else
+		{
+			Token name = CreateUniqueName(inliner->input, &inliner->name_n, param);
+			AddInlineRename(inliner, param, name);
+			HoistInstruction(inliner, PushInlineVariable(inliner, name, info->param_types[i], arg));
+		}
+	}
+	RenameLocals(inliner, (Instruction *)info->body);
+
+	Instruction *last = GetLastInstruction(info->body);
+	for(Instruction *i = info->body->first; i; i = i->next)
+	{
+		if(i == last && i->id == ReturnInstructionId)
+			break;
+		HoistInstruction(inliner, CloneInstruction(inliner, i));
+	}
+
+	if(!result_used || !last || last->id != ReturnInstructionId || !((ReturnInstruction *)last)->value)
+		return 0;
+
+	Expression *result = CloneExpression(inliner, ((ReturnInstruction *)last)->value);
+	if(result->id == VarExpressionId)
+		return result;
+
+	Token name = CreateUniqueName(inliner->input, &inliner->name_n, info->name);
+	HoistInstruction(inliner, PushInlineVariable(inliner, name, info->return_type, result));
+
+	var.name = name;
+	var.type = info->return_type;
+	return (Expression *)PushVarExpression(&inliner->input->arena, var);
+}
+
+static bool
+func TryInlineCall(Inliner *inliner, Expression *call, bool result_used, Expression **result)
+{
+	InlineInfo *info = GetInlineInfo(inliner, call);
+	if(!info)
+		return false;
+
+	info->call_n++;
+	if(info->blocker)
+		return false;
+
+	if((inliner->keeps_call && (info->reads_memory || info->writes_memory)) || (inliner->keeps_load && info->writes_memory))
+		return false;
+
+	// A result that is not used is only dropped if evaluating it has no effects.
+	Instruction *last = GetLastInstruction(info->body);
+	if(!result_used && last && last->id == ReturnInstructionId &&
+	   ((ReturnInstruction *)last)->value && HasCall(((ReturnInstruction *)last)->value))
+		return false;
+
+	Expression *args[InlineMaxRenameN];
+	Expression **arg = 0;
+	for(size_t i = 0; (arg = GetExpressionChild(call, i)) != 0; i++)
+		args[i] = *arg;
+
+	*result = ExpandCall(inliner, info, args, result_used);
+	info->inlined_call_n++;
+	inliner->inlined_call_n++;
+	return true;
+}
+
+static void
+func InlineExpression(Inliner *inliner, Expression **slot)
+{
+	// Arguments are expanded first, so that they are hoisted in evaluation order.
+	bool keeps_load = inliner->keeps_load;
+	bool keeps_call = inliner->keeps_call;
+	Expression **child = 0;
+	for(size_t i = 0; (child = GetExpressionChild(*slot, i)) != 0; i++)
+		InlineExpression(inliner, child);
+
+	Expression *result = 0;
+	if(TryInlineCall(inliner, *slot, true, &result))
+	{
+		// The arguments went before the body, so they are not kept in place any more.
+		*slot = result;
+		inliner->keeps_load = keeps_load;
+		inliner->keeps_call = keeps_call;
+	}
+	else
+	{
+		inliner->keeps_load |= IsPointerLoad(*slot);
+		inliner->keeps_call |= ((*slot)->id == FuncCallExpressionId || (*slot)->id == OperatorCallExpressionId);
+	}
+}
+
+static void decl InlineBlock(Inliner *, BlockInstruction *);
+
+static bool
+func InlineInstruction(Inliner *inliner, Instruction *instruction)
+{
+	// Returns true if the instruction itself was replaced by the hoisted instructions.
+	switch(instruction->id)
+	{
+		case BlockInstructionId:
+		{
+			InlineBlock(inliner, (BlockInstruction *)instruction);
+			return false;
+		}
+		case FuncCallInstructionId:
+		{
+			FuncCallInstruction *i = (FuncCallInstruction *)instruction;
+			Expression **arg = 0;
+			for(size_t index = 0; (arg = GetExpressionChild((Expression *)i->e, index)) != 0; index++)
+				InlineExpression(inliner, arg);
+
+			// The arguments go before the body too, so the call itself keeps nothing in place.
+			inliner->keeps_load = false;
+			inliner->keeps_call = false;
+			Expression *result = 0;
+			return TryInlineCall(inliner, (Expression *)i->e, false, &result);
+		}
+		case AssignInstructionId:
+		{
+			// The target is only stored to, so only the loads in its address are kept.
+			AssignInstruction *i = (AssignInstruction *)instruction;
+			Expression **child = 0;
+			for(size_t index = 0; (child = GetExpressionChild(i->left, index)) != 0; index++)
+				InlineExpression(inliner, child);
+			InlineExpression(inliner, &i->right);
+			return false;
+		}
+		case IfInstructionId:
+		{
+			IfInstruction *i = (IfInstruction *)instruction;
+			InlineExpression(inliner, &i->condition);
+			InlineBlock(inliner, i->body);
+			return false;
+		}
+		case ForInstructionId:
+		{
+			// The init runs once before the loop, the condition and the update run on every iteration.
+			ForInstruction *i = (ForInstruction *)instruction;
+			if(i->init->id == FuncCallInstructionId)
+			{
+				Expression **arg = 0;
+				FuncCallExpression *call = ((FuncCallInstruction *)i->init)->e;
+				for(size_t index = 0; (arg = GetExpressionChild((Expression *)call, index)) != 0; index++)
+					InlineExpression(inliner, arg);
+			}
+			else
+			{
+				InlineInstruction(inliner, i->init);
+			}
+			InlineBlock(inliner, i->body);
+			return false;
+		}
+		default:
+		{
+			Expression **e = 0;
+			for(size_t index = 0; (e = GetInstructionExpression(instruction, index)) != 0; index++)
+				InlineExpression(inliner, e);
+			return false;
+		}
+	}
+}
+
+static void
+func InlineBlock(Inliner *inliner, BlockInstruction *block)
+{
+	Instruction *saved_first = inliner->first_hoisted;
+	Instruction *saved_last = inliner->last_hoisted;
+
+	Instruction **link = &block->first;
+	while(*link)
+	{
+		Instruction *instruction = *link;
+		Instruction *next = instruction->next;
+
+		inliner->first_hoisted = 0;
+		inliner->last_hoisted = 0;
+		inliner->keeps_load = false;
+		inliner->keeps_call = false;
+		bool replaced = InlineInstruction(inliner, instruction);
+
+		Instruction *first = inliner->first_hoisted;
+		Instruction *last = inliner->last_hoisted;
+		if(!replaced)
+		{
+			if(last)
+				last->next = instruction;
+			else
+				first = instruction;
+			last = instruction;
+		}
+
+		if(first)
+		{
+			*link = first;
+			last->next = next;
+			SetMissingOffsets(first, next, instruction->offset);
+			link = &last->next;
+		}
+		else
+		{
+			*link = next;
+		}
+	}
+
+	inliner->first_hoisted = saved_first;
+	inliner->last_hoisted = saved_last;
+}
+
+static void
+func WriteInlineReport(Inliner *inliner, DefinitionList *def_list)
+{
+	ParseInput *input = inliner->input;
+	printf("Inlining:\n");
+	for(DefinitionListElem *elem = def_list; elem; elem = elem->next)
+	{
+		InlineInfo *info = 0;
+		if(elem->definition->id == FuncDefinitionId)
+			info = ((FuncDefinition *)elem->definition)->inline_info;
+		else if(elem->definition->id == OperatorDefinitionId)
+			info = ((OperatorDefinition *)elem->definition)->inline_info;
+
+		if(!info)
+			continue;
+
+		Atom *name = &input->atoms.atoms[info->name.value];
+		printf("  %.*s: %zu of %zu calls inlined", (int)name->length, name->text, info->inlined_call_n, info->call_n);
+		if(info->blocker)
+			printf(", not inlined: %s", info->blocker);
+		else
+			printf(", cost %zu", info->cost);
+		if(info->is_inline)
+			printf(", marked inline");
+		printf("\n");
+	}
+	printf("Inlined %zu calls.\n", inliner->inlined_call_n);
+}
+
+static void
+func InlineDefinitionList(ParseInput *input, DefinitionList *def_list, bool keeps_packed, bool report)
+{
+	// Callees are defined before their callers, so their bodies are already final when they are copied.
+	Inliner *inliner = ArenaPushType(&input->arena, Inliner);
+	*inliner = (Inliner){};
+	inliner->input = input;
+	inliner->keeps_packed = keeps_packed;
+
+	for(DefinitionListElem *elem = def_list; elem; elem = elem->next)
+	{
+		Definition *definition = elem->definition;
+		if(definition->id == FuncDefinitionId)
+		{
+			FuncDefinition *def = (FuncDefinition *)definition;
+			if(!def->is_extern)
+				InlineBlock(inliner, def->body);
+		}
+		else if(definition->id == OperatorDefinitionId)
+		{
+			InlineBlock(inliner, ((OperatorDefinition *)definition)->body);
+		}
+	}
+
+	if(report)
+	{
+		WriteInlineReport(inliner, def_list);
+	}
+}
@@ -0,0 +1,309 @@
+// Struct layout: size, alignment and padding of every struct, as the C compiler lays it out for x64.
+// Fields are placed in order, each at the next multiple of its alignment,
+// and the size is rounded up to the alignment of the struct.
+// A packed struct has no padding between its fields and alignment 1,
+// and align(N) raises the alignment of the struct to N.
+//
+// With --reorder-fields, the fields of structs that are not packed are sorted by decreasing alignment,
+// which leaves no padding between them. With --profile-use, the fields accessed in hot functions come first,
+// so they share cache lines. This runs before compile-time evaluation writes any struct constants.
+
+#define LayoutPointerSize 8
+#define LayoutMaxFieldN 256
+
+static U64 decl GetStructAlign(StructDefinition *);
+
+static U64
+func GetTypeAlign(VarType *type)
+{
+	switch(type->id)
+	{
+		case ArrayTypeId:
+		{
+			return GetTypeAlign(((ArrayType *)type)->element_type);
+		}
+		case PointerTypeId:
+		{
+			return LayoutPointerSize;
+		}
+		case StructTypeId:
+		{
+			return GetStructAlign(((StructType *)type)->def);
+		}
+		default:
+		{
+			// bool is written as int.
+			return 4;
+		}
+	}
+}
+
+static U64
+func GetStructAlign(StructDefinition *def)
+{
+	U64 align = 1;
+	if(!def->packed)
+	{
+		for(StructVar *var = def->first_var; var; var = var->next)
+		{
+			U64 var_align = GetTypeAlign(var->type);
+			if(var_align > align)
+				align = var_align;
+		}
+	}
+	if(def->align_attribute > align)
+		align = def->align_attribute;
+	return align;
+}
+
+static U64
+func AlignUp(U64 value, U64 align)
+{
+	return (value + align - 1) & ~(align - 1);
+}
+
+static bool decl LayoutStruct(StructDefinition *);
+
+static bool
+func GetTypeSize(VarType *type, U64 *size)
+{
+	switch(type->id)
+	{
+		case ArrayTypeId:
+		{
+			// Sizes that compile-time evaluation could not fold have no layout.
+			ArrayType *array = (ArrayType *)type;
+			U64 element_size = 0;
+			if(!array->size || array->size->id != IntegerConstantExpressionId || !GetTypeSize(array->element_type, &element_size))
+				return false;
+			*size = (U64)((IntegerConstantExpression *)array->size)->value * element_size;
+			return true;
+		}
+		case PointerTypeId:
+		{
+			*size = LayoutPointerSize;
+			return true;
+		}
+		case StructTypeId:
+		{
+			StructDefinition *def = ((StructType *)type)->def;
+			if(!LayoutStruct(def))
+				return false;
+			*size = def->size;
+			return true;
+		}
+		default:
+		{
+			*size = 4;
+			return true;
+		}
+	}
+}
+
+static bool
+func LayoutStruct(StructDefinition *def)
+{
+	if(def->has_layout)
+		return true;
+
+	U64 align = GetStructAlign(def);
+
+	U64 offset = 0;
+	U64 field_size_sum = 0;
+	for(StructVar *var = def->first_var; var; var = var->next)
+	{
+		U64 size = 0;
+		if(!GetTypeSize(var->type, &size))
+			return false;
+		if(!def->packed)
+			offset = AlignUp(offset, GetTypeAlign(var->type));
+		offset += size;
+		field_size_sum += size;
+	}
+
+	def->size = AlignUp(offset, align);
+	def->align = align;
+	def->padding = def->size - field_size_sum;
+	def->has_layout = true;
+	return true;
+}
+
+static bool
+func GetFieldOffset(StructDefinition *def, Token name, U64 *offset)
+{
+	// Placed the same way as in LayoutStruct.
+	if(!LayoutStruct(def))
+		return false;
+
+	U64 at = 0;
+	for(StructVar *var = def->first_var; var; var = var->next)
+	{
+		U64 size = 0;
+		GetTypeSize(var->type, &size);
+		if(!def->packed)
+			at = AlignUp(at, GetTypeAlign(var->type));
+		if(TokensEqual(var->name, name))
+		{
+			*offset = at;
+			return true;
+		}
+		at += size;
+	}
+	return false;
+}
+
+static void
+func MarkHotField(Expression *base, Token name)
+{
+	VarType *type = base->type;
+	if(type && type->id == PointerTypeId)
+		type = ((PointerType *)type)->pointed_type;
+	if(!type || type->id != StructTypeId)
+		return;
+
+	StructVar *var = GetStructVar(((StructType *)type)->def, name);
+	if(var)
+		var->is_hot = true;
+}
+
+static void
+func MarkHotFieldsInExpression(Expression *e)
+{
+	if(e->id == StructVarExpressionId)
+	{
+		StructVarExpression *s = (StructVarExpression *)e;
+		MarkHotField(s->base, s->var_name);
+	}
+	else if(e->id == ArrayIndexExpressionId)
+	{
+		// Indexing a struct indexes the array it uses.
+		Expression *array = ((ArrayIndexExpression *)e)->array;
+		if(array->type && array->type->id == StructTypeId && ((StructType *)array->type)->def->used_var)
+			((StructType *)array->type)->def->used_var->is_hot = true;
+	}
+
+	Expression **child = 0;
+	for(size_t i = 0; (child = GetExpressionChild(e, i)) != 0; i++)
+		MarkHotFieldsInExpression(*child);
+}
+
+static void
+func MarkHotFieldsInInstruction(Instruction *instruction)
+{
+	Expression **e = 0;
+	for(size_t i = 0; (e = GetInstructionExpression(instruction, i)) != 0; i++)
+		MarkHotFieldsInExpression(*e);
+
+	for(Instruction *i = GetInstructionChild(instruction, 0); i; i = GetInstructionChild(instruction, i))
+		MarkHotFieldsInInstruction(i);
+}
+
+static bool
+func FieldGoesBefore(StructVar *var1, StructVar *var2)
+{
+	if(var1->is_hot != var2->is_hot)
+		return var1->is_hot;
+	return GetTypeAlign(var1->type) > GetTypeAlign(var2->type);
+}
+
+static bool
+func ReorderStructFields(StructDefinition *def)
+{
+	// Insertion sort, so fields that compare equal keep the order they were declared in.
+	StructVar *vars[LayoutMaxFieldN];
+	size_t var_n = 0;
+	for(StructVar *var = def->first_var; var; var = var->next)
+	{
+		if(var_n == LayoutMaxFieldN)
+			return false;
+		vars[var_n] = var;
+		var_n++;
+	}
+
+	bool moved = false;
+	for(size_t i = 1; i < var_n; i++)
+	{
+		StructVar *var = vars[i];
+		size_t j = i;
+		while(j > 0 && FieldGoesBefore(var, vars[j - 1]))
+		{
+			vars[j] = vars[j - 1];
+			j--;
+		}
+		vars[j] = var;
+		moved |= (j != i);
+	}
+
+	if(!moved)
+		return false;
+
+	for(size_t i = 0; i + 1 < var_n; i++)
+		vars[i]->next = vars[i + 1];
+	vars[var_n - 1]->next = 0;
+	def->first_var = vars[0];
+	return true;
+}
+
+static void
+func ReorderFieldsInDefinitionList(ParseInput *input, DefinitionList *def_list)
+{
+	if(input->has_profile)
+	{
+		for(DefinitionListElem *elem = def_list; elem; elem = elem->next)
+		{
+			Definition *definition = elem->definition;
+			if(definition->id == FuncDefinitionId && ((FuncDefinition *)definition)->is_hot)
+				MarkHotFieldsInInstruction((Instruction *)((FuncDefinition *)definition)->body);
+		}
+	}
+
+	for(DefinitionListElem *elem = def_list; elem; elem = elem->next)
+	{
+		if(elem->definition->id != StructDefinitionId)
+			continue;
+
+		StructDefinition *def = (StructDefinition *)elem->definition;
+		if(!def->packed)
+			def->reordered = ReorderStructFields(def);
+	}
+}
+
+static size_t
+func LayoutStructs(ParseInput *input, DefinitionList *def_list, bool report)
+{
+	// Returns the number of structs with an align attribute, WriteC defines M64_ALIGN for them.
+	size_t struct_n = 0;
+	size_t aligned_n = 0;
+	size_t reordered_n = 0;
+	U64 padding = 0;
+
+	if(report)
+		printf("Struct layout:\n");
+
+	for(DefinitionListElem *elem = def_list; elem; elem = elem->next)
+	{
+		if(elem->definition->id != StructDefinitionId)
+			continue;
+
+		StructDefinition *def = (StructDefinition *)elem->definition;
+		aligned_n += (def->align_attribute != 0);
+		reordered_n += def->reordered;
+		if(!LayoutStruct(def))
+			continue;
+
+		struct_n++;
+		padding += def->padding;
+		if(report && (def->padding > 0 || def->align_attribute || def->packed || def->reordered))
+		{
+			Atom *atom = &input->atoms.atoms[def->name.value];
+			printf("  %.*s: %llu bytes, align %llu, %llu padding bytes%s\n",
+			       (int)atom->length, atom->text, (unsigned long long)def->size, (unsigned long long)def->align,
+			       (unsigned long long)def->padding, def->reordered ? ", reordered" : "");
+		}
+	}
+
+	if(report)
+		printf("Laid out %zu structs with %llu padding bytes, %zu reordered.\n", struct_n, (unsigned long long)padding, reordered_n);
+
+	return aligned_n;
+}
@@ -0,0 +1,248 @@
+// Linkage and parameter passing of the C output, after the other passes.
+// Definitions that are not exported are written static, and the small ones static inline:
+// the C compiler can inline and drop them without link-time optimization.
+// C code in the same file, from #c_code or a program that includes the output, can still call them.
+// Definitions that the generated code never calls are also static inline, so they do not warn when unused.
+// main and the definitions marked export keep external linkage.
+//
+// A struct parameter larger than two registers is passed as a const pointer instead of copied,
+// when the definition never changes it and uses no pointers at all, so nothing can write the argument
+// during the call, and every call passes an argument that has an address.
+// Exported definitions keep their by-value signature in a wrapper that passes the pointers.
+// Programs with #c_code keep every signature, the C code calls with values.
+
+#define LinkageMaxInlineCost 40
+#define LinkageMaxRegisterSize 16
+
+typedef struct tdef LinkageInfo
+{
+	ParseInput *input;
+	bool has_c_code;
+
+	size_t static_n;
+	size_t static_inline_n;
+	size_t by_pointer_n;
+	size_t wrapper_n;
+} LinkageInfo;
+
+static bool
+func UsesPointersInExpression(Expression *e)
+{
+	if(e->type && TypeHasPointer(e->type))
+		return true;
+
+	Expression **child = 0;
+	for(size_t i = 0; (child = GetExpressionChild(e, i)) != 0; i++)
+	{
+		if(UsesPointersInExpression(*child))
+			return true;
+	}
+	return false;
+}
+
+static bool
+func UsesPointers(Instruction *instruction)
+{
+	Expression **e = 0;
+	for(size_t i = 0; (e = GetInstructionExpression(instruction, i)) != 0; i++)
+	{
+		if(UsesPointersInExpression(*e))
+			return true;
+	}
+
+	if(instruction->id == CreateVariableInstructionId && TypeHasPointer(((CreateVariableInstruction *)instruction)->type))
+		return true;
+
+	for(Instruction *i = GetInstructionChild(instruction, 0); i; i = GetInstructionChild(instruction, i))
+	{
+		if(UsesPointers(i))
+			return true;
+	}
+	return false;
+}
+
+static bool
+func IsLargeStruct(VarType *type)
+{
+	U64 size = 0;
+	return (type->id == StructTypeId && GetTypeSize(type, &size) && size > LinkageMaxRegisterSize);
+}
+
+static bool
+func CanPassByPointer(LinkageInfo *info, VarType *type, Token name, BlockInstruction *body, bool uses_pointers)
+{
+	return (!info->has_c_code && !uses_pointers && IsLargeStruct(type) && !IsVarWritten((Instruction *)body, name));
+}
+
+static bool
+func HasAddress(Expression *e)
+{
+	switch(e->id)
+	{
+		case VarExpressionId:
+		case DereferenceExpressionId:
+		{
+			return true;
+		}
+		case ParenExpressionId:
+		{
+			return HasAddress(((ParenExpression *)e)->in);
+		}
+		case StructVarExpressionId:
+		{
+			Expression *base = ((StructVarExpression *)e)->base;
+			return (base->type->id == PointerTypeId || HasAddress(base));
+		}
+		case ArrayIndexExpressionId:
+		{
+			Expression *array = ((ArrayIndexExpression *)e)->array;
+			return (array->type->id == PointerTypeId || HasAddress(array));
+		}
+		default:
+		{
+			return false;
+		}
+	}
+}
+
+static void
+func CheckCallArguments(Expression *e)
+{
+	// A call that passes a value without an address keeps the parameter by value.
+	if(e->id == FuncCallExpressionId)
+	{
+		FuncCallExpression *call = (FuncCallExpression *)e;
+		call->func_def->is_called = true;
+		FuncParam *param = call->func_def->header.first_param;
+		for(FuncCallArgument *arg = call->first_call_arg; arg && param; arg = arg->next, param = param->next)
+		{
+			if(param->by_pointer && !HasAddress(arg->arg))
+				param->by_pointer = false;
+		}
+	}
+	else if(e->id == OperatorCallExpressionId)
+	{
+		OperatorCallExpression *call = (OperatorCallExpression *)e;
+		call->def->is_called = true;
+		if(call->def->left_by_pointer && !HasAddress(call->left))
+			call->def->left_by_pointer = false;
+		if(call->def->right_by_pointer && !HasAddress(call->right))
+			call->def->right_by_pointer = false;
+	}
+
+	Expression **child = 0;
+	for(size_t i = 0; (child = GetExpressionChild(e, i)) != 0; i++)
+		CheckCallArguments(*child);
+}
+
+static void
+func CheckCallArgumentsInInstruction(Instruction *instruction)
+{
+	Expression **e = 0;
+	for(size_t i = 0; (e = GetInstructionExpression(instruction, i)) != 0; i++)
+		CheckCallArguments(*e);
+
+	for(Instruction *i = GetInstructionChild(instruction, 0); i; i = GetInstructionChild(instruction, i))
+		CheckCallArgumentsInInstruction(i);
+}
+
+static void
+func AssignFuncLinkage(LinkageInfo *info, FuncDefinition *def)
+{
+	Atom *atom = &info->input->atoms.atoms[def->header.name.value];
+	bool is_exported = (def->is_exported || TextEquals(atom->text, atom->length, "main"));
+	bool is_small = (GetBlockCost(def->body) <= LinkageMaxInlineCost);
+
+	def->is_static = !is_exported;
+	def->is_static_inline = (!is_exported && is_small && !def->is_cold);
+
+	bool uses_pointers = UsesPointers((Instruction *)def->body);
+	for(FuncParam *param = def->header.first_param; param; param = param->next)
+		uses_pointers |= TypeHasPointer(param->type);
+	for(FuncParam *param = def->header.first_param; param; param = param->next)
+		param->by_pointer = CanPassByPointer(info, param->type, param->name, def->body, uses_pointers);
+}
+
+static void
+func AssignOperatorLinkage(LinkageInfo *info, OperatorDefinition *def)
+{
+	bool is_small = (GetBlockCost(def->body) <= LinkageMaxInlineCost);
+	def->is_static = !def->is_exported;
+	def->is_static_inline = (!def->is_exported && is_small);
+
+	bool uses_pointers = UsesPointers((Instruction *)def->body);
+	uses_pointers |= TypeHasPointer(def->left_type) || TypeHasPointer(def->right_type);
+	def->left_by_pointer = CanPassByPointer(info, def->left_type, def->left_name, def->body, uses_pointers);
+	def->right_by_pointer = CanPassByPointer(info, def->right_type, def->right_name, def->body, uses_pointers);
+}
+
+static void
+func AssignLinkage(ParseInput *input, DefinitionList *def_list, bool report)
+{
+	LinkageInfo info = {};
+	info.input = input;
+	info.has_c_code = false;
+	for(DefinitionListElem *elem = def_list; elem; elem = elem->next)
+		info.has_c_code |= (elem->definition->id == CCodeDefinitionId);
+
+	for(DefinitionListElem *elem = def_list; elem; elem = elem->next)
+	{
+		Definition *definition = elem->definition;
+		if(definition->id == FuncDefinitionId && !((FuncDefinition *)definition)->is_extern)
+			AssignFuncLinkage(&info, (FuncDefinition *)definition);
+		else if(definition->id == OperatorDefinitionId)
+			AssignOperatorLinkage(&info, (OperatorDefinition *)definition);
+	}
+
+	for(DefinitionListElem *elem = def_list; elem; elem = elem->next)
+	{
+		Definition *definition = elem->definition;
+		if(definition->id == FuncDefinitionId && !((FuncDefinition *)definition)->is_extern)
+			CheckCallArgumentsInInstruction((Instruction *)((FuncDefinition *)definition)->body);
+		else if(definition->id == OperatorDefinitionId)
+			CheckCallArgumentsInInstruction((Instruction *)((OperatorDefinition *)definition)->body);
+	}
+
+	for(DefinitionListElem *elem = def_list; elem; elem = elem->next)
+	{
+		Definition *definition = elem->definition;
+		if(IsCompileTimeOnly(definition))
+			continue;
+
+		size_t by_pointer_n = 0;
+		if(definition->id == FuncDefinitionId && !((FuncDefinition *)definition)->is_extern)
+		{
+			FuncDefinition *def = (FuncDefinition *)definition;
+			for(FuncParam *param = def->header.first_param; param; param = param->next)
+				by_pointer_n += param->by_pointer;
+			def->is_static_inline |= (def->is_static && !def->is_called);
+
+			def->has_wrapper = (!def->is_static && by_pointer_n > 0);
+			if(def->has_wrapper)
+				def->wrapped_name = CreateUniqueName(input, &input->instance_name_n, def->header.name);
+			info.static_n += def->is_static;
+			info.static_inline_n += def->is_static_inline;
+			info.wrapper_n += def->has_wrapper;
+		}
+		else if(definition->id == OperatorDefinitionId)
+		{
+			OperatorDefinition *def = (OperatorDefinition *)definition;
+			by_pointer_n = def->left_by_pointer + def->right_by_pointer;
+			def->is_static_inline |= (def->is_static && !def->is_called);
+			def->has_wrapper = (!def->is_static && by_pointer_n > 0);
+			if(def->has_wrapper)
+				def->wrapped_name = CreateUniqueName(input, &input->instance_name_n, def->name);
+			info.static_n += def->is_static;
+			info.static_inline_n += def->is_static_inline;
+			info.wrapper_n += def->has_wrapper;
+		}
+		info.by_pointer_n += by_pointer_n;
+	}
+
+	if(report)
+	{
+		printf("Linkage:\n");
+		printf("%zu static definitions, %zu of them inline, %zu struct parameters passed by pointer, %zu wrappers.\n",
+		       info.static_n, info.static_inline_n, info.by_pointer_n, info.wrapper_n);
+	}
+}
@@ -0,0 +1,1117 @@
+// Loop optimizations on the M64 tree, after inlining.
+// Expressions that do not change inside a for loop are computed once before it,
+// and indexing with the loop variable is replaced by a pointer that moves with it.
+//
+// Aliasing follows the M64 types: a store through a pointer to T can only change
+// values of type T, or of a struct that contains T.
+// A pointer cast like @uint::p breaks this, so in functions that can see a cast pointer
+// every store through a pointer can change every load. Pointers from C can be cast too.
+// A loop body can run zero times, and C callers can pass a null pointer with it,
+// so loads through pointers are only moved out of the loop condition, which always runs.
+
+typedef struct tdef LoopStore
+{
+	VarType *type;
+	struct LoopStore *next;
+} LoopStore;
+
+typedef struct tdef LoopHoist
+{
+	Expression *e;
+	Var var;
+	struct LoopHoist *next;
+} LoopHoist;
+
+typedef struct tdef LoopPointer
+{
+	ArrayIndexExpression *index;
+	Var var;
+	struct LoopPointer *next;
+} LoopPointer;
+
+typedef struct tdef LoopDefinition
+{
+	CreateVariableInstruction *def;
+	bool reduced;
+	struct LoopDefinition *next;
+} LoopDefinition;
+
+#define LoopMaxIndexTermN 16
+
+typedef struct tdef LoopIndex
+{
+	// index = loop_var * stride + terms
+	Expression *stride;
+	Expression *terms[LoopMaxIndexTermN];
+	bool negative[LoopMaxIndexTermN];
+	size_t term_n;
+} LoopIndex;
+
+typedef struct tdef CallEffect
+{
+	Definition *def;
+	bool writes_memory;
+	struct CallEffect *next;
+} CallEffect;
+
+typedef struct tdef LoopOptimizer
+{
+	ParseInput *input;
+	size_t name_n;
+
+	// written_stamp[atom] == stamp for every variable written or created in the current loop.
+	size_t *written_stamp;
+	size_t written_stamp_n;
+	size_t stamp;
+
+	LoopStore *first_store;
+	bool calls_write_memory;
+	// Of the function being optimized.
+	bool sees_pointer_casts;
+
+	LoopHoist *first_hoist;
+	LoopPointer *first_pointer;
+	CallEffect *first_call_effect;
+
+	// Instructions that go before the loop being optimized.
+	Instruction *first_hoisted;
+	Instruction *last_hoisted;
+
+	size_t hoisted_n;
+	size_t reduced_n;
+} LoopOptimizer;
+
+static bool
+func TypeContains(VarType *outer, VarType *inner)
+{
+	if(TypesEqual(outer, inner))
+		return true;
+
+	if(outer->id == ArrayTypeId)
+		return TypeContains(((ArrayType *)outer)->element_type, inner);
+
+	if(outer->id == StructTypeId)
+	{
+		StructDefinition *def = ((StructType *)outer)->def;
+		for(StructVar *var = def->first_var; var; var = var->next)
+		{
+			if(TypeContains(var->type, inner))
+				return true;
+		}
+	}
+
+	return false;
+}
+
+static bool
+func TypeHasPointer(VarType *type)
+{
+	if(type->id == PointerTypeId)
+		return true;
+
+	if(type->id == ArrayTypeId)
+		return TypeHasPointer(((ArrayType *)type)->element_type);
+
+	if(type->id == StructTypeId)
+	{
+		StructDefinition *def = ((StructType *)type)->def;
+		for(StructVar *var = def->first_var; var; var = var->next)
+		{
+			if(TypeHasPointer(var->type))
+				return true;
+		}
+	}
+
+	return false;
+}
+
+static bool *
+func GetSeesPointerCasts(Definition *definition)
+{
+	if(definition->id == FuncDefinitionId && !((FuncDefinition *)definition)->is_extern)
+		return &((FuncDefinition *)definition)->sees_pointer_casts;
+	if(definition->id == OperatorDefinitionId)
+		return &((OperatorDefinition *)definition)->sees_pointer_casts;
+	return 0;
+}
+
+static void
+func MarkCallPointerCasts(bool *sees, Definition *callee, bool passes_pointers, bool *changed)
+{
+	// A call that passes or returns pointers shares them between the two functions.
+	bool *callee_sees = GetSeesPointerCasts(callee);
+	if(!passes_pointers || !callee_sees)
+		return;
+
+	if(*callee_sees)
+	{
+		*sees = true;
+	}
+	else if(*sees)
+	{
+		*callee_sees = true;
+		*changed = true;
+	}
+}
+
+static void
+func MarkPointerCastsInExpression(bool *sees, Expression *e, bool *changed)
+{
+	if(e->id == CastExpressionId && ((CastExpression *)e)->type->id == PointerTypeId)
+	{
+		*sees = true;
+	}
+	else if(e->id == FuncCallExpressionId)
+	{
+		FuncCallExpression *call = (FuncCallExpression *)e;
+		bool passes_pointers = (e->type && TypeHasPointer(e->type));
+		for(FuncCallArgument *arg = call->first_call_arg; arg; arg = arg->next)
+			passes_pointers |= TypeHasPointer(arg->arg->type);
+		MarkCallPointerCasts(sees, &call->func_def->def, passes_pointers, changed);
+	}
+	else if(e->id == OperatorCallExpressionId)
+	{
+		OperatorDefinition *def = ((OperatorCallExpression *)e)->def;
+		bool passes_pointers = (TypeHasPointer(def->left_type) || TypeHasPointer(def->right_type) || TypeHasPointer(def->return_type));
+		MarkCallPointerCasts(sees, &def->def, passes_pointers, changed);
+	}
+
+	Expression **child = 0;
+	for(size_t i = 0; (child = GetExpressionChild(e, i)) != 0; i++)
+		MarkPointerCastsInExpression(sees, *child, changed);
+}
+
+static void
+func MarkPointerCastsInInstruction(bool *sees, Instruction *instruction, bool *changed)
+{
+	Expression **e = 0;
+	for(size_t i = 0; (e = GetInstructionExpression(instruction, i)) != 0; i++)
+		MarkPointerCastsInExpression(sees, *e, changed);
+
+	for(Instruction *i = GetInstructionChild(instruction, 0); i; i = GetInstructionChild(instruction, i))
+		MarkPointerCastsInInstruction(sees, i, changed);
+}
+
+static bool
+func IsCallableFromC(ParseInput *input, Definition *definition)
+{
+	if(definition->id == OperatorDefinitionId)
+		return ((OperatorDefinition *)definition)->is_exported;
+
+	FuncDefinition *def = (FuncDefinition *)definition;
+	Atom *atom = &input->atoms.atoms[def->header.name.value];
+	return (def->is_exported || TextEquals(atom->text, atom->length, "main"));
+}
+
+static void
+func MarkPointerCasts(ParseInput *input, DefinitionList *def_list)
+{
+	// Sets sees_pointer_casts for every definition that casts a pointer,
+	// and for every definition that shares pointers with one through a call, in either direction.
+	// C code can cast pointers too, so this starts from every definition it can call:
+	// exported ones, main, and all of them in a program with #c_code.
+	bool has_c_code = false;
+	for(DefinitionListElem *elem = def_list; elem; elem = elem->next)
+		has_c_code |= (elem->definition->id == CCodeDefinitionId);
+
+	for(DefinitionListElem *elem = def_list; elem; elem = elem->next)
+	{
+		bool *def_sees = GetSeesPointerCasts(elem->definition);
+		if(def_sees && (has_c_code || IsCallableFromC(input, elem->definition)))
+			*def_sees = true;
+	}
+
+	bool changed = true;
+	while(changed)
+	{
+		changed = false;
+		for(DefinitionListElem *elem = def_list; elem; elem = elem->next)
+		{
+			bool *def_sees = GetSeesPointerCasts(elem->definition);
+			if(!def_sees)
+				continue;
+
+			BlockInstruction *body = (elem->definition->id == FuncDefinitionId) ?
+			                         ((FuncDefinition *)elem->definition)->body : ((OperatorDefinition *)elem->definition)->body;
+			bool sees = *def_sees;
+			MarkPointerCastsInInstruction(&sees, (Instruction *)body, &changed);
+			if(sees && !*def_sees)
+			{
+				*def_sees = true;
+				changed = true;
+			}
+		}
+	}
+}
+
+static bool decl InstructionWritesMemory(LoopOptimizer *, Instruction *);
+
+static bool
+func CallWritesMemory(LoopOptimizer *opt, Expression *call)
+{
+	// Without pointers in its parameters, an M64 function can only change its own variables.
+	// Extern functions can do anything.
+	Definition *def = 0;
+	BlockInstruction *body = 0;
+	bool has_pointer = false;
+	if(call->id == FuncCallExpressionId)
+	{
+		FuncDefinition *func_def = ((FuncCallExpression *)call)->func_def;
+		if(func_def->is_extern)
+			return true;
+
+		def = &func_def->def;
+		body = func_def->body;
+		for(FuncParam *param = func_def->header.first_param; param; param = param->next)
+			has_pointer |= TypeHasPointer(param->type);
+	}
+	else
+	{
+		OperatorDefinition *op_def = ((OperatorCallExpression *)call)->def;
+		def = &op_def->def;
+		body = op_def->body;
+		has_pointer = (TypeHasPointer(op_def->left_type) || TypeHasPointer(op_def->right_type));
+	}
+
+	if(has_pointer)
+		return true;
+
+	for(CallEffect *effect = opt->first_call_effect; effect; effect = effect->next)
+	{
+		if(effect->def == def)
+			return effect->writes_memory;
+	}
+
+	// Callees are defined before their callers, so this cannot recurse forever.
+	CallEffect *effect = ArenaPushType(&opt->input->arena, CallEffect);
+	effect->def = def;
+	effect->writes_memory = InstructionWritesMemory(opt, (Instruction *)body);
+	effect->next = opt->first_call_effect;
+	opt->first_call_effect = effect;
+	return effect->writes_memory;
+}
+
+static bool
+func ExpressionWritesMemory(LoopOptimizer *opt, Expression *e)
+{
+	if((e->id == FuncCallExpressionId || e->id == OperatorCallExpressionId) && CallWritesMemory(opt, e))
+		return true;
+
+	Expression **child = 0;
+	for(size_t i = 0; (child = GetExpressionChild(e, i)) != 0; i++)
+	{
+		if(ExpressionWritesMemory(opt, *child))
+			return true;
+	}
+	return false;
+}
+
+static bool
+func InstructionWritesMemory(LoopOptimizer *opt, Instruction *instruction)
+{
+	Expression **e = 0;
+	for(size_t i = 0; (e = GetInstructionExpression(instruction, i)) != 0; i++)
+	{
+		if(ExpressionWritesMemory(opt, *e))
+			return true;
+	}
+
+	switch(instruction->id)
+	{
+		case AndEqualsInstructionId:
+			return !GetWrittenVar(((AndEqualsInstruction *)instruction)->left);
+		case AssignInstructionId:
+			return !GetWrittenVar(((AssignInstruction *)instruction)->left);
+		case IncrementInstructionId:
+			return !GetWrittenVar(((IncrementInstruction *)instruction)->value);
+		default:
+		{
+			for(Instruction *i = GetInstructionChild(instruction, 0); i; i = GetInstructionChild(instruction, i))
+			{
+				if(InstructionWritesMemory(opt, i))
+					return true;
+			}
+			return false;
+		}
+	}
+}
+
+static void
+func MarkWrittenVar(LoopOptimizer *opt, Token name)
+{
+	if(name.value >= opt->written_stamp_n)
+	{
+		size_t stamp_n = opt->input->atoms.atom_n + 256;
+		opt->written_stamp = (size_t *)realloc(opt->written_stamp, stamp_n * sizeof(size_t));
+		memset(opt->written_stamp + opt->written_stamp_n, 0, (stamp_n - opt->written_stamp_n) * sizeof(size_t));
+		opt->written_stamp_n = stamp_n;
+	}
+	opt->written_stamp[name.value] = opt->stamp;
+}
+
+static bool
+func IsVarWrittenInLoop(LoopOptimizer *opt, Token name)
+{
+	return (name.value < opt->written_stamp_n && opt->written_stamp[name.value] == opt->stamp);
+}
+
+static void
+func MarkStore(LoopOptimizer *opt, Expression *target)
+{
+	Var *var = GetWrittenVar(target);
+	if(var)
+	{
+		MarkWrittenVar(opt, var->name);
+	}
+	else
+	{
+		LoopStore *store = ArenaPushType(&opt->input->arena, LoopStore);
+		store->type = target->type;
+		store->next = opt->first_store;
+		opt->first_store = store;
+	}
+}
+
+static void
+func MarkLoopWrites(LoopOptimizer *opt, Instruction *instruction)
+{
+	Expression **e = 0;
+	for(size_t i = 0; (e = GetInstructionExpression(instruction, i)) != 0; i++)
+	{
+		if(ExpressionWritesMemory(opt, *e))
+			opt->calls_write_memory = true;
+	}
+
+	switch(instruction->id)
+	{
+		case AndEqualsInstructionId:
+			MarkStore(opt, ((AndEqualsInstruction *)instruction)->left);
+			break;
+		case AssignInstructionId:
+			MarkStore(opt, ((AssignInstruction *)instruction)->left);
+			break;
+		case IncrementInstructionId:
+			MarkStore(opt, ((IncrementInstruction *)instruction)->value);
+			break;
+		case CreateVariableInstructionId:
+			MarkWrittenVar(opt, ((CreateVariableInstruction *)instruction)->name);
+			break;
+		default:
+			break;
+	}
+
+	for(Instruction *i = GetInstructionChild(instruction, 0); i; i = GetInstructionChild(instruction, i))
+		MarkLoopWrites(opt, i);
+}
+
+static bool
+func IsLoadChanged(LoopOptimizer *opt, VarType *type)
+{
+	if(opt->calls_write_memory)
+		return true;
+	if(opt->sees_pointer_casts && opt->first_store)
+		return true;
+
+	for(LoopStore *store = opt->first_store; store; store = store->next)
+	{
+		if(TypeContains(store->type, type) || TypeContains(type, store->type))
+			return true;
+	}
+	return false;
+}
+
+static bool
+func IsLoopInvariant(LoopOptimizer *opt, Expression *e, bool in_condition)
+{
+	switch(e->id)
+	{
+		case BoolConstantExpressionId:
+		case FloatConstantExpressionId:
+		case IntegerConstantExpressionId:
+			return true;
+		case FuncCallExpressionId:
+		case OperatorCallExpressionId:
+			return false;
+		case VarExpressionId:
+			return !IsVarWrittenInLoop(opt, ((VarExpression *)e)->var.name);
+		case StructVarExpressionId:
+		{
+			StructVarExpression *s = (StructVarExpression *)e;
+			if(s->base->type->id == PointerTypeId && (!in_condition || IsLoadChanged(opt, e->type)))
+				return false;
+			return IsLoopInvariant(opt, s->base, in_condition);
+		}
+		case DereferenceExpressionId:
+		{
+			DereferenceExpression *d = (DereferenceExpression *)e;
+			if(!in_condition || IsLoadChanged(opt, e->type))
+				return false;
+			return IsLoopInvariant(opt, d->pointer, in_condition);
+		}
+		case ArrayIndexExpressionId:
+		{
+			ArrayIndexExpression *a = (ArrayIndexExpression *)e;
+			if(a->array->type->id == PointerTypeId && (!in_condition || IsLoadChanged(opt, e->type)))
+				return false;
+			return (IsLoopInvariant(opt, a->array, in_condition) && IsLoopInvariant(opt, a->index, in_condition));
+		}
+		default:
+		{
+			Expression **child = 0;
+			for(size_t i = 0; (child = GetExpressionChild(e, i)) != 0; i++)
+			{
+				if(!IsLoopInvariant(opt, *child, in_condition))
+					return false;
+			}
+			return true;
+		}
+	}
+}
+
+static bool
+func HasLoadOrOperation(Expression *e)
+{
+	switch(e->id)
+	{
+		case BoolConstantExpressionId:
+		case FloatConstantExpressionId:
+		case IntegerConstantExpressionId:
+		case VarExpressionId:
+			return false;
+		case StructVarExpressionId:
+		{
+			StructVarExpression *s = (StructVarExpression *)e;
+			return (s->base->type->id == PointerTypeId || HasLoadOrOperation(s->base));
+		}
+		case ArrayIndexExpressionId:
+		{
+			ArrayIndexExpression *a = (ArrayIndexExpression *)e;
+			return (a->array->type->id == PointerTypeId || HasLoadOrOperation(a->array) || HasLoadOrOperation(a->index));
+		}
+		case ParenExpressionId:
+			return HasLoadOrOperation(((ParenExpression *)e)->in);
+		default:
+			return true;
+	}
+}
+
+static bool
+func HasVar(Expression *e)
+{
+	if(e->id == VarExpressionId)
+		return true;
+
+	Expression **child = 0;
+	for(size_t i = 0; (child = GetExpressionChild(e, i)) != 0; i++)
+	{
+		if(HasVar(*child))
+			return true;
+	}
+	return false;
+}
+
+static bool
+func IsWorthHoisting(Expression *e)
+{
+	// Struct and array values would be copied, constant expressions are folded by the C compiler anyway.
+	if(!e->type || (e->type->id != BaseTypeId && e->type->id != PointerTypeId))
+		return false;
+	return (HasLoadOrOperation(e) && HasVar(e));
+}
+
+static bool
+func ExpressionsEqual(Expression *a, Expression *b)
+{
+	if(a->id != b->id || !TypesEqual(a->type, b->type))
+		return false;
+
+	switch(a->id)
+	{
+		case BoolConstantExpressionId:
+			return (((BoolConstantExpression *)a)->token.id == ((BoolConstantExpression *)b)->token.id);
+		case FloatConstantExpressionId:
+			return (((FloatConstantExpression *)a)->value == ((FloatConstantExpression *)b)->value);
+		case IntegerConstantExpressionId:
+			return (((IntegerConstantExpression *)a)->value == ((IntegerConstantExpression *)b)->value);
+		case VarExpressionId:
+			return TokensEqual(((VarExpression *)a)->var.name, ((VarExpression *)b)->var.name);
+		case StructVarExpressionId:
+			if(!TokensEqual(((StructVarExpression *)a)->var_name, ((StructVarExpression *)b)->var_name))
+				return false;
+			break;
+		case CastExpressionId:
+			if(!TypesEqual(((CastExpression *)a)->type, ((CastExpression *)b)->type))
+				return false;
+			break;
+		case FuncCallExpressionId:
+		case OperatorCallExpressionId:
+			return false;
+		default:
+			break;
+	}
+
+	Expression **child_a = 0;
+	for(size_t i = 0; (child_a = GetExpressionChild(a, i)) != 0; i++)
+	{
+		Expression **child_b = GetExpressionChild(b, i);
+		if(!child_b || !ExpressionsEqual(*child_a, *child_b))
+			return false;
+	}
+	return true;
+}
+
+static Token
+func GetLoopTempName(LoopOptimizer *opt, Expression *e)
+{
+	while(e->id == ParenExpressionId)
+		e = ((ParenExpression *)e)->in;
+
+	Token name = {};
+	if(e->id == StructVarExpressionId)
+	{
+		name = ((StructVarExpression *)e)->var_name;
+	}
+	else if(e->id == VarExpressionId)
+	{
+		name = ((VarExpression *)e)->var.name;
+	}
+	else
+	{
+		name.id = NameTokenId;
+		name.value = InternAtom(&opt->input->atoms, "t", 1);
+	}
+	return CreateUniqueName(opt->input, &opt->name_n, name);
+}
+
+static void
+func HoistLoopInstruction(LoopOptimizer *opt, Instruction *instruction)
+{
+	instruction->next = 0;
+	if(opt->last_hoisted)
+		opt->last_hoisted->next = instruction;
+	else
+		opt->first_hoisted = instruction;
+	opt->last_hoisted = instruction;
+}
+
+static Var
+func CreateLoopTemp(LoopOptimizer *opt, Expression *e, Token name)
+{
+	CreateVariableInstruction *i = ArenaPushType(&opt->input->arena, CreateVariableInstruction);
+	*i = (CreateVariableInstruction){};
+	i->i.id = CreateVariableInstructionId;
+	i->name = name;
+	i->type = e->type;
+	i->init = e;
+	HoistLoopInstruction(opt, (Instruction *)i);
+
+	Var var = {};
+	var.name = name;
+	var.type = e->type;
+	return var;
+}
+
+static void
+func HoistInvariants(LoopOptimizer *opt, Expression **slot, bool is_target, bool in_condition)
+{
+	// The target of an assignment stays in place, but the values it is computed from can move.
+	Expression *e = *slot;
+	if(!is_target && IsWorthHoisting(e) && IsLoopInvariant(opt, e, in_condition))
+	{
+		LoopHoist *hoist = opt->first_hoist;
+		while(hoist && !ExpressionsEqual(hoist->e, e))
+			hoist = hoist->next;
+
+		if(!hoist)
+		{
+			hoist = ArenaPushType(&opt->input->arena, LoopHoist);
+			hoist->e = e;
+			hoist->var = CreateLoopTemp(opt, e, GetLoopTempName(opt, e));
+			hoist->next = opt->first_hoist;
+			opt->first_hoist = hoist;
+			opt->hoisted_n++;
+		}
+
+		*slot = (Expression *)PushVarExpression(&opt->input->arena, hoist->var);
+		return;
+	}
+
+	Expression **child = 0;
+	for(size_t i = 0; (child = GetExpressionChild(e, i)) != 0; i++)
+		HoistInvariants(opt, child, false, in_condition);
+}
+
+static void
+func HoistFromInstruction(LoopOptimizer *opt, Instruction *instruction)
+{
+	switch(instruction->id)
+	{
+		case AndEqualsInstructionId:
+		{
+			AndEqualsInstruction *i = (AndEqualsInstruction *)instruction;
+			HoistInvariants(opt, &i->left, true, false);
+			HoistInvariants(opt, &i->right, false, false);
+			break;
+		}
+		case AssignInstructionId:
+		{
+			AssignInstruction *i = (AssignInstruction *)instruction;
+			HoistInvariants(opt, &i->left, true, false);
+			HoistInvariants(opt, &i->right, false, false);
+			break;
+		}
+		case IncrementInstructionId:
+		{
+			HoistInvariants(opt, &((IncrementInstruction *)instruction)->value, true, false);
+			break;
+		}
+		case BlockInstructionId:
+		{
+			for(Instruction *i = ((BlockInstruction *)instruction)->first; i; i = i->next)
+				HoistFromInstruction(opt, i);
+			break;
+		}
+		case IfInstructionId:
+		{
+			IfInstruction *i = (IfInstruction *)instruction;
+			HoistInvariants(opt, &i->condition, false, false);
+			HoistFromInstruction(opt, (Instruction *)i->body);
+			break;
+		}
+		case ForInstructionId:
+		{
+			ForInstruction *i = (ForInstruction *)instruction;
+			HoistFromInstruction(opt, i->init);
+			HoistInvariants(opt, &i->condition, false, false);
+			if(i->update)
+				HoistFromInstruction(opt, i->update);
+			HoistFromInstruction(opt, (Instruction *)i->body);
+			break;
+		}
+		default:
+		{
+			Expression **e = 0;
+			for(size_t index = 0; (e = GetInstructionExpression(instruction, index)) != 0; index++)
+				HoistInvariants(opt, e, false, false);
+			break;
+		}
+	}
+}
+
+static bool
+func IsIndexLeaf(LoopOptimizer *opt, Expression *e)
+{
+	if(e->id == IntegerConstantExpressionId)
+		return true;
+	return (e->id == VarExpressionId && !IsVarWrittenInLoop(opt, ((VarExpression *)e)->var.name));
+}
+
+static bool
+func DecomposeIndex(LoopOptimizer *opt, Expression *e, Token loop_var, bool negative, LoopIndex *index)
+{
+	switch(e->id)
+	{
+		case ParenExpressionId:
+			return DecomposeIndex(opt, ((ParenExpression *)e)->in, loop_var, negative, index);
+		case AddExpressionId:
+		{
+			AddExpression *add = (AddExpression *)e;
+			return (DecomposeIndex(opt, add->left, loop_var, negative, index) &&
+			        DecomposeIndex(opt, add->right, loop_var, negative, index));
+		}
+		case SubtractExpressionId:
+		{
+			SubtractExpression *sub = (SubtractExpression *)e;
+			return (DecomposeIndex(opt, sub->left, loop_var, negative, index) &&
+			        DecomposeIndex(opt, sub->right, loop_var, !negative, index));
+		}
+		case MultiplyExpressionId:
+		{
+			MultiplyExpression *mul = (MultiplyExpression *)e;
+			Expression *stride = 0;
+			if(IsVarNamed(mul->left, loop_var))
+				stride = mul->right;
+			else if(IsVarNamed(mul->right, loop_var))
+				stride = mul->left;
+
+			if(!stride || negative || index->stride || !IsIndexLeaf(opt, stride))
+				return false;
+			index->stride = stride;
+			return true;
+		}
+		default:
+		{
+			if(IsVarNamed(e, loop_var))
+			{
+				if(negative || index->stride)
+					return false;
+				index->stride = (Expression *)PushIntegerConstantExpression(&opt->input->arena, ((VarExpression *)e)->var.name, 1, e->type);
+				return true;
+			}
+
+			if(!IsIndexLeaf(opt, e) || index->term_n == LoopMaxIndexTermN)
+				return false;
+			index->terms[index->term_n] = e;
+			index->negative[index->term_n] = negative;
+			index->term_n++;
+			return true;
+		}
+	}
+}
+
+static Expression *
+func CopyIndexLeaf(LoopOptimizer *opt, Expression *e)
+{
+	if(e->id == VarExpressionId)
+		return (Expression *)PushVarExpression(&opt->input->arena, ((VarExpression *)e)->var);
+
+	IntegerConstantExpression *copy = ArenaPushType(&opt->input->arena, IntegerConstantExpression);
+	*copy = *(IntegerConstantExpression *)e;
+	return (Expression *)copy;
+}
+
+static bool
+func IsOne(Expression *e)
+{
+	return (e->id == IntegerConstantExpressionId && ((IntegerConstantExpression *)e)->value == 1);
+}
+
+static LoopDefinition *
+func GetIndexDefinition(LoopDefinition *first_def, Expression *index)
+{
+	if(index->id != VarExpressionId)
+		return 0;
+
+	for(LoopDefinition *def = first_def; def; def = def->next)
+	{
+		if(TokensEqual(def->def->name, ((VarExpression *)index)->var.name))
+			return def;
+	}
+	return 0;
+}
+
+typedef struct tdef LoopReduction
+{
+	ForInstruction *loop;
+	Token loop_var;
+	CreateVariableInstruction *init;
+	Expression *start;
+	LoopDefinition *first_def;
+	BlockInstruction *body;
+} LoopReduction;
+
+static void
+func ReduceIndex(LoopOptimizer *opt, LoopReduction *reduction, Expression **slot)
+{
+	ArrayIndexExpression *e = (ArrayIndexExpression *)*slot;
+	if(e->array->type->id != PointerTypeId || !IsIndexLeaf(opt, e->array) || e->array->id != VarExpressionId)
+		return;
+
+	for(LoopPointer *pointer = opt->first_pointer; pointer; pointer = pointer->next)
+	{
+		if(ExpressionsEqual((Expression *)pointer->index, (Expression *)e))
+		{
+			*slot = (Expression *)PushDereferenceExpression(&opt->input->arena, (Expression *)PushVarExpression(&opt->input->arena, pointer->var));
+			opt->reduced_n++;
+			return;
+		}
+	}
+
+	// A variable set once at the top of the body stands for its value.
+	Expression *index_value = e->index;
+	LoopDefinition *index_def = GetIndexDefinition(reduction->first_def, e->index);
+	if(index_def)
+	{
+		CreateVariableInstruction *def = index_def->def;
+		if(!def->init || IsVarWritten((Instruction *)reduction->body, def->name))
+			return;
+		index_value = def->init;
+	}
+
+	LoopIndex index = {};
+	if(!DecomposeIndex(opt, index_value, reduction->loop_var, false, &index) || !index.stride)
+		return;
+
+	MemoryArena *arena = &opt->input->arena;
+	if(!reduction->start)
+	{
+		// The start value is needed before the loop, so it gets a name unless it already has one.
+		CreateVariableInstruction *init = reduction->init;
+		if(IsIndexLeaf(opt, init->init))
+		{
+			reduction->start = init->init;
+		}
+		else
+		{
+			Var start = CreateLoopTemp(opt, init->init, CreateUniqueName(opt->input, &opt->name_n, init->name));
+			reduction->start = (Expression *)PushVarExpression(arena, start);
+			init->init = (Expression *)PushVarExpression(arena, start);
+		}
+	}
+
+	Expression *offset = CopyIndexLeaf(opt, reduction->start);
+	if(!IsOne(index.stride))
+		offset = (Expression *)PushMultiplyExpression(arena, offset, CopyIndexLeaf(opt, index.stride));
+	for(size_t i = 0; i < index.term_n; i++)
+	{
+		Expression *term = CopyIndexLeaf(opt, index.terms[i]);
+		if(index.negative[i])
+			offset = (Expression *)PushSubtractExpression(arena, offset, term);
+		else
+			offset = (Expression *)PushAddExpression(arena, offset, term);
+	}
+
+	Expression *array = CopyIndexLeaf(opt, e->array);
+	Expression *init = array;
+	if(offset->id != IntegerConstantExpressionId || ((IntegerConstantExpression *)offset)->value != 0)
+		init = (Expression *)PushAddExpression(arena, array, (Expression *)PushParenExpression(arena, offset));
+
+	LoopPointer *pointer = ArenaPushType(arena, LoopPointer);
+	pointer->index = e;
+	pointer->var = CreateLoopTemp(opt, init, CreateUniqueName(opt->input, &opt->name_n, ((VarExpression *)e->array)->var.name));
+	pointer->next = opt->first_pointer;
+	opt->first_pointer = pointer;
+
+	// The pointer moves at the end of every iteration, together with the loop variable.
+	Instruction *step = 0;
+	Expression *pointer_var = (Expression *)PushVarExpression(arena, pointer->var);
+	if(IsOne(index.stride))
+	{
+		IncrementInstruction *i = ArenaPushType(arena, IncrementInstruction);
+		*i = (IncrementInstruction){};
+		i->i.id = IncrementInstructionId;
+		i->value = pointer_var;
+		step = (Instruction *)i;
+	}
+	else
+	{
+		AssignInstruction *i = ArenaPushType(arena, AssignInstruction);
+		*i = (AssignInstruction){};
+		i->i.id = AssignInstructionId;
+		i->left = pointer_var;
+		i->right = (Expression *)PushAddExpression(arena, (Expression *)PushVarExpression(arena, pointer->var), CopyIndexLeaf(opt, index.stride));
+		step = (Instruction *)i;
+	}
+	step->offset = reduction->loop->i.offset;
+	GetLastInstruction(reduction->body)->next = step;
+
+	*slot = (Expression *)PushDereferenceExpression(arena, (Expression *)PushVarExpression(arena, pointer->var));
+	opt->reduced_n++;
+	if(index_def)
+		index_def->reduced = true;
+}
+
+static void
+func ReduceInExpression(LoopOptimizer *opt, LoopReduction *reduction, Expression **slot)
+{
+	Expression **child = 0;
+	for(size_t i = 0; (child = GetExpressionChild(*slot, i)) != 0; i++)
+		ReduceInExpression(opt, reduction, child);
+
+	if((*slot)->id == ArrayIndexExpressionId)
+		ReduceIndex(opt, reduction, slot);
+}
+
+static void
+func ReduceInInstruction(LoopOptimizer *opt, LoopReduction *reduction, Instruction *instruction)
+{
+	Expression **e = 0;
+	for(size_t i = 0; (e = GetInstructionExpression(instruction, i)) != 0; i++)
+		ReduceInExpression(opt, reduction, e);
+
+	for(Instruction *i = GetInstructionChild(instruction, 0); i; i = GetInstructionChild(instruction, i))
+		ReduceInInstruction(opt, reduction, i);
+}
+
+static size_t
+func CountVarUsesInInstruction(Instruction *instruction, Token name)
+{
+	size_t use_n = 0;
+	Expression **e = 0;
+	for(size_t i = 0; (e = GetInstructionExpression(instruction, i)) != 0; i++)
+		use_n += CountVarUses(*e, name);
+
+	switch(instruction->id)
+	{
+		case AndEqualsInstructionId:
+			use_n += CountVarUses(((AndEqualsInstruction *)instruction)->left, name);
+			break;
+		case AssignInstructionId:
+			use_n += CountVarUses(((AssignInstruction *)instruction)->left, name);
+			break;
+		default:
+			break;
+	}
+
+	for(Instruction *i = GetInstructionChild(instruction, 0); i; i = GetInstructionChild(instruction, i))
+		use_n += CountVarUsesInInstruction(i, name);
+	return use_n;
+}
+
+static void
+func ReduceLoopIndices(LoopOptimizer *opt, ForInstruction *loop)
+{
+	// Only loops over an int variable that is changed by the update alone.
+	if(loop->init->id != CreateVariableInstructionId || !loop->update || loop->update->id != IncrementInstructionId)
+		return;
+
+	CreateVariableInstruction *init = (CreateVariableInstruction *)loop->init;
+	IncrementInstruction *update = (IncrementInstruction *)loop->update;
+	if(!init->init || !IsIntegerType(init->type) || !IsVarNamed(update->value, init->name))
+		return;
+	if(IsVarWritten((Instruction *)loop->body, init->name) || !loop->body->first)
+		return;
+
+	LoopReduction reduction = {};
+	reduction.loop = loop;
+	reduction.loop_var = init->name;
+	reduction.body = loop->body;
+
+	reduction.init = init;
+	if(!IsIndexLeaf(opt, init->init) && HasCall(init->init))
+		return;
+
+	size_t reduced_n = opt->reduced_n;
+	opt->first_pointer = 0;
+	for(Instruction *i = loop->body->first; i; i = i->next)
+	{
+		ReduceInInstruction(opt, &reduction, i);
+		if(i->id == CreateVariableInstructionId)
+		{
+			LoopDefinition *def = ArenaPushType(&opt->input->arena, LoopDefinition);
+			def->def = (CreateVariableInstruction *)i;
+			def->reduced = false;
+			def->next = reduction.first_def;
+			reduction.first_def = def;
+		}
+	}
+
+	if(opt->reduced_n == reduced_n)
+		return;
+
+	// Index variables that were only used for the reduced indexing are no longer needed.
+	for(LoopDefinition *def = reduction.first_def; def; def = def->next)
+	{
+		if(!def->reduced || HasCall(def->def->init) || CountVarUsesInInstruction((Instruction *)loop, def->def->name) > 0)
+			continue;
+
+		Instruction **link = &loop->body->first;
+		while(*link != (Instruction *)def->def)
+			link = &(*link)->next;
+		*link = def->def->i.next;
+	}
+}
+
+static void decl OptimizeLoopsInBlock(LoopOptimizer *, BlockInstruction *);
+
+static void
+func OptimizeLoop(LoopOptimizer *opt, ForInstruction *loop)
+{
+	opt->stamp++;
+	opt->first_store = 0;
+	opt->calls_write_memory = false;
+	opt->first_hoist = 0;
+	MarkLoopWrites(opt, (Instruction *)loop);
+
+	HoistInvariants(opt, &loop->condition, false, true);
+	if(loop->update)
+		HoistFromInstruction(opt, loop->update);
+	HoistFromInstruction(opt, (Instruction *)loop->body);
+
+	ReduceLoopIndices(opt, loop);
+}
+
+static void
+func OptimizeLoopsInInstruction(LoopOptimizer *opt, Instruction *instruction)
+{
+	switch(instruction->id)
+	{
+		case BlockInstructionId:
+			OptimizeLoopsInBlock(opt, (BlockInstruction *)instruction);
+			break;
+		case IfInstructionId:
+			OptimizeLoopsInBlock(opt, ((IfInstruction *)instruction)->body);
+			break;
+		case ForInstructionId:
+			// Outer loops first, so that values are moved as far out as they can go.
+			OptimizeLoop(opt, (ForInstruction *)instruction);
+			break;
+		default:
+			break;
+	}
+}
+
+static void
+func OptimizeLoopsInBlock(LoopOptimizer *opt, BlockInstruction *block)
+{
+	Instruction **link = &block->first;
+	while(*link)
+	{
+		Instruction *instruction = *link;
+
+		opt->first_hoisted = 0;
+		opt->last_hoisted = 0;
+		OptimizeLoopsInInstruction(opt, instruction);
+
+		if(opt->first_hoisted)
+		{
+			*link = opt->first_hoisted;
+			opt->last_hoisted->next = instruction;
+			SetMissingOffsets(opt->first_hoisted, instruction, instruction->offset);
+		}
+
+		if(instruction->id == ForInstructionId)
+			OptimizeLoopsInBlock(opt, ((ForInstruction *)instruction)->body);
+
+		link = &instruction->next;
+	}
+}
+
+static void
+func OptimizeLoops(ParseInput *input, DefinitionList *def_list, bool report)
+{
+	LoopOptimizer *opt = ArenaPushType(&input->arena, LoopOptimizer);
+	*opt = (LoopOptimizer){};
+	opt->input = input;
+
+	if(report)
+		printf("Loops:\n");
+
+	MarkPointerCasts(input, def_list);
+	for(DefinitionListElem *elem = def_list; elem; elem = elem->next)
+	{
+		Definition *definition = elem->definition;
+		BlockInstruction *body = 0;
+		Token name = {};
+		if(definition->id == FuncDefinitionId && !((FuncDefinition *)definition)->is_extern)
+		{
+			body = ((FuncDefinition *)definition)->body;
+			name = ((FuncDefinition *)definition)->header.name;
+		}
+		else if(definition->id == OperatorDefinitionId)
+		{
+			body = ((OperatorDefinition *)definition)->body;
+			name = ((OperatorDefinition *)definition)->name;
+		}
+
+		if(!body)
+			continue;
+
+		opt->sees_pointer_casts = *GetSeesPointerCasts(definition);
+		size_t hoisted_n = opt->hoisted_n;
+		size_t reduced_n = opt->reduced_n;
+		OptimizeLoopsInBlock(opt, body);
+
+		if(report && (opt->hoisted_n != hoisted_n || opt->reduced_n != reduced_n))
+		{
+			Atom *atom = &input->atoms.atoms[name.value];
+			printf("  %.*s: %zu invariant expressions hoisted, %zu indices turned into pointers\n",
+			       (int)atom->length, atom->text, opt->hoisted_n - hoisted_n, opt->reduced_n - reduced_n);
+		}
+	}
+
+	if(report)
+		printf("Hoisted %zu expressions, reduced %zu indices.\n", opt->hoisted_n, opt->reduced_n);
+
+	free(opt->written_stamp);
+}
@@ -1,5 +1,24 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <float.h>
+
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#define M64_SSE2
+#endif
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <pthread.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <dlfcn.h>
+#include <time.h>
+#endif
 
 #define func
 #define decl
@@ -9,6 +28,13 @@
 #define true 1
 #define false 0
 
+typedef long long I64;
+typedef unsigned long long U64;
+typedef int I32;
+typedef unsigned int U32;
+typedef unsigned short U16;
+typedef unsigned char U8;
+
 typedef struct tdef MemoryArena
 {
 	char *memory;
@@ -44,9 +70,8 @@ func ArenaPush(MemoryArena *arena, size_t size)
 
 typedef struct tdef CodePosition
 {
+	char *code;
 	char *at;
-	size_t row;
-	size_t col;
 } CodePosition;
 
 typedef enum tdef TokenId
@@ -62,16 +87,20 @@ typedef enum tdef TokenId
 	ColonColonTokenId,
 	ColonEqualsTokenId,
 	ColonTokenId,
+	CCodeTokenId,
 	DotTokenId,
 	EndOfFileTokenId,
 	EqualsTokenId,
+	ExportTokenId,
 	ExternTokenId,
 	FalseTokenId,
 	FloatConstantTokenId,
 	ForTokenId,
 	FuncTokenId,
 	GreaterThanTokenId,
+	HashTokenId,
 	IfTokenId,
+	InlineTokenId,
 	IntegerConstantTokenId,
 	LessThanTokenId,
 	LessThanEqualTokenId,
@@ -94,13 +123,52 @@ typedef enum tdef TokenId
 
 typedef struct tdef Token
 {
-	TokenId id;
-	char *text;
-	size_t length;
-	size_t row;
-	size_t col;
+	// Byte offset of the token in the source code.
+	U32 offset;
+	// NameTokenId and CCodeTokenId: index of the atom holding the text.
+	// IntegerConstantTokenId and FloatConstantTokenId: index of the decoded literal.
+	// Any other token: length in bytes.
+	U32 value;
+	U16 id;
 } Token;
 
+typedef struct tdef Atom
+{
+	char *text;
+	U32 length;
+	// Next atom in the same hash bucket.
+	U32 next;
+} Atom;
+
+#define NoAtom 0xFFFFFFFF
+
+// Every distinct name is stored once, so names compare by their atom index.
+typedef struct tdef AtomTable
+{
+	Atom *atoms;
+	U32 atom_n;
+	U32 max_atom_n;
+	U32 *buckets;
+	U32 bucket_n;
+} AtomTable;
+
+// Names the parser looks for, interned first so that their indices are known.
+typedef enum tdef BuiltinAtomId
+{
+	BoolAtomId,
+	FloatAtomId,
+	IntAtomId,
+	UIntAtomId,
+	BuiltinAtomN
+} BuiltinAtomId;
+
+typedef struct tdef Literal
+{
+	I64 int_value;
+	double float_value;
+	U32 length;
+} Literal;
+
 typedef enum tdef VarTypeId
 {
 	NoTypeId,
@@ -198,17 +266,20 @@ func IsIntegerType(VarType *type)
 }
 
 #define VarStackMaxSize 64
+// Deeper expressions, types or blocks are rejected instead of running out of stack.
+#define MaxNestingDepth 256
 typedef struct tdef VarStack
 {
 	Var *vars;
 	size_t size;
 } VarStack;
 
-typedef struct tdef CodeLine
+typedef struct tdef LineIndex
 {
-	char *string;
-	size_t length;
-} CodeLine;
+	// line_starts[i] is the offset of the first character of line i + 1.
+	size_t *line_starts;
+	size_t line_n;
+} LineIndex;
 
 struct decl VarType;
 struct decl FuncDefinition;
@@ -216,21 +287,53 @@ struct decl FuncDefinition;
 typedef struct tdef ParseInput
 {
 	MemoryArena arena;
-	size_t line_n;
-	CodeLine *lines;
-	CodePosition *pos;
+	char *code;
+	size_t code_size;
+	// Only built when the first diagnostic is printed, use GetLineIndex.
+	LineIndex line_index;
+	Token *tokens;
+	size_t token_n;
+	AtomTable atoms;
+	Literal *literals;
+	size_t literal_n;
+	size_t token_at;
 	VarStack var_stack;
 	bool any_error;
 	Token last_token;
+	size_t nesting_depth;
 	
 	struct StructDefinition *first_struct_definition;
+	// Latest definition for each atom, so that lookups do not walk the lists.
+	struct StructDefinition **struct_by_atom;
 	
 	struct FuncDefinition *func_definition;
 	struct FuncDefinition *first_func_definition;
+	struct FuncDefinition **func_by_atom;
 	
 	struct OperatorDefinition *operator_definition;
 	struct OperatorDefinition *first_operator_definition;
 	
+	struct GenericFuncDefinition **generic_by_atom;
+	// Every instance of a #func, looked up by its meta arguments.
+	struct GenericInstance **instance_buckets;
+	size_t instance_bucket_n;
+	size_t instance_n;
+	size_t reused_instance_n;
+	// Instances go to the definition list right before the definition that needed them.
+	struct GenericInstance *first_pending_instance;
+	struct GenericInstance *last_pending_instance;
+	// Meta parameters of the #func instance being read.
+	struct MetaBinding *bindings;
+	size_t binding_n;
+	size_t instance_depth;
+	size_t instance_name_n;
+	
+	// Functions and branches are numbered in the order they are read, the same way in every build,
+	// so a profile written by an instrumented build can be matched to them.
+	U32 profile_func_n;
+	U32 profile_branch_n;
+	bool has_profile;
+	
 	VarType *bool_type;
 	VarType *int_type;
 	VarType *float_type;
@@ -252,13 +355,11 @@ func ReadFileToMemory(FILE *file)
 			buffer = realloc(buffer, buffer_size);
 		}
 
-		char c;
-		int res = fscanf(file, "%c", &c);
-		if(res != 1)
+		size_t read_size = fread(buffer + size, 1, buffer_size - size, file);
+		if(read_size == 0)
 			break;
 
-		buffer[size] = c;
-		size++;
+		size += read_size;
 	}
 
 	buffer = realloc(buffer, size + 1);
@@ -266,20 +367,139 @@ func ReadFileToMemory(FILE *file)
 	return buffer;
 }
 
+static unsigned int
+func CountTrailingZeros(unsigned int mask)
+{
+#ifdef _MSC_VER
+	unsigned long index = 0;
+	_BitScanForward(&index, mask);
+	return (unsigned int)index;
+#else
+	return (unsigned int)__builtin_ctz(mask);
+#endif
+}
+
 static void
-func PrintLine(CodeLine line)
+func PushLineStart(LineIndex *index, size_t *max_line_n, size_t offset)
+{
+	if(index->line_n >= *max_line_n)
+	{
+		*max_line_n = 2 * (*max_line_n);
+		index->line_starts = realloc(index->line_starts, (*max_line_n) * sizeof(size_t));
+	}
+	
+	index->line_starts[index->line_n] = offset;
+	index->line_n++;
+}
+
+static LineIndex
+func BuildLineIndex(char *code, size_t code_size)
+{
+	LineIndex index = {};
+	size_t max_line_n = 1024;
+	index.line_starts = malloc(max_line_n * sizeof(size_t));
+	PushLineStart(&index, &max_line_n, 0);
+	
+	size_t at = 0;
+#ifdef M64_SSE2
+	// Compare 16 bytes at a time, then visit the set bits of the mask.
+	__m128i newline = _mm_set1_epi8('\n');
+	for(; at + 16 <= code_size; at += 16)
+	{
+		__m128i chars = _mm_loadu_si128((__m128i *)(code + at));
+		unsigned int mask = (unsigned int)_mm_movemask_epi8(_mm_cmpeq_epi8(chars, newline));
+		while(mask)
+		{
+			PushLineStart(&index, &max_line_n, at + CountTrailingZeros(mask) + 1);
+			mask &= mask - 1;
+		}
+	}
+#endif
+	for(; at < code_size; at++)
+	{
+		if(code[at] == '\n')
+		{
+			PushLineStart(&index, &max_line_n, at + 1);
+		}
+	}
+	
+	return index;
+}
+
+static LineIndex *
+func GetLineIndex(ParseInput *input)
+{
+	if(!input->line_index.line_starts)
+	{
+		input->line_index = BuildLineIndex(input->code, input->code_size);
+	}
+	
+	return &input->line_index;
+}
+
+typedef struct tdef SourceLocation
+{
+	size_t row;
+	size_t col;
+	char *line;
+	size_t line_length;
+} SourceLocation;
+
+static SourceLocation
+func GetSourceLocation(ParseInput *input, size_t offset)
+{
+	LineIndex *index = GetLineIndex(input);
+	
+	size_t low = 0;
+	size_t high = index->line_n;
+	while(high - low > 1)
+	{
+		size_t mid = low + (high - low) / 2;
+		if(index->line_starts[mid] <= offset)
+			low = mid;
+		else
+			high = mid;
+	}
+	
+	size_t line_start = index->line_starts[low];
+	size_t line_end = (low + 1 < index->line_n) ? index->line_starts[low + 1] - 1 : input->code_size;
+	if(line_end > line_start && input->code[line_end - 1] == '\r')
+	{
+		line_end--;
+	}
+	
+	SourceLocation location = {};
+	location.row = low + 1;
+	location.col = offset - line_start + 1;
+	location.line = input->code + line_start;
+	location.line_length = line_end - line_start;
+	return location;
+}
+
+static size_t
+func GetTokenLength(ParseInput *input, Token token)
 {
-	printf("%.*s\n", line.length, line.string);
+	switch(token.id)
+	{
+		case NameTokenId:
+		case CCodeTokenId:
+			return input->atoms.atoms[token.value].length;
+		case IntegerConstantTokenId:
+		case FloatConstantTokenId:
+			return input->literals[token.value].length;
+		default:
+			return token.value;
+	}
 }
 
 static void
 func PrintTokenInLine(ParseInput *input, Token token)
 {
-	CodeLine line = input->lines[token.row];
-	PrintLine(input->lines[token.row]);
-	for(size_t i = 0; i < token.col - 1; i++)
+	SourceLocation location = GetSourceLocation(input, token.offset);
+	printf("%.*s\n", (int)location.line_length, location.line);
+	for(size_t i = 0; i < location.col - 1 && i < location.line_length; i++)
 	{
-		if(line.string[i] == '\t')
+		if(location.line[i] == '\t')
 		{
 			printf("\t");
 		}
@@ -288,7 +508,8 @@ func PrintTokenInLine(ParseInput *input, Token token)
 			printf(" ");
 		}
 	}
-	for(int i = 0; i < token.length; i++)
+	size_t length = GetTokenLength(input, token);
+	for(size_t i = 0; i < length; i++)
 	{
 		printf("^");		
 	}
@@ -305,19 +526,19 @@ func SetErrorToken(ParseInput *input, char *description, Token token)
 	}
 	
 	printf("Error: %s\n", description);
-	printf("In line %i\n", token.row);
+	printf("In line %i\n", (int)GetSourceLocation(input, token.offset).row);
 	PrintTokenInLine(input, token);
 	
 	input->any_error = true;
 }
 
-static void decl WriteErrorVarType(VarType *);
+static void decl WriteErrorVarType(ParseInput *, VarType *);
 
 static void
-func WriteErrorMessageVarType(char *message, VarType *type)
+func WriteErrorMessageVarType(ParseInput *input, char *message, VarType *type)
 {
 	printf("%s", message);
-	WriteErrorVarType(type);
+	WriteErrorVarType(input, type);
 	printf("\n");
 }
 
@@ -328,56 +549,120 @@ func SetError(ParseInput *input, char *description)
 }
 
 static bool
-func TokensEqual(Token token1, Token token2)
+func EnterNesting(ParseInput *input)
 {
-	if(token1.id != token2.id)
+	input->nesting_depth++;
+	if(input->nesting_depth > MaxNestingDepth)
 	{
+		SetError(input, "Code is nested too deeply.");
+		input->nesting_depth--;
 		return false;
 	}
-	if(token1.length != token2.length)
-	{
-		return false;
-	}
-	
-	for(size_t i = 0; i < token1.length; i++)
-	{
-		if(token1.text[i] != token2.text[i])
-		{
-			return false;
-		}
-	}
 	
 	return true;
 }
 
+static void
+func LeaveNesting(ParseInput *input)
+{
+	input->nesting_depth--;
+}
 
+static bool
+func TokensEqual(Token token1, Token token2)
+{
+	// Names are interned, equal names have the same atom index.
+	return (token1.id == token2.id && token1.value == token2.value);
+}
 
 static bool 
-func TokenEquals(Token token, char *text)
+func TextEquals(char *text, size_t length, char *string)
 {
-	bool length_matches = true;
-	bool text_matches = true;
-	for(int i = 0; i < token.length; i++)
+	return (strncmp(text, string, length) == 0 && string[length] == 0);
+}
+
+static U32
+func HashText(char *text, size_t length)
+{
+	U32 hash = 2166136261u;
+	for(size_t i = 0; i < length; i++)
 	{
-		if(text[i] == 0)
-		{
-			length_matches = false;
-			break;
-		}
-		else if (text[i] != token.text[i])
+		hash ^= (unsigned char)text[i];
+		hash *= 16777619u;
+	}
+	return hash;
+}
+
+static void
+func ResizeAtomBuckets(AtomTable *table, U32 bucket_n)
+{
+	free(table->buckets);
+	table->bucket_n = bucket_n;
+	table->buckets = malloc(bucket_n * sizeof(U32));
+	memset(table->buckets, 0xFF, bucket_n * sizeof(U32));
+	
+	for(U32 i = 0; i < table->atom_n; i++)
+	{
+		Atom *atom = &table->atoms[i];
+		U32 bucket = HashText(atom->text, atom->length) & (bucket_n - 1);
+		atom->next = table->buckets[bucket];
+		table->buckets[bucket] = i;
+	}
+}
+
+static U32
+func InternAtom(AtomTable *table, char *text, U32 length)
+{
+	U32 hash = HashText(text, length);
+	if(table->bucket_n > 0)
+	{
+		for(U32 i = table->buckets[hash & (table->bucket_n - 1)]; i != NoAtom; i = table->atoms[i].next)
 		{
-			text_matches = false;
-			break;
+			Atom *atom = &table->atoms[i];
+			if(atom->length == length && memcmp(atom->text, text, length) == 0)
+			{
+				return i;
+			}
 		}
 	}
-
-	if(text_matches && length_matches)
+	
+	if(table->atom_n >= table->max_atom_n)
+	{
+		table->max_atom_n = (table->max_atom_n == 0) ? 1024 : 2 * table->max_atom_n;
+		table->atoms = realloc(table->atoms, table->max_atom_n * sizeof(Atom));
+	}
+	
+	U32 index = table->atom_n;
+	table->atom_n++;
+	
+	Atom *atom = &table->atoms[index];
+	atom->text = text;
+	atom->length = length;
+	atom->next = NoAtom;
+	
+	if(2 * table->atom_n > table->bucket_n)
 	{
-		if(text[token.length] != 0)
-			length_matches = false;
+		ResizeAtomBuckets(table, (table->bucket_n == 0) ? 1024 : 2 * table->bucket_n);
 	}
+	else
+	{
+		U32 bucket = hash & (table->bucket_n - 1);
+		atom->next = table->buckets[bucket];
+		table->buckets[bucket] = index;
+	}
+	
+	return index;
+}
 
-	return (text_matches && length_matches);
+static void
+func InitAtomTable(AtomTable *table)
+{
+	// Same order as BuiltinAtomId.
+	char *names[BuiltinAtomN] = {"bool", "float", "int", "uint"};
+	for(U32 i = 0; i < BuiltinAtomN; i++)
+	{
+		InternAtom(table, names[i], (U32)strlen(names[i]));
+	}
 }
 
 static bool
@@ -390,8 +675,27 @@ static bool
 func IsHexadecimalDigit(char c)
 {
 	return (c >= '0' && c <= '9') || 
-		   (c >= 'a' && c <= 'z') || 
-		   (c >= 'A' && c <= 'Z');
+		   (c >= 'a' && c <= 'f') || 
+		   (c >= 'A' && c <= 'F');
+}
+
+static bool
+func IsBinaryDigit(char c)
+{
+	return (c == '0' || c == '1');
+}
+
+static int
+func GetDigitValue(char c)
+{
+	if(c >= '0' && c <= '9')
+		return c - '0';
+	else if(c >= 'a' && c <= 'f')
+		return 10 + c - 'a';
+	else if(c >= 'A' && c <= 'F')
+		return 10 + c - 'A';
+	else
+		return 0;
 }
 
 static bool
@@ -422,64 +726,131 @@ func IsAlpha(char c)
 static void
 func SkipWhiteSpace(CodePosition *pos)
 {
+	while(IsWhiteSpace(pos->at[0]))
+	{
+		pos->at++;
+	}
+}
+
+static bool
+func IsCCodeDirective(char *at)
+{
+	return (strncmp(at, "#c_code", 7) == 0 && !IsAlpha(at[7]) && !IsDigit(at[7]));
+}
+
+static Token
+func ReadTokenUntilClosingBraces(CodePosition *pos)
+{
+	Token token = {};
+	token.id = CCodeTokenId;
+	token.offset = (U32)(pos->at - pos->code);
+	
+	int open_braces_count = 1;
 	while(pos->at[0])
 	{
-		if(IsWhiteSpace(pos->at[0]))
+		if(pos->at[0] == '{')
+			open_braces_count++;
+
+		if(pos->at[0] == '}')
 		{
-			if(IsNewLine(pos->at[0]))
-			{
-				pos->row++;
-				pos->col = 1;
-			}
-			else
-				pos->col++;
-			pos->at++;
+			open_braces_count--;
+			if(open_braces_count == 0)
+				break;
 		}
-		else
-			break;
+		
+		pos->at++;
+		token.value++;
 	}
+	
+	return token;
 }
 
-static void
-func ReadCodeLines(ParseInput *input)
+static double
+func ParseFloat(char *start, char *end)
 {
-	input->lines = ArenaPushArray(&input->arena, 2, CodeLine);
-	input->line_n = 2;
+	char buffer[64];
+	size_t length = end - start;
+	char *text = buffer;
+	if(length + 1 > sizeof(buffer))
+		text = malloc(length + 1);
 	
-	size_t row = 1;
-	char *at = input->pos->at;
-	input->lines[row].string = at;
-	input->lines[row].length = 0;
+	memcpy(text, start, length);
+	text[length] = 0;
+	double value = strtod(text, 0);
 	
-	while(*at)
+	if(text != buffer)
+		free(text);
+	
+	return value;
+}
+
+static void
+func LexNumber(CodePosition *pos, Token *token, Literal *literal)
+{
+	// Literals are decoded once here, later stages only read the Literal.
+	int base = 10;
+	char *at = pos->at;
+	if(at[0] == '0' && (at[1] == 'x' || at[1] == 'X') && IsHexadecimalDigit(at[2]))
 	{
-		if(IsNewLine(*at))
-		{
-			ArenaPushType(&input->arena, CodeLine);
-			row++;
-			input->lines[row].string = at + 1;
-			input->lines[row].length = 0;
-			input->line_n++;
-		}
-		else
-			input->lines[row].length++;
+		base = 16;
+		at += 2;
+	}
+	else if(at[0] == '0' && (at[1] == 'b' || at[1] == 'B') && IsBinaryDigit(at[2]))
+	{
+		base = 2;
+		at += 2;
+	}
+	else if(at[0] == '0' && IsDigit(at[1]))
+	{
+		base = 8;
+		at++;
+	}
+	
+	bool valid_digits = true;
+	bool overflow = false;
+	unsigned long long value = 0;
+	while((base == 16) ? IsHexadecimalDigit(at[0]) : IsDigit(at[0]))
+	{
+		int digit = GetDigitValue(at[0]);
+		if(digit >= base)
+			valid_digits = false;
+		if(value > (ULLONG_MAX - digit) / base)
+			overflow = true;
 		
+		value = base * value + digit;
+		at++;
+	}
+	
+	if(at[0] == '.' && (base == 10 || base == 8))
+	{
 		at++;
+		while(IsDigit(at[0]))
+			at++;
+		
+		token->id = FloatConstantTokenId;
+		literal->float_value = ParseFloat(pos->at, at);
+	}
+	else
+	{
+		// An out of range value is kept as LLONG_MAX so that it fails every range check.
+		token->id = valid_digits ? IntegerConstantTokenId : UnknownTokenId;
+		literal->int_value = (overflow || value > LLONG_MAX) ? LLONG_MAX : (I64)value;
 	}
+	
+	token->value = (U32)(at - pos->at);
+	literal->length = token->value;
+	pos->at = at;
 }
 
 static Token
-func ReadToken(ParseInput *input)
+func LexToken(CodePosition *pos, Literal *literal)
 {
-	CodePosition *pos = input->pos;
 	SkipWhiteSpace(pos);
 
 	Token token = {};
 	token.id = UnknownTokenId;
-	token.text = pos->at;
-	token.length = 0;
-	token.row = pos->row;
-	token.col = pos->col;
+	token.offset = (U32)(pos->at - pos->code);
+	token.value = 0;
 
 	if(pos->at[0] == 0)
 	{
@@ -488,43 +859,43 @@ func ReadToken(ParseInput *input)
 	else if(pos->at[0] == '.')
 	{
 		token.id = DotTokenId;
-		token.length = 1;
+		token.value = 1;
 		pos->at++;
 	}
 	else if(pos->at[0] == '{')
 	{
 		token.id = OpenBracesTokenId;
-		token.length = 1;
+		token.value = 1;
 		pos->at++;
 	}
 	else if(pos->at[0] == '}')
 	{
 		token.id = CloseBracesTokenId;
-		token.length = 1;
+		token.value = 1;
 		pos->at++;
 	}
 	else if(pos->at[0] == '[')
 	{
 		token.id = OpenBracketsTokenId;
-		token.length = 1;
+		token.value = 1;
 		pos->at++;
 	}
 	else if(pos->at[0] == ']')
 	{
 		token.id = CloseBracketsTokenId;
-		token.length = 1;
+		token.value = 1;
 		pos->at++;
 	}
 	else if(pos->at[0] == '(')
 	{
 		token.id = OpenParenTokenId;
-		token.length = 1;
+		token.value = 1;
 		pos->at++;
 	}
 	else if(pos->at[0] == ')')
 	{
 		token.id = CloseParenTokenId;
-		token.length = 1;
+		token.value = 1;
 		pos->at++;
 	}
 	else if(pos->at[0] == '<')
@@ -532,26 +903,26 @@ func ReadToken(ParseInput *input)
 		if(pos->at[1] == '=')
 		{
 			token.id = LessThanEqualTokenId;
-			token.length = 2;
+			token.value = 2;
 			pos->at += 2;
 		}
 		else
 		{
 			token.id = LessThanTokenId;
-			token.length = 1;
+			token.value = 1;
 			pos->at++;
 		}
 	}
 	else if(pos->at[0] == '>')
 	{
 		token.id = GreaterThanTokenId;
-		token.length = 1;
+		token.value = 1;
 		pos->at++;
 	}
 	else if(pos->at[0] == ',')
 	{
 		token.id = CommaTokenId;
-		token.length = 1;
+		token.value = 1;
 		pos->at++;
 	}
 	else if(pos->at[0] == ':')
@@ -559,38 +930,38 @@ func ReadToken(ParseInput *input)
 		if(pos->at[1] == '=')
 		{
 			token.id = ColonEqualsTokenId;
-			token.length = 2;
+			token.value = 2;
 			pos->at += 2;
 		}
 		else if(pos->at[1] == ':')
 		{
 			token.id = ColonColonTokenId;
-			token.length = 2;
+			token.value = 2;
 			pos->at += 2;
 		}
 		else
 		{
 			token.id = ColonTokenId;
-			token.length = 1;
+			token.value = 1;
 			pos->at++;
 		}
 	}
 	else if(pos->at[0] == ';')
 	{
 		token.id = SemiColonTokenId;
-		token.length = 1;
+		token.value = 1;
 		pos->at++;
 	}
 	else if(pos->at[0] == '=')
 	{
 		token.id = EqualsTokenId;
-		token.length = 1;
+		token.value = 1;
 		pos->at++;
 	}
 	else if(pos->at[0] == '@')
 	{
 		token.id = AtTokenId;
-		token.length = 1;
+		token.value = 1;
 		pos->at++;
 	}
 	else if(pos->at[0] == '+')
@@ -599,144 +970,95 @@ func ReadToken(ParseInput *input)
 		{
 			token.id = PlusPlusTokenId;
 			pos->at += 2;
-			token.length = 2;
+			token.value = 2;
 		}
 		else
 		{
 			token.id = PlusTokenId;
 			pos->at++;
-			token.length = 1;
+			token.value = 1;
 		}
 	}
 	else if(pos->at[0] == '-')
 	{
 		token.id = MinusTokenId;
-		token.length = 1;
+		token.value = 1;
 		pos->at++;
 	}
 	else if(pos->at[0] == '*')
 	{
 		token.id = StarTokenId;
 		pos->at++;
-		token.length = 1;
+		token.value = 1;
 	}
 	else if(pos->at[0] == '&' && pos->at[1] == '=')
 	{
 		token.id = AndEqualsTokenId;
 		pos->at += 2;
-		token.length = 2;
+		token.value = 2;
 	}
 	else if(IsDigit(pos->at[0]))
 	{
-		if(pos->at[0] == '0' && pos->at[1] == 'x' && IsHexadecimalDigit(pos->at[2]))
-		{
-			pos->at += 2;
-			token.length = 2;
-			while(1)
-			{
-				if(IsHexadecimalDigit(pos->at[0]))
-				{
-					token.length++;
-					pos->at++;
-				}
-				else
-				{
-					break;
-				}
-			}
-			
-			token.id = IntegerConstantTokenId;
-		}
-		else
-		{
-			while(1)
-			{
-				if(IsDigit(pos->at[0]))
-				{
-					token.length++;
-					pos->at++;
-				}
-				else
-				{
-					break;
-				}
-			}
-			
-			if(pos->at[0] == '.')
-			{
-				pos->at++;
-				token.length++;
-				while(1)
-				{
-					if(IsDigit(pos->at[0]))
-					{
-						token.length++;
-						pos->at++;
-					
-					}
-					else
-					{
-						break;
-					}
-				}
-				
-				token.id = FloatConstantTokenId;
-			}
-			else
-			{
-				token.id = IntegerConstantTokenId;
-			}
-		}
+		LexNumber(pos, &token, literal);
 	}
 	else if(IsAlpha(pos->at[0]))
 	{
+		char *text = pos->at;
 		while(IsAlpha(pos->at[0]) || IsDigit(pos->at[0]))
 		{
-			token.length++;
+			token.value++;
 			pos->at++;
 		}
 		
-		if(TokenEquals(token, "extern"))
+		if(TextEquals(text, token.value, "export"))
+		{
+			token.id = ExportTokenId;
+		}
+		else if(TextEquals(text, token.value, "extern"))
 		{
 			token.id = ExternTokenId;
 		}
-		else if(TokenEquals(token, "false"))
+		else if(TextEquals(text, token.value, "false"))
 		{
 			token.id = FalseTokenId;;
 		}
-		else if(TokenEquals(token, "for"))
+		else if(TextEquals(text, token.value, "for"))
 		{
 			token.id = ForTokenId;
 		}
-		else if(TokenEquals(token, "func"))
+		else if(TextEquals(text, token.value, "func"))
 		{
 			token.id = FuncTokenId;
 		}
-		else if(TokenEquals(token, "if"))
+		else if(TextEquals(text, token.value, "if"))
 		{
 			token.id = IfTokenId;
 		}
-		else if(TokenEquals(token, "operator"))
+		else if(TextEquals(text, token.value, "inline"))
+		{
+			token.id = InlineTokenId;
+		}
+		else if(TextEquals(text, token.value, "operator"))
 		{
 			token.id = OperatorTokenId;
 		}
-		else if(TokenEquals(token, "return"))
+		else if(TextEquals(text, token.value, "return"))
 		{
 			token.id = ReturnTokenId;
 		}
-		else if(TokenEquals(token, "struct"))
+		else if(TextEquals(text, token.value, "struct"))
 		{
 			token.id = StructTokenId;
 		}
-		else if(TokenEquals(token, "to"))
+		else if(TextEquals(text, token.value, "to"))
 		{
 			token.id = ToTokenId;
 		}
-		else if(TokenEquals(token, "true"))
+		else if(TextEquals(text, token.value, "true"))
 		{
 			token.id = TrueTokenId;
 		}
-		else if(TokenEquals(token, "use"))
+		else if(TextEquals(text, token.value, "use"))
 		{
 			token.id = UseTokenId;
 		}
@@ -745,77 +1067,385 @@ func ReadToken(ParseInput *input)
 			token.id = NameTokenId;
 		}
 	}
+	else if(IsCCodeDirective(pos->at))
+	{
+		// The body of a #c_code block is not M64 code, it becomes a single token.
+		pos->at += 7;
+		SkipWhiteSpace(pos);
+		
+		if(pos->at[0] != '{')
+		{
+			token.value = 7;
+			return token;
+		}
+		
+		pos->at++;
+		token = ReadTokenUntilClosingBraces(pos);
+		if(pos->at[0] == '}')
+		{
+			pos->at++;
+		}
+		return token;
+	}
+	else if(pos->at[0] == '#')
+	{
+		token.id = HashTokenId;
+		token.value = 1;
+		pos->at++;
+	}
 	else
 	{
-		while(!IsWhiteSpace(pos->at[0]))
+		while(pos->at[0] && !IsWhiteSpace(pos->at[0]))
 		{
-			token.length++;
+			token.value++;
 			pos->at++;
 		}
 		token.id = UnknownTokenId;
 	}
-	
-	input->pos->col += token.length;
-	input->last_token = token;
 
 	return token;
 }
 
-static bool
-func ReadTokenId(ParseInput *input, TokenId id)
+typedef struct tdef TokenArray
 {
-	SkipWhiteSpace(input->pos);
-	
-	CodePosition start_pos = *input->pos;
+	Token *tokens;
+	size_t token_n;
+	size_t max_token_n;
+} TokenArray;
+
+static void
+func PushToken(TokenArray *array, Token token)
+{
+	if(array->token_n >= array->max_token_n)
+	{
+		array->max_token_n = (array->max_token_n == 0) ? 1024 : 2 * array->max_token_n;
+		array->tokens = realloc(array->tokens, array->max_token_n * sizeof(Token));
+	}
 	
-	Token token = ReadToken(input);
-	if(token.id != id)
-		*input->pos = start_pos;
-	
-	return (token.id == id);
+	array->tokens[array->token_n] = token;
+	array->token_n++;
 }
 
-static Token
-func ReadTokenUntilClosingBraces(ParseInput *input)
+// Inputs smaller than this are lexed on the calling thread only.
+#define LexParallelMinSize (1024 * 1024)
+#define LexMaxJobN 64
+
+typedef struct tdef LexJob
 {
-	CodePosition *pos = input->pos;
+	char *code;
+	char *start;
+	char *end;
 	
-	Token token = {};
-	token.id = UnknownTokenId;
-	token.text = pos->at;
+	TokenArray array;
+	// Literal indices are local to the job until the jobs are stitched together.
+	Literal *literals;
+	size_t literal_n;
+	size_t max_literal_n;
+} LexJob;
+
+static bool
+func IsLiteralTokenId(TokenId id)
+{
+	return (id == IntegerConstantTokenId || id == FloatConstantTokenId);
+}
+
+static void
+func RunLexJob(LexJob *job)
+{
+	CodePosition pos = {};
+	pos.code = job->code;
+	pos.at = job->start;
 	
-	int open_braces_count = 1;
 	while(1)
 	{
-		if(pos->at[0] == '{')
-			open_braces_count++;
+		SkipWhiteSpace(&pos);
+		if(pos.at >= job->end || pos.at[0] == 0)
+			break;
+		
+		Literal literal = {};
+		Token token = LexToken(&pos, &literal);
+		if(IsLiteralTokenId(token.id))
+		{
+			if(job->literal_n >= job->max_literal_n)
+			{
+				job->max_literal_n = (job->max_literal_n == 0) ? 256 : 2 * job->max_literal_n;
+				job->literals = realloc(job->literals, job->max_literal_n * sizeof(Literal));
+			}
+			
+			token.value = (U32)job->literal_n;
+			job->literals[job->literal_n] = literal;
+			job->literal_n++;
+		}
+		PushToken(&job->array, token);
+	}
+}
 
-		if(pos->at[0] == '}')
+#ifdef _WIN32
+static DWORD WINAPI
+func LexJobThread(LPVOID param)
+{
+	RunLexJob((LexJob *)param);
+	return 0;
+}
+#else
+static void *
+func LexJobThread(void *param)
+{
+	RunLexJob((LexJob *)param);
+	return 0;
+}
+#endif
+
+static int
+func GetProcessorCount()
+{
+#ifdef _WIN32
+	SYSTEM_INFO info = {};
+	GetSystemInfo(&info);
+	return (int)info.dwNumberOfProcessors;
+#else
+	return (int)sysconf(_SC_NPROCESSORS_ONLN);
+#endif
+}
+
+static void
+func RunLexJobs(LexJob *jobs, size_t job_n)
+{
+	// Job 0 runs on the calling thread, a job whose thread cannot be started runs there too.
+	bool started[LexMaxJobN] = {};
+#ifdef _WIN32
+	HANDLE threads[LexMaxJobN];
+	for(size_t i = 1; i < job_n; i++)
+	{
+		threads[i] = CreateThread(0, 0, LexJobThread, &jobs[i], 0, 0);
+		started[i] = (threads[i] != 0);
+	}
+#else
+	pthread_t threads[LexMaxJobN];
+	for(size_t i = 1; i < job_n; i++)
+	{
+		started[i] = (pthread_create(&threads[i], 0, LexJobThread, &jobs[i]) == 0);
+	}
+#endif
+	
+	for(size_t i = 0; i < job_n; i++)
+	{
+		if(!started[i])
+		{
+			RunLexJob(&jobs[i]);
+		}
+	}
+	
+	for(size_t i = 1; i < job_n; i++)
+	{
+		if(started[i])
+		{
+#ifdef _WIN32
+			WaitForSingleObject(threads[i], INFINITE);
+			CloseHandle(threads[i]);
+#else
+			pthread_join(threads[i], 0);
+#endif
+		}
+	}
+}
+
+static bool
+func StartsWithDefinitionKeyword(char *at)
+{
+	char *keywords[] = {"#func", "export", "extern", "func", "inline", "operator", "struct"};
+	for(size_t i = 0; i < sizeof(keywords) / sizeof(keywords[0]); i++)
+	{
+		size_t length = strlen(keywords[i]);
+		if(strncmp(at, keywords[i], length) == 0 && !IsAlpha(at[length]) && !IsDigit(at[length]))
+		{
+			return true;
+		}
+	}
+	
+	return false;
+}
+
+static char *
+func SkipCCodeBlock(char *at, char *end)
+{
+	at += 7;
+	while(at < end && IsWhiteSpace(at[0]))
+		at++;
+	
+	if(at >= end || at[0] != '{')
+		return at;
+	
+	int open_braces_count = 0;
+	while(at < end)
+	{
+		if(at[0] == '{')
+			open_braces_count++;
+		
+		if(at[0] == '}')
 		{
 			open_braces_count--;
 			if(open_braces_count == 0)
+				return at + 1;
+		}
+		
+		at++;
+	}
+	
+	return at;
+}
+
+static size_t
+func FindDefinitionStarts(char *code, char *end, size_t min_distance, char **starts, size_t max_start_n)
+{
+	// Top-level definitions begin with a keyword in column 1.
+	// A line start is always a token boundary unless it is inside a #c_code block.
+	size_t start_n = 0;
+	char *last_start = code;
+	char *at = code;
+	while(at < end && start_n < max_start_n)
+	{
+		if((size_t)(at - last_start) >= min_distance && StartsWithDefinitionKeyword(at))
+		{
+			starts[start_n] = at;
+			start_n++;
+			last_start = at;
+		}
+		
+		char *line_end = memchr(at, '\n', end - at);
+		if(!line_end)
+			line_end = end;
+		
+		char *hash = memchr(at, '#', line_end - at);
+		while(hash)
+		{
+			if(IsCCodeDirective(hash))
 			{
-				pos->at--;
-				break;
+				at = SkipCCodeBlock(hash, end);
+				line_end = memchr(at, '\n', end - at);
+				if(!line_end)
+					line_end = end;
+			}
+			else
+			{
+				at = hash + 1;
 			}
+			hash = memchr(at, '#', line_end - at);
 		}
 		
-		if(!pos->at[0])
-			break;
+		at = line_end + 1;
+	}
+	
+	return start_n;
+}
+
+static void
+func LexCode(ParseInput *input)
+{
+	char *code = input->code;
+	size_t size = input->code_size;
+	char *end = code + size;
+	
+	size_t job_n = 1;
+	if(size >= LexParallelMinSize)
+	{
+		int processor_n = GetProcessorCount();
+		if(processor_n > 1)
+			job_n = (processor_n < LexMaxJobN) ? (size_t)processor_n : LexMaxJobN;
+	}
+	
+	char *starts[LexMaxJobN];
+	starts[0] = code;
+	job_n = 1 + FindDefinitionStarts(code, end, size / job_n, starts + 1, job_n - 1);
+	
+	LexJob jobs[LexMaxJobN] = {};
+	for(size_t i = 0; i < job_n; i++)
+	{
+		jobs[i].code = code;
+		jobs[i].start = starts[i];
+		jobs[i].end = (i + 1 < job_n) ? starts[i + 1] : end;
+	}
+	
+	RunLexJobs(jobs, job_n);
+	
+	size_t total_token_n = 1;
+	size_t total_literal_n = 0;
+	for(size_t i = 0; i < job_n; i++)
+	{
+		total_token_n += jobs[i].array.token_n;
+		total_literal_n += jobs[i].literal_n;
+	}
+	
+	// Names are interned on this thread, in source order, so atom indices do not depend on the job count.
+	InitAtomTable(&input->atoms);
+	Token *tokens = malloc(total_token_n * sizeof(Token));
+	Literal *literals = malloc((total_literal_n + 1) * sizeof(Literal));
+	size_t at = 0;
+	size_t literal_at = 0;
+	for(size_t i = 0; i < job_n; i++)
+	{
+		LexJob *job = &jobs[i];
+		for(size_t j = 0; j < job->array.token_n; j++)
+		{
+			Token token = job->array.tokens[j];
+			if(token.id == NameTokenId || token.id == CCodeTokenId)
+				token.value = InternAtom(&input->atoms, code + token.offset, token.value);
+			else if(IsLiteralTokenId(token.id))
+				token.value += (U32)literal_at;
+			
+			tokens[at] = token;
+			at++;
+		}
 		
-		pos->at++;
-		token.length++;
+		if(job->literal_n > 0)
+			memcpy(literals + literal_at, job->literals, job->literal_n * sizeof(Literal));
+		literal_at += job->literal_n;
+		
+		free(job->array.tokens);
+		free(job->literals);
 	}
 	
+	Token end_token = {};
+	end_token.id = EndOfFileTokenId;
+	end_token.offset = (U32)size;
+	end_token.value = 0;
+	tokens[at] = end_token;
+	
+	input->tokens = tokens;
+	input->token_n = total_token_n;
+	input->literals = literals;
+	input->literal_n = total_literal_n;
+}
+
+static Token
+func ReadToken(ParseInput *input)
+{
+	Token token = input->tokens[input->token_at];
+	if(token.id != EndOfFileTokenId)
+		input->token_at++;
+	
+	input->last_token = token;
 	return token;
 }
 
+static bool
+func ReadTokenId(ParseInput *input, TokenId id)
+{
+	size_t start_at = input->token_at;
+	
+	Token token = ReadToken(input);
+	if(token.id != id)
+		input->token_at = start_at;
+	
+	return (token.id == id);
+}
+
 static Token
 func PeekToken(ParseInput *input)
 {
-	CodePosition start_pos = *input->pos;
+	size_t start_at = input->token_at;
 	Token token = ReadToken(input);
-	*input->pos = start_pos;
+	input->token_at = start_at;
 	
 	return token;
 }
@@ -830,10 +1460,10 @@ func PeekTokenId(ParseInput *input, TokenId id)
 static bool
 func PeekTwoTokenIds(ParseInput *input, TokenId id1, TokenId id2)
 {
-	CodePosition start_pos = *input->pos;
+	size_t start_at = input->token_at;
 	Token token1 = ReadToken(input);
 	Token token2 = ReadToken(input);
-	*input->pos = start_pos;
+	input->token_at = start_at;
 
 	return (token1.id == id1 && token2.id == id2);	
 }
@@ -909,6 +1539,7 @@ typedef enum tdef ExpressionId
 	ArrayIndexExpressionId,
 	BoolConstantExpressionId,
 	CastExpressionId,
+	ConstantDataExpressionId,
 	DereferenceExpressionId,
 	FloatConstantExpressionId,
 	FuncCallExpressionId,
@@ -959,6 +1590,8 @@ typedef struct tdef ArrayIndexExpression
 	
 	Expression *array;
 	Expression *index;
+	// Set by --bounds-check when the index is not known to be in bounds.
+	bool checked;
 } ArrayIndexExpression;
 
 static ArrayIndexExpression *decl PushArrayIndexExpression(MemoryArena *, Expression *, Expression *);
@@ -981,6 +1614,36 @@ func PushBoolConstantExpression(MemoryArena *arena, Token token, VarType *bool_t
 	return e;
 }
 
+typedef union tdef ConstantScalar
+{
+	// Bool, int and uint values, extended to 64 bits.
+	I64 i;
+	// Float values, already rounded to float.
+	double f;
+} ConstantScalar;
+
+typedef struct tdef ConstantDataExpression
+{
+	Expression e;
+	
+	// One scalar for each base type value in the type, in memory order.
+	ConstantScalar *values;
+	size_t value_n;
+} ConstantDataExpression;
+
+static ConstantDataExpression *
+func PushConstantDataExpression(MemoryArena *arena, VarType *type, ConstantScalar *values, size_t value_n)
+{
+	ConstantDataExpression *e = ArenaPushType(arena, ConstantDataExpression);
+	e->e.id = ConstantDataExpressionId;
+	e->e.type = type;
+	
+	e->values = values;
+	e->value_n = value_n;
+	e->e.modifiable = false;
+	return e;
+}
+
 typedef struct tdef CastExpression
 {
 	Expression e;
@@ -1047,16 +1710,18 @@ typedef struct tdef FloatConstantExpression
 	Expression e;
 	
 	Token token;
+	double value;
 } FloatConstantExpression;
 
 static FloatConstantExpression *
-func PushFloatConstantExpression(MemoryArena *arena, Token token, VarType *float_type)
+func PushFloatConstantExpression(MemoryArena *arena, Token token, double value, VarType *float_type)
 {
 	FloatConstantExpression *e = ArenaPushType(arena, FloatConstantExpression);
 	e->e.id = FloatConstantExpressionId;
 	e->e.type = float_type;
 	
 	e->token = token;
+	e->value = value;
 	return e;
 }
 
@@ -1073,16 +1738,18 @@ typedef struct tdef IntegerConstantExpression
 	Expression e;
 	
 	Token token;
+	I64 value;
 } IntegerConstantExpression;
 
 static IntegerConstantExpression *
-func PushIntegerConstantExpression(MemoryArena *arena, Token token, VarType *int_type)
+func PushIntegerConstantExpression(MemoryArena *arena, Token token, I64 value, VarType *int_type)
 {
 	IntegerConstantExpression *e = ArenaPushType(arena, IntegerConstantExpression);
 	e->e.id = IntegerConstantExpressionId;
 	e->e.type = int_type;
 	
 	e->token = token;
+	e->value = value;
 	e->e.modifiable = false;
 	return e;
 }
@@ -1228,6 +1895,7 @@ func PushSubtractExpression(MemoryArena *arena, Expression *left, Expression *ri
 
 typedef enum tdef DefinitionId
 {
+	CCodeDefinitionId,
 	FuncDefinitionId,
 	OperatorDefinitionId,
 	StructDefinitionId
@@ -1243,6 +1911,12 @@ typedef struct tdef FuncParam
 	struct FuncParam *next;
 	Token name;
 	VarType *type;
+	
+	// Pointer parameters only, set by the alias analysis.
+	bool is_restrict;
+	bool is_const;
+	// Large struct parameters only, passed as a const pointer, set by AssignLinkage.
+	bool by_pointer;
 } FuncParam;
 
 typedef struct tdef FuncHeader
@@ -1263,22 +1937,152 @@ typedef struct tdef FuncDefinition
 	struct BlockInstruction *body;
 	
 	bool is_extern;
+	bool is_inline;
+	// Declared with export, or main: keeps external linkage and its by-value signature.
+	bool is_exported;
+	// Only called from the generated code, so it does not need external linkage.
+	bool is_static;
+	// Small enough to be written as static inline, set by AssignLinkage.
+	bool is_static_inline;
+	// Called from the generated code, set by AssignLinkage.
+	bool is_called;
+	// Exported functions with by_pointer parameters are written under this name,
+	// and a wrapper with the exported name passes the pointers.
+	bool has_wrapper;
+	Token wrapped_name;
+	struct InlineInfo *inline_info;
+	// Can get a pointer made by a cast, which can point to any type. Set by MarkPointerCasts.
+	bool sees_pointer_casts;
+	// Can run an extern function, which can reach any memory. Set by AnalyzeAliasing.
+	bool calls_extern;
+	
+	U32 profile_id;
+	// Set from the profile, 0 without one.
+	U64 profile_call_n;
+	bool is_hot;
+	bool is_cold;
 } FuncDefinition;
 
 static FuncDefinition *
 func GetFuncDefinition(ParseInput *input, Token name)
 {
-	for(FuncDefinition *f = input->first_func_definition; f; f = f->next)
+	if(name.id != NameTokenId)
+	{
+		return 0;
+	}
+	
+	return input->func_by_atom[name.value];
+}
+
+static Token
+func CreateUniqueName(ParseInput *input, size_t *name_n, Token name)
+{
+	// An atom that did not exist before cannot clash with any name in the source.
+	Atom *atom = &input->atoms.atoms[name.value];
+	while(1)
+	{
+		(*name_n)++;
+		char buffer[32];
+		int suffix_length = snprintf(buffer, sizeof(buffer), "_%zu", *name_n);
+
+		U32 length = atom->length + (U32)suffix_length;
+		char *text = ArenaPushArray(&input->arena, length, char);
+		memcpy(text, atom->text, atom->length);
+		memcpy(text + atom->length, buffer, suffix_length);
+
+		U32 atom_n = input->atoms.atom_n;
+		U32 index = InternAtom(&input->atoms, text, length);
+		if(index == atom_n)
+		{
+			Token result = name;
+			result.value = index;
+			return result;
+		}
+
+		// The atom array may have moved.
+		atom = &input->atoms.atoms[name.value];
+	}
+}
+
+typedef enum tdef MetaParamKind
+{
+	TypeMetaParamKind,
+	FuncMetaParamKind
+} MetaParamKind;
+
+#define GenericMaxMetaParamN 8
+#define GenericMaxSignatureParamN 16
+// Deeper than this, a #func is most likely instanced with ever growing types.
+#define GenericMaxInstanceDepth 32
+#define GenericMaxNameLength 256
+
+typedef struct tdef MetaParam
+{
+	Token name;
+	MetaParamKind kind;
+} MetaParam;
+
+typedef struct tdef MetaBinding
+{
+	U32 name;
+	VarType *type;
+	FuncDefinition *function;
+} MetaBinding;
+
+typedef struct tdef GenericFuncDefinition
+{
+	Token name;
+	// The header and body are read again for each instance, starting at the name.
+	size_t header_at;
+	
+	MetaParam meta_params[GenericMaxMetaParamN];
+	size_t meta_param_n;
+} GenericFuncDefinition;
+
+typedef struct tdef GenericInstance
+{
+	GenericFuncDefinition *generic;
+	MetaBinding args[GenericMaxMetaParamN];
+	U32 hash;
+	// 0 while the instance is being read.
+	FuncDefinition *def;
+	
+	struct GenericInstance *next_in_bucket;
+	struct GenericInstance *next_pending;
+} GenericInstance;
+
+static MetaBinding *
+func GetMetaBinding(ParseInput *input, Token name)
+{
+	if(name.id != NameTokenId)
+	{
+		return 0;
+	}
+	
+	for(size_t i = 0; i < input->binding_n; i++)
 	{
-		if(TokensEqual(f->header.name, name))
+		if(input->bindings[i].name == name.value)
 		{
-			return f;
+			return &input->bindings[i];
 		}
 	}
 	
 	return 0;
 }
 
+static GenericFuncDefinition *
+func GetGenericFuncDefinition(ParseInput *input, Token name)
+{
+	if(name.id != NameTokenId)
+	{
+		return 0;
+	}
+	
+	return input->generic_by_atom[name.value];
+}
+
+static FuncDefinition *decl ReadGenericCall(ParseInput *, GenericFuncDefinition *);
+
 typedef struct tdef FuncCallArgument
 {
 	struct FuncCallArgument *next;
@@ -1295,6 +2099,7 @@ func PushFuncCallExpression(MemoryArena *arena, FuncDefinition *func_def, FuncCa
 	
 	e->func_def = func_def;
 	e->first_call_arg = first_call_arg;
+	e->e.modifiable = false;
 	return e;
 }
 
@@ -1316,6 +2121,20 @@ typedef struct tdef OperatorDefinition
 	VarType *return_type;
 	
 	struct BlockInstruction *body;
+	
+	bool is_inline;
+	bool is_exported;
+	bool is_static;
+	bool is_static_inline;
+	bool is_called;
+	bool left_by_pointer;
+	bool right_by_pointer;
+	bool has_wrapper;
+	Token wrapped_name;
+	struct InlineInfo *inline_info;
+	struct PackedInfo *packed_info;
+	bool sees_pointer_casts;
+	bool calls_extern;
 } OperatorDefinition;
 
 static OperatorDefinition *
@@ -1342,6 +2161,7 @@ func PushOperatorCallExpression(MemoryArena *arena, OperatorDefinition *op_def,
 	e->def = op_def;
 	e->left = left;
 	e->right = right;
+	e->e.modifiable = false;
 	return e;
 }
 
@@ -1350,6 +2170,9 @@ typedef struct tdef StructVar
 	Token name;
 	VarType *type;
 	struct StructVar *next;
+	
+	// Accessed in a function that is hot in the profile.
+	bool is_hot;
 } StructVar;
 
 typedef struct tdef StructDefinition
@@ -1361,6 +2184,17 @@ typedef struct tdef StructDefinition
 	Token name;
 	StructVar *used_var;
 	StructVar *first_var;
+	
+	// From `struct Name align(N) packed`, align_attribute is 0 without align.
+	U32 align_attribute;
+	bool packed;
+	
+	// Set by LayoutStructs, in bytes, as the C compiler lays the struct out for x64.
+	bool has_layout;
+	U64 size;
+	U64 align;
+	U64 padding;
+	bool reordered;
 } StructDefinition;
 
 static StructVarExpression *
@@ -1402,6 +2236,7 @@ func PushArrayIndexExpression(MemoryArena *arena, Expression *array, Expression
 	
 	e->array = array;
 	e->index = index;
+	e->checked = false;
 	e->e.modifiable = true;
 	return e;
 }
@@ -1440,6 +2275,7 @@ func GetStructVar(StructDefinition *def, Token name)
 }
 
 static Expression *decl ReadExpression(ParseInput *);
+static Expression *decl ReadNumberLevelExpression(ParseInput *);
 static VarType *decl ReadVarType(ParseInput *);
 
 static FuncCallArgument *
@@ -1451,8 +2287,65 @@ func PushFuncCallArgument(MemoryArena *arena, Expression *expression)
 	return arg;
 }
 
+static bool
+func IntegerFitsType(I64 value, VarType *type)
+{
+	if(type->id != BaseTypeId)
+	{
+		return false;
+	}
+	
+	BaseType *base = (BaseType *)type;
+	switch(base->base_id)
+	{
+		case BoolBaseTypeId:
+			return (value == 0 || value == 1);
+		case Int32BaseTypeId:
+			return (value >= INT_MIN && value <= INT_MAX);
+		case UInt32BaseTypeId:
+			return (value >= 0 && value <= UINT_MAX);
+		case Float32BaseTypeId:
+			return true;
+	}
+	
+	return false;
+}
+
 static Expression *
-func ReadNumberLevelExpression(ParseInput *input)
+func ReadIntegerConstant(ParseInput *input, VarType *range_type, bool is_negated)
+{
+	// The constant gets type int, but its range is checked against the type it is cast to.
+	// A negated constant is checked with its sign, so that -2147483648 is an int.
+	Token token = ReadToken(input);
+	I64 value = input->literals[token.value].int_value;
+	if(is_negated)
+		value = -value;
+	if(!IntegerFitsType(value, range_type))
+	{
+		SetErrorToken(input, "Integer constant out of range.", token);
+		WriteErrorMessageVarType(input, "Type: ", range_type);
+		return 0;
+	}
+	
+	return (Expression *)PushIntegerConstantExpression(&input->arena, token, value, input->int_type);
+}
+
+static Expression *
+func ReadFloatConstant(ParseInput *input)
+{
+	Token token = ReadToken(input);
+	double value = input->literals[token.value].float_value;
+	if(value > FLT_MAX)
+	{
+		SetErrorToken(input, "Float constant out of range.", token);
+		return 0;
+	}
+	
+	return (Expression *)PushFloatConstantExpression(&input->arena, token, value, input->float_type);
+}
+
+static Expression *
+func ReadNumberLevelExpressionBody(ParseInput *input)
 {
 	Expression *e = 0;
 	
@@ -1465,7 +2358,20 @@ func ReadNumberLevelExpression(ParseInput *input)
 			return 0;
 		}
 		
-		Expression *value = ReadNumberLevelExpression(input);
+		Expression *value = 0;
+		if(PeekTokenId(input, IntegerConstantTokenId))
+		{
+			value = ReadIntegerConstant(input, (type->id == BaseTypeId) ? type : input->int_type, false);
+			if(!value)
+			{
+				return 0;
+			}
+		}
+		else
+		{
+			value = ReadNumberLevelExpression(input);
+		}
+		
 		if(!value)
 		{
 			SetError(input, "Expected expression after '::'.");
@@ -1474,13 +2380,21 @@ func ReadNumberLevelExpression(ParseInput *input)
 
 		e = (Expression *)PushCastExpression(&input->arena, type, value);
 	}
-	else if(ReadTokenId(input, IntegerConstantTokenId))
-	{
-		e = (Expression *)PushIntegerConstantExpression(&input->arena, input->last_token, input->int_type);
-	}
-	else if(ReadTokenId(input, FloatConstantTokenId))
+	else if(PeekTokenId(input, IntegerConstantTokenId))
 	{
-		e = (Expression *)PushFloatConstantExpression(&input->arena, input->last_token, input->float_type);
+		e = ReadIntegerConstant(input, input->int_type, false);
+		if(!e)
+		{
+			return 0;
+		}
+	}
+	else if(PeekTokenId(input, FloatConstantTokenId))
+	{
+		e = ReadFloatConstant(input);
+		if(!e)
+		{
+			return 0;
+		}
 	}
 	else if(ReadTokenId(input, FalseTokenId) || ReadTokenId(input, TrueTokenId))
 	{
@@ -1488,14 +2402,25 @@ func ReadNumberLevelExpression(ParseInput *input)
 	}
 	else if(ReadTokenId(input, MinusTokenId))
 	{
-		Expression *value = ReadNumberLevelExpression(input);
-		if(!value)
+		if(PeekTokenId(input, IntegerConstantTokenId))
 		{
-			SetError(input, "Expected expression after '-'.");
-			return 0;
+			e = ReadIntegerConstant(input, input->int_type, true);
+			if(!e)
+			{
+				return 0;
+			}
+		}
+		else
+		{
+			Expression *value = ReadNumberLevelExpression(input);
+			if(!value)
+			{
+				SetError(input, "Expected expression after '-'.");
+				return 0;
+			}
+			
+			e = (Expression *)PushNegativeExpression(&input->arena, value);
 		}
-		
-		e = (Expression *)PushNegativeExpression(&input->arena, value);
 	}
 	else if(ReadTokenId(input, OpenParenTokenId))
 	{
@@ -1531,8 +2456,10 @@ func ReadNumberLevelExpression(ParseInput *input)
 		
 		if(!ok)
 		{
-			FuncDefinition *f = GetFuncDefinition(input, name);
-			if(f)
+			MetaBinding *binding = GetMetaBinding(input, name);
+			FuncDefinition *f = binding ? binding->function : GetFuncDefinition(input, name);
+			GenericFuncDefinition *generic = f ? 0 : GetGenericFuncDefinition(input, name);
+			if(f || generic)
 			{
 				if(!ReadTokenId(input, OpenParenTokenId))
 				{
@@ -1540,13 +2467,23 @@ func ReadNumberLevelExpression(ParseInput *input)
 					return 0;
 				}
 				
+				// The meta arguments of a #func come first and pick the instance that is called.
+				if(generic)
+				{
+					f = ReadGenericCall(input, generic);
+					if(!f)
+					{
+						return 0;
+					}
+				}
+				
 				FuncCallArgument *first_call_arg = 0;
 				FuncCallArgument *last_call_arg = 0;
 				
 				FuncHeader *header = &f->header;
 				for(FuncParam *param = header->first_param; param; param = param->next)
 				{
-					if(last_call_arg != 0)
+					if(last_call_arg != 0 || (generic && param == header->first_param))
 					{
 						if(!ReadTokenId(input, CommaTokenId))
 						{
@@ -1565,8 +2502,8 @@ func ReadNumberLevelExpression(ParseInput *input)
 					if(!TypesEqual(arg->type, param->type))
 					{
 						SetError(input, "Types do not match for function call.");
-						WriteErrorMessageVarType("Need: ", param->type);
-						WriteErrorMessageVarType("Got:  ", arg->type);
+						WriteErrorMessageVarType(input, "Need: ", param->type);
+						WriteErrorMessageVarType(input, "Got:  ", arg->type);
 						return 0;
 					}
 					
@@ -1743,6 +2680,19 @@ func ReadNumberLevelExpression(ParseInput *input)
 	return e;
 }
 
+static Expression *
+func ReadNumberLevelExpression(ParseInput *input)
+{
+	if(!EnterNesting(input))
+	{
+		return 0;
+	}
+	
+	Expression *result = ReadNumberLevelExpressionBody(input);
+	LeaveNesting(input);
+	return result;
+}
+
 static Expression *
 func ReadBitLevelExpression(ParseInput *input)
 {
@@ -1754,6 +2704,11 @@ static Expression *
 func ReadProductLevelExpression(ParseInput *input)
 {
 	Expression *e = ReadBitLevelExpression(input);
+	if(!e)
+	{
+		return 0;
+	}
+	
 	while(1)
 	{
 		if(ReadTokenId(input, StarTokenId))
@@ -1814,6 +2769,11 @@ static Expression *
 func ReadSumLevelExpression(ParseInput *input)
 {
 	Expression *e = ReadProductLevelExpression(input);
+	if(!e)
+	{
+		return 0;
+	}
+	
 	while(1)
 	{
 		if(ReadTokenId(input, PlusTokenId))
@@ -1835,8 +2795,8 @@ func ReadSumLevelExpression(ParseInput *input)
 			else if(!TypesEqual(left->type, right->type))
 			{
 				SetError(input, "Types do not match for '+'.");
-				WriteErrorMessageVarType("Left:  ", left->type);
-				WriteErrorMessageVarType("Right: ", right->type);
+				WriteErrorMessageVarType(input, "Left:  ", left->type);
+				WriteErrorMessageVarType(input, "Right: ", right->type);
 				return 0;
 			}
 			else
@@ -1863,14 +2823,14 @@ func ReadSumLevelExpression(ParseInput *input)
 			else if(!TypesEqual(left->type, right->type))
 			{
 				SetError(input, "Types do not match for '-'.");
-				WriteErrorMessageVarType("Left:  ", left->type);
-				WriteErrorMessageVarType("Right: ", right->type);
+				WriteErrorMessageVarType(input, "Left:  ", left->type);
+				WriteErrorMessageVarType(input, "Right: ", right->type);
 				return 0;
 			}
 			else if(!CanSubtractType(left->type))
 			{
 				SetError(input, "Cannot use '-' on type.");
-				WriteErrorMessageVarType("Type: ", left->type);
+				WriteErrorMessageVarType(input, "Type: ", left->type);
 				return 0;
 			}
 			else
@@ -1890,6 +2850,11 @@ static Expression *
 func ReadCompareLevelExpression(ParseInput *input)
 {
 	Expression *e = ReadSumLevelExpression(input);
+	if(!e)
+	{
+		return 0;
+	}
+	
 	while(1)
 	{
 		if(ReadTokenId(input, LessThanTokenId))
@@ -1992,6 +2957,9 @@ typedef struct tdef Instruction
 {
 	InstructionId id;
 	struct Instruction *next;
+	// Byte offset of the first token in the source code.
+	// Instructions added by the passes get the offset of the statement they were made for, or 0.
+	U32 offset;
 } Instruction;
 
 typedef struct tdef AndEqualsInstruction
@@ -2028,12 +2996,22 @@ typedef struct tdef CreateVariableInstruction
 	Expression *init;
 } CreateVariableInstruction;
 
+typedef enum tdef BranchHint
+{
+	NoBranchHint,
+	LikelyBranchHint,
+	UnlikelyBranchHint
+} BranchHint;
+
 typedef struct tdef IfInstruction
 {
 	Instruction i;
 	
 	Expression *condition;
 	BlockInstruction *body;
+	
+	U32 branch_id;
+	BranchHint hint;
 } IfInstruction;
 
 static IfInstruction *
@@ -2057,6 +3035,9 @@ func ReadIfInstruction(ParseInput *input)
 	
 	i->condition = condition;
 	i->body = body;
+	i->branch_id = input->profile_branch_n;
+	i->hint = NoBranchHint;
+	input->profile_branch_n++;
 	
 	SetStackState(input, stack_state);
 	return i;
@@ -2078,6 +3059,11 @@ typedef struct tdef ForInstruction
 	Instruction *update;
 	
 	BlockInstruction *body;
+	
+	// Set if the loop can also run as a vector loop.
+	struct VectorLoop *vector;
+	
+	U32 branch_id;
 } ForInstruction;
 
 static bool
@@ -2172,6 +3158,9 @@ func ReadForInstruction(ParseInput *input)
 	i->init = init;
 	i->condition = condition;
 	i->update = update;
+	i->vector = 0;
+	i->branch_id = input->profile_branch_n;
+	input->profile_branch_n++;
 	
 	i->body = ReadBlock(input);
 		
@@ -2232,21 +3221,18 @@ func PushStructType(MemoryArena *arena, StructDefinition *def)
 static StructDefinition *
 func GetStructDefinition(ParseInput *input, Token name)
 {
-	for(StructDefinition *def = input->first_struct_definition; def; def = def->next)
+	if(name.id != NameTokenId)
 	{
-		if(TokensEqual(def->name, name))
-		{
-			return def;
-		}
+		return 0;
 	}
 	
-	return 0;
+	return input->struct_by_atom[name.value];
 }
 
 static VarType *
-func ReadVarType(ParseInput *input)
+func ReadVarTypeBody(ParseInput *input)
 {
-	CodePosition start_pos = *input->pos;
+	size_t start_at = input->token_at;
 	
 	VarType *type = 0;
 	
@@ -2255,7 +3241,7 @@ func ReadVarType(ParseInput *input)
 		VarType *pointed_type = ReadVarType(input);
 		if(!pointed_type)
 		{
-			*input->pos = start_pos;
+			input->token_at = start_at;
 			return 0;
 		}
 		
@@ -2293,22 +3279,27 @@ func ReadVarType(ParseInput *input)
 	}
 	else if(ReadTokenId(input, NameTokenId))
 	{
-		if(TokenEquals(input->last_token, "int"))
+		if(input->last_token.value == IntAtomId)
 		{
 			type = input->int_type;
 		}
-		else if(TokenEquals(input->last_token, "uint"))
+		else if(input->last_token.value == UIntAtomId)
 		{
 			type = input->uint_type;
 		}
-		else if(TokenEquals(input->last_token, "float"))
+		else if(input->last_token.value == FloatAtomId)
 		{
 			type = input->float_type;
 		}
-		else if(TokenEquals(input->last_token, "bool"))
+		else if(input->last_token.value == BoolAtomId)
 		{
 			type = input->bool_type;
 		}
+		else if(GetMetaBinding(input, input->last_token))
+		{
+			// 0 for a function meta parameter, which is not a type.
+			type = GetMetaBinding(input, input->last_token)->type;
+		}
 		else
 		{			
 			StructDefinition *def = GetStructDefinition(input, input->last_token);
@@ -2321,12 +3312,25 @@ func ReadVarType(ParseInput *input)
 	
 	if(!type)
 	{
-		*input->pos = start_pos;
+		input->token_at = start_at;
 	}
 	
 	return type;
 }
 
+static VarType *
+func ReadVarType(ParseInput *input)
+{
+	if(!EnterNesting(input))
+	{
+		return 0;
+	}
+	
+	VarType *result = ReadVarTypeBody(input);
+	LeaveNesting(input);
+	return result;
+}
+
 typedef struct tdef NameList
 {
 	size_t size;
@@ -2380,7 +3384,7 @@ func NeedsSemicolon(InstructionId id)
 static ReturnInstruction *decl ReadReturnInstruction(ParseInput *);
 
 static Instruction *
-func ReadInstruction(ParseInput *input)
+func ReadInstructionBody(ParseInput *input)
 {
 	Instruction *instruction = 0;
 	if(PeekTokenId(input, ForTokenId))
@@ -2563,10 +3567,29 @@ func ReadInstruction(ParseInput *input)
 	return instruction;
 }
 
+static Instruction *
+func ReadInstruction(ParseInput *input)
+{
+	if(!EnterNesting(input))
+	{
+		return 0;
+	}
+	
+	U32 offset = PeekToken(input).offset;
+	Instruction *result = ReadInstructionBody(input);
+	if(result)
+	{
+		result->offset = offset;
+	}
+	LeaveNesting(input);
+	return result;
+}
+
 static BlockInstruction *
 func ReadBlock(ParseInput *input)
 {
 	BlockInstruction *block = 0;
+	U32 offset = PeekToken(input).offset;
 	if(!ReadTokenId(input, OpenBracesTokenId))
 	{
 		SetError(input, "Expected '{'");
@@ -2613,6 +3636,7 @@ func ReadBlock(ParseInput *input)
 	block = ArenaPushType(&input->arena, BlockInstruction);
 	block->i.id = BlockInstructionId;
 	block->i.next = 0;
+	block->i.offset = offset;
 	block->first = first_instruction;
 	
 	SetStackState(input, stack_state);
@@ -2665,6 +3689,80 @@ func ReadReturnInstruction(ParseInput *input)
 	return i;
 }
 
+static bool
+func ReadMetaParamType(ParseInput *input, NameList name_list)
+{
+	// The meta arguments are bound before the header of an instance is read,
+	// so this only checks functions against the signature their meta parameter asks for.
+	ReadTokenId(input, HashTokenId);
+	if(input->instance_depth == 0)
+	{
+		SetError(input, "Meta parameters can only be used in a #func.");
+		return false;
+	}
+	
+	if(ReadTokenId(input, NameTokenId))
+	{
+		Atom *atom = &input->atoms.atoms[input->last_token.value];
+		if(TextEquals(atom->text, atom->length, "type"))
+		{
+			return true;
+		}
+	}
+	else if(ReadTokenId(input, FuncTokenId))
+	{
+		if(!ReadTokenId(input, OpenParenTokenId))
+		{
+			return true;
+		}
+		
+		VarType *param_types[GenericMaxSignatureParamN];
+		size_t param_n = 0;
+		while(!ReadTokenId(input, CloseParenTokenId))
+		{
+			if(param_n > 0 && !ReadTokenId(input, CommaTokenId))
+			{
+				SetError(input, "Expected ',' between parameter types.");
+				return false;
+			}
+			
+			VarType *type = ReadVarType(input);
+			if(!type || param_n == GenericMaxSignatureParamN)
+			{
+				SetError(input, "Expected parameter type.");
+				return false;
+			}
+			param_types[param_n] = type;
+			param_n++;
+		}
+		
+		VarType *return_type = ReadVarType(input);
+		for(size_t i = 0; i < name_list.size; i++)
+		{
+			FuncDefinition *f = GetMetaBinding(input, name_list.names[i])->function;
+			bool matches = TypesEqual(f->header.return_type, return_type);
+			size_t index = 0;
+			for(FuncParam *param = f->header.first_param; param; param = param->next, index++)
+			{
+				if(index >= param_n || !TypesEqual(param->type, param_types[index]))
+				{
+					matches = false;
+				}
+			}
+			
+			if(!matches || index != param_n)
+			{
+				SetErrorToken(input, "Function does not match the signature of its meta parameter.", name_list.names[i]);
+				return false;
+			}
+		}
+		return true;
+	}
+	
+	SetError(input, "Expected 'type' or 'func' after '#'.");
+	return false;
+}
+
 static FuncHeader
 func ReadFuncHeader(ParseInput *input)
 {
@@ -2681,6 +3779,7 @@ func ReadFuncHeader(ParseInput *input)
 	
 	FuncParam *first_param = 0;
 	FuncParam *last_param = 0;
+	bool any_meta_param = false;
 	while(1)
 	{
 		if(ReadTokenId(input, CloseParenTokenId))
@@ -2688,7 +3787,7 @@ func ReadFuncHeader(ParseInput *input)
 			break;
 		}
 		
-		if(first_param)
+		if(first_param || any_meta_param)
 		{
 			if(!ReadTokenId(input, CommaTokenId))
 			{
@@ -2708,6 +3807,16 @@ func ReadFuncHeader(ParseInput *input)
 			break;
 		}
 		
+		if(PeekTokenId(input, HashTokenId))
+		{
+			if(!ReadMetaParamType(input, name_list))
+			{
+				break;
+			}
+			any_meta_param = true;
+			continue;
+		}
+		
 		VarType *param_type = ReadVarType(input);
 		for(size_t i = 0; i < name_list.size; i++)
 		{
@@ -2721,6 +3830,9 @@ func ReadFuncHeader(ParseInput *input)
 			FuncParam *param = ArenaPushType(&input->arena, FuncParam);
 			param->name = param_name;
 			param->type = param_type;
+			param->is_restrict = false;
+			param->is_const = false;
+			param->by_pointer = false;
 			param->next = 0;
 			if(last_param)
 			{
@@ -2780,92 +3892,664 @@ func ReadFuncDefinition(ParseInput *input)
 	
 	def->body = body;
 	def->is_extern = false;
+	def->is_inline = false;
+	def->inline_info = 0;
+	def->sees_pointer_casts = false;
+	def->calls_extern = false;
+	def->is_exported = false;
+	def->is_static = false;
+	def->is_static_inline = false;
+	def->is_called = false;
+	def->has_wrapper = false;
+	def->profile_id = input->profile_func_n;
+	input->profile_func_n++;
+	def->profile_call_n = 0;
+	def->is_hot = false;
+	def->is_cold = false;
 	
 	input->func_definition = prev_func_definition;
 	
 	def->next = input->first_func_definition;
 	input->first_func_definition = def;
+	input->func_by_atom[def->header.name.value] = def;
 	
 	SetStackState(input, stack_state);
 	
 	return def;
 }
 
-static OperatorDefinition *
-func ReadOperatorDefinition(ParseInput *input)
+static U32
+func HashMetaType(VarType *type)
 {
-	StackState stack_state = GetStackState(input);
-	
-	OperatorDefinition *def = ArenaPushType(&input->arena, OperatorDefinition);
-	def->def.id = OperatorDefinitionId;
-	
-	ReadTokenId(input, OperatorTokenId);
-	
-	Token op = ReadToken(input);
-	switch(op.id)
+	U32 hash = (U32)type->id * 31 + 17;
+	switch(type->id)
 	{
-		case MinusTokenId:
-		case PlusTokenId:
-		case StarTokenId:
+		case ArrayTypeId:
+		{
+			ArrayType *t = (ArrayType *)type;
+			if(t->size && t->size->id == IntegerConstantExpressionId)
+			{
+				hash = hash * 31 + (U32)((IntegerConstantExpression *)t->size)->value;
+			}
+			hash = hash * 31 + HashMetaType(t->element_type);
+			break;
+		}
+		case BaseTypeId:
+		{
+			hash = hash * 31 + (U32)((BaseType *)type)->base_id;
+			break;
+		}
+		case PointerTypeId:
+		{
+			hash = hash * 31 + HashMetaType(((PointerType *)type)->pointed_type);
+			break;
+		}
+		case StructTypeId:
 		{
+			hash = hash * 31 + ((StructType *)type)->def->name.value;
 			break;
 		}
 		default:
 		{
-			SetError(input, "Invalid operator.");
-			return 0;			
+			break;
 		}
 	}
-	
-	def->op = op.id;
-	
-	Token name = ReadToken(input);
-	if(name.id != NameTokenId)
+	return hash;
+}
+
+static bool
+func MetaTypesEqual(VarType *type1, VarType *type2)
+{
+	// Unlike TypesEqual this looks through pointers and arrays, they make a different instance.
+	if(!TypesEqual(type1, type2))
 	{
-		SetError(input, "Invalid operator name!");
-		return 0;
+		return false;
 	}
 	
-	def->name = name;
-	
-	if(!ReadTokenId(input, OpenParenTokenId))
+	switch(type1->id)
 	{
-		SetError(input, "Expected '(' for operator.");
-		return 0;
+		case ArrayTypeId:
+		{
+			ArrayType *t1 = (ArrayType *)type1;
+			ArrayType *t2 = (ArrayType *)type2;
+			if(t1->size != t2->size)
+			{
+				if(!t1->size || !t2->size)
+				{
+					return false;
+				}
+				if(t1->size->id != IntegerConstantExpressionId || t2->size->id != IntegerConstantExpressionId)
+				{
+					return false;
+				}
+				if(((IntegerConstantExpression *)t1->size)->value != ((IntegerConstantExpression *)t2->size)->value)
+				{
+					return false;
+				}
+			}
+			return MetaTypesEqual(t1->element_type, t2->element_type);
+		}
+		case PointerTypeId:
+		{
+			return MetaTypesEqual(((PointerType *)type1)->pointed_type, ((PointerType *)type2)->pointed_type);
+		}
+		default:
+		{
+			break;
+		}
 	}
-	
-	Token left_name = ReadToken(input);
-	if(left_name.id != NameTokenId)
+	return true;
+}
+
+static U32
+func HashMetaArgs(GenericFuncDefinition *generic, MetaBinding *args)
+{
+	U32 hash = generic->name.value;
+	for(size_t i = 0; i < generic->meta_param_n; i++)
 	{
-		SetError(input, "Invalid left operand name.");
-		return 0;
+		if(args[i].type)
+		{
+			hash = hash * 31 + HashMetaType(args[i].type);
+		}
+		else
+		{
+			hash = hash * 31 + args[i].function->header.name.value;
+		}
 	}
-	
-	if(VarExists(&input->var_stack, left_name))
+	return hash;
+}
+
+static GenericInstance *
+func FindGenericInstance(ParseInput *input, GenericFuncDefinition *generic, MetaBinding *args, U32 hash)
+{
+	if(input->instance_bucket_n == 0)
 	{
-		SetError(input, "Variable already exists.");
 		return 0;
 	}
 	
-	if(!ReadTokenId(input, ColonTokenId))
+	GenericInstance *instance = input->instance_buckets[hash % input->instance_bucket_n];
+	for(; instance; instance = instance->next_in_bucket)
 	{
-		SetError(input, "Expected ':'.");
-		return 0;
+		if(instance->generic != generic || instance->hash != hash)
+		{
+			continue;
+		}
+		
+		bool equal = true;
+		for(size_t i = 0; i < generic->meta_param_n; i++)
+		{
+			if(args[i].type)
+			{
+				equal = equal && MetaTypesEqual(args[i].type, instance->args[i].type);
+			}
+			else
+			{
+				equal = equal && (args[i].function == instance->args[i].function);
+			}
+		}
+		
+		if(equal)
+		{
+			return instance;
+		}
 	}
-	
-	VarType *left_type = ReadVarType(input);
-	if(!left_type)
+	return 0;
+}
+
+static void
+func AddGenericInstance(ParseInput *input, GenericInstance *instance)
+{
+	if(input->instance_n >= input->instance_bucket_n)
 	{
-		SetError(input, "Expected left operand type.");
-		return 0;
+		size_t bucket_n = (input->instance_bucket_n == 0) ? 64 : 2 * input->instance_bucket_n;
+		GenericInstance **buckets = ArenaPushArray(&input->arena, bucket_n, GenericInstance *);
+		memset(buckets, 0, bucket_n * sizeof(GenericInstance *));
+		for(size_t i = 0; i < input->instance_bucket_n; i++)
+		{
+			GenericInstance *next = 0;
+			for(GenericInstance *moved = input->instance_buckets[i]; moved; moved = next)
+			{
+				next = moved->next_in_bucket;
+				moved->next_in_bucket = buckets[moved->hash % bucket_n];
+				buckets[moved->hash % bucket_n] = moved;
+			}
+		}
+		input->instance_buckets = buckets;
+		input->instance_bucket_n = bucket_n;
 	}
 	
-	Var left_var = {};
-	left_var.name = left_name;
-	left_var.type = left_type;
-	PushVar(&input->var_stack, left_var);
-	
-	def->left_name = left_name;
+	size_t bucket = instance->hash % input->instance_bucket_n;
+	instance->next_in_bucket = input->instance_buckets[bucket];
+	input->instance_buckets[bucket] = instance;
+	input->instance_n++;
+}
+
+static void
+func AppendMangledText(char *buffer, size_t *length, char *text, size_t text_length)
+{
+	for(size_t i = 0; i < text_length && *length < GenericMaxNameLength; i++)
+	{
+		buffer[*length] = text[i];
+		(*length)++;
+	}
+}
+
+static void
+func AppendMangledType(ParseInput *input, char *buffer, size_t *length, VarType *type)
+{
+	switch(type->id)
+	{
+		case ArrayTypeId:
+		{
+			ArrayType *t = (ArrayType *)type;
+			char size_text[32] = "a";
+			if(t->size && t->size->id == IntegerConstantExpressionId)
+			{
+				snprintf(size_text, sizeof(size_text), "a%lld", (long long)((IntegerConstantExpression *)t->size)->value);
+			}
+			AppendMangledText(buffer, length, size_text, strlen(size_text));
+			AppendMangledType(input, buffer, length, t->element_type);
+			break;
+		}
+		case BaseTypeId:
+		{
+			// In the order of BaseVarTypeId.
+			char *names[] = {"bool", "int", "float", "uint"};
+			char *name = names[((BaseType *)type)->base_id];
+			AppendMangledText(buffer, length, name, strlen(name));
+			break;
+		}
+		case PointerTypeId:
+		{
+			AppendMangledText(buffer, length, "p", 1);
+			AppendMangledType(input, buffer, length, ((PointerType *)type)->pointed_type);
+			break;
+		}
+		case StructTypeId:
+		{
+			Atom *atom = &input->atoms.atoms[((StructType *)type)->def->name.value];
+			AppendMangledText(buffer, length, atom->text, atom->length);
+			break;
+		}
+		default:
+		{
+			break;
+		}
+	}
+}
+
+static Token
+func CreateInstanceName(ParseInput *input, GenericInstance *instance)
+{
+	// Swap(int, ...) becomes Swap_int, MaxOf(float, FloatLess, ...) becomes MaxOf_float_FloatLess.
+	GenericFuncDefinition *generic = instance->generic;
+	char buffer[GenericMaxNameLength];
+	size_t length = 0;
+	
+	Atom *atom = &input->atoms.atoms[generic->name.value];
+	AppendMangledText(buffer, &length, atom->text, atom->length);
+	for(size_t i = 0; i < generic->meta_param_n; i++)
+	{
+		AppendMangledText(buffer, &length, "_", 1);
+		if(instance->args[i].type)
+		{
+			AppendMangledType(input, buffer, &length, instance->args[i].type);
+		}
+		else
+		{
+			Atom *func_atom = &input->atoms.atoms[instance->args[i].function->header.name.value];
+			AppendMangledText(buffer, &length, func_atom->text, func_atom->length);
+		}
+	}
+	
+	char *text = ArenaPushArray(&input->arena, length, char);
+	memcpy(text, buffer, length);
+	
+	Token name = generic->name;
+	U32 atom_n = input->atoms.atom_n;
+	name.value = InternAtom(&input->atoms, text, (U32)length);
+	if(name.value != atom_n)
+	{
+		name = CreateUniqueName(input, &input->instance_name_n, name);
+	}
+	return name;
+}
+
+static FuncDefinition *
+func ReadGenericInstance(ParseInput *input, GenericInstance *instance)
+{
+	// The instance is read from the tokens of the #func like any function, with the meta parameters bound.
+	// It is read in the middle of another definition, so everything that definition uses is saved.
+	size_t saved_token_at = input->token_at;
+	Token saved_last_token = input->last_token;
+	VarStack saved_var_stack = input->var_stack;
+	FuncDefinition *saved_func_definition = input->func_definition;
+	OperatorDefinition *saved_operator_definition = input->operator_definition;
+	MetaBinding *saved_bindings = input->bindings;
+	size_t saved_binding_n = input->binding_n;
+	
+	input->var_stack.vars = ArenaPushArray(&input->arena, VarStackMaxSize, Var);
+	input->var_stack.size = 0;
+	input->func_definition = 0;
+	input->operator_definition = 0;
+	input->bindings = instance->args;
+	input->binding_n = instance->generic->meta_param_n;
+	input->token_at = instance->generic->header_at;
+	input->instance_depth++;
+	
+	FuncDefinition *def = ArenaPushType(&input->arena, FuncDefinition);
+	def->def.id = FuncDefinitionId;
+	
+	FuncHeader header = ReadFuncHeader(input);
+	BlockInstruction *body = 0;
+	if(!input->any_error)
+	{
+		def->header = header;
+		def->header.name = CreateInstanceName(input, instance);
+		
+		input->func_definition = def;
+		body = ReadBlock(input);
+		if(!body && !input->any_error)
+		{
+			SetError(input, "Function doesn't have a body!");
+		}
+	}
+	
+	input->instance_depth--;
+	input->token_at = saved_token_at;
+	input->last_token = saved_last_token;
+	input->var_stack = saved_var_stack;
+	input->func_definition = saved_func_definition;
+	input->operator_definition = saved_operator_definition;
+	input->bindings = saved_bindings;
+	input->binding_n = saved_binding_n;
+	
+	if(!body)
+	{
+		return 0;
+	}
+	
+	def->body = body;
+	def->is_extern = false;
+	def->is_inline = false;
+	def->inline_info = 0;
+	def->sees_pointer_casts = false;
+	def->calls_extern = false;
+	def->is_exported = false;
+	def->is_static = true;
+	def->is_static_inline = false;
+	def->is_called = false;
+	def->has_wrapper = false;
+	def->profile_id = input->profile_func_n;
+	input->profile_func_n++;
+	def->profile_call_n = 0;
+	def->is_hot = false;
+	def->is_cold = false;
+	
+	def->next = input->first_func_definition;
+	input->first_func_definition = def;
+	
+	return def;
+}
+
+static FuncDefinition *
+func ReadGenericCall(ParseInput *input, GenericFuncDefinition *generic)
+{
+	MetaBinding args[GenericMaxMetaParamN];
+	for(size_t i = 0; i < generic->meta_param_n; i++)
+	{
+		MetaParam *param = &generic->meta_params[i];
+		if(i > 0 && !ReadTokenId(input, CommaTokenId))
+		{
+			SetError(input, "Expected ',' between meta arguments.");
+			return 0;
+		}
+		
+		args[i].name = param->name.value;
+		args[i].type = 0;
+		args[i].function = 0;
+		if(param->kind == TypeMetaParamKind)
+		{
+			args[i].type = ReadVarType(input);
+			if(!args[i].type)
+			{
+				SetError(input, "Expected type for meta parameter.");
+				return 0;
+			}
+		}
+		else
+		{
+			Token name = ReadToken(input);
+			MetaBinding *binding = GetMetaBinding(input, name);
+			args[i].function = binding ? binding->function : GetFuncDefinition(input, name);
+			if(!args[i].function)
+			{
+				SetError(input, "Expected function for meta parameter.");
+				return 0;
+			}
+		}
+	}
+	
+	U32 hash = HashMetaArgs(generic, args);
+	GenericInstance *instance = FindGenericInstance(input, generic, args, hash);
+	if(instance)
+	{
+		if(!instance->def)
+		{
+			SetError(input, "A #func cannot call itself.");
+			return 0;
+		}
+		input->reused_instance_n++;
+		return instance->def;
+	}
+	
+	if(input->instance_depth >= GenericMaxInstanceDepth)
+	{
+		SetError(input, "Too many nested #func instances.");
+		return 0;
+	}
+	
+	instance = ArenaPushType(&input->arena, GenericInstance);
+	instance->generic = generic;
+	memcpy(instance->args, args, generic->meta_param_n * sizeof(MetaBinding));
+	instance->hash = hash;
+	instance->def = 0;
+	instance->next_in_bucket = 0;
+	instance->next_pending = 0;
+	AddGenericInstance(input, instance);
+	
+	instance->def = ReadGenericInstance(input, instance);
+	if(!instance->def)
+	{
+		return 0;
+	}
+	
+	// Instances read inside this one are already pending, so they get written first.
+	if(input->last_pending_instance)
+	{
+		input->last_pending_instance->next_pending = instance;
+	}
+	else
+	{
+		input->first_pending_instance = instance;
+	}
+	input->last_pending_instance = instance;
+	
+	return instance->def;
+}
+
+static void
+func SkipMetaParamType(ParseInput *input)
+{
+	// Stops at the ',' or ')' after the type, parentheses of #func signatures are skipped.
+	size_t depth = 0;
+	while(!PeekTokenId(input, EndOfFileTokenId))
+	{
+		Token token = PeekToken(input);
+		if(depth == 0 && (token.id == CommaTokenId || token.id == CloseParenTokenId))
+		{
+			break;
+		}
+		
+		if(token.id == OpenParenTokenId || token.id == OpenBracketsTokenId)
+		{
+			depth++;
+		}
+		else if(token.id == CloseParenTokenId || token.id == CloseBracketsTokenId)
+		{
+			depth--;
+		}
+		ReadToken(input);
+	}
+}
+
+static void
+func ReadGenericFuncDefinition(ParseInput *input)
+{
+	// Only the meta parameters are read here, the rest is checked for each instance.
+	ReadTokenId(input, HashTokenId);
+	ReadTokenId(input, FuncTokenId);
+	
+	GenericFuncDefinition *generic = ArenaPushType(&input->arena, GenericFuncDefinition);
+	generic->header_at = input->token_at;
+	generic->meta_param_n = 0;
+	generic->name = ReadToken(input);
+	if(generic->name.id != NameTokenId)
+	{
+		SetError(input, "Invalid function name.");
+		return;
+	}
+	
+	if(!ReadTokenId(input, OpenParenTokenId))
+	{
+		SetError(input, "Expected '(' after function name.");
+		return;
+	}
+	
+	bool any_value_param = false;
+	while(!ReadTokenId(input, CloseParenTokenId))
+	{
+		if((generic->meta_param_n > 0 || any_value_param) && !ReadTokenId(input, CommaTokenId))
+		{
+			SetError(input, "Expected ',' between parameters.");
+			return;
+		}
+		
+		NameList name_list = ReadNameList(input);
+		if(name_list.size == 0 || !ReadTokenId(input, ColonTokenId))
+		{
+			SetError(input, "Expected ':' after function parameter name.");
+			return;
+		}
+		
+		if(!ReadTokenId(input, HashTokenId))
+		{
+			any_value_param = true;
+			SkipMetaParamType(input);
+			continue;
+		}
+		
+		if(any_value_param)
+		{
+			SetError(input, "Meta parameters have to come before the other parameters.");
+			return;
+		}
+		
+		MetaParamKind kind = TypeMetaParamKind;
+		Token token = ReadToken(input);
+		if(token.id == FuncTokenId)
+		{
+			kind = FuncMetaParamKind;
+			SkipMetaParamType(input);
+		}
+		else if(token.id != NameTokenId || !TextEquals(input->atoms.atoms[token.value].text, input->atoms.atoms[token.value].length, "type"))
+		{
+			SetError(input, "Expected 'type' or 'func' after '#'.");
+			return;
+		}
+		
+		for(size_t i = 0; i < name_list.size; i++)
+		{
+			if(generic->meta_param_n == GenericMaxMetaParamN)
+			{
+				SetError(input, "Too many meta parameters.");
+				return;
+			}
+			generic->meta_params[generic->meta_param_n].name = name_list.names[i];
+			generic->meta_params[generic->meta_param_n].kind = kind;
+			generic->meta_param_n++;
+		}
+	}
+	
+	if(generic->meta_param_n == 0)
+	{
+		SetError(input, "A #func needs at least one meta parameter.");
+		return;
+	}
+	
+	while(!PeekTokenId(input, OpenBracesTokenId) && !PeekTokenId(input, EndOfFileTokenId))
+	{
+		ReadToken(input);
+	}
+	
+	size_t depth = 0;
+	do
+	{
+		Token token = ReadToken(input);
+		if(token.id == OpenBracesTokenId)
+		{
+			depth++;
+		}
+		else if(token.id == CloseBracesTokenId)
+		{
+			depth--;
+		}
+		else if(token.id == EndOfFileTokenId)
+		{
+			SetError(input, "Function doesn't have a body!");
+			return;
+		}
+	}
+	while(depth > 0);
+	
+	input->generic_by_atom[generic->name.value] = generic;
+}
+
+static OperatorDefinition *
+func ReadOperatorDefinition(ParseInput *input)
+{
+	StackState stack_state = GetStackState(input);
+	
+	OperatorDefinition *def = ArenaPushType(&input->arena, OperatorDefinition);
+	def->def.id = OperatorDefinitionId;
+	
+	ReadTokenId(input, OperatorTokenId);
+	
+	Token op = ReadToken(input);
+	switch(op.id)
+	{
+		case MinusTokenId:
+		case PlusTokenId:
+		case StarTokenId:
+		{
+			break;
+		}
+		default:
+		{
+			SetError(input, "Invalid operator.");
+			return 0;			
+		}
+	}
+	
+	def->op = op.id;
+	
+	Token name = ReadToken(input);
+	if(name.id != NameTokenId)
+	{
+		SetError(input, "Invalid operator name!");
+		return 0;
+	}
+	
+	def->name = name;
+	
+	if(!ReadTokenId(input, OpenParenTokenId))
+	{
+		SetError(input, "Expected '(' for operator.");
+		return 0;
+	}
+	
+	Token left_name = ReadToken(input);
+	if(left_name.id != NameTokenId)
+	{
+		SetError(input, "Invalid left operand name.");
+		return 0;
+	}
+	
+	if(VarExists(&input->var_stack, left_name))
+	{
+		SetError(input, "Variable already exists.");
+		return 0;
+	}
+	
+	if(!ReadTokenId(input, ColonTokenId))
+	{
+		SetError(input, "Expected ':'.");
+		return 0;
+	}
+	
+	VarType *left_type = ReadVarType(input);
+	if(!left_type)
+	{
+		SetError(input, "Expected left operand type.");
+		return 0;
+	}
+	
+	Var left_var = {};
+	left_var.name = left_name;
+	left_var.type = left_type;
+	PushVar(&input->var_stack, left_var);
+	
+	def->left_name = left_name;
 	def->left_type = left_type;
 	
 	if(!ReadTokenId(input, CommaTokenId))
@@ -2926,6 +4610,17 @@ func ReadOperatorDefinition(ParseInput *input)
 	}
 	
 	def->body = body;
+	def->is_inline = false;
+	def->is_exported = false;
+	def->is_static = false;
+	def->is_static_inline = false;
+	def->is_called = false;
+	def->left_by_pointer = false;
+	def->right_by_pointer = false;
+	def->has_wrapper = false;
+	def->packed_info = 0;
+	def->sees_pointer_casts = false;
+	def->calls_extern = false;
 	
 	def->next = input->first_operator_definition;
 	input->first_operator_definition = def;
@@ -2938,15 +4633,57 @@ func ReadOperatorDefinition(ParseInput *input)
 static bool
 func HasStruct(ParseInput *input, Token name)
 {
-	for(StructDefinition *def = input->first_struct_definition; def; def = def->next)
+	return (GetStructDefinition(input, name) != 0);
+}
+
+static bool
+func ReadStructAttributes(ParseInput *input, StructDefinition *def)
+{
+	// align and packed are only attributes between the struct name and '{', they can still name variables.
+	while(PeekTokenId(input, NameTokenId))
 	{
-		if(TokensEqual(def->name, name))
+		Token token = ReadToken(input);
+		Atom *atom = &input->atoms.atoms[token.value];
+		if(TextEquals(atom->text, atom->length, "packed") && !def->packed)
 		{
-			return true;
+			def->packed = true;
+		}
+		else if(TextEquals(atom->text, atom->length, "align") && def->align_attribute == 0)
+		{
+			if(!ReadTokenId(input, OpenParenTokenId))
+			{
+				SetError(input, "Expected '(' after align.");
+				return false;
+			}
+			
+			Token value = ReadToken(input);
+			if(value.id != IntegerConstantTokenId)
+			{
+				SetErrorToken(input, "Struct alignment has to be an integer constant.", value);
+				return false;
+			}
+			
+			I64 align = input->literals[value.value].int_value;
+			if(align <= 0 || align > 4096 || (align & (align - 1)) != 0)
+			{
+				SetErrorToken(input, "Struct alignment has to be a power of two, at most 4096.", value);
+				return false;
+			}
+			def->align_attribute = (U32)align;
+			
+			if(!ReadTokenId(input, CloseParenTokenId))
+			{
+				SetError(input, "Expected ')' after struct alignment.");
+				return false;
+			}
+		}
+		else
+		{
+			SetErrorToken(input, "Unknown or repeated struct attribute, expected align(N) or packed.", token);
+			return false;
 		}
 	}
-	
-	return false;
+	return true;
 }
 
 static StructDefinition *
@@ -2970,6 +4707,13 @@ func ReadStructDefinition(ParseInput *input)
 		return 0;
 	}
 	
+	def->align_attribute = 0;
+	def->packed = false;
+	if(!ReadStructAttributes(input, def))
+	{
+		return 0;
+	}
+	
 	if(!ReadTokenId(input, OpenBracesTokenId))
 	{
 		SetError(input, "Expected '{'");
@@ -3037,6 +4781,7 @@ func ReadStructDefinition(ParseInput *input)
 			var->name = name;
 			var->type = type;
 			var->next = 0;
+			var->is_hot = false;
 			if(last_var)
 			{
 				last_var->next = var;
@@ -3064,9 +4809,15 @@ func ReadStructDefinition(ParseInput *input)
 	def->name = name;
 	def->first_var = first_var;
 	def->used_var = used_var;
+	def->has_layout = false;
+	def->size = 0;
+	def->align = 0;
+	def->padding = 0;
+	def->reordered = false;
 	
 	def->next = input->first_struct_definition;
 	input->first_struct_definition = def;
+	input->struct_by_atom[def->name.value] = def;
 	
 	return def;
 }
@@ -3102,23 +4853,71 @@ func ReadExternFuncDefinition(ParseInput *input)
 	def->header = header;
 	
 	def->is_extern = true;
+	def->is_inline = false;
+	def->inline_info = 0;
+	def->sees_pointer_casts = false;
+	def->calls_extern = true;
+	def->is_exported = false;
+	def->is_static = false;
+	def->is_static_inline = false;
+	def->is_called = false;
+	def->has_wrapper = false;
+	def->profile_id = 0;
+	def->profile_call_n = 0;
+	def->is_hot = false;
+	def->is_cold = false;
 	
 	def->next = input->first_func_definition;
 	input->first_func_definition = def;
+	input->func_by_atom[def->header.name.value] = def;
 	
 	SetStackState(input, stack_state);
 	
 	return def;
 }
 
+typedef struct tdef CCodeDefinition
+{
+	Definition def;
+	
+	Token code;
+} CCodeDefinition;
+
+static CCodeDefinition *
+func ReadCCodeDefinition(ParseInput *input)
+{
+	CCodeDefinition *def = ArenaPushType(&input->arena, CCodeDefinition);
+	def->def.id = CCodeDefinitionId;
+	def->code = ReadToken(input);
+	return def;
+}
+
 static Definition *
 func ReadDefinition(ParseInput *input)
 {
 	Definition *def = 0;
+	bool is_exported = ReadTokenId(input, ExportTokenId);
+	bool is_inline = ReadTokenId(input, InlineTokenId);
 	Token token = PeekToken(input);
-	if(token.id == FuncTokenId)
+	if(is_exported && token.id != FuncTokenId && token.id != OperatorTokenId)
 	{
-		def = (Definition *)ReadFuncDefinition(input);
+		SetErrorToken(input, "Only a 'func' or an 'operator' can be exported.", token);
+		ReadToken(input);
+	}
+	else if(is_inline && token.id != FuncTokenId && token.id != OperatorTokenId)
+	{
+		SetErrorToken(input, "Expected 'func' or 'operator' after 'inline' instead of ", token);
+		ReadToken(input);
+	}
+	else if(token.id == FuncTokenId)
+	{
+		FuncDefinition *func_def = ReadFuncDefinition(input);
+		if(func_def)
+		{
+			func_def->is_inline = is_inline;
+			func_def->is_exported = is_exported;
+		}
+		def = (Definition *)func_def;
 	}
 	else if(token.id == ExternTokenId)
 	{
@@ -3130,7 +4929,22 @@ func ReadDefinition(ParseInput *input)
 	}
 	else if(token.id == OperatorTokenId)
 	{
-		def = (Definition *)ReadOperatorDefinition(input);
+		OperatorDefinition *op_def = ReadOperatorDefinition(input);
+		if(op_def)
+		{
+			op_def->is_inline = is_inline;
+			op_def->is_exported = is_exported;
+		}
+		def = (Definition *)op_def;
+	}
+	else if(token.id == CCodeTokenId)
+	{
+		def = (Definition *)ReadCCodeDefinition(input);
+	}
+	else if(token.id == HashTokenId && PeekTwoTokenIds(input, HashTokenId, FuncTokenId))
+	{
+		// Instances are added to the definition list when they are called.
+		ReadGenericFuncDefinition(input);
 	}
 	else
 	{
@@ -3153,11 +4967,23 @@ func ReadDefinitionList(ParseInput *input)
 		
 		Definition *definition = ReadDefinition(input);
 		
-		if(definition)
+		// Instances of a #func come before the definition that called them first.
+		while(input->first_pending_instance || definition)
 		{
+			Definition *next = definition;
+			if(input->first_pending_instance)
+			{
+				next = (Definition *)input->first_pending_instance->def;
+				input->first_pending_instance = input->first_pending_instance->next_pending;
+			}
+			else
+			{
+				definition = 0;
+			}
+			
 			DefinitionListElem *elem = ArenaPushType(&input->arena, DefinitionListElem);
 			elem->next = 0;
-			elem->definition = definition;
+			elem->definition = next;
 		
 			if(!last_elem)
 			{
@@ -3170,14 +4996,22 @@ func ReadDefinitionList(ParseInput *input)
 				last_elem = elem;
 			}
 		}
+		input->last_pending_instance = 0;
 	}
 
 	return first_elem;
 }
 
 static void
-func WriteErrorVarType(VarType *type)
+func WriteErrorVarType(ParseInput *input, VarType *type)
 {
+	// Calls to functions without a return type have no type.
+	if(!type)
+	{
+		printf("No type");
+		return;
+	}
+	
 	switch(type->id)
 	{
 		case NoTypeId:
@@ -3189,7 +5023,7 @@ func WriteErrorVarType(VarType *type)
 		{
 			ArrayType *t = (ArrayType *)type;
 			printf("[]");
-			WriteErrorVarType(t->element_type);
+			WriteErrorVarType(input, t->element_type);
 			break;
 		}
 		case BaseTypeId:
@@ -3229,13 +5063,14 @@ func WriteErrorVarType(VarType *type)
 		{
 			PointerType *t = (PointerType *)type;
 			printf("@");
-			WriteErrorVarType(t->pointed_type);
+			WriteErrorVarType(input, t->pointed_type);
 			break;
 		}
 		case StructTypeId:
 		{
 			StructType *t = (StructType *)type;
-			printf("struct %.*s", t->def->name.length, t->def->name.text);
+			Atom *name = &input->atoms.atoms[t->def->name.value];
+			printf("struct %.*s", (int)name->length, name->text);
 			break;
 		}
 		default:
@@ -3245,69 +5080,346 @@ func WriteErrorVarType(VarType *type)
 	}
 }
 
+static void
+func InitParseInput(ParseInput *input)
+{
+	// input->code and input->code_size are set by the caller.
+	LexCode(input);
+	input->token_at = 0;
+	
+	input->arena = CreateArena((size_t)64 * 1024 * 1024);
+	
+	input->var_stack.vars = ArenaPushArray(&input->arena, VarStackMaxSize, Var);
+	input->var_stack.size = 0;
+	
+	size_t atom_n = input->atoms.atom_n;
+	input->struct_by_atom = ArenaPushArray(&input->arena, atom_n, StructDefinition *);
+	memset(input->struct_by_atom, 0, atom_n * sizeof(StructDefinition *));
+	input->func_by_atom = ArenaPushArray(&input->arena, atom_n, FuncDefinition *);
+	memset(input->func_by_atom, 0, atom_n * sizeof(FuncDefinition *));
+	input->generic_by_atom = ArenaPushArray(&input->arena, atom_n, GenericFuncDefinition *);
+	memset(input->generic_by_atom, 0, atom_n * sizeof(GenericFuncDefinition *));
+	input->instance_buckets = 0;
+	input->instance_bucket_n = 0;
+	input->instance_n = 0;
+	input->reused_instance_n = 0;
+	input->first_pending_instance = 0;
+	input->last_pending_instance = 0;
+	input->bindings = 0;
+	input->binding_n = 0;
+	input->instance_depth = 0;
+	input->instance_name_n = 0;
+	input->profile_func_n = 0;
+	input->profile_branch_n = 0;
+	input->has_profile = false;
+	
+	BaseType *bool_base = ArenaPushType(&input->arena, BaseType);
+	bool_base->type.id = BaseTypeId;
+	bool_base->base_id = BoolBaseTypeId;
+	input->bool_type = (VarType *)bool_base;
+
+	BaseType *int_base = ArenaPushType(&input->arena, BaseType);
+	int_base->type.id = BaseTypeId;
+	int_base->base_id = Int32BaseTypeId;
+	input->int_type = (VarType *)int_base;
+	
+	BaseType *float_base = ArenaPushType(&input->arena, BaseType);
+	float_base->type.id = BaseTypeId;
+	float_base->base_id = Float32BaseTypeId;
+	input->float_type = (VarType *)float_base;
+	
+	BaseType *uint_base = ArenaPushType(&input->arena, BaseType);
+	uint_base->type.id = BaseTypeId;
+	uint_base->base_id = UInt32BaseTypeId;
+	input->uint_type = (VarType *)uint_base;
+}
+
+#define SplitMaxPartN 1024
+
+typedef struct tdef CompileOptions
+{
+	bool report;
+	bool no_eval;
+	bool no_inline;
+	bool no_sroa;
+	bool no_loop_opt;
+	bool no_vectorize;
+	bool bounds_check;
+	bool no_alias;
+	bool profile_generate;
+	char *profile_use_path;
+	bool reorder_fields;
+	bool no_line_directives;
+	size_t split_n;
+	bool makefile;
+	char *build_path;
+	char *cc;
+	char *cflags;
+	bool x64;
+	bool x64_asm;
+	bool no_peephole;
+	bool jit;
+	char *entry;
+} CompileOptions;
+
+#ifdef M64_NO_MAIN
+static void
+func FreeParseInput(ParseInput *input)
+{
+	// Only programs that include M64.c parse more than once, the compiler exits instead.
+	free(input->arena.memory);
+	free(input->tokens);
+	free(input->literals);
+	free(input->atoms.atoms);
+	free(input->atoms.buckets);
+	free(input->line_index.line_starts);
+}
+#endif
+
+#include "Profile.h"
+#include "Packed.h"
+#include "Inline.h"
+#include "Eval.h"
+#include "Sroa.h"
+#include "Loop.h"
+#include "Alias.h"
+#include "Vectorize.h"
+#include "BoundsCheck.h"
+#include "Layout.h"
+// Only the compiler writes C, hosts that include M64.c use the x64 backend.
+#ifndef M64_NO_MAIN
+#include "Linkage.h"
 #include "WriteC.h"
-#include "WriteFormatted.h"
+#include "Build.h"
+#endif
+#include "X64Ir.h"
+#include "X64Alloc.h"
+#include "X64Peephole.h"
+#include "X64Encode.h"
 #include "WriteX64.h"
 
-int main(int arg_n, char **arg_v)
+typedef struct tdef PassCounts
 {
-	setvbuf(stdout, NULL, _IONBF, 0);
+	size_t vector_loop_n;
+	size_t bounds_check_n;
+	size_t restrict_n;
+	size_t aligned_struct_n;
+} PassCounts;
+
+static bool
+func RunPasses(ParseInput *input, DefinitionList *def_list, CompileOptions *options, PassCounts *counts)
+{
+	// The passes between parsing and writing the output, shared by every output and the JIT.
+	counts->vector_loop_n = 0;
+	counts->bounds_check_n = 0;
+	counts->restrict_n = 0;
+	
+	if(options->report && input->instance_n > 0)
+	{
+		printf("Generics:\n");
+		printf("Created %zu instances, %zu calls reused an instance.\n", input->instance_n, input->reused_instance_n);
+	}
+	
+	if(options->profile_use_path && !UseProfile(input, def_list, options->profile_use_path, options->report))
+	{
+		return false;
+	}
+	
+	if(options->reorder_fields)
+	{
+		ReorderFieldsInDefinitionList(input, def_list);
+	}
+	
+	if(!EvaluateDefinitionList(input, def_list, !options->no_eval, options->report))
+	{
+		return false;
+	}
 	
-	if(arg_n != 3)
+	if(!options->no_inline)
 	{
-		printf("Usage: M64.exe [m64_input_file] [c_output_file]\n");
+		InlineDefinitionList(input, def_list, options->x64 || options->jit, options->report);
+	}
+	
+	if(!options->no_sroa)
+	{
+		SplitStructVarsInDefinitionList(input, def_list, options->report);
+	}
+	
+	if(!options->no_loop_opt)
+	{
+		OptimizeLoops(input, def_list, options->report);
+	}
+	
+	if(!options->no_vectorize)
+	{
+		counts->vector_loop_n = VectorizeLoops(input, def_list, options->report);
+	}
+	
+	if(options->bounds_check)
+	{
+		counts->bounds_check_n = AddBoundsChecks(input, def_list, options->report);
+	}
+	
+	if(!options->no_alias)
+	{
+		counts->restrict_n = AnalyzeAliasing(input, def_list, options->report);
+	}
+	
+	counts->aligned_struct_n = LayoutStructs(input, def_list, options->report);
+	
+	return true;
+}
+
+#include "X64Jit.h"
+
+#ifndef M64_NO_MAIN
+int main(int arg_n, char **arg_v)
+{
+	setvbuf(stdout, NULL, _IONBF, 0);
+	double start_seconds = GetWallSeconds();
+	
+	CompileOptions options = {};
+	char *in_path = 0;
+	char *out_path = 0;
+	char *c_out_path = 0;
+	bool valid_args = true;
+	for(int i = 1; i < arg_n; i++)
+	{
+		char *arg = arg_v[i];
+		if(strcmp(arg, "--report") == 0)
+			options.report = true;
+		else if(strcmp(arg, "--no-eval") == 0)
+			options.no_eval = true;
+		else if(strcmp(arg, "--no-inline") == 0)
+			options.no_inline = true;
+		else if(strcmp(arg, "--no-sroa") == 0)
+			options.no_sroa = true;
+		else if(strcmp(arg, "--no-loop-opt") == 0)
+			options.no_loop_opt = true;
+		else if(strcmp(arg, "--no-vectorize") == 0)
+			options.no_vectorize = true;
+		else if(strcmp(arg, "--bounds-check") == 0)
+			options.bounds_check = true;
+		else if(strcmp(arg, "--no-alias") == 0)
+			options.no_alias = true;
+		else if(strcmp(arg, "--profile-generate") == 0)
+			options.profile_generate = true;
+		else if(strcmp(arg, "--profile-use") == 0 && i + 1 < arg_n)
+			options.profile_use_path = arg_v[++i];
+		else if(strcmp(arg, "--reorder-fields") == 0)
+			options.reorder_fields = true;
+		else if(strcmp(arg, "--no-line-directives") == 0)
+			options.no_line_directives = true;
+		else if(strcmp(arg, "--split") == 0 && i + 1 < arg_n)
+			options.split_n = strtoul(arg_v[++i], 0, 10);
+		else if(strcmp(arg, "--makefile") == 0)
+			options.makefile = true;
+		else if(strcmp(arg, "--build") == 0 && i + 1 < arg_n)
+			options.build_path = arg_v[++i];
+		else if(strcmp(arg, "--cc") == 0 && i + 1 < arg_n)
+			options.cc = arg_v[++i];
+		else if(strcmp(arg, "--cflags") == 0 && i + 1 < arg_n)
+			options.cflags = arg_v[++i];
+		else if(strcmp(arg, "--x64") == 0)
+			options.x64 = true;
+		else if(strcmp(arg, "--asm") == 0)
+			options.x64_asm = true;
+		else if(strcmp(arg, "--no-peephole") == 0)
+			options.no_peephole = true;
+		else if(strcmp(arg, "--jit") == 0)
+			options.jit = true;
+		else if(strcmp(arg, "--entry") == 0 && i + 1 < arg_n)
+			options.entry = arg_v[++i];
+		else if(arg[0] == '-' && arg[1] == '-')
+			valid_args = false;
+		else if(!in_path)
+			in_path = arg;
+		else if(!out_path)
+			out_path = arg;
+		else if(!c_out_path)
+			c_out_path = arg;
+		else
+			valid_args = false;
+	}
+	
+	if(options.profile_generate && options.profile_use_path)
+		valid_args = false;
+	
+	// The counters of an instrumented build live in a single file.
+	if(options.profile_generate && options.split_n > 0)
+		valid_args = false;
+	if(options.split_n > SplitMaxPartN || (options.makefile && options.split_n == 0))
+		valid_args = false;
+	
+	// --build writes no C file, so it takes no output file and cannot split.
+	if(options.build_path && (out_path || options.split_n > 0))
+		valid_args = false;
+	if((options.cc || options.cflags) && !options.build_path)
+		valid_args = false;
+	
+	// The x64 output is an ELF object, or with --asm an assembly file, without the C runtime parts,
+	// and a C file for the C code of the program.
+	// Loops are written one iteration at a time.
+	if(options.x64 && (options.build_path || options.split_n > 0 || options.profile_generate))
+		valid_args = false;
+	if((c_out_path || options.x64_asm) && !options.x64)
+		valid_args = false;
+	if(options.no_peephole && !options.x64 && !options.jit)
+		valid_args = false;
+	if(options.x64)
+		options.no_vectorize = true;
+	
+	// --jit runs the x64 code in this process and writes no file.
+	if(options.jit && (out_path || options.x64 || options.build_path || options.split_n > 0 || options.profile_generate))
+		valid_args = false;
+	if(options.entry && !options.jit)
+		valid_args = false;
+	if(options.jit)
+		options.no_vectorize = true;
+	
+	// Calls are only counted when they are not inlined, and vector loops would skip the counted condition.
+	if(options.profile_generate)
+	{
+		options.no_inline = true;
+		options.no_vectorize = true;
+	}
+	
+	if(!valid_args || !in_path || (!out_path && !options.build_path && !options.jit))
+	{
+		printf("Usage: M64.exe [--report] [--no-eval] [--no-inline] [--no-sroa] [--no-loop-opt] [--no-vectorize] [--bounds-check] [--no-alias] [--profile-generate | --profile-use profile_file] [--reorder-fields] [--no-line-directives] [--split part_count [--makefile]] [m64_input_file] [c_output_file]\n");
+		printf("       M64.exe [options] --build exe_file [--cc c_compiler] [--cflags c_flags] [m64_input_file]\n");
+		printf("       M64.exe [options] --x64 [--asm] [--no-peephole] [m64_input_file] [object_or_asm_output_file] [c_output_file]\n");
+		printf("       M64.exe [options] --jit [--no-peephole] [--entry function_name] [m64_input_file]\n");
 		return -1;
 	}
 
-	FILE *in = fopen(arg_v[1], "r");
+	FILE *in = fopen(in_path, "r");
 	if(!in)
 	{
-		printf("Cannot open file <%s>\n", arg_v[1]);
+		printf("Cannot open file <%s>\n", in_path);
 		return -1;
 	}
 
-	FILE *out = fopen(arg_v[2], "w");
-	if(!out)
+	bool binary_out = (options.x64 && !options.x64_asm);
+	FILE *out = out_path ? fopen(out_path, binary_out ? "wb" : "w") : 0;
+	if(out_path && !out)
 	{
-		printf("Cannot create file to write to <%s>\n", arg_v[2]);
+		printf("Cannot create file to write to <%s>\n", out_path);
 		return -1;
 	}
 
 	char *buffer = ReadFileToMemory(in);
 	
-	CodePosition pos = {};
-	pos.at = buffer;
-	pos.row = 1;
-	pos.col = 1;
 	ParseInput input = {};
-	input.pos = &pos;
-	
-	input.arena = CreateArena((size_t)64 * 1024 * 1024);
-	
-	input.var_stack.vars = ArenaPushArray(&input.arena, VarStackMaxSize, Var);
-	input.var_stack.size = 0;
-	
-	BaseType *bool_base = ArenaPushType(&input.arena, BaseType);
-	bool_base->type.id = BaseTypeId;
-	bool_base->base_id = BoolBaseTypeId;
-	input.bool_type = (VarType *)bool_base;
-
-	BaseType *int_base = ArenaPushType(&input.arena, BaseType);
-	int_base->type.id = BaseTypeId;
-	int_base->base_id = Int32BaseTypeId;
-	input.int_type = (VarType *)int_base;
-	
-	BaseType *float_base = ArenaPushType(&input.arena, BaseType);
-	float_base->type.id = BaseTypeId;
-	float_base->base_id = Float32BaseTypeId;
-	input.float_type = (VarType *)float_base;
-	
-	BaseType *uint_base = ArenaPushType(&input.arena, BaseType);
-	uint_base->type.id = BaseTypeId;
-	uint_base->base_id = UInt32BaseTypeId;
-	input.uint_type = (VarType *)uint_base;
+	input.code = buffer;
+	input.code_size = strlen(buffer);
+	if(input.code_size >= UINT_MAX)
+	{
+		printf("File <%s> is too large, tokens address at most 4 GB.\n", in_path);
+		return -1;
+	}
 	
-	ReadCodeLines(&input);
+	InitParseInput(&input);
 	
 	DefinitionList *def_list = ReadDefinitionList(&input);
 	
@@ -3315,27 +5427,141 @@ int main(int arg_n, char **arg_v)
 	{
 		return -1;
 	}
-#if 0
-	X64Output output = {};
-	output.arena = CreateArena((size_t)64 * 1024);
-	X64WriteDefinitionList(&output, def_list);
 	
-	for(size_t i = 0; i < output.arena.used_size; i++)
-		fprintf(out, "%c", output.arena.memory[i]);
-#endif
+	PassCounts counts = {};
+	if(!RunPasses(&input, def_list, &options, &counts))
+	{
+		return -1;
+	}
+	
+	if(options.jit)
+	{
+		return X64JitRun(&input, def_list, &options, start_seconds);
+	}
+	
+	if(options.x64)
+	{
+		// The C code calls the M64 functions of the assembly, so they all keep external linkage.
+		// It goes to the C output file with the structs and the prototypes of everything else.
+		bool has_c_code = false;
+		for(DefinitionListElem *elem = def_list; elem; elem = elem->next)
+			has_c_code |= (elem->definition->id == CCodeDefinitionId);
+		if(has_c_code && !c_out_path)
+		{
+			printf("Error: The program has C code, the x64 output needs a C output file for it.\n");
+			return -1;
+		}
+		
+		X64Object object = {};
+		X64Output x64 = {};
+		x64.arena = CreateArena((size_t)64 * 1024 * 1024);
+		x64.atoms = &input.atoms;
+		x64.input = &input;
+		x64.object = options.x64_asm ? 0 : &object;
+		x64.label_base = 0;
+		x64.error = false;
+		x64.peephole = !options.no_peephole;
+		X64WriteDefinitionList(&x64, def_list, options.report);
+		if(x64.error)
+		{
+			return -1;
+		}
+		if(x64.object)
+		{
+			X64WriteObject(&object, &input.atoms, &x64.arena);
+		}
+		X64FreeObject(&object);
+		
+		fwrite(x64.arena.memory, 1, x64.arena.used_size, out);
+		if(!c_out_path)
+		{
+			return 0;
+		}
+		
+		FILE *c_out = fopen(c_out_path, "w");
+		if(!c_out)
+		{
+			printf("Cannot create file to write to <%s>\n", c_out_path);
+			return -1;
+		}
+		
+		Output c_output = {};
+		c_output.arena = CreateArena((size_t)64 * 1024 * 1024);
+		c_output.atoms = &input.atoms;
+		c_output.tabs = 0;
+		c_output.uses_sse2 = false;
+		c_output.uses_bounds_check = false;
+		c_output.uses_restrict = (counts.restrict_n > 0);
+		c_output.uses_align = (counts.aligned_struct_n > 0);
+		c_output.instrument = false;
+		c_output.profile_func_n = 0;
+		c_output.profile_branch_n = 0;
+		c_output.count_next_block = false;
+		c_output.call_count_id = 0;
+		c_output.uses_profile = false;
+		c_output.source = 0;
+		c_output.source_path = in_path;
+		c_output.output_path = c_out_path;
+		c_output.line_n = 0;
+		c_output.in_source = false;
+		c_output.source_line = 0;
+		c_output.source_line_at = 0;
+		c_output.split_n = 1;
+		WriteDefinitionList(&c_output, def_list);
+		if(c_output.error)
+		{
+			return -1;
+		}
+		
+		fwrite(c_output.arena.memory, 1, c_output.arena.used_size, c_out);
+		return 0;
+	}
+	
+	AssignLinkage(&input, def_list, options.report);
+	
 	Output output = {};
-	output.arena = CreateArena((size_t)64 * 1024);
+	output.arena = CreateArena((size_t)64 * 1024 * 1024);
+	output.atoms = &input.atoms;
 	output.tabs = 0;
+	output.uses_sse2 = (counts.vector_loop_n > 0);
+	output.uses_bounds_check = (counts.bounds_check_n > 0);
+	output.uses_restrict = (counts.restrict_n > 0);
+	output.uses_align = (counts.aligned_struct_n > 0);
+	output.instrument = options.profile_generate;
+	output.profile_func_n = input.profile_func_n;
+	output.profile_branch_n = input.profile_branch_n;
+	output.count_next_block = false;
+	output.call_count_id = 0;
+	output.uses_profile = input.has_profile;
+	output.source = options.no_line_directives ? 0 : &input;
+	output.source_path = in_path;
+	output.output_path = out_path ? out_path : "<stdin>";
+	output.line_n = 0;
+	output.in_source = false;
+	output.source_line = 0;
+	output.source_line_at = 0;
+	output.split_n = options.split_n;
 	WriteDefinitionList(&output, def_list);
 	if(output.error)
 	{
 		return -1;
 	}
 	
+	if(options.build_path)
+	{
+		return BuildExecutable(&output, options.build_path, options.cc, options.cflags, options.report) ? 0 : -1;
+	}
+	
 	for(size_t i = 0; i < output.arena.used_size; i++)
 	{
 		fprintf(out, "%c", output.arena.memory[i]);
 	}
 	
+	if(options.split_n > 0 && !WriteSplitParts(&output, def_list, out_path, options.makefile, options.report))
+	{
+		return -1;
+	}
+	
 	return 0;
 }
+#endif
@@ -165,8 +165,6 @@ func PushReal32Value(Runtime *runtime, float value)
 	return result;
 }
 
-typedef long long I64;
-
 static Value *
 func PushIntegerConstantValue(Runtime *runtime, I64 value, BaseVarTypeId base_type)
 {
@@ -245,91 +243,6 @@ func PushValueListElem(Runtime *runtime, Value *value)
 
 static Value *decl ExecuteFunction(Runtime *runtime, Func *function, ValueList *param_values);
 
-static I64
-func ParseIntFromToken(Token token)
-{
-	Assert(token.id == IntegerConstantTokenId);
-	I64 result = 0;
-	
-	char *s = token.text;
-	char *end = token.text + token.length;
-
-	bool is_negative = false;
-	if(s[0] == '-')
-	{
-		is_negative = true;
-		s++;
-	}
-	else if(s[0] == '+')
-	{
-		s++;
-	}
-
-	if(s[0] == '0' && (s[1] == 'x' || s[1] == 'X'))
-	{
-		s += 2;
-		while(s < end)
-		{
-			int digit = 0;
-			if(s[0] >= '0' && s[0] <= '0')
-			{
-				digit = s[0] - '0';
-			}
-			else if(s[0] >= 'a' && s[0] <= 'f')
-			{
-				digit = 10 + s[0] - 'a';
-			}
-			else if(s[0] >= 'A' && s[0] <= 'F')
-			{
-				digit = 10 + s[0] - 'A';
-			}
-
-			result = 16 * result + digit;
-
-			s++;
-		}
-	}
-	else if(s[0] == '0' && (s[1] == 'b' || s[1] == 'B'))
-	{
-		s += 2;
-		while(s < end)
-		{
-			int digit = (s[0] - '0');
-			result = 2 * result + digit;
-
-			s++;
-		}
-	}
-	else if(s[0] == '0' && (s + 1 < end && IsOctalDigit(s[1])))
-	{
-		s++;
-		while(s < end)
-		{
-			int digit = (s[0] - '0');
-			result = 8 * result + digit;
-
-			s++;
-		}
-	}
-	else
-	{
-		while(s < end)
-		{
-			int digit = (s[0] - '0');
-			result = 10 * result + digit;
-
-			s++;
-		}
-	}
-
-	if(is_negative)
-	{
-		result = -result;
-	}
-
-	return result;
-}
-
 static void
 func I64ToValue(Value *value, I64 i)
 {
@@ -492,11 +405,10 @@ func ExecuteExpression(Runtime *runtime, Expression *expression)
 		case IntegerConstantExpressionId:
 		{
 			IntegerConstantExpression *e = (IntegerConstantExpression *)expression;
-			I64 value = ParseIntFromToken(e->token);
 
 			Assert(expression->type->id == BaseTypeId);
 			BaseType *base_type = (BaseType *)expression->type;
-			result = PushIntegerConstantValue(runtime, value, base_type->base_id);
+			result = PushIntegerConstantValue(runtime, e->value, base_type->base_id);
 
 			break;
 		}
@@ -5,6 +5,8 @@
 #define decl
 #define tdef
 
+typedef long long I64;
+
 struct tdef MemArena
 {
 	char *memory;
@@ -602,6 +604,7 @@ struct tdef IntegerConstantExpression
 	Expression expr;
 
 	Token token;
+	I64 value;
 };
 
 struct tdef CharacterConstantExpression
@@ -3014,6 +3017,91 @@ func ExpressionHasAddress(Expression *expression)
 	return has_address;
 }
 
+static I64
+func ParseIntFromToken(Token token)
+{
+	Assert(token.id == IntegerConstantTokenId);
+	I64 result = 0;
+	
+	char *s = token.text;
+	char *end = token.text + token.length;
+
+	bool is_negative = false;
+	if(s[0] == '-')
+	{
+		is_negative = true;
+		s++;
+	}
+	else if(s[0] == '+')
+	{
+		s++;
+	}
+
+	if(s[0] == '0' && (s[1] == 'x' || s[1] == 'X'))
+	{
+		s += 2;
+		while(s < end)
+		{
+			int digit = 0;
+			if(s[0] >= '0' && s[0] <= '9')
+			{
+				digit = s[0] - '0';
+			}
+			else if(s[0] >= 'a' && s[0] <= 'f')
+			{
+				digit = 10 + s[0] - 'a';
+			}
+			else if(s[0] >= 'A' && s[0] <= 'F')
+			{
+				digit = 10 + s[0] - 'A';
+			}
+
+			result = 16 * result + digit;
+
+			s++;
+		}
+	}
+	else if(s[0] == '0' && (s[1] == 'b' || s[1] == 'B'))
+	{
+		s += 2;
+		while(s < end)
+		{
+			int digit = (s[0] - '0');
+			result = 2 * result + digit;
+
+			s++;
+		}
+	}
+	else if(s[0] == '0' && (s + 1 < end && IsOctalDigit(s[1])))
+	{
+		s++;
+		while(s < end)
+		{
+			int digit = (s[0] - '0');
+			result = 8 * result + digit;
+
+			s++;
+		}
+	}
+	else
+	{
+		while(s < end)
+		{
+			int digit = (s[0] - '0');
+			result = 10 * result + digit;
+
+			s++;
+		}
+	}
+
+	if(is_negative)
+	{
+		result = -result;
+	}
+
+	return result;
+}
+
 static IntegerConstantExpression *
 func PushIntegerConstantExpression(MemArena *arena, Token token)
 {
@@ -3034,6 +3122,7 @@ func PushIntegerConstantExpression(MemArena *arena, Token token)
 	}
 	result->expr.type = type;
 	result->token = token;
+	result->value = ParseIntFromToken(token);
 	return result;
 }
 
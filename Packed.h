@@ -0,0 +1,374 @@
+// Recognizes operators that do the same float arithmetic on every field of a small float struct, like
+//     operator+ add_float2(p1: float2, p2: float2) float2 { return float2_xy(p1.x + p2.x, p1.y + p2.y); }
+//     operator* mul_float_float2(x: float, v: float2) float2 { return float2_xy(x * v.x, x * v.y); }
+// A packed struct has two or four float fields and nothing else. The x64 backend keeps it in one xmm register,
+// where such an operator is a single addps, subps or mulps, so the inliner leaves its calls to the backend.
+// The body is followed through locals, field assignments and calls of functions without branches,
+// every field of the result has to be the same operation on the same field of the struct parameters.
+
+#define PackedMaxLaneN 4
+#define PackedMaxTermN 256
+#define PackedMaxVarN 64
+#define PackedMaxCallDepth 4
+
+typedef enum tdef PackedTermKind
+{
+	UnknownPackedTerm,
+	// A float parameter of the operator.
+	ParamPackedTerm,
+	// A field of a struct parameter of the operator.
+	LanePackedTerm,
+	ArithmeticPackedTerm
+} PackedTermKind;
+
+typedef struct tdef PackedTerm
+{
+	PackedTermKind kind;
+	U32 param;
+	U32 lane;
+	ExpressionId op;
+	struct PackedTerm *left;
+	struct PackedTerm *right;
+} PackedTerm;
+
+typedef struct tdef PackedValue
+{
+	// A float only uses the first lane.
+	PackedTerm *lanes[PackedMaxLaneN];
+} PackedValue;
+
+typedef struct tdef PackedVar
+{
+	U32 name;
+	PackedValue value;
+} PackedVar;
+
+typedef struct tdef PackedFrame
+{
+	PackedVar vars[PackedMaxVarN];
+	size_t var_n;
+	PackedValue result;
+	bool has_result;
+} PackedFrame;
+
+typedef struct tdef PackedEvaluator
+{
+	PackedTerm terms[PackedMaxTermN];
+	size_t term_n;
+	PackedTerm unknown;
+	size_t depth;
+} PackedEvaluator;
+
+typedef struct tdef PackedInfo
+{
+	bool is_packed;
+	ExpressionId op;
+	U32 lane_n;
+	// A side that is not a packed struct is a float that every lane uses.
+	bool left_is_packed;
+	bool right_is_packed;
+} PackedInfo;
+
+static bool
+func IsPackedFloat(VarType *type)
+{
+	return (type->id == BaseTypeId && ((BaseType *)type)->base_id == Float32BaseTypeId);
+}
+
+static U32
+func GetPackedLaneN(VarType *type)
+{
+	// 0 for types that are not packed structs.
+	if(type->id != StructTypeId)
+		return 0;
+	U32 lane_n = 0;
+	for(StructVar *var = ((StructType *)type)->def->first_var; var; var = var->next)
+	{
+		if(!IsPackedFloat(var->type))
+			return 0;
+		lane_n++;
+	}
+	return (lane_n == 2 || lane_n == 4) ? lane_n : 0;
+}
+
+static bool
+func GetPackedFieldLane(VarType *type, Token name, U32 *lane)
+{
+	*lane = 0;
+	for(StructVar *var = ((StructType *)type)->def->first_var; var; var = var->next, (*lane)++)
+	{
+		if(TokensEqual(var->name, name))
+			return true;
+	}
+	return false;
+}
+
+static PackedValue
+func UnknownPackedValue(PackedEvaluator *ev)
+{
+	PackedValue value = {};
+	for(U32 i = 0; i < PackedMaxLaneN; i++)
+		value.lanes[i] = &ev->unknown;
+	return value;
+}
+
+static PackedTerm *
+func NewPackedTerm(PackedEvaluator *ev, PackedTermKind kind)
+{
+	if(ev->term_n == PackedMaxTermN)
+		return &ev->unknown;
+	PackedTerm *term = &ev->terms[ev->term_n];
+	ev->term_n++;
+	*term = (PackedTerm){};
+	term->kind = kind;
+	return term;
+}
+
+static PackedVar *
+func FindPackedVar(PackedFrame *frame, Token name)
+{
+	for(size_t i = frame->var_n; i > 0; i--)
+	{
+		if(frame->vars[i - 1].name == name.value)
+			return &frame->vars[i - 1];
+	}
+	return 0;
+}
+
+static bool
+func AddPackedVar(PackedFrame *frame, Token name, PackedValue value)
+{
+	if(frame->var_n == PackedMaxVarN)
+		return false;
+	frame->vars[frame->var_n].name = name.value;
+	frame->vars[frame->var_n].value = value;
+	frame->var_n++;
+	return true;
+}
+
+static bool decl EvaluatePackedBlock(PackedEvaluator *, PackedFrame *, BlockInstruction *);
+
+static PackedValue
+func EvaluatePackedExpression(PackedEvaluator *ev, PackedFrame *frame, Expression *expression)
+{
+	PackedValue value = UnknownPackedValue(ev);
+	switch(expression->id)
+	{
+		case ParenExpressionId:
+		{
+			return EvaluatePackedExpression(ev, frame, ((ParenExpression *)expression)->in);
+		}
+		case VarExpressionId:
+		{
+			PackedVar *var = FindPackedVar(frame, ((VarExpression *)expression)->var.name);
+			return var ? var->value : value;
+		}
+		case StructVarExpressionId:
+		{
+			StructVarExpression *e = (StructVarExpression *)expression;
+			U32 lane = 0;
+			if(GetPackedLaneN(e->base->type) > 0 && GetPackedFieldLane(e->base->type, e->var_name, &lane))
+				value.lanes[0] = EvaluatePackedExpression(ev, frame, e->base).lanes[lane];
+			return value;
+		}
+		case AddExpressionId:
+		case SubtractExpressionId:
+		case MultiplyExpressionId:
+		{
+			// The three have the same layout.
+			AddExpression *e = (AddExpression *)expression;
+			if(!IsPackedFloat(expression->type))
+				return value;
+			PackedTerm *term = NewPackedTerm(ev, ArithmeticPackedTerm);
+			term->op = expression->id;
+			term->left = EvaluatePackedExpression(ev, frame, e->left).lanes[0];
+			term->right = EvaluatePackedExpression(ev, frame, e->right).lanes[0];
+			value.lanes[0] = term;
+			return value;
+		}
+		case FuncCallExpressionId:
+		{
+			FuncCallExpression *e = (FuncCallExpression *)expression;
+			FuncDefinition *def = e->func_def;
+			if(def->is_extern || ev->depth == PackedMaxCallDepth)
+				return value;
+
+			PackedFrame *callee = (PackedFrame *)malloc(sizeof(PackedFrame));
+			callee->var_n = 0;
+			callee->has_result = false;
+			FuncCallArgument *arg = e->first_call_arg;
+			bool is_known = true;
+			for(FuncParam *param = def->header.first_param; param && arg; param = param->next, arg = arg->next)
+				is_known &= AddPackedVar(callee, param->name, EvaluatePackedExpression(ev, frame, arg->arg));
+
+			ev->depth++;
+			if(is_known && EvaluatePackedBlock(ev, callee, def->body) && callee->has_result)
+				value = callee->result;
+			ev->depth--;
+			free(callee);
+			return value;
+		}
+		default:
+		{
+			return value;
+		}
+	}
+}
+
+static bool
+func EvaluatePackedBlock(PackedEvaluator *ev, PackedFrame *frame, BlockInstruction *block)
+{
+	// False for bodies that are not a straight line of these instructions.
+	size_t var_n = frame->var_n;
+	for(Instruction *instruction = block->first; instruction; instruction = instruction->next)
+	{
+		if(frame->has_result)
+			return false;
+		switch(instruction->id)
+		{
+			case CreateVariableInstructionId:
+			{
+				CreateVariableInstruction *i = (CreateVariableInstruction *)instruction;
+				PackedValue value = i->init ? EvaluatePackedExpression(ev, frame, i->init) : UnknownPackedValue(ev);
+				if(!AddPackedVar(frame, i->name, value))
+					return false;
+				break;
+			}
+			case AssignInstructionId:
+			{
+				AssignInstruction *i = (AssignInstruction *)instruction;
+				Expression *left = i->left;
+				while(left->id == ParenExpressionId)
+					left = ((ParenExpression *)left)->in;
+
+				PackedValue value = EvaluatePackedExpression(ev, frame, i->right);
+				U32 lane = 0;
+				if(left->id == VarExpressionId)
+				{
+					PackedVar *var = FindPackedVar(frame, ((VarExpression *)left)->var.name);
+					if(!var)
+						return false;
+					var->value = value;
+				}
+				else if(left->id == StructVarExpressionId)
+				{
+					StructVarExpression *e = (StructVarExpression *)left;
+					if(e->base->id != VarExpressionId || GetPackedLaneN(e->base->type) == 0 || !GetPackedFieldLane(e->base->type, e->var_name, &lane))
+						return false;
+					PackedVar *var = FindPackedVar(frame, ((VarExpression *)e->base)->var.name);
+					if(!var)
+						return false;
+					var->value.lanes[lane] = value.lanes[0];
+				}
+				else
+				{
+					return false;
+				}
+				break;
+			}
+			case BlockInstructionId:
+			{
+				if(!EvaluatePackedBlock(ev, frame, (BlockInstruction *)instruction))
+					return false;
+				break;
+			}
+			case ReturnInstructionId:
+			{
+				ReturnInstruction *i = (ReturnInstruction *)instruction;
+				if(!i->value)
+					return false;
+				frame->result = EvaluatePackedExpression(ev, frame, i->value);
+				frame->has_result = true;
+				break;
+			}
+			default:
+			{
+				return false;
+			}
+		}
+	}
+	frame->var_n = var_n;
+	return true;
+}
+
+static bool
+func IsPackedParamTerm(PackedTerm *term, U32 param, bool is_packed, U32 lane)
+{
+	if(is_packed)
+		return (term->kind == LanePackedTerm && term->param == param && term->lane == lane);
+	return (term->kind == ParamPackedTerm && term->param == param);
+}
+
+static PackedValue
+func GetPackedParamValue(PackedEvaluator *ev, U32 param, bool is_packed)
+{
+	PackedValue value = UnknownPackedValue(ev);
+	for(U32 lane = 0; lane < (is_packed ? PackedMaxLaneN : 1); lane++)
+	{
+		PackedTerm *term = NewPackedTerm(ev, is_packed ? LanePackedTerm : ParamPackedTerm);
+		term->param = param;
+		term->lane = lane;
+		value.lanes[lane] = term;
+	}
+	return value;
+}
+
+static bool
+func IsPackedOperator(OperatorDefinition *def, PackedInfo *info)
+{
+	VarType *types[2] = {def->left_type, def->right_type};
+	bool is_packed[2] = {false, false};
+	for(U32 i = 0; i < 2; i++)
+	{
+		is_packed[i] = TypesEqual(types[i], def->return_type);
+		if(!is_packed[i] && !IsPackedFloat(types[i]))
+			return false;
+	}
+	info->lane_n = GetPackedLaneN(def->return_type);
+	info->left_is_packed = is_packed[0];
+	info->right_is_packed = is_packed[1];
+	if(info->lane_n == 0 || (!is_packed[0] && !is_packed[1]))
+		return false;
+
+	PackedEvaluator *ev = (PackedEvaluator *)malloc(sizeof(PackedEvaluator));
+	PackedFrame *frame = (PackedFrame *)malloc(sizeof(PackedFrame));
+	ev->term_n = 0;
+	ev->unknown = (PackedTerm){};
+	ev->depth = 0;
+	frame->var_n = 0;
+	frame->has_result = false;
+	AddPackedVar(frame, def->left_name, GetPackedParamValue(ev, 0, is_packed[0]));
+	AddPackedVar(frame, def->right_name, GetPackedParamValue(ev, 1, is_packed[1]));
+
+	// Addition and multiplication also match with the parameters the other way around.
+	bool matches = EvaluatePackedBlock(ev, frame, def->body) && frame->has_result;
+	for(U32 lane = 0; lane < info->lane_n && matches; lane++)
+	{
+		PackedTerm *term = frame->result.lanes[lane];
+		if(lane == 0)
+			info->op = term->op;
+		matches = (term->kind == ArithmeticPackedTerm && term->op == info->op);
+		if(!matches)
+			break;
+		bool in_order = IsPackedParamTerm(term->left, 0, is_packed[0], lane) && IsPackedParamTerm(term->right, 1, is_packed[1], lane);
+		bool swapped = IsPackedParamTerm(term->left, 1, is_packed[1], lane) && IsPackedParamTerm(term->right, 0, is_packed[0], lane);
+		matches = in_order || (swapped && term->op != SubtractExpressionId);
+	}
+
+	free(ev);
+	free(frame);
+	return matches;
+}
+
+static PackedInfo *
+func GetPackedInfo(ParseInput *input, OperatorDefinition *def)
+{
+	if(!def->packed_info)
+	{
+		PackedInfo *info = ArenaPushType(&input->arena, PackedInfo);
+		*info = (PackedInfo){};
+		info->is_packed = IsPackedOperator(def, info);
+		def->packed_info = info;
+	}
+	return def->packed_info;
+}
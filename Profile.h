@@ -0,0 +1,192 @@
+// Profile guided optimization in two builds.
+// With --profile-generate, WriteC counts the calls of every function and how often
+// the condition of every if and for is true. The program writes the counts to
+// M64_PROFILE_PATH (m64.profile by default) when it exits.
+// With --profile-use, the counts are read back right after parsing:
+//     functions that were never called are cold, they are not inlined and are written as cold and noinline,
+//     functions that were called at least 1% as often as the most called one may be inlined even when larger,
+//     if conditions that were true or false 90% of the time are written with __builtin_expect,
+//     and the functions are written hot first.
+//
+// The profile is text:
+//     m64-profile <function count> <branch count>
+//     f <function id> <calls> <name>
+//     b <branch id> <evaluations> <times true>
+
+// Conditions evaluated fewer times than this get no hint.
+#define ProfileMinBranchN 16
+
+typedef struct tdef ProfileBranch
+{
+	U64 evaluated_n;
+	U64 true_n;
+} ProfileBranch;
+
+typedef struct tdef ProfileReader
+{
+	ParseInput *input;
+	ProfileBranch *branches;
+	size_t likely_n;
+	size_t unlikely_n;
+} ProfileReader;
+
+static void decl HintBranchesInBlock(ProfileReader *, BlockInstruction *);
+
+static void
+func HintBranchesInInstruction(ProfileReader *reader, Instruction *instruction)
+{
+	switch(instruction->id)
+	{
+		case BlockInstructionId:
+		{
+			HintBranchesInBlock(reader, (BlockInstruction *)instruction);
+			break;
+		}
+		case IfInstructionId:
+		{
+			IfInstruction *i = (IfInstruction *)instruction;
+			ProfileBranch *branch = &reader->branches[i->branch_id];
+			if(branch->evaluated_n >= ProfileMinBranchN)
+			{
+				if(branch->true_n * 10 >= branch->evaluated_n * 9)
+				{
+					i->hint = LikelyBranchHint;
+					reader->likely_n++;
+				}
+				else if(branch->true_n * 10 <= branch->evaluated_n)
+				{
+					i->hint = UnlikelyBranchHint;
+					reader->unlikely_n++;
+				}
+			}
+			HintBranchesInBlock(reader, i->body);
+			break;
+		}
+		case ForInstructionId:
+		{
+			HintBranchesInBlock(reader, ((ForInstruction *)instruction)->body);
+			break;
+		}
+		default:
+		{
+			break;
+		}
+	}
+}
+
+static void
+func HintBranchesInBlock(ProfileReader *reader, BlockInstruction *block)
+{
+	for(Instruction *i = block->first; i; i = i->next)
+		HintBranchesInInstruction(reader, i);
+}
+
+static bool
+func UseProfile(ParseInput *input, DefinitionList *def_list, char *path, bool report)
+{
+	// A profile of a different version of the source is ignored with a warning.
+	FILE *file = fopen(path, "r");
+	if(!file)
+	{
+		printf("Error: Cannot open profile <%s>.\n", path);
+		return false;
+	}
+
+	FuncDefinition **funcs = ArenaPushArray(&input->arena, input->profile_func_n + 1, FuncDefinition *);
+	memset(funcs, 0, (input->profile_func_n + 1) * sizeof(FuncDefinition *));
+	for(DefinitionListElem *elem = def_list; elem; elem = elem->next)
+	{
+		Definition *definition = elem->definition;
+		if(definition->id == FuncDefinitionId && !((FuncDefinition *)definition)->is_extern)
+			funcs[((FuncDefinition *)definition)->profile_id] = (FuncDefinition *)definition;
+	}
+
+	ProfileReader reader = {};
+	reader.input = input;
+	reader.branches = ArenaPushArray(&input->arena, input->profile_branch_n + 1, ProfileBranch);
+	memset(reader.branches, 0, (input->profile_branch_n + 1) * sizeof(ProfileBranch));
+
+	U64 *call_ns = ArenaPushArray(&input->arena, input->profile_func_n + 1, U64);
+	memset(call_ns, 0, (input->profile_func_n + 1) * sizeof(U64));
+
+	unsigned int func_n = 0;
+	unsigned int branch_n = 0;
+	bool matches = (fscanf(file, "m64-profile %u %u", &func_n, &branch_n) == 2);
+	matches = matches && func_n == input->profile_func_n && branch_n == input->profile_branch_n;
+	while(matches)
+	{
+		char kind[2];
+		unsigned int id = 0;
+		unsigned long long count1 = 0;
+		if(fscanf(file, "%1s %u %llu", kind, &id, &count1) != 3)
+			break;
+
+		if(kind[0] == 'f' && id < func_n)
+		{
+			char name[256];
+			matches = (fscanf(file, "%255s", name) == 1);
+			if(matches && funcs[id])
+			{
+				Atom *atom = &input->atoms.atoms[funcs[id]->header.name.value];
+				matches = TextEquals(atom->text, atom->length, name);
+			}
+			call_ns[id] = count1;
+		}
+		else if(kind[0] == 'b' && id < branch_n)
+		{
+			unsigned long long count2 = 0;
+			matches = (fscanf(file, "%llu", &count2) == 1 && count2 <= count1);
+			reader.branches[id].evaluated_n = count1;
+			reader.branches[id].true_n = count2;
+		}
+		else
+		{
+			matches = false;
+		}
+	}
+	fclose(file);
+
+	if(!matches)
+	{
+		printf("Warning: Profile <%s> was not written for this source, it is ignored.\n", path);
+		return true;
+	}
+
+	input->has_profile = true;
+	U64 max_call_n = 0;
+	for(U32 i = 0; i < input->profile_func_n; i++)
+	{
+		if(call_ns[i] > max_call_n)
+			max_call_n = call_ns[i];
+	}
+
+	size_t hot_n = 0;
+	size_t cold_n = 0;
+	for(U32 i = 0; i < input->profile_func_n; i++)
+	{
+		FuncDefinition *def = funcs[i];
+		if(!def)
+			continue;
+
+		def->profile_call_n = call_ns[i];
+		def->is_cold = (call_ns[i] == 0);
+		def->is_hot = (call_ns[i] > 0 && call_ns[i] * 100 >= max_call_n);
+		hot_n += def->is_hot;
+		cold_n += def->is_cold;
+		HintBranchesInBlock(&reader, def->body);
+	}
+
+	for(DefinitionListElem *elem = def_list; elem; elem = elem->next)
+	{
+		if(elem->definition->id == OperatorDefinitionId)
+			HintBranchesInBlock(&reader, ((OperatorDefinition *)elem->definition)->body);
+	}
+
+	if(report)
+	{
+		printf("Profile:\n");
+		printf("%zu hot and %zu cold functions, %zu likely and %zu unlikely branches.\n",
+		       hot_n, cold_n, reader.likely_n, reader.unlikely_n);
+	}
+	return true;
+}
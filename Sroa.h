@@ -0,0 +1,567 @@
+// Scalar replacement of small struct variables on the M64 tree, after inlining.
+// A local like float2 that is only used through its fields, or copied as a whole
+// to and from other values, is split into one local for each field.
+// Inlined vector math then works on plain float variables instead of struct copies.
+//
+// A struct variable stays whole when it is passed to a call, returned,
+// created in the init of a for loop, or copied in a place that takes a single instruction.
+// Whole copies are done field by field, so the other side has to be free of calls.
+
+// Structs with more fields than this are left alone.
+#define SroaMaxFieldN 8
+
+typedef struct tdef SroaVar
+{
+	CreateVariableInstruction *def;
+	StructDefinition *struct_def;
+	bool split;
+
+	// One scalar for each field of the struct, in field order.
+	Var fields[SroaMaxFieldN];
+	size_t field_n;
+
+	struct SroaVar *next;
+} SroaVar;
+
+typedef struct tdef Sroa
+{
+	ParseInput *input;
+	size_t name_n;
+
+	// vars[atom] is the candidate with that name if stamp[atom] == current_stamp.
+	SroaVar **vars;
+	size_t *stamp;
+	size_t stamp_n;
+	size_t current_stamp;
+
+	SroaVar *first_var;
+
+	// Only used for cloning expressions, nothing is renamed.
+	Inliner cloner;
+
+	size_t split_n;
+	size_t scalar_n;
+} Sroa;
+
+static bool
+func IsSplittableType(VarType *type)
+{
+	if(type->id != StructTypeId)
+		return false;
+
+	size_t field_n = 0;
+	for(StructVar *var = ((StructType *)type)->def->first_var; var; var = var->next)
+	{
+		if(var->type->id != BaseTypeId)
+			return false;
+		field_n++;
+	}
+	return (field_n > 0 && field_n <= SroaMaxFieldN);
+}
+
+static SroaVar *
+func GetSroaVarByName(Sroa *sroa, Token name)
+{
+	if(name.value < sroa->stamp_n && sroa->stamp[name.value] == sroa->current_stamp)
+		return sroa->vars[name.value];
+	return 0;
+}
+
+static SroaVar *
+func GetSroaVar(Sroa *sroa, Expression *e)
+{
+	while(e->id == ParenExpressionId)
+		e = ((ParenExpression *)e)->in;
+
+	if(e->id != VarExpressionId)
+		return 0;
+	return GetSroaVarByName(sroa, ((VarExpression *)e)->var.name);
+}
+
+static void
+func AddSroaVar(Sroa *sroa, CreateVariableInstruction *def)
+{
+	// Every local is added, so that a name used by two variables is never split.
+	Token name = def->name;
+	if(name.value >= sroa->stamp_n)
+	{
+		size_t stamp_n = sroa->input->atoms.atom_n + 256;
+		sroa->vars = (SroaVar **)realloc(sroa->vars, stamp_n * sizeof(SroaVar *));
+		sroa->stamp = (size_t *)realloc(sroa->stamp, stamp_n * sizeof(size_t));
+		memset(sroa->stamp + sroa->stamp_n, 0, (stamp_n - sroa->stamp_n) * sizeof(size_t));
+		sroa->stamp_n = stamp_n;
+	}
+
+	SroaVar *existing = GetSroaVarByName(sroa, name);
+	if(existing)
+	{
+		// The same name in two sibling blocks, a use could mean either of them.
+		existing->split = false;
+		return;
+	}
+
+	SroaVar *var = ArenaPushType(&sroa->input->arena, SroaVar);
+	*var = (SroaVar){};
+	var->def = def;
+	var->split = IsSplittableType(def->type);
+	if(var->split)
+		var->struct_def = ((StructType *)def->type)->def;
+	var->next = sroa->first_var;
+	sroa->first_var = var;
+
+	sroa->vars[name.value] = var;
+	sroa->stamp[name.value] = sroa->current_stamp;
+}
+
+static void
+func CollectSroaVars(Sroa *sroa, Instruction *instruction)
+{
+	switch(instruction->id)
+	{
+		case CreateVariableInstructionId:
+		{
+			AddSroaVar(sroa, (CreateVariableInstruction *)instruction);
+			break;
+		}
+		case ForInstructionId:
+		{
+			// The init of a for loop is a single instruction, so its variable is never split.
+			ForInstruction *i = (ForInstruction *)instruction;
+			if(i->init->id == CreateVariableInstructionId)
+			{
+				AddSroaVar(sroa, (CreateVariableInstruction *)i->init);
+				sroa->vars[((CreateVariableInstruction *)i->init)->name.value]->split = false;
+			}
+			CollectSroaVars(sroa, (Instruction *)i->body);
+			break;
+		}
+		default:
+		{
+			for(Instruction *i = GetInstructionChild(instruction, 0); i; i = GetInstructionChild(instruction, i))
+				CollectSroaVars(sroa, i);
+			break;
+		}
+	}
+}
+
+static void
+func CheckSroaExpression(Sroa *sroa, Expression *e, bool whole_use)
+{
+	// whole_use is true where a split variable can be copied field by field.
+	SroaVar *var = GetSroaVar(sroa, e);
+	if(var)
+	{
+		if(!whole_use)
+			var->split = false;
+		return;
+	}
+
+	if(e->id == StructVarExpressionId && GetSroaVar(sroa, ((StructVarExpression *)e)->base))
+		return;
+
+	Expression **child = 0;
+	for(size_t i = 0; (child = GetExpressionChild(e, i)) != 0; i++)
+		CheckSroaExpression(sroa, *child, false);
+}
+
+static bool
+func CanCopyFrom(Expression *source, SroaVar *target)
+{
+	// Copying field by field evaluates the source once for each field.
+	return (!HasCall(source) && CountVarUses(source, target->def->name) == 0);
+}
+
+static void
+func CheckSroaInstruction(Sroa *sroa, Instruction *instruction, bool single)
+{
+	// single is true where the instruction cannot be replaced by several ones.
+	if(single)
+	{
+		Expression **e = 0;
+		for(size_t i = 0; (e = GetInstructionExpression(instruction, i)) != 0; i++)
+			CheckSroaExpression(sroa, *e, false);
+		return;
+	}
+
+	switch(instruction->id)
+	{
+		case AssignInstructionId:
+		{
+			AssignInstruction *i = (AssignInstruction *)instruction;
+			SroaVar *target = GetSroaVar(sroa, i->left);
+			if(target)
+			{
+				if(!CanCopyFrom(i->right, target))
+					target->split = false;
+			}
+			else
+			{
+				CheckSroaExpression(sroa, i->left, false);
+			}
+			CheckSroaExpression(sroa, i->right, !HasCall(i->left));
+			break;
+		}
+		case CreateVariableInstructionId:
+		{
+			CreateVariableInstruction *i = (CreateVariableInstruction *)instruction;
+			if(!i->init)
+				break;
+
+			SroaVar *target = GetSroaVarByName(sroa, i->name);
+			if(target && target->def == i && !CanCopyFrom(i->init, target))
+				target->split = false;
+			CheckSroaExpression(sroa, i->init, true);
+			break;
+		}
+		case BlockInstructionId:
+		{
+			for(Instruction *i = ((BlockInstruction *)instruction)->first; i; i = i->next)
+				CheckSroaInstruction(sroa, i, false);
+			break;
+		}
+		case IfInstructionId:
+		{
+			IfInstruction *i = (IfInstruction *)instruction;
+			CheckSroaExpression(sroa, i->condition, false);
+			CheckSroaInstruction(sroa, (Instruction *)i->body, false);
+			break;
+		}
+		case ForInstructionId:
+		{
+			ForInstruction *i = (ForInstruction *)instruction;
+			CheckSroaInstruction(sroa, i->init, true);
+			CheckSroaExpression(sroa, i->condition, false);
+			if(i->update)
+				CheckSroaInstruction(sroa, i->update, true);
+			CheckSroaInstruction(sroa, (Instruction *)i->body, false);
+			break;
+		}
+		default:
+		{
+			CheckSroaInstruction(sroa, instruction, true);
+			break;
+		}
+	}
+}
+
+static Token
+func CreateFieldName(Sroa *sroa, Token var_name, Token field_name)
+{
+	// var_field, with a number added only if that name is taken.
+	ParseInput *input = sroa->input;
+	Atom *var_atom = &input->atoms.atoms[var_name.value];
+	Atom *field_atom = &input->atoms.atoms[field_name.value];
+
+	U32 length = var_atom->length + 1 + field_atom->length;
+	char *text = ArenaPushArray(&input->arena, length, char);
+	memcpy(text, var_atom->text, var_atom->length);
+	text[var_atom->length] = '_';
+	memcpy(text + var_atom->length + 1, field_atom->text, field_atom->length);
+
+	U32 atom_n = input->atoms.atom_n;
+	Token result = var_name;
+	result.value = InternAtom(&input->atoms, text, length);
+	if(result.value != atom_n)
+		result = CreateUniqueName(input, &sroa->name_n, result);
+	return result;
+}
+
+static void
+func CreateSroaFields(Sroa *sroa, SroaVar *var)
+{
+	for(StructVar *field = var->struct_def->first_var; field; field = field->next)
+	{
+		Var *scalar = &var->fields[var->field_n];
+		var->field_n++;
+		scalar->type = field->type;
+		scalar->name = CreateFieldName(sroa, var->def->name, field->name);
+	}
+}
+
+static size_t
+func GetFieldIndex(StructDefinition *def, Token name)
+{
+	size_t index = 0;
+	for(StructVar *field = def->first_var; field; field = field->next)
+	{
+		if(TokensEqual(field->name, name))
+			break;
+		index++;
+	}
+	return index;
+}
+
+static void
+func ReplaceSroaFields(Sroa *sroa, Expression **slot)
+{
+	Expression *e = *slot;
+	if(e->id == StructVarExpressionId)
+	{
+		StructVarExpression *s = (StructVarExpression *)e;
+		SroaVar *var = GetSroaVar(sroa, s->base);
+		if(var && var->split)
+		{
+			size_t index = GetFieldIndex(var->struct_def, s->var_name);
+			*slot = (Expression *)PushVarExpression(&sroa->input->arena, var->fields[index]);
+			return;
+		}
+	}
+
+	Expression **child = 0;
+	for(size_t i = 0; (child = GetExpressionChild(e, i)) != 0; i++)
+		ReplaceSroaFields(sroa, child);
+}
+
+static Expression *
+func GetSroaField(Sroa *sroa, Expression *e, size_t index, StructVar *field)
+{
+	// The field of a whole struct value, as a new expression.
+	SroaVar *var = GetSroaVar(sroa, e);
+	if(var && var->split)
+		return (Expression *)PushVarExpression(&sroa->input->arena, var->fields[index]);
+
+	if(e->id == ConstantDataExpressionId)
+	{
+		ConstantDataExpression *data = (ConstantDataExpression *)e;
+		StructDefinition *def = ((StructType *)e->type)->def;
+		return PushConstantExpression(&sroa->input->arena, field->type, data->values[GetScalarOffset(def, field->name)]);
+	}
+
+	Expression *result = (Expression *)PushStructVarExpression(&sroa->input->arena, CloneExpression(&sroa->cloner, e), field);
+	ReplaceSroaFields(sroa, &result);
+	return result;
+}
+
+static Expression *
+func PushZeroExpression(Sroa *sroa, VarType *type)
+{
+	// A struct created without a value starts out zeroed, and so do its scalars.
+	MemoryArena *arena = &sroa->input->arena;
+	Token token = {};
+	if(((BaseType *)type)->base_id == Float32BaseTypeId)
+		return (Expression *)PushFloatConstantExpression(arena, token, 0.0, type);
+	return (Expression *)PushIntegerConstantExpression(arena, token, 0, type);
+}
+
+static Instruction *
+func PushSroaAssign(Sroa *sroa, Expression *left, Expression *right)
+{
+	AssignInstruction *i = ArenaPushType(&sroa->input->arena, AssignInstruction);
+	*i = (AssignInstruction){};
+	i->i.id = AssignInstructionId;
+	i->left = left;
+	i->right = right;
+	return (Instruction *)i;
+}
+
+static Instruction *
+func SplitSroaInstruction(Sroa *sroa, Instruction *instruction)
+{
+	// Returns the first of the instructions that replace a whole struct copy, 0 to keep it.
+	MemoryArena *arena = &sroa->input->arena;
+	Instruction *first = 0;
+	Instruction **link = &first;
+
+	if(instruction->id == AssignInstructionId)
+	{
+		AssignInstruction *i = (AssignInstruction *)instruction;
+		SroaVar *target = GetSroaVar(sroa, i->left);
+		SroaVar *source = GetSroaVar(sroa, i->right);
+		if(target && target->split)
+		{
+			size_t index = 0;
+			for(StructVar *field = target->struct_def->first_var; field; field = field->next, index++)
+			{
+				Expression *left = (Expression *)PushVarExpression(arena, target->fields[index]);
+				*link = PushSroaAssign(sroa, left, GetSroaField(sroa, i->right, index, field));
+				link = &(*link)->next;
+			}
+		}
+		else if(source && source->split)
+		{
+			size_t index = 0;
+			for(StructVar *field = source->struct_def->first_var; field; field = field->next, index++)
+			{
+				Expression *right = (Expression *)PushVarExpression(arena, source->fields[index]);
+				*link = PushSroaAssign(sroa, GetSroaField(sroa, i->left, index, field), right);
+				link = &(*link)->next;
+			}
+		}
+	}
+	else if(instruction->id == CreateVariableInstructionId)
+	{
+		CreateVariableInstruction *i = (CreateVariableInstruction *)instruction;
+		SroaVar *target = GetSroaVarByName(sroa, i->name);
+		SroaVar *source = i->init ? GetSroaVar(sroa, i->init) : 0;
+		if(target && target->def == i && target->split)
+		{
+			size_t index = 0;
+			for(StructVar *field = target->struct_def->first_var; field; field = field->next, index++)
+			{
+				Expression *init = i->init ? GetSroaField(sroa, i->init, index, field) : PushZeroExpression(sroa, field->type);
+				*link = PushInlineVariable(&sroa->cloner, target->fields[index].name, field->type, init);
+				link = &(*link)->next;
+			}
+		}
+		else if(source && source->split)
+		{
+			*link = PushInlineVariable(&sroa->cloner, i->name, i->type, 0);
+			link = &(*link)->next;
+
+			Var whole = {};
+			whole.name = i->name;
+			whole.type = i->type;
+			size_t index = 0;
+			for(StructVar *field = source->struct_def->first_var; field; field = field->next, index++)
+			{
+				Expression *left = (Expression *)PushStructVarExpression(arena, (Expression *)PushVarExpression(arena, whole), field);
+				Expression *right = (Expression *)PushVarExpression(arena, source->fields[index]);
+				*link = PushSroaAssign(sroa, left, right);
+				link = &(*link)->next;
+			}
+		}
+	}
+
+	return first;
+}
+
+static void decl SplitSroaBlock(Sroa *, BlockInstruction *);
+
+static void
+func SplitSroaInInstruction(Sroa *sroa, Instruction *instruction)
+{
+	Expression **e = 0;
+	for(size_t i = 0; (e = GetInstructionExpression(instruction, i)) != 0; i++)
+		ReplaceSroaFields(sroa, e);
+
+	switch(instruction->id)
+	{
+		case BlockInstructionId:
+		{
+			SplitSroaBlock(sroa, (BlockInstruction *)instruction);
+			break;
+		}
+		case IfInstructionId:
+		{
+			SplitSroaBlock(sroa, ((IfInstruction *)instruction)->body);
+			break;
+		}
+		case ForInstructionId:
+		{
+			ForInstruction *i = (ForInstruction *)instruction;
+			SplitSroaInInstruction(sroa, i->init);
+			if(i->update)
+				SplitSroaInInstruction(sroa, i->update);
+			SplitSroaBlock(sroa, i->body);
+			break;
+		}
+		default:
+		{
+			break;
+		}
+	}
+}
+
+static void
+func SplitSroaBlock(Sroa *sroa, BlockInstruction *block)
+{
+	Instruction **link = &block->first;
+	while(*link)
+	{
+		Instruction *instruction = *link;
+		Instruction *first = SplitSroaInstruction(sroa, instruction);
+		if(first)
+		{
+			Instruction *last = first;
+			while(last->next)
+				last = last->next;
+
+			last->next = instruction->next;
+			*link = first;
+			SetMissingOffsets(first, instruction->next, instruction->offset);
+			link = &last->next;
+		}
+		else
+		{
+			SplitSroaInInstruction(sroa, instruction);
+			link = &instruction->next;
+		}
+	}
+}
+
+static void
+func SplitStructVars(Sroa *sroa, BlockInstruction *body)
+{
+	sroa->current_stamp++;
+	sroa->first_var = 0;
+
+	CollectSroaVars(sroa, (Instruction *)body);
+	if(!sroa->first_var)
+		return;
+
+	CheckSroaInstruction(sroa, (Instruction *)body, false);
+
+	bool any_split = false;
+	for(SroaVar *var = sroa->first_var; var; var = var->next)
+	{
+		if(var->split)
+		{
+			CreateSroaFields(sroa, var);
+			sroa->split_n++;
+			sroa->scalar_n += var->field_n;
+			any_split = true;
+		}
+	}
+
+	if(any_split)
+		SplitSroaBlock(sroa, body);
+}
+
+static void
+func SplitStructVarsInDefinitionList(ParseInput *input, DefinitionList *def_list, bool report)
+{
+	Sroa *sroa = ArenaPushType(&input->arena, Sroa);
+	*sroa = (Sroa){};
+	sroa->input = input;
+	sroa->cloner.input = input;
+
+	if(report)
+		printf("Scalar replacement:\n");
+
+	for(DefinitionListElem *elem = def_list; elem; elem = elem->next)
+	{
+		Definition *definition = elem->definition;
+		BlockInstruction *body = 0;
+		Token name = {};
+		if(definition->id == FuncDefinitionId && !((FuncDefinition *)definition)->is_extern)
+		{
+			body = ((FuncDefinition *)definition)->body;
+			name = ((FuncDefinition *)definition)->header.name;
+		}
+		else if(definition->id == OperatorDefinitionId)
+		{
+			body = ((OperatorDefinition *)definition)->body;
+			name = ((OperatorDefinition *)definition)->name;
+		}
+
+		if(!body)
+			continue;
+
+		size_t split_n = sroa->split_n;
+		size_t scalar_n = sroa->scalar_n;
+		SplitStructVars(sroa, body);
+
+		if(report && sroa->split_n != split_n)
+		{
+			Atom *atom = &input->atoms.atoms[name.value];
+			printf("  %.*s: %zu struct variables split into %zu scalars\n",
+			       (int)atom->length, atom->text, sroa->split_n - split_n, sroa->scalar_n - scalar_n);
+		}
+	}
+
+	if(report)
+		printf("Split %zu struct variables into %zu scalars.\n", sroa->split_n, sroa->scalar_n);
+
+	free(sroa->vars);
+	free(sroa->stamp);
+}
@@ -1,3 +1,16 @@
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#define M64_SSE2
+#endif
+
+#ifndef M64_RESTRICT
+#if defined(__cplusplus) || defined(_MSC_VER)
+#define M64_RESTRICT __restrict
+#else
+#define M64_RESTRICT restrict
+#endif
+#endif
+
 typedef struct Bitmap
 {
     unsigned int *memory;
@@ -5,23 +18,44 @@ typedef struct Bitmap
     int height;
 } Bitmap;
 
-void FillWithColor(Bitmap *bitmap, unsigned int color)
+#line 8 "Test/Code.m64"
+static inline void FillWithColor(const Bitmap *M64_RESTRICT bitmap, unsigned int color)
 {
     unsigned int *pixel = bitmap->memory;
-    for(int row = 0; row < bitmap->height; row++)
+    int height_1 = bitmap->height;
+#line 11 "Test/Code.m64"
+    for(int row = 0; row < height_1; row++)
     {
-        for(int col = 0; col < bitmap->width; col++)
+        int width_2 = bitmap->width;
+#line 13 "Test/Code.m64"
         {
-            *pixel = color;
-            pixel++;
+            int col = 0;
+#ifdef M64_SSE2
+            {
+                for(; (long long)width_2 - col >= 4; col += 4)
+                {
+                    _mm_storeu_si128((__m128i *)pixel, _mm_set1_epi32((int)color));
+                    pixel += 4;
+                }
+            }
+#endif
+            for(; col < width_2; col++)
+            {
+#line 15 "Test/Code.m64"
+                *pixel = color;
+                pixel++;
+            }
         }
     }
 }
+#line 52 "Test/Code.h"
 
-void SetPixelColor(Bitmap *bitmap, int row, int col, unsigned int color)
+#line 21 "Test/Code.m64"
+static inline void SetPixelColor(const Bitmap *M64_RESTRICT bitmap, int row, int col, unsigned int color)
 {
     bitmap->memory[row * bitmap->width + col] = color;
 }
+#line 59 "Test/Code.h"
 
 typedef struct float2
 {
@@ -34,75 +68,276 @@ typedef struct Quad2
     float2 p[4];
 } Quad2;
 
-float2 float2_xy(float x, float y)
+#line 36 "Test/Code.m64"
+static inline float2 float2_xy(float x, float y)
 {
     float2 result = {};
     result.x = x;
     result.y = y;
     return result;
 }
+#line 80 "Test/Code.h"
 
-float2 TurnToRight(float2 v)
+#line 44 "Test/Code.m64"
+static inline float2 TurnToRight(float2 v)
 {
-    return float2_xy(-v.y, v.x);
+    float x_1 = -v.y;
+#line 46 "Test/Code.m64"
+    float y_2 = v.x;
+#line 38 "Test/Code.m64"
+    float2 result_3 = {};
+    result_3.x = x_1;
+    result_3.y = y_2;
+#line 46 "Test/Code.m64"
+    return result_3;
 }
+#line 95 "Test/Code.h"
 
-float2 mul_float_float2(float x, float2 v)
+#line 49 "Test/Code.m64"
+static inline float2 mul_float_float2(float x, float2 v)
 {
-    return float2_xy(x * v.x, x * v.y);
+    float x_4 = x * v.x;
+#line 51 "Test/Code.m64"
+    float y_5 = x * v.y;
+#line 38 "Test/Code.m64"
+    float2 result_6 = {};
+    result_6.x = x_4;
+    result_6.y = y_5;
+#line 51 "Test/Code.m64"
+    return result_6;
 }
+#line 110 "Test/Code.h"
 
-float2 sub_float2(float2 p1, float2 p2)
+#line 54 "Test/Code.m64"
+static inline float2 sub_float2(float2 p1, float2 p2)
 {
-    return float2_xy(p1.x - p2.x, p1.y - p2.y);
+    float x_7 = p1.x - p2.x;
+#line 56 "Test/Code.m64"
+    float y_8 = p1.y - p2.y;
+#line 38 "Test/Code.m64"
+    float2 result_9 = {};
+    result_9.x = x_7;
+    result_9.y = y_8;
+#line 56 "Test/Code.m64"
+    return result_9;
 }
+#line 125 "Test/Code.h"
 
-float2 add_float2(float2 p1, float2 p2)
+#line 59 "Test/Code.m64"
+static inline float2 add_float2(float2 p1, float2 p2)
 {
-    return float2_xy(p1.x + p2.x, p1.y + p2.y);
+    float x_10 = p1.x + p2.x;
+#line 61 "Test/Code.m64"
+    float y_11 = p1.y + p2.y;
+#line 38 "Test/Code.m64"
+    float2 result_12 = {};
+    result_12.x = x_10;
+    result_12.y = y_11;
+#line 61 "Test/Code.m64"
+    return result_12;
 }
+#line 140 "Test/Code.h"
 
-Quad2 GetRotatedQuadAroundPoint(float2 center, float2 cos_sin, float2 size)
+#line 64 "Test/Code.m64"
+static inline Quad2 GetRotatedQuadAroundPoint(float2 center, float2 cos_sin, float2 size)
 {
     Quad2 q = {};
-    float2 y_dir = cos_sin;
-    float2 x_dir = TurnToRight(cos_sin);
-    float2 to_y = mul_float_float2((0.5f * size.y), y_dir);
-    float2 to_x = mul_float_float2((0.5f * size.x), x_dir);
-    float2 top = add_float2(center, to_y);
-    float2 bottom = sub_float2(center, to_y);
-    q.p[0] = add_float2(top, to_x);
-    q.p[1] = sub_float2(top, to_x);
-    q.p[2] = sub_float2(bottom, to_x);
-    q.p[3] = add_float2(bottom, to_x);
+#line 68 "Test/Code.m64"
+    float y_dir_x = cos_sin.x;
+#line 68 "Test/Code.m64"
+    float y_dir_y = cos_sin.y;
+#line 46 "Test/Code.m64"
+    float x_1_13 = -cos_sin.y;
+#line 46 "Test/Code.m64"
+    float y_2_14 = cos_sin.x;
+#line 38 "Test/Code.m64"
+    float result_3_15_x = 0.0f;
+#line 38 "Test/Code.m64"
+    float result_3_15_y = 0.0f;
+    result_3_15_x = x_1_13;
+    result_3_15_y = y_2_14;
+#line 69 "Test/Code.m64"
+    float x_dir_x = result_3_15_x;
+#line 69 "Test/Code.m64"
+    float x_dir_y = result_3_15_y;
+#line 71 "Test/Code.m64"
+    float x_16 = (0.5f * size.y);
+#line 51 "Test/Code.m64"
+    float x_4_17 = x_16 * y_dir_x;
+#line 51 "Test/Code.m64"
+    float y_5_18 = x_16 * y_dir_y;
+#line 38 "Test/Code.m64"
+    float result_6_19_x = 0.0f;
+#line 38 "Test/Code.m64"
+    float result_6_19_y = 0.0f;
+    result_6_19_x = x_4_17;
+    result_6_19_y = y_5_18;
+#line 71 "Test/Code.m64"
+    float to_y_x = result_6_19_x;
+#line 71 "Test/Code.m64"
+    float to_y_y = result_6_19_y;
+    float x_20 = (0.5f * size.x);
+#line 51 "Test/Code.m64"
+    float x_4_21 = x_20 * x_dir_x;
+#line 51 "Test/Code.m64"
+    float y_5_22 = x_20 * x_dir_y;
+#line 38 "Test/Code.m64"
+    float result_6_23_x = 0.0f;
+#line 38 "Test/Code.m64"
+    float result_6_23_y = 0.0f;
+    result_6_23_x = x_4_21;
+    result_6_23_y = y_5_22;
+#line 72 "Test/Code.m64"
+    float to_x_x = result_6_23_x;
+#line 72 "Test/Code.m64"
+    float to_x_y = result_6_23_y;
+#line 61 "Test/Code.m64"
+    float x_10_24 = center.x + to_y_x;
+#line 61 "Test/Code.m64"
+    float y_11_25 = center.y + to_y_y;
+#line 38 "Test/Code.m64"
+    float result_12_26_x = 0.0f;
+#line 38 "Test/Code.m64"
+    float result_12_26_y = 0.0f;
+    result_12_26_x = x_10_24;
+    result_12_26_y = y_11_25;
+#line 74 "Test/Code.m64"
+    float top_x = result_12_26_x;
+#line 74 "Test/Code.m64"
+    float top_y = result_12_26_y;
+#line 56 "Test/Code.m64"
+    float x_7_27 = center.x - to_y_x;
+#line 56 "Test/Code.m64"
+    float y_8_28 = center.y - to_y_y;
+#line 38 "Test/Code.m64"
+    float result_9_29_x = 0.0f;
+#line 38 "Test/Code.m64"
+    float result_9_29_y = 0.0f;
+    result_9_29_x = x_7_27;
+    result_9_29_y = y_8_28;
+#line 75 "Test/Code.m64"
+    float bottom_x = result_9_29_x;
+#line 75 "Test/Code.m64"
+    float bottom_y = result_9_29_y;
+#line 61 "Test/Code.m64"
+    float x_10_30 = top_x + to_x_x;
+#line 61 "Test/Code.m64"
+    float y_11_31 = top_y + to_x_y;
+#line 38 "Test/Code.m64"
+    float result_12_32_x = 0.0f;
+#line 38 "Test/Code.m64"
+    float result_12_32_y = 0.0f;
+    result_12_32_x = x_10_30;
+    result_12_32_y = y_11_31;
+#line 77 "Test/Code.m64"
+    q.p[0].x = result_12_32_x;
+#line 77 "Test/Code.m64"
+    q.p[0].y = result_12_32_y;
+#line 56 "Test/Code.m64"
+    float x_7_33 = top_x - to_x_x;
+#line 56 "Test/Code.m64"
+    float y_8_34 = top_y - to_x_y;
+#line 38 "Test/Code.m64"
+    float result_9_35_x = 0.0f;
+#line 38 "Test/Code.m64"
+    float result_9_35_y = 0.0f;
+    result_9_35_x = x_7_33;
+    result_9_35_y = y_8_34;
+#line 78 "Test/Code.m64"
+    q.p[1].x = result_9_35_x;
+#line 78 "Test/Code.m64"
+    q.p[1].y = result_9_35_y;
+#line 56 "Test/Code.m64"
+    float x_7_36 = bottom_x - to_x_x;
+#line 56 "Test/Code.m64"
+    float y_8_37 = bottom_y - to_x_y;
+#line 38 "Test/Code.m64"
+    float result_9_38_x = 0.0f;
+#line 38 "Test/Code.m64"
+    float result_9_38_y = 0.0f;
+    result_9_38_x = x_7_36;
+    result_9_38_y = y_8_37;
+#line 79 "Test/Code.m64"
+    q.p[2].x = result_9_38_x;
+#line 79 "Test/Code.m64"
+    q.p[2].y = result_9_38_y;
+#line 61 "Test/Code.m64"
+    float x_10_39 = bottom_x + to_x_x;
+#line 61 "Test/Code.m64"
+    float y_11_40 = bottom_y + to_x_y;
+#line 38 "Test/Code.m64"
+    float result_12_41_x = 0.0f;
+#line 38 "Test/Code.m64"
+    float result_12_41_y = 0.0f;
+    result_12_41_x = x_10_39;
+    result_12_41_y = y_11_40;
+#line 80 "Test/Code.m64"
+    q.p[3].x = result_12_41_x;
+#line 80 "Test/Code.m64"
+    q.p[3].y = result_12_41_y;
+#line 82 "Test/Code.m64"
     return q;
 }
+#line 282 "Test/Code.h"
 
-int TurnsRight(float2 p0, float2 p1, float2 p2)
+#line 85 "Test/Code.m64"
+static int TurnsRight(float2 p0, float2 p1, float2 p2)
 {
-    float2 d0 = sub_float2(p1, p0);
-    float2 d1 = sub_float2(p2, p0);
-    float det = (d0.x * d1.y) - (d0.y * d1.x);
+#line 56 "Test/Code.m64"
+    float x_7_42 = p1.x - p0.x;
+#line 56 "Test/Code.m64"
+    float y_8_43 = p1.y - p0.y;
+#line 38 "Test/Code.m64"
+    float result_9_44_x = 0.0f;
+#line 38 "Test/Code.m64"
+    float result_9_44_y = 0.0f;
+    result_9_44_x = x_7_42;
+    result_9_44_y = y_8_43;
+#line 87 "Test/Code.m64"
+    float d0_x = result_9_44_x;
+#line 87 "Test/Code.m64"
+    float d0_y = result_9_44_y;
+#line 56 "Test/Code.m64"
+    float x_7_45 = p2.x - p0.x;
+#line 56 "Test/Code.m64"
+    float y_8_46 = p2.y - p0.y;
+#line 38 "Test/Code.m64"
+    float result_9_47_x = 0.0f;
+#line 38 "Test/Code.m64"
+    float result_9_47_y = 0.0f;
+    result_9_47_x = x_7_45;
+    result_9_47_y = y_8_46;
+#line 88 "Test/Code.m64"
+    float d1_x = result_9_47_x;
+#line 88 "Test/Code.m64"
+    float d1_y = result_9_47_y;
+#line 90 "Test/Code.m64"
+    float det = (d0_x * d1_y) - (d0_y * d1_x);
     int turns_right = (det < 0.0f);
     return turns_right;
 }
+#line 320 "Test/Code.h"
 
-int IsPointInQuad2(float2 p, Quad2 q)
+#line 95 "Test/Code.m64"
+static int IsPointInQuad2(float2 p, const Quad2 *q)
 {
     int is_inside = 1;
-    is_inside &= TurnsRight(q.p[0], q.p[1], p);
-    is_inside &= TurnsRight(q.p[1], q.p[2], p);
-    is_inside &= TurnsRight(q.p[2], q.p[3], p);
-    is_inside &= TurnsRight(q.p[3], q.p[0], p);
+    is_inside &= TurnsRight((*q).p[0], (*q).p[1], p);
+    is_inside &= TurnsRight((*q).p[1], (*q).p[2], p);
+    is_inside &= TurnsRight((*q).p[2], (*q).p[3], p);
+    is_inside &= TurnsRight((*q).p[3], (*q).p[0], p);
     return is_inside;
 }
+#line 332 "Test/Code.h"
 
-void DrawQuad2(Bitmap *bitmap, Quad2 quad, unsigned int color)
+#line 105 "Test/Code.m64"
+static void DrawQuad2(const Bitmap *bitmap, Quad2 quad, unsigned int color)
 {
     float min_x = quad.p[0].x;
     float max_x = quad.p[0].x;
     float min_y = quad.p[0].y;
     float max_y = quad.p[0].y;
+#line 112 "Test/Code.m64"
     for(int i = 1; i < 4; i++)
     {
         float x = quad.p[i].x;
@@ -124,20 +359,46 @@ void DrawQuad2(Bitmap *bitmap, Quad2 quad, unsigned int color)
             max_y = y;
         }
     }
-    for(int row = (int)min_y; row < (int)max_y + 1; row++)
+#line 134 "Test/Code.m64"
+    int t_3 = (int)max_y + 1;
+#line 134 "Test/Code.m64"
+    int t_4 = (int)min_x;
+#line 134 "Test/Code.m64"
+    int t_5 = (int)max_x + 1;
+#line 134 "Test/Code.m64"
+    for(int row = (int)min_y; row < t_3; row++)
     {
-        for(int col = (int)min_x; col < (int)max_x + 1; col++)
+        float t_6 = (float)row;
+#line 136 "Test/Code.m64"
+        for(int col = t_4; col < t_5; col++)
         {
-            float2 p = float2_xy((float)col, (float)row);
-            if(IsPointInQuad2(p, quad))
+            float x_48 = (float)col;
+#line 138 "Test/Code.m64"
+            float y_49 = t_6;
+#line 38 "Test/Code.m64"
+            float result_50_x = 0.0f;
+#line 38 "Test/Code.m64"
+            float result_50_y = 0.0f;
+            result_50_x = x_48;
+            result_50_y = y_49;
+#line 138 "Test/Code.m64"
+            float2 p = {};
+#line 138 "Test/Code.m64"
+            p.x = result_50_x;
+#line 138 "Test/Code.m64"
+            p.y = result_50_y;
+            if(IsPointInQuad2(p, &quad))
             {
-                SetPixelColor(bitmap, row, col, color);
+#line 23 "Test/Code.m64"
+                bitmap->memory[row * bitmap->width + col] = color;
             }
         }
     }
 }
+#line 399 "Test/Code.h"
 
-void DrawRectMinMax(Bitmap *bitmap, int min_row, int min_col, int max_row, int max_col, unsigned int color)
+#line 147 "Test/Code.m64"
+static inline void DrawRectMinMax(const Bitmap *M64_RESTRICT bitmap, int min_row, int min_col, int max_row, int max_col, unsigned int color)
 {
     for(int row = min_row; row <= max_row; row++)
     {
@@ -148,6 +409,7 @@ void DrawRectMinMax(Bitmap *bitmap, int min_row, int min_col, int max_row, int m
         }
     }
 }
+#line 413 "Test/Code.h"
 
 typedef struct Input
 {
@@ -155,7 +417,8 @@ typedef struct Input
     float time;
 } Input;
 
-float Min2(float x, float y)
+#line 165 "Test/Code.m64"
+static inline float Min2(float x, float y)
 {
     if(x < y)
     {
@@ -163,6 +426,7 @@ float Min2(float x, float y)
     }
     return y;
 }
+#line 430 "Test/Code.h"
 
 float cosf(float x);
 
@@ -175,7 +439,8 @@ typedef struct float3
     float z;
 } float3;
 
-float3 float3_xyz(float x, float y, float z)
+#line 182 "Test/Code.m64"
+static inline float3 float3_xyz(float x, float y, float z)
 {
     float3 r = {};
     r.x = x;
@@ -183,23 +448,51 @@ float3 float3_xyz(float x, float y, float z)
     r.z = z;
     return r;
 }
+#line 452 "Test/Code.h"
 
-float3 add_float3(float3 p1, float3 p2)
+#line 191 "Test/Code.m64"
+static inline float3 add_float3(float3 p1, float3 p2)
 {
-    return float3_xyz(p1.x + p2.x, p1.y + p2.y, p1.z + p2.z);
+    float x_51 = p1.x + p2.x;
+#line 193 "Test/Code.m64"
+    float y_52 = p1.y + p2.y;
+#line 193 "Test/Code.m64"
+    float z_53 = p1.z + p2.z;
+#line 184 "Test/Code.m64"
+    float3 r_54 = {};
+    r_54.x = x_51;
+    r_54.y = y_52;
+    r_54.z = z_53;
+#line 193 "Test/Code.m64"
+    return r_54;
 }
+#line 470 "Test/Code.h"
 
-float3 sub_float3(float3 p1, float3 p2)
+#line 196 "Test/Code.m64"
+static inline float3 sub_float3(float3 p1, float3 p2)
 {
-    return float3_xyz(p1.x - p2.x, p1.y - p2.y, p1.z - p2.z);
+    float x_55 = p1.x - p2.x;
+#line 198 "Test/Code.m64"
+    float y_56 = p1.y - p2.y;
+#line 198 "Test/Code.m64"
+    float z_57 = p1.z - p2.z;
+#line 184 "Test/Code.m64"
+    float3 r_58 = {};
+    r_58.x = x_55;
+    r_58.y = y_56;
+    r_58.z = z_57;
+#line 198 "Test/Code.m64"
+    return r_58;
 }
+#line 488 "Test/Code.h"
 
 typedef struct float3x3
 {
     float v[3][3];
 } float3x3;
 
-float3x3 float3x3_v(float v00, float v01, float v02, float v10, float v11, float v12, float v20, float v21, float v22)
+#line 206 "Test/Code.m64"
+static float3x3 float3x3_v(float v00, float v01, float v02, float v10, float v11, float v12, float v20, float v21, float v22)
 {
     float3x3 m = {};
     m.v[0][0] = v00;
@@ -213,17 +506,21 @@ float3x3 float3x3_v(float v00, float v01, float v02, float v10, float v11, float
     m.v[2][2] = v22;
     return m;
 }
+#line 510 "Test/Code.h"
 
-float3 transform3(float3x3 m, float3 v)
+#line 221 "Test/Code.m64"
+static float3 transform3(const float3x3 *m, float3 v)
 {
     float3 result = {};
-    result.x = m.v[0][0] * v.x + m.v[0][1] * v.y + m.v[0][2] * v.z;
-    result.y = m.v[1][0] * v.x + m.v[1][1] * v.y + m.v[1][2] * v.z;
-    result.z = m.v[2][0] * v.x + m.v[2][1] * v.y + m.v[2][2] * v.z;
+    result.x = m->v[0][0] * v.x + m->v[0][1] * v.y + m->v[0][2] * v.z;
+    result.y = m->v[1][0] * v.x + m->v[1][1] * v.y + m->v[1][2] * v.z;
+    result.z = m->v[2][0] * v.x + m->v[2][1] * v.y + m->v[2][2] * v.z;
     return result;
 }
+#line 521 "Test/Code.h"
 
-float3 float3_xy_z(float2 xy, float z)
+#line 230 "Test/Code.m64"
+static inline float3 float3_xy_z(float2 xy, float z)
 {
     float3 r = {};
     r.x = xy.x;
@@ -231,57 +528,646 @@ float3 float3_xy_z(float2 xy, float z)
     r.z = z;
     return r;
 }
+#line 532 "Test/Code.h"
 
-float3x3 GetRotationAroundY(float2 cos_sin)
+#line 239 "Test/Code.m64"
+static inline float3x3 GetRotationAroundY(float2 cos_sin)
 {
     float c = cos_sin.x;
     float s = cos_sin.y;
+#line 244 "Test/Code.m64"
     float3x3 tm = float3x3_v(c, 0.0f, s, 0.0f, 1.0f, 0.0f, -s, 0.0f, c);
+#line 251 "Test/Code.m64"
     return tm;
 }
+#line 544 "Test/Code.h"
 
-float2 ToXY(float3 v)
+#line 254 "Test/Code.m64"
+static inline float2 ToXY(float3 v)
 {
-    return float2_xy(v.x, v.y);
+    float x_59 = v.x;
+#line 256 "Test/Code.m64"
+    float y_60 = v.y;
+#line 38 "Test/Code.m64"
+    float2 result_61 = {};
+    result_61.x = x_59;
+    result_61.y = y_60;
+#line 256 "Test/Code.m64"
+    return result_61;
 }
+#line 559 "Test/Code.h"
 
-void DrawQuad3(Bitmap *bitmap, float3 v1, float3 v2, float3 v3, float3 v4, unsigned int color)
+#line 259 "Test/Code.m64"
+static void DrawQuad3(const Bitmap *bitmap, float3 v1, float3 v2, float3 v3, float3 v4, unsigned int color)
 {
     Quad2 quad = {};
-    quad.p[0] = ToXY(v1);
-    quad.p[1] = ToXY(v2);
-    quad.p[2] = ToXY(v3);
-    quad.p[3] = ToXY(v4);
+#line 256 "Test/Code.m64"
+    float x_59_62 = v1.x;
+#line 256 "Test/Code.m64"
+    float y_60_63 = v1.y;
+#line 38 "Test/Code.m64"
+    float result_61_64_x = 0.0f;
+#line 38 "Test/Code.m64"
+    float result_61_64_y = 0.0f;
+    result_61_64_x = x_59_62;
+    result_61_64_y = y_60_63;
+#line 262 "Test/Code.m64"
+    quad.p[0].x = result_61_64_x;
+#line 262 "Test/Code.m64"
+    quad.p[0].y = result_61_64_y;
+#line 256 "Test/Code.m64"
+    float x_59_65 = v2.x;
+#line 256 "Test/Code.m64"
+    float y_60_66 = v2.y;
+#line 38 "Test/Code.m64"
+    float result_61_67_x = 0.0f;
+#line 38 "Test/Code.m64"
+    float result_61_67_y = 0.0f;
+    result_61_67_x = x_59_65;
+    result_61_67_y = y_60_66;
+#line 263 "Test/Code.m64"
+    quad.p[1].x = result_61_67_x;
+#line 263 "Test/Code.m64"
+    quad.p[1].y = result_61_67_y;
+#line 256 "Test/Code.m64"
+    float x_59_68 = v3.x;
+#line 256 "Test/Code.m64"
+    float y_60_69 = v3.y;
+#line 38 "Test/Code.m64"
+    float result_61_70_x = 0.0f;
+#line 38 "Test/Code.m64"
+    float result_61_70_y = 0.0f;
+    result_61_70_x = x_59_68;
+    result_61_70_y = y_60_69;
+#line 264 "Test/Code.m64"
+    quad.p[2].x = result_61_70_x;
+#line 264 "Test/Code.m64"
+    quad.p[2].y = result_61_70_y;
+#line 256 "Test/Code.m64"
+    float x_59_71 = v4.x;
+#line 256 "Test/Code.m64"
+    float y_60_72 = v4.y;
+#line 38 "Test/Code.m64"
+    float result_61_73_x = 0.0f;
+#line 38 "Test/Code.m64"
+    float result_61_73_y = 0.0f;
+    result_61_73_x = x_59_71;
+    result_61_73_y = y_60_72;
+#line 265 "Test/Code.m64"
+    quad.p[3].x = result_61_73_x;
+#line 265 "Test/Code.m64"
+    quad.p[3].y = result_61_73_y;
     DrawQuad2(bitmap, quad, color);
 }
+#line 623 "Test/Code.h"
 
-void Update3D(Input *input, Bitmap *bitmap)
+#line 269 "Test/Code.m64"
+static void Update3D(const Input *input, const Bitmap *bitmap)
 {
-    FillWithColor(bitmap, (unsigned int)0);
+    unsigned int color_74 = (unsigned int)0;
+#line 10 "Test/Code.m64"
+    unsigned int *pixel_75 = bitmap->memory;
+    for(int row_76 = 0; row_76 < bitmap->height; row_76++)
+    {
+        for(int col_77 = 0; col_77 < bitmap->width; col_77++)
+        {
+            *pixel_75 = color_74;
+            pixel_75++;
+        }
+    }
+#line 273 "Test/Code.m64"
     float min_side = 0.5f * Min2(input->screen_size.x, input->screen_size.y);
-    float2 mid = mul_float_float2(0.5f, input->screen_size);
-    float3 cube_center = float3_xy_z(mid, 0.0f);
+#line 275 "Test/Code.m64"
+    float x_78 = 0.5f;
+#line 275 "Test/Code.m64"
+    float v_79_x = input->screen_size.x;
+#line 275 "Test/Code.m64"
+    float v_79_y = input->screen_size.y;
+#line 51 "Test/Code.m64"
+    float x_4_80 = x_78 * v_79_x;
+#line 51 "Test/Code.m64"
+    float y_5_81 = x_78 * v_79_y;
+#line 38 "Test/Code.m64"
+    float result_6_82_x = 0.0f;
+#line 38 "Test/Code.m64"
+    float result_6_82_y = 0.0f;
+    result_6_82_x = x_4_80;
+    result_6_82_y = y_5_81;
+#line 275 "Test/Code.m64"
+    float mid_x = result_6_82_x;
+#line 275 "Test/Code.m64"
+    float mid_y = result_6_82_y;
+#line 277 "Test/Code.m64"
+    float z_83 = 0.0f;
+#line 232 "Test/Code.m64"
+    float r_84_x = 0.0f;
+#line 232 "Test/Code.m64"
+    float r_84_y = 0.0f;
+#line 232 "Test/Code.m64"
+    float r_84_z = 0.0f;
+    r_84_x = mid_x;
+    r_84_y = mid_y;
+    r_84_z = z_83;
+#line 277 "Test/Code.m64"
+    float cube_center_x = r_84_x;
+#line 277 "Test/Code.m64"
+    float cube_center_y = r_84_y;
+#line 277 "Test/Code.m64"
+    float cube_center_z = r_84_z;
     float cube_side = min_side;
-    float2 cos_sin = float2_xy(cosf(input->time), sinf(input->time));
-    float3x3 rot_tm = GetRotationAroundY(cos_sin);
-    float3 x_side = transform3(rot_tm, float3_xyz(0.5f * min_side, 0.0f, 0.0f));
-    float3 y_side = transform3(rot_tm, float3_xyz(0.0f, 0.5f * min_side, 0.0f));
-    float3 z_side = transform3(rot_tm, float3_xyz(0.0f, 0.0f, 0.5f * min_side));
-    float3 corner_ldf = sub_float3(sub_float3(sub_float3(cube_center, x_side), y_side), z_side);
-    float3 corner_ldb = add_float3(sub_float3(sub_float3(cube_center, x_side), y_side), z_side);
-    float3 corner_luf = sub_float3(add_float3(sub_float3(cube_center, x_side), y_side), z_side);
-    float3 corner_lub = add_float3(add_float3(sub_float3(cube_center, x_side), y_side), z_side);
-    float3 corner_rdf = sub_float3(sub_float3(add_float3(cube_center, x_side), y_side), z_side);
-    float3 corner_rdb = add_float3(sub_float3(add_float3(cube_center, x_side), y_side), z_side);
-    float3 corner_ruf = sub_float3(add_float3(add_float3(cube_center, x_side), y_side), z_side);
-    float3 corner_rub = add_float3(add_float3(add_float3(cube_center, x_side), y_side), z_side);
-    DrawQuad3(bitmap, corner_luf, corner_ruf, corner_rdf, corner_ldf, (unsigned int)0x00FF00);
-    DrawQuad3(bitmap, corner_ruf, corner_rub, corner_rdb, corner_rdf, (unsigned int)0xFF8800);
-    DrawQuad3(bitmap, corner_rub, corner_lub, corner_ldb, corner_rdb, (unsigned int)0x0000FF);
-    DrawQuad3(bitmap, corner_lub, corner_luf, corner_ldf, corner_ldb, (unsigned int)0xFF0000);
+#line 280 "Test/Code.m64"
+    float x_85 = cosf(input->time);
+#line 280 "Test/Code.m64"
+    float y_86 = sinf(input->time);
+#line 38 "Test/Code.m64"
+    float result_87_x = 0.0f;
+#line 38 "Test/Code.m64"
+    float result_87_y = 0.0f;
+    result_87_x = x_85;
+    result_87_y = y_86;
+#line 280 "Test/Code.m64"
+    float cos_sin_x = result_87_x;
+#line 280 "Test/Code.m64"
+    float cos_sin_y = result_87_y;
+#line 241 "Test/Code.m64"
+    float c_88 = cos_sin_x;
+    float s_89 = cos_sin_y;
+#line 244 "Test/Code.m64"
+    float3x3 tm_90 = float3x3_v(c_88, 0.0f, s_89, 0.0f, 1.0f, 0.0f, -s_89, 0.0f, c_88);
+#line 281 "Test/Code.m64"
+    float3x3 rot_tm = tm_90;
+#line 283 "Test/Code.m64"
+    float x_91 = 0.5f * min_side;
+#line 283 "Test/Code.m64"
+    float y_92 = 0.0f;
+#line 283 "Test/Code.m64"
+    float z_93 = 0.0f;
+#line 184 "Test/Code.m64"
+    float3 r_94 = {};
+    r_94.x = x_91;
+    r_94.y = y_92;
+    r_94.z = z_93;
+#line 283 "Test/Code.m64"
+    float3 x_side = transform3(&rot_tm, r_94);
+    float x_95 = 0.0f;
+#line 284 "Test/Code.m64"
+    float y_96 = 0.5f * min_side;
+#line 284 "Test/Code.m64"
+    float z_97 = 0.0f;
+#line 184 "Test/Code.m64"
+    float3 r_98 = {};
+    r_98.x = x_95;
+    r_98.y = y_96;
+    r_98.z = z_97;
+#line 284 "Test/Code.m64"
+    float3 y_side = transform3(&rot_tm, r_98);
+    float x_99 = 0.0f;
+#line 285 "Test/Code.m64"
+    float y_100 = 0.0f;
+#line 285 "Test/Code.m64"
+    float z_101 = 0.5f * min_side;
+#line 184 "Test/Code.m64"
+    float3 r_102 = {};
+    r_102.x = x_99;
+    r_102.y = y_100;
+    r_102.z = z_101;
+#line 285 "Test/Code.m64"
+    float3 z_side = transform3(&rot_tm, r_102);
+#line 198 "Test/Code.m64"
+    float x_55_103 = cube_center_x - x_side.x;
+#line 198 "Test/Code.m64"
+    float y_56_104 = cube_center_y - x_side.y;
+#line 198 "Test/Code.m64"
+    float z_57_105 = cube_center_z - x_side.z;
+#line 184 "Test/Code.m64"
+    float r_58_106_x = 0.0f;
+#line 184 "Test/Code.m64"
+    float r_58_106_y = 0.0f;
+#line 184 "Test/Code.m64"
+    float r_58_106_z = 0.0f;
+    r_58_106_x = x_55_103;
+    r_58_106_y = y_56_104;
+    r_58_106_z = z_57_105;
+#line 198 "Test/Code.m64"
+    float x_55_107 = r_58_106_x - y_side.x;
+#line 198 "Test/Code.m64"
+    float y_56_108 = r_58_106_y - y_side.y;
+#line 198 "Test/Code.m64"
+    float z_57_109 = r_58_106_z - y_side.z;
+#line 184 "Test/Code.m64"
+    float r_58_110_x = 0.0f;
+#line 184 "Test/Code.m64"
+    float r_58_110_y = 0.0f;
+#line 184 "Test/Code.m64"
+    float r_58_110_z = 0.0f;
+    r_58_110_x = x_55_107;
+    r_58_110_y = y_56_108;
+    r_58_110_z = z_57_109;
+#line 198 "Test/Code.m64"
+    float x_55_111 = r_58_110_x - z_side.x;
+#line 198 "Test/Code.m64"
+    float y_56_112 = r_58_110_y - z_side.y;
+#line 198 "Test/Code.m64"
+    float z_57_113 = r_58_110_z - z_side.z;
+#line 184 "Test/Code.m64"
+    float r_58_114_x = 0.0f;
+#line 184 "Test/Code.m64"
+    float r_58_114_y = 0.0f;
+#line 184 "Test/Code.m64"
+    float r_58_114_z = 0.0f;
+    r_58_114_x = x_55_111;
+    r_58_114_y = y_56_112;
+    r_58_114_z = z_57_113;
+#line 287 "Test/Code.m64"
+    float3 corner_ldf = {};
+#line 287 "Test/Code.m64"
+    corner_ldf.x = r_58_114_x;
+#line 287 "Test/Code.m64"
+    corner_ldf.y = r_58_114_y;
+#line 287 "Test/Code.m64"
+    corner_ldf.z = r_58_114_z;
+#line 198 "Test/Code.m64"
+    float x_55_115 = cube_center_x - x_side.x;
+#line 198 "Test/Code.m64"
+    float y_56_116 = cube_center_y - x_side.y;
+#line 198 "Test/Code.m64"
+    float z_57_117 = cube_center_z - x_side.z;
+#line 184 "Test/Code.m64"
+    float r_58_118_x = 0.0f;
+#line 184 "Test/Code.m64"
+    float r_58_118_y = 0.0f;
+#line 184 "Test/Code.m64"
+    float r_58_118_z = 0.0f;
+    r_58_118_x = x_55_115;
+    r_58_118_y = y_56_116;
+    r_58_118_z = z_57_117;
+#line 198 "Test/Code.m64"
+    float x_55_119 = r_58_118_x - y_side.x;
+#line 198 "Test/Code.m64"
+    float y_56_120 = r_58_118_y - y_side.y;
+#line 198 "Test/Code.m64"
+    float z_57_121 = r_58_118_z - y_side.z;
+#line 184 "Test/Code.m64"
+    float r_58_122_x = 0.0f;
+#line 184 "Test/Code.m64"
+    float r_58_122_y = 0.0f;
+#line 184 "Test/Code.m64"
+    float r_58_122_z = 0.0f;
+    r_58_122_x = x_55_119;
+    r_58_122_y = y_56_120;
+    r_58_122_z = z_57_121;
+#line 193 "Test/Code.m64"
+    float x_51_123 = r_58_122_x + z_side.x;
+#line 193 "Test/Code.m64"
+    float y_52_124 = r_58_122_y + z_side.y;
+#line 193 "Test/Code.m64"
+    float z_53_125 = r_58_122_z + z_side.z;
+#line 184 "Test/Code.m64"
+    float r_54_126_x = 0.0f;
+#line 184 "Test/Code.m64"
+    float r_54_126_y = 0.0f;
+#line 184 "Test/Code.m64"
+    float r_54_126_z = 0.0f;
+    r_54_126_x = x_51_123;
+    r_54_126_y = y_52_124;
+    r_54_126_z = z_53_125;
+#line 288 "Test/Code.m64"
+    float3 corner_ldb = {};
+#line 288 "Test/Code.m64"
+    corner_ldb.x = r_54_126_x;
+#line 288 "Test/Code.m64"
+    corner_ldb.y = r_54_126_y;
+#line 288 "Test/Code.m64"
+    corner_ldb.z = r_54_126_z;
+#line 198 "Test/Code.m64"
+    float x_55_127 = cube_center_x - x_side.x;
+#line 198 "Test/Code.m64"
+    float y_56_128 = cube_center_y - x_side.y;
+#line 198 "Test/Code.m64"
+    float z_57_129 = cube_center_z - x_side.z;
+#line 184 "Test/Code.m64"
+    float r_58_130_x = 0.0f;
+#line 184 "Test/Code.m64"
+    float r_58_130_y = 0.0f;
+#line 184 "Test/Code.m64"
+    float r_58_130_z = 0.0f;
+    r_58_130_x = x_55_127;
+    r_58_130_y = y_56_128;
+    r_58_130_z = z_57_129;
+#line 193 "Test/Code.m64"
+    float x_51_131 = r_58_130_x + y_side.x;
+#line 193 "Test/Code.m64"
+    float y_52_132 = r_58_130_y + y_side.y;
+#line 193 "Test/Code.m64"
+    float z_53_133 = r_58_130_z + y_side.z;
+#line 184 "Test/Code.m64"
+    float r_54_134_x = 0.0f;
+#line 184 "Test/Code.m64"
+    float r_54_134_y = 0.0f;
+#line 184 "Test/Code.m64"
+    float r_54_134_z = 0.0f;
+    r_54_134_x = x_51_131;
+    r_54_134_y = y_52_132;
+    r_54_134_z = z_53_133;
+#line 198 "Test/Code.m64"
+    float x_55_135 = r_54_134_x - z_side.x;
+#line 198 "Test/Code.m64"
+    float y_56_136 = r_54_134_y - z_side.y;
+#line 198 "Test/Code.m64"
+    float z_57_137 = r_54_134_z - z_side.z;
+#line 184 "Test/Code.m64"
+    float r_58_138_x = 0.0f;
+#line 184 "Test/Code.m64"
+    float r_58_138_y = 0.0f;
+#line 184 "Test/Code.m64"
+    float r_58_138_z = 0.0f;
+    r_58_138_x = x_55_135;
+    r_58_138_y = y_56_136;
+    r_58_138_z = z_57_137;
+#line 289 "Test/Code.m64"
+    float3 corner_luf = {};
+#line 289 "Test/Code.m64"
+    corner_luf.x = r_58_138_x;
+#line 289 "Test/Code.m64"
+    corner_luf.y = r_58_138_y;
+#line 289 "Test/Code.m64"
+    corner_luf.z = r_58_138_z;
+#line 198 "Test/Code.m64"
+    float x_55_139 = cube_center_x - x_side.x;
+#line 198 "Test/Code.m64"
+    float y_56_140 = cube_center_y - x_side.y;
+#line 198 "Test/Code.m64"
+    float z_57_141 = cube_center_z - x_side.z;
+#line 184 "Test/Code.m64"
+    float r_58_142_x = 0.0f;
+#line 184 "Test/Code.m64"
+    float r_58_142_y = 0.0f;
+#line 184 "Test/Code.m64"
+    float r_58_142_z = 0.0f;
+    r_58_142_x = x_55_139;
+    r_58_142_y = y_56_140;
+    r_58_142_z = z_57_141;
+#line 193 "Test/Code.m64"
+    float x_51_143 = r_58_142_x + y_side.x;
+#line 193 "Test/Code.m64"
+    float y_52_144 = r_58_142_y + y_side.y;
+#line 193 "Test/Code.m64"
+    float z_53_145 = r_58_142_z + y_side.z;
+#line 184 "Test/Code.m64"
+    float r_54_146_x = 0.0f;
+#line 184 "Test/Code.m64"
+    float r_54_146_y = 0.0f;
+#line 184 "Test/Code.m64"
+    float r_54_146_z = 0.0f;
+    r_54_146_x = x_51_143;
+    r_54_146_y = y_52_144;
+    r_54_146_z = z_53_145;
+#line 193 "Test/Code.m64"
+    float x_51_147 = r_54_146_x + z_side.x;
+#line 193 "Test/Code.m64"
+    float y_52_148 = r_54_146_y + z_side.y;
+#line 193 "Test/Code.m64"
+    float z_53_149 = r_54_146_z + z_side.z;
+#line 184 "Test/Code.m64"
+    float r_54_150_x = 0.0f;
+#line 184 "Test/Code.m64"
+    float r_54_150_y = 0.0f;
+#line 184 "Test/Code.m64"
+    float r_54_150_z = 0.0f;
+    r_54_150_x = x_51_147;
+    r_54_150_y = y_52_148;
+    r_54_150_z = z_53_149;
+#line 290 "Test/Code.m64"
+    float3 corner_lub = {};
+#line 290 "Test/Code.m64"
+    corner_lub.x = r_54_150_x;
+#line 290 "Test/Code.m64"
+    corner_lub.y = r_54_150_y;
+#line 290 "Test/Code.m64"
+    corner_lub.z = r_54_150_z;
+#line 193 "Test/Code.m64"
+    float x_51_151 = cube_center_x + x_side.x;
+#line 193 "Test/Code.m64"
+    float y_52_152 = cube_center_y + x_side.y;
+#line 193 "Test/Code.m64"
+    float z_53_153 = cube_center_z + x_side.z;
+#line 184 "Test/Code.m64"
+    float r_54_154_x = 0.0f;
+#line 184 "Test/Code.m64"
+    float r_54_154_y = 0.0f;
+#line 184 "Test/Code.m64"
+    float r_54_154_z = 0.0f;
+    r_54_154_x = x_51_151;
+    r_54_154_y = y_52_152;
+    r_54_154_z = z_53_153;
+#line 198 "Test/Code.m64"
+    float x_55_155 = r_54_154_x - y_side.x;
+#line 198 "Test/Code.m64"
+    float y_56_156 = r_54_154_y - y_side.y;
+#line 198 "Test/Code.m64"
+    float z_57_157 = r_54_154_z - y_side.z;
+#line 184 "Test/Code.m64"
+    float r_58_158_x = 0.0f;
+#line 184 "Test/Code.m64"
+    float r_58_158_y = 0.0f;
+#line 184 "Test/Code.m64"
+    float r_58_158_z = 0.0f;
+    r_58_158_x = x_55_155;
+    r_58_158_y = y_56_156;
+    r_58_158_z = z_57_157;
+#line 198 "Test/Code.m64"
+    float x_55_159 = r_58_158_x - z_side.x;
+#line 198 "Test/Code.m64"
+    float y_56_160 = r_58_158_y - z_side.y;
+#line 198 "Test/Code.m64"
+    float z_57_161 = r_58_158_z - z_side.z;
+#line 184 "Test/Code.m64"
+    float r_58_162_x = 0.0f;
+#line 184 "Test/Code.m64"
+    float r_58_162_y = 0.0f;
+#line 184 "Test/Code.m64"
+    float r_58_162_z = 0.0f;
+    r_58_162_x = x_55_159;
+    r_58_162_y = y_56_160;
+    r_58_162_z = z_57_161;
+#line 291 "Test/Code.m64"
+    float3 corner_rdf = {};
+#line 291 "Test/Code.m64"
+    corner_rdf.x = r_58_162_x;
+#line 291 "Test/Code.m64"
+    corner_rdf.y = r_58_162_y;
+#line 291 "Test/Code.m64"
+    corner_rdf.z = r_58_162_z;
+#line 193 "Test/Code.m64"
+    float x_51_163 = cube_center_x + x_side.x;
+#line 193 "Test/Code.m64"
+    float y_52_164 = cube_center_y + x_side.y;
+#line 193 "Test/Code.m64"
+    float z_53_165 = cube_center_z + x_side.z;
+#line 184 "Test/Code.m64"
+    float r_54_166_x = 0.0f;
+#line 184 "Test/Code.m64"
+    float r_54_166_y = 0.0f;
+#line 184 "Test/Code.m64"
+    float r_54_166_z = 0.0f;
+    r_54_166_x = x_51_163;
+    r_54_166_y = y_52_164;
+    r_54_166_z = z_53_165;
+#line 198 "Test/Code.m64"
+    float x_55_167 = r_54_166_x - y_side.x;
+#line 198 "Test/Code.m64"
+    float y_56_168 = r_54_166_y - y_side.y;
+#line 198 "Test/Code.m64"
+    float z_57_169 = r_54_166_z - y_side.z;
+#line 184 "Test/Code.m64"
+    float r_58_170_x = 0.0f;
+#line 184 "Test/Code.m64"
+    float r_58_170_y = 0.0f;
+#line 184 "Test/Code.m64"
+    float r_58_170_z = 0.0f;
+    r_58_170_x = x_55_167;
+    r_58_170_y = y_56_168;
+    r_58_170_z = z_57_169;
+#line 193 "Test/Code.m64"
+    float x_51_171 = r_58_170_x + z_side.x;
+#line 193 "Test/Code.m64"
+    float y_52_172 = r_58_170_y + z_side.y;
+#line 193 "Test/Code.m64"
+    float z_53_173 = r_58_170_z + z_side.z;
+#line 184 "Test/Code.m64"
+    float r_54_174_x = 0.0f;
+#line 184 "Test/Code.m64"
+    float r_54_174_y = 0.0f;
+#line 184 "Test/Code.m64"
+    float r_54_174_z = 0.0f;
+    r_54_174_x = x_51_171;
+    r_54_174_y = y_52_172;
+    r_54_174_z = z_53_173;
+#line 292 "Test/Code.m64"
+    float3 corner_rdb = {};
+#line 292 "Test/Code.m64"
+    corner_rdb.x = r_54_174_x;
+#line 292 "Test/Code.m64"
+    corner_rdb.y = r_54_174_y;
+#line 292 "Test/Code.m64"
+    corner_rdb.z = r_54_174_z;
+#line 193 "Test/Code.m64"
+    float x_51_175 = cube_center_x + x_side.x;
+#line 193 "Test/Code.m64"
+    float y_52_176 = cube_center_y + x_side.y;
+#line 193 "Test/Code.m64"
+    float z_53_177 = cube_center_z + x_side.z;
+#line 184 "Test/Code.m64"
+    float r_54_178_x = 0.0f;
+#line 184 "Test/Code.m64"
+    float r_54_178_y = 0.0f;
+#line 184 "Test/Code.m64"
+    float r_54_178_z = 0.0f;
+    r_54_178_x = x_51_175;
+    r_54_178_y = y_52_176;
+    r_54_178_z = z_53_177;
+#line 193 "Test/Code.m64"
+    float x_51_179 = r_54_178_x + y_side.x;
+#line 193 "Test/Code.m64"
+    float y_52_180 = r_54_178_y + y_side.y;
+#line 193 "Test/Code.m64"
+    float z_53_181 = r_54_178_z + y_side.z;
+#line 184 "Test/Code.m64"
+    float r_54_182_x = 0.0f;
+#line 184 "Test/Code.m64"
+    float r_54_182_y = 0.0f;
+#line 184 "Test/Code.m64"
+    float r_54_182_z = 0.0f;
+    r_54_182_x = x_51_179;
+    r_54_182_y = y_52_180;
+    r_54_182_z = z_53_181;
+#line 198 "Test/Code.m64"
+    float x_55_183 = r_54_182_x - z_side.x;
+#line 198 "Test/Code.m64"
+    float y_56_184 = r_54_182_y - z_side.y;
+#line 198 "Test/Code.m64"
+    float z_57_185 = r_54_182_z - z_side.z;
+#line 184 "Test/Code.m64"
+    float r_58_186_x = 0.0f;
+#line 184 "Test/Code.m64"
+    float r_58_186_y = 0.0f;
+#line 184 "Test/Code.m64"
+    float r_58_186_z = 0.0f;
+    r_58_186_x = x_55_183;
+    r_58_186_y = y_56_184;
+    r_58_186_z = z_57_185;
+#line 293 "Test/Code.m64"
+    float3 corner_ruf = {};
+#line 293 "Test/Code.m64"
+    corner_ruf.x = r_58_186_x;
+#line 293 "Test/Code.m64"
+    corner_ruf.y = r_58_186_y;
+#line 293 "Test/Code.m64"
+    corner_ruf.z = r_58_186_z;
+#line 193 "Test/Code.m64"
+    float x_51_187 = cube_center_x + x_side.x;
+#line 193 "Test/Code.m64"
+    float y_52_188 = cube_center_y + x_side.y;
+#line 193 "Test/Code.m64"
+    float z_53_189 = cube_center_z + x_side.z;
+#line 184 "Test/Code.m64"
+    float r_54_190_x = 0.0f;
+#line 184 "Test/Code.m64"
+    float r_54_190_y = 0.0f;
+#line 184 "Test/Code.m64"
+    float r_54_190_z = 0.0f;
+    r_54_190_x = x_51_187;
+    r_54_190_y = y_52_188;
+    r_54_190_z = z_53_189;
+#line 193 "Test/Code.m64"
+    float x_51_191 = r_54_190_x + y_side.x;
+#line 193 "Test/Code.m64"
+    float y_52_192 = r_54_190_y + y_side.y;
+#line 193 "Test/Code.m64"
+    float z_53_193 = r_54_190_z + y_side.z;
+#line 184 "Test/Code.m64"
+    float r_54_194_x = 0.0f;
+#line 184 "Test/Code.m64"
+    float r_54_194_y = 0.0f;
+#line 184 "Test/Code.m64"
+    float r_54_194_z = 0.0f;
+    r_54_194_x = x_51_191;
+    r_54_194_y = y_52_192;
+    r_54_194_z = z_53_193;
+#line 193 "Test/Code.m64"
+    float x_51_195 = r_54_194_x + z_side.x;
+#line 193 "Test/Code.m64"
+    float y_52_196 = r_54_194_y + z_side.y;
+#line 193 "Test/Code.m64"
+    float z_53_197 = r_54_194_z + z_side.z;
+#line 184 "Test/Code.m64"
+    float r_54_198_x = 0.0f;
+#line 184 "Test/Code.m64"
+    float r_54_198_y = 0.0f;
+#line 184 "Test/Code.m64"
+    float r_54_198_z = 0.0f;
+    r_54_198_x = x_51_195;
+    r_54_198_y = y_52_196;
+    r_54_198_z = z_53_197;
+#line 294 "Test/Code.m64"
+    float3 corner_rub = {};
+#line 294 "Test/Code.m64"
+    corner_rub.x = r_54_198_x;
+#line 294 "Test/Code.m64"
+    corner_rub.y = r_54_198_y;
+#line 294 "Test/Code.m64"
+    corner_rub.z = r_54_198_z;
+#line 296 "Test/Code.m64"
+    DrawQuad3(bitmap, corner_luf, corner_ruf, corner_rdf, corner_ldf, (unsigned int)65280);
+    DrawQuad3(bitmap, corner_ruf, corner_rub, corner_rdb, corner_rdf, (unsigned int)16746496);
+    DrawQuad3(bitmap, corner_rub, corner_lub, corner_ldb, corner_rdb, (unsigned int)255);
+    DrawQuad3(bitmap, corner_lub, corner_luf, corner_ldf, corner_ldb, (unsigned int)16711680);
 }
+#line 1167 "Test/Code.h"
 
-void Update(Input *input, Bitmap *bitmap)
+#line 302 "Test/Code.m64"
+void Update(const Input *input, const Bitmap *bitmap)
 {
     Update3D(input, bitmap);
 }
+#line 1174 "Test/Code.h"
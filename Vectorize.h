@@ -0,0 +1,509 @@
+// Recognizes simple array loops that can run four elements at a time.
+// A loop has to count an int from a start to an end that does not change, one step at a time,
+// and its body has to be one of these, on 32 bit elements:
+//     fill    a[i] = v;
+//     copy    a[i] = b[i];
+//     map     a[i] = b[i] + c[i];    with +, - or * (float only), either side can also be a value
+//     sum     s = s + a[i];          int and uint only
+//     min/max if a[i] < m { m = a[i]; }   int only
+// Elements can also be read through pointers that move with the loop, `p@` followed by `p++`.
+// The loop is kept as it is, the writers put the vector loop before it and
+// the original loop runs the remaining iterations.
+
+typedef enum tdef VectorLoopKind
+{
+	FillVectorLoop,
+	CopyVectorLoop,
+	MapVectorLoop,
+	SumVectorLoop,
+	MinVectorLoop,
+	MaxVectorLoop
+} VectorLoopKind;
+
+typedef struct tdef VectorStream
+{
+	// Either pointer@ with pointer++ at the end of the body, or pointer[loop_var].
+	Token pointer;
+	bool indexed;
+} VectorStream;
+
+typedef struct tdef VectorOperand
+{
+	// 0 for a value that does not change in the loop.
+	VectorStream *stream;
+	Expression *value;
+} VectorOperand;
+
+#define VectorMaxStreamN 4
+
+typedef struct tdef VectorLoop
+{
+	VectorLoopKind kind;
+	VarType *element_type;
+
+	Token loop_var;
+	Expression *end;
+	bool end_inclusive;
+
+	// The stored or reduced stream is the first one.
+	VectorStream streams[VectorMaxStreamN];
+	size_t stream_n;
+	// Pointers that move with the loop.
+	Token moving[VectorMaxStreamN];
+	size_t moving_n;
+
+	ExpressionId op;
+	VectorOperand left;
+	VectorOperand right;
+
+	Token accumulator;
+
+	// Names for the C code around the vector loop.
+	Token vector_name;
+	Token lanes_name;
+	Token lane_name;
+	Token element_name;
+	Token mask_name;
+} VectorLoop;
+
+typedef struct tdef Vectorizer
+{
+	ParseInput *input;
+	size_t name_n;
+	size_t vectorized_n;
+	bool report;
+} Vectorizer;
+
+static bool
+func IsVectorElementType(VarType *type)
+{
+	if(!type || type->id != BaseTypeId)
+		return false;
+
+	BaseVarTypeId id = ((BaseType *)type)->base_id;
+	return (id == Int32BaseTypeId || id == UInt32BaseTypeId || id == Float32BaseTypeId);
+}
+
+static bool
+func IsFloatBaseType(VarType *type)
+{
+	return (type->id == BaseTypeId && ((BaseType *)type)->base_id == Float32BaseTypeId);
+}
+
+static bool
+func IsUIntBaseType(VarType *type)
+{
+	return (type->id == BaseTypeId && ((BaseType *)type)->base_id == UInt32BaseTypeId);
+}
+
+static bool
+func IsVectorNameUsed(VectorLoop *loop, Token name)
+{
+	if(TokensEqual(name, loop->loop_var))
+		return true;
+	for(size_t i = 0; i < loop->moving_n; i++)
+	{
+		if(TokensEqual(name, loop->moving[i]))
+			return true;
+	}
+	return false;
+}
+
+static bool
+func IsVectorValue(VectorLoop *loop, Expression *e)
+{
+	// A value that is the same in every iteration.
+	if(e->id == IntegerConstantExpressionId || e->id == FloatConstantExpressionId)
+		return true;
+	if(e->id != VarExpressionId)
+		return false;
+
+	Token name = ((VarExpression *)e)->var.name;
+	if(loop->accumulator.id == NameTokenId && TokensEqual(name, loop->accumulator))
+		return false;
+	return !IsVectorNameUsed(loop, name);
+}
+
+static bool
+func IsOnlyUsedInStreams(VectorLoop *loop, Expression *e)
+{
+	// The loop variable and the moving pointers can only appear as a[i] and p@.
+	if(e->id == DereferenceExpressionId && ((DereferenceExpression *)e)->pointer->id == VarExpressionId)
+		return true;
+	if(e->id == ArrayIndexExpressionId)
+	{
+		ArrayIndexExpression *a = (ArrayIndexExpression *)e;
+		if(IsVarNamed(a->index, loop->loop_var) && a->array->id == VarExpressionId)
+			return !IsVectorNameUsed(loop, ((VarExpression *)a->array)->var.name);
+	}
+	if(e->id == VarExpressionId)
+		return !IsVectorNameUsed(loop, ((VarExpression *)e)->var.name);
+
+	Expression **child = 0;
+	for(size_t i = 0; (child = GetExpressionChild(e, i)) != 0; i++)
+	{
+		if(!IsOnlyUsedInStreams(loop, *child))
+			return false;
+	}
+	return true;
+}
+
+static VectorStream *
+func GetVectorStream(VectorLoop *loop, Expression *e)
+{
+	VectorStream stream = {};
+	if(e->id == DereferenceExpressionId)
+	{
+		Expression *pointer = ((DereferenceExpression *)e)->pointer;
+		if(pointer->id != VarExpressionId)
+			return 0;
+
+		stream.pointer = ((VarExpression *)pointer)->var.name;
+		bool moving = false;
+		for(size_t i = 0; i < loop->moving_n; i++)
+			moving |= TokensEqual(stream.pointer, loop->moving[i]);
+		if(!moving)
+			return 0;
+	}
+	else if(e->id == ArrayIndexExpressionId)
+	{
+		ArrayIndexExpression *a = (ArrayIndexExpression *)e;
+		if(a->array->type->id != PointerTypeId || a->array->id != VarExpressionId || !IsVarNamed(a->index, loop->loop_var))
+			return 0;
+
+		stream.pointer = ((VarExpression *)a->array)->var.name;
+		stream.indexed = true;
+		if(IsVectorNameUsed(loop, stream.pointer))
+			return 0;
+	}
+	else
+	{
+		return 0;
+	}
+
+	if(!TypesEqual(e->type, loop->element_type))
+		return 0;
+
+	for(size_t i = 0; i < loop->stream_n; i++)
+	{
+		if(TokensEqual(loop->streams[i].pointer, stream.pointer) && loop->streams[i].indexed == stream.indexed)
+			return &loop->streams[i];
+	}
+
+	if(loop->stream_n == VectorMaxStreamN)
+		return 0;
+
+	loop->streams[loop->stream_n] = stream;
+	loop->stream_n++;
+	return &loop->streams[loop->stream_n - 1];
+}
+
+static bool
+func GetVectorOperand(VectorLoop *loop, Expression *e, VectorOperand *operand)
+{
+	operand->stream = GetVectorStream(loop, e);
+	operand->value = e;
+	if(operand->stream)
+		return true;
+	return (IsVectorValue(loop, e) && TypesEqual(e->type, loop->element_type));
+}
+
+static char *
+func MatchVectorAssign(VectorLoop *loop, AssignInstruction *assign)
+{
+	Expression *left = assign->left;
+	Expression *right = assign->right;
+	loop->element_type = left->type;
+	if(!IsVectorElementType(loop->element_type))
+		return "elements are not 32 bit numbers";
+
+	if(left->id == VarExpressionId)
+	{
+		// s = s + a[i]
+		loop->kind = SumVectorLoop;
+		loop->accumulator = ((VarExpression *)left)->var.name;
+		if(IsVectorNameUsed(loop, loop->accumulator))
+			return "loop variable is changed in the body";
+		if(IsFloatBaseType(loop->element_type))
+			return "float sum would round differently";
+		if(right->id != AddExpressionId)
+			return "body is not a fill, copy, map or reduction";
+
+		AddExpression *add = (AddExpression *)right;
+		Expression *element = IsVarNamed(add->left, loop->accumulator) ? add->right : add->left;
+		Expression *other = (element == add->right) ? add->left : add->right;
+		if(!IsVarNamed(other, loop->accumulator) || !GetVectorStream(loop, element))
+			return "body is not a fill, copy, map or reduction";
+		return 0;
+	}
+
+	if(!GetVectorStream(loop, left))
+		return "body is not a fill, copy, map or reduction";
+
+	if(right->id == AddExpressionId || right->id == SubtractExpressionId || right->id == MultiplyExpressionId)
+	{
+		AddExpression *binary = (AddExpression *)right;
+		loop->kind = MapVectorLoop;
+		loop->op = right->id;
+		if(right->id == MultiplyExpressionId && !IsFloatBaseType(loop->element_type))
+			return "int multiplication needs SSE4.1";
+		if(!GetVectorOperand(loop, binary->left, &loop->left) || !GetVectorOperand(loop, binary->right, &loop->right))
+			return "body is not a fill, copy, map or reduction";
+		if(!loop->left.stream && !loop->right.stream)
+			return "body is not a fill, copy, map or reduction";
+		return 0;
+	}
+
+	VectorOperand operand = {};
+	if(!GetVectorOperand(loop, right, &operand))
+		return "body is not a fill, copy, map or reduction";
+
+	loop->kind = operand.stream ? CopyVectorLoop : FillVectorLoop;
+	loop->left = operand;
+	return 0;
+}
+
+static char *
+func MatchVectorIf(VectorLoop *loop, IfInstruction *i)
+{
+	// if a[i] < m { m = a[i]; }
+	Instruction *body = i->body->first;
+	if(!body || body->next || body->id != AssignInstructionId)
+		return "body is not a fill, copy, map or reduction";
+
+	AssignInstruction *assign = (AssignInstruction *)body;
+	if(assign->left->id != VarExpressionId)
+		return "body is not a fill, copy, map or reduction";
+
+	loop->accumulator = ((VarExpression *)assign->left)->var.name;
+	loop->element_type = assign->left->type;
+	if(!IsVectorElementType(loop->element_type))
+		return "elements are not 32 bit numbers";
+	if(IsVectorNameUsed(loop, loop->accumulator))
+		return "loop variable is changed in the body";
+	if(IsFloatBaseType(loop->element_type) || IsUIntBaseType(loop->element_type))
+		return "only int min and max are vectorized";
+
+	Expression *condition = i->condition;
+	if(condition->id != LessThanExpressionId && condition->id != GreaterThanExpressionId)
+		return "body is not a fill, copy, map or reduction";
+
+	LessThanExpression *compare = (LessThanExpression *)condition;
+	bool less = (condition->id == LessThanExpressionId);
+	Expression *element = compare->left;
+	if(IsVarNamed(compare->left, loop->accumulator))
+	{
+		element = compare->right;
+		less = !less;
+	}
+	else if(!IsVarNamed(compare->right, loop->accumulator))
+	{
+		return "body is not a fill, copy, map or reduction";
+	}
+
+	if(!ExpressionsEqual(element, assign->right) || !GetVectorStream(loop, element))
+		return "body is not a fill, copy, map or reduction";
+
+	loop->kind = less ? MinVectorLoop : MaxVectorLoop;
+	return 0;
+}
+
+static char *
+func MatchVectorLoop(ForInstruction *for_loop, VectorLoop *loop)
+{
+	if(for_loop->init->id != CreateVariableInstructionId || !for_loop->update || for_loop->update->id != IncrementInstructionId)
+		return "loop does not count up one by one";
+
+	CreateVariableInstruction *init = (CreateVariableInstruction *)for_loop->init;
+	if(!init->init || !IsIntegerType(init->type) || !IsVarNamed(((IncrementInstruction *)for_loop->update)->value, init->name))
+		return "loop does not count up one by one";
+	loop->loop_var = init->name;
+
+	Expression *condition = for_loop->condition;
+	if(condition->id != LessThanExpressionId && condition->id != LessThanEqualExpressionId)
+		return "loop does not count up one by one";
+
+	LessThanExpression *compare = (LessThanExpression *)condition;
+	if(!IsVarNamed(compare->left, loop->loop_var))
+		return "loop does not count up one by one";
+	loop->end = compare->right;
+	loop->end_inclusive = (condition->id == LessThanEqualExpressionId);
+
+	// The body is one instruction, then the pointers that move with the loop.
+	Instruction *main = for_loop->body->first;
+	if(!main)
+		return "body is empty";
+
+	for(Instruction *i = main->next; i; i = i->next)
+	{
+		if(i->id != IncrementInstructionId || loop->moving_n == VectorMaxStreamN)
+			return "body is not a fill, copy, map or reduction";
+
+		Expression *pointer = ((IncrementInstruction *)i)->value;
+		if(pointer->id != VarExpressionId || pointer->type->id != PointerTypeId)
+			return "body is not a fill, copy, map or reduction";
+
+		Token name = ((VarExpression *)pointer)->var.name;
+		if(IsVectorNameUsed(loop, name))
+			return "body is not a fill, copy, map or reduction";
+		loop->moving[loop->moving_n] = name;
+		loop->moving_n++;
+	}
+
+	if(!IsVectorValue(loop, loop->end) || !IsIntegerType(loop->end->type))
+		return "loop end changes in the loop";
+
+	char *reason = 0;
+	if(main->id == AssignInstructionId)
+		reason = MatchVectorAssign(loop, (AssignInstruction *)main);
+	else if(main->id == IfInstructionId)
+		reason = MatchVectorIf(loop, (IfInstruction *)main);
+	else
+		reason = "body is not a fill, copy, map or reduction";
+
+	if(reason)
+		return reason;
+
+	bool only_streams = false;
+	if(main->id == AssignInstructionId)
+	{
+		AssignInstruction *assign = (AssignInstruction *)main;
+		only_streams = (IsOnlyUsedInStreams(loop, assign->left) && IsOnlyUsedInStreams(loop, assign->right));
+	}
+	else
+	{
+		IfInstruction *i = (IfInstruction *)main;
+		AssignInstruction *assign = (AssignInstruction *)i->body->first;
+		only_streams = (IsOnlyUsedInStreams(loop, i->condition) && IsOnlyUsedInStreams(loop, assign->right));
+	}
+	if(!only_streams)
+		return "loop variable is used outside of indexing";
+
+	for(size_t i = 0; i < loop->moving_n; i++)
+	{
+		bool used = false;
+		for(size_t j = 0; j < loop->stream_n; j++)
+			used |= (!loop->streams[j].indexed && TokensEqual(loop->streams[j].pointer, loop->moving[i]));
+		if(!used)
+			return "a moving pointer is not accessed";
+	}
+
+	return 0;
+}
+
+static char *
+func GetVectorLoopKindName(VectorLoopKind kind)
+{
+	switch(kind)
+	{
+		case FillVectorLoop: return "fill";
+		case CopyVectorLoop: return "copy";
+		case MapVectorLoop:  return "map";
+		case SumVectorLoop:  return "sum";
+		case MinVectorLoop:  return "min";
+		case MaxVectorLoop:  return "max";
+	}
+	return "";
+}
+
+static void decl VectorizeBlock(Vectorizer *, BlockInstruction *, Token);
+
+static bool
+func HasInnerLoop(BlockInstruction *block)
+{
+	for(Instruction *i = block->first; i; i = i->next)
+	{
+		if(i->id == ForInstructionId)
+			return true;
+		if(i->id == BlockInstructionId && HasInnerLoop((BlockInstruction *)i))
+			return true;
+		if(i->id == IfInstructionId && HasInnerLoop(((IfInstruction *)i)->body))
+			return true;
+	}
+	return false;
+}
+
+static void
+func VectorizeLoop(Vectorizer *vectorizer, ForInstruction *for_loop, Token func_name)
+{
+	if(HasInnerLoop(for_loop->body))
+	{
+		VectorizeBlock(vectorizer, for_loop->body, func_name);
+		return;
+	}
+
+	ParseInput *input = vectorizer->input;
+	VectorLoop *loop = ArenaPushType(&input->arena, VectorLoop);
+	*loop = (VectorLoop){};
+	char *reason = MatchVectorLoop(for_loop, loop);
+
+	Atom *name = &input->atoms.atoms[func_name.value];
+	if(reason)
+	{
+		if(vectorizer->report)
+			printf("  %.*s: loop not vectorized, %s\n", (int)name->length, name->text, reason);
+		return;
+	}
+
+	loop->vector_name = CreateUniqueName(input, &vectorizer->name_n, loop->loop_var);
+	loop->lanes_name = CreateUniqueName(input, &vectorizer->name_n, loop->loop_var);
+	loop->lane_name = CreateUniqueName(input, &vectorizer->name_n, loop->loop_var);
+	loop->element_name = CreateUniqueName(input, &vectorizer->name_n, loop->loop_var);
+	loop->mask_name = CreateUniqueName(input, &vectorizer->name_n, loop->loop_var);
+	for_loop->vector = loop;
+	vectorizer->vectorized_n++;
+
+	if(vectorizer->report)
+	{
+		// Names may have moved with the new atoms.
+		name = &input->atoms.atoms[func_name.value];
+		Atom *loop_var = &input->atoms.atoms[loop->loop_var.value];
+		printf("  %.*s, loop over %.*s: vectorized %s\n",
+		       (int)name->length, name->text, (int)loop_var->length, loop_var->text, GetVectorLoopKindName(loop->kind));
+	}
+}
+
+static void
+func VectorizeBlock(Vectorizer *vectorizer, BlockInstruction *block, Token func_name)
+{
+	for(Instruction *i = block->first; i; i = i->next)
+	{
+		if(i->id == ForInstructionId)
+			VectorizeLoop(vectorizer, (ForInstruction *)i, func_name);
+		else if(i->id == BlockInstructionId)
+			VectorizeBlock(vectorizer, (BlockInstruction *)i, func_name);
+		else if(i->id == IfInstructionId)
+			VectorizeBlock(vectorizer, ((IfInstruction *)i)->body, func_name);
+	}
+}
+
+static size_t
+func VectorizeLoops(ParseInput *input, DefinitionList *def_list, bool report)
+{
+	Vectorizer vectorizer = {};
+	vectorizer.input = input;
+	vectorizer.report = report;
+
+	if(report)
+		printf("Vectorization:\n");
+
+	for(DefinitionListElem *elem = def_list; elem; elem = elem->next)
+	{
+		Definition *definition = elem->definition;
+		if(definition->id == FuncDefinitionId && !((FuncDefinition *)definition)->is_extern)
+		{
+			FuncDefinition *def = (FuncDefinition *)definition;
+			VectorizeBlock(&vectorizer, def->body, def->header.name);
+		}
+		else if(definition->id == OperatorDefinitionId)
+		{
+			OperatorDefinition *def = (OperatorDefinition *)definition;
+			VectorizeBlock(&vectorizer, def->body, def->name);
+		}
+	}
+
+	if(report)
+		printf("Vectorized %zu loops.\n", vectorizer.vectorized_n);
+
+	return vectorizer.vectorized_n;
+}
@@ -1,16 +1,61 @@
 typedef struct tdef Output
 {
 	MemoryArena arena;
+	AtomTable *atoms;
 	size_t tabs;
 	
+	// Vector loops are written with SSE2 intrinsics, behind #ifdef M64_SSE2.
+	bool uses_sse2;
+	bool uses_bounds_check;
+	bool uses_restrict;
+	bool uses_align;
+	
+	// --profile-generate writes counters, numbered like the functions and branches of the parse.
+	bool instrument;
+	U32 profile_func_n;
+	U32 profile_branch_n;
+	// Set when the function body written next starts by counting its call.
+	bool count_next_block;
+	U32 call_count_id;
+	// --profile-use writes branch hints, cold functions, and the functions hot first.
+	bool uses_profile;
+	// With --split N, the output file is a header with the structs and prototypes,
+	// and the bodies are written into N .c files next to it by WriteSplitParts.
+	size_t split_n;
+	
+	// The definition whose body is being written, for its struct parameters passed by pointer.
+	FuncHeader *func_header;
+	OperatorDefinition *operator_def;
+	
+	// Statements are preceded by #line directives pointing into the M64 source, unless --no-line-directives.
+	ParseInput *source;
+	char *source_path;
+	char *output_path;
+	// Newlines written so far.
+	size_t line_n;
+	// Set after a #line into the source: line source_line_at + 1 of the output is source_line of the source.
+	bool in_source;
+	size_t source_line;
+	size_t source_line_at;
+	
 	bool error;
 } Output;
 
 static void 
 func WriteChar(Output *output, char c)
 {
-	char *mem = ArenaPushType(&output->arena, char);
+	// Output that does not fit the arena is an error, and nothing more is written.
+	char *mem = output->error ? 0 : ArenaPushType(&output->arena, char);
+	if(!mem)
+	{
+		output->error = true;
+		return;
+	}
 	*mem = c;
+	if(c == '\n')
+	{
+		output->line_n++;
+	}
 }
 
 static void
@@ -34,14 +79,142 @@ func WriteString(Output *output, char *string)
 static void 
 func WriteToken(Output *output, Token token)
 {
-	for(size_t i = 0; i < token.length; i++)
+	Atom *atom = &output->atoms->atoms[token.value];
+	for(size_t i = 0; i < atom->length; i++)
+	{
+		WriteChar(output, atom->text[i]);
+	}
+}
+
+static void
+func WriteInteger(Output *output, I64 value)
+{
+	char buffer[32];
+	snprintf(buffer, sizeof(buffer), "%lld", value);
+	WriteString(output, buffer);
+}
+
+static void
+func WriteLineDirective(Output *output, size_t line, char *path)
+{
+	WriteString(output, "#line ");
+	WriteInteger(output, (I64)line);
+	WriteString(output, " \"");
+	for(char *at = path; *at; at++)
+	{
+		if(*at == '\\' || *at == '"')
+		{
+			WriteChar(output, '\\');
+		}
+		WriteChar(output, *at);
+	}
+	WriteString(output, "\"\n");
+}
+
+static void
+func WriteSourceLine(Output *output, U32 offset)
+{
+	// Only written when the lines of the output have drifted from the source.
+	if(!output->source || offset == 0)
+	{
+		return;
+	}
+	
+	size_t line = GetSourceLocation(output->source, offset).row;
+	if(output->in_source && output->source_line + (output->line_n - output->source_line_at) == line)
+	{
+		return;
+	}
+	
+	WriteLineDirective(output, line, output->source_path);
+	output->in_source = true;
+	output->source_line = line;
+	output->source_line_at = output->line_n;
+}
+
+static void
+func WriteOutputLine(Output *output)
+{
+	// Code that does not come from a statement is reported at its own line of the output.
+	if(!output->in_source)
+	{
+		return;
+	}
+	
+	WriteLineDirective(output, output->line_n + 2, output->output_path);
+	output->in_source = false;
+}
+
+static void
+func WriteFloat(Output *output, double value)
+{
+	// Shortest precision that reads back as the same float.
+	float f = (float)value;
+	char buffer[64];
+	for(int precision = 6; precision <= 9; precision++)
+	{
+		snprintf(buffer, sizeof(buffer), "%.*g", precision, f);
+		if((float)strtod(buffer, 0) == f)
+		{
+			break;
+		}
+	}
+	
+	WriteString(output, buffer);
+	if(!strpbrk(buffer, ".e"))
 	{
-		WriteChar(output, token.text[i]);
+		WriteString(output, ".0");
 	}
+	WriteString(output, "f");
 }
 
 static void decl WriteExpression(Output *, Expression *);
 
+static void
+func WriteConstantData(Output *output, VarType *type, ConstantScalar *values, size_t *at)
+{
+	// An initializer list, with braces around every struct and array.
+	if(type->id == BaseTypeId)
+	{
+		ConstantScalar value = values[*at];
+		(*at)++;
+		if(((BaseType *)type)->base_id == Float32BaseTypeId)
+			WriteFloat(output, value.f);
+		else
+			WriteInteger(output, value.i);
+		if(((BaseType *)type)->base_id == UInt32BaseTypeId)
+			WriteString(output, "u");
+		return;
+	}
+	
+	WriteString(output, "{");
+	if(type->id == StructTypeId)
+	{
+		for(StructVar *var = ((StructType *)type)->def->first_var; var; var = var->next)
+		{
+			WriteConstantData(output, var->type, values, at);
+			if(var->next)
+			{
+				WriteString(output, ", ");
+			}
+		}
+	}
+	else
+	{
+		ArrayType *array = (ArrayType *)type;
+		I64 size = ((IntegerConstantExpression *)array->size)->value;
+		for(I64 i = 0; i < size; i++)
+		{
+			WriteConstantData(output, array->element_type, values, at);
+			if(i + 1 < size)
+			{
+				WriteString(output, ", ");
+			}
+		}
+	}
+	WriteString(output, "}");
+}
+
 static void
 func WriteType(Output *output, VarType *type)
 {
@@ -158,7 +331,16 @@ func WriteTypeAndVar(Output *output, VarType *type, Token var_name)
 }
 
 static void
-func WriteFuncHeader(Output *output, FuncHeader *header)
+func WritePointerParam(Output *output, VarType *type, Token name)
+{
+	WriteString(output, "const ");
+	WriteType(output, type);
+	WriteString(output, " *");
+	WriteToken(output, name);
+}
+
+static void
+func WriteFuncHeader(Output *output, FuncHeader *header, Token name, bool by_pointer)
 {
 	if(header->return_type)
 	{
@@ -170,7 +352,7 @@ func WriteFuncHeader(Output *output, FuncHeader *header)
 		WriteString(output, "void ");
 	}
 	
-	WriteToken(output, header->name);
+	WriteToken(output, name);
 	WriteString(output, "(");
 	
 	bool is_first_param = true;
@@ -186,7 +368,29 @@ func WriteFuncHeader(Output *output, FuncHeader *header)
 			WriteString(output, ", ");
 		}
 		
-		WriteTypeAndVar(output, param->type, param->name);
+		if(param->by_pointer && by_pointer)
+		{
+			WritePointerParam(output, param->type, param->name);
+		}
+		else if(param->type->id == PointerTypeId && (param->is_const || param->is_restrict))
+		{
+			PointerType *t = (PointerType *)param->type;
+			if(param->is_const)
+			{
+				WriteString(output, "const ");
+			}
+			WriteType(output, t->pointed_type);
+			WriteString(output, " *");
+			if(param->is_restrict)
+			{
+				WriteString(output, "M64_RESTRICT ");
+			}
+			WriteToken(output, param->name);
+		}
+		else
+		{
+			WriteTypeAndVar(output, param->type, param->name);
+		}
 		
 		param = param->next;
 	}
@@ -194,6 +398,41 @@ func WriteFuncHeader(Output *output, FuncHeader *header)
 	WriteString(output, ")");
 }
 
+static bool
+func IsPointerParam(Output *output, Token name)
+{
+	if(output->func_header)
+	{
+		for(FuncParam *param = output->func_header->first_param; param; param = param->next)
+		{
+			if(param->by_pointer && TokensEqual(param->name, name))
+			{
+				return true;
+			}
+		}
+	}
+	
+	OperatorDefinition *def = output->operator_def;
+	if(def)
+	{
+		return (def->left_by_pointer && TokensEqual(def->left_name, name)) || (def->right_by_pointer && TokensEqual(def->right_name, name));
+	}
+	return false;
+}
+
+static void
+func WritePostfixBase(Output *output, Expression *e)
+{
+	// The base of a field access binds tighter than anything but other postfix expressions.
+	bool is_postfix = (e->id == VarExpressionId || e->id == StructVarExpressionId || e->id == ArrayIndexExpressionId ||
+	                   e->id == FuncCallExpressionId || e->id == ParenExpressionId);
+	if(!is_postfix)
+		WriteString(output, "(");
+	WriteExpression(output, e);
+	if(!is_postfix)
+		WriteString(output, ")");
+}
+
 static void
 func WriteExpression(Output *output, Expression *expression)
 {
@@ -224,7 +463,18 @@ func WriteExpression(Output *output, Expression *expression)
 			}
 
 			WriteString(output, "[");
-			WriteExpression(output, e->index);
+			if(e->checked)
+			{
+				WriteString(output, "M64CheckIndex(");
+				WriteExpression(output, e->index);
+				WriteString(output, ", ");
+				WriteExpression(output, GetIndexedArrayType(e)->size);
+				WriteString(output, ")");
+			}
+			else
+			{
+				WriteExpression(output, e->index);
+			}
 			WriteString(output, "]");
 			break;
 		}
@@ -251,6 +501,13 @@ func WriteExpression(Output *output, Expression *expression)
 			WriteExpression(output, e->value);
 			break;
 		}
+		case ConstantDataExpressionId:
+		{
+			ConstantDataExpression *e = (ConstantDataExpression *)expression;
+			size_t at = 0;
+			WriteConstantData(output, e->e.type, e->values, &at);
+			break;
+		}
 		case DereferenceExpressionId:
 		{
 			DereferenceExpression *e = (DereferenceExpression *)expression;
@@ -261,8 +518,7 @@ func WriteExpression(Output *output, Expression *expression)
 		case FloatConstantExpressionId:
 		{
 			FloatConstantExpression *e = (FloatConstantExpression *)expression;
-			WriteToken(output, e->token);
-			WriteString(output, "f");
+			WriteFloat(output, e->value);
 			break;
 		}
 		case FuncCallExpressionId:
@@ -270,10 +526,16 @@ func WriteExpression(Output *output, Expression *expression)
 			FuncCallExpression *e = (FuncCallExpression *)expression;
 			FuncDefinition *def = e->func_def;
 			
-			WriteToken(output, def->header.name);
+			WriteToken(output, def->has_wrapper ? def->wrapped_name : def->header.name);
 			WriteString(output, "(");
+			FuncParam *param = def->header.first_param;
 			for(FuncCallArgument *arg = e->first_call_arg; arg; arg = arg->next)
 			{
+				if(param && param->by_pointer)
+				{
+					WriteString(output, "&");
+				}
+				param = param ? param->next : 0;
 				WriteExpression(output, arg->arg);
 				if(arg->next)
 				{
@@ -286,7 +548,11 @@ func WriteExpression(Output *output, Expression *expression)
 		case IntegerConstantExpressionId:
 		{
 			IntegerConstantExpression *e = (IntegerConstantExpression *)expression;
-			WriteToken(output, e->token);
+			// In C -2147483648 is the negation of a long, so the smallest int is written another way.
+			if(e->value == INT_MIN)
+				WriteString(output, "(-2147483647 - 1)");
+			else
+				WriteInteger(output, e->value);
 			break;
 		}
 		case GreaterThanExpressionId:
@@ -331,10 +597,10 @@ func WriteExpression(Output *output, Expression *expression)
 		case OperatorCallExpressionId:
 		{
 			OperatorCallExpression *e = (OperatorCallExpression *)expression;
-			WriteToken(output, e->def->name);
-			WriteString(output, "(");
+			WriteToken(output, e->def->has_wrapper ? e->def->wrapped_name : e->def->name);
+			WriteString(output, e->def->left_by_pointer ? "(&" : "(");
 			WriteExpression(output, e->left);
-			WriteString(output, ", ");
+			WriteString(output, e->def->right_by_pointer ? ", &" : ", ");
 			WriteExpression(output, e->right);
 			WriteString(output, ")");
 			break;
@@ -350,9 +616,20 @@ func WriteExpression(Output *output, Expression *expression)
 		case StructVarExpressionId:
 		{
 			StructVarExpression *e = (StructVarExpression *)expression;
-			WriteExpression(output, e->base);
+			bool through_param = (e->base->id == VarExpressionId && IsPointerParam(output, ((VarExpression *)e->base)->var.name));
+			// A dereferenced base like p@ is written as p->a, since *p.a would take the field first.
+			bool through_pointer = (e->base->id == DereferenceExpressionId);
+			if(through_param)
+			{
+				WriteToken(output, ((VarExpression *)e->base)->var.name);
+			}
+			else
+			{
+				Expression *base = through_pointer ? ((DereferenceExpression *)e->base)->pointer : e->base;
+				WritePostfixBase(output, base);
+			}
 			
-			if(e->base->type->id == PointerTypeId)
+			if(e->base->type->id == PointerTypeId || through_param || through_pointer)
 			{
 				WriteString(output, "->");
 			}
@@ -377,7 +654,16 @@ func WriteExpression(Output *output, Expression *expression)
 		case VarExpressionId:
 		{
 			VarExpression *e = (VarExpression *)expression;
-			WriteToken(output, e->var.name);
+			if(IsPointerParam(output, e->var.name))
+			{
+				WriteString(output, "(*");
+				WriteToken(output, e->var.name);
+				WriteString(output, ")");
+			}
+			else
+			{
+				WriteToken(output, e->var.name);
+			}
 			break;
 		}
 		default:
@@ -390,6 +676,7 @@ func WriteExpression(Output *output, Expression *expression)
 }
 
 static void func WriteBlock(Output *, BlockInstruction *);
+static void decl WriteVectorLoop(Output *, ForInstruction *);
 
 static void
 func WriteInstruction(Output *output, Instruction *instruction)
@@ -443,7 +730,24 @@ func WriteInstruction(Output *output, Instruction *instruction)
 		{
 			IfInstruction *i = (IfInstruction *)instruction;
 			WriteString(output, "if(");
-			WriteExpression(output, i->condition);
+			if(output->instrument)
+			{
+				WriteString(output, "M64CountBranch(");
+				WriteInteger(output, i->branch_id);
+				WriteString(output, ", ");
+				WriteExpression(output, i->condition);
+				WriteString(output, ")");
+			}
+			else if(i->hint != NoBranchHint)
+			{
+				WriteString(output, (i->hint == LikelyBranchHint) ? "M64_LIKELY(" : "M64_UNLIKELY(");
+				WriteExpression(output, i->condition);
+				WriteString(output, ")");
+			}
+			else
+			{
+				WriteExpression(output, i->condition);
+			}
 			WriteString(output, ")\n");
 			
 			WriteBlock(output, i->body);
@@ -462,12 +766,28 @@ func WriteInstruction(Output *output, Instruction *instruction)
 		case ForInstructionId:
 		{
 			ForInstruction *i = (ForInstruction *)instruction;
+			if(i->vector)
+			{
+				WriteVectorLoop(output, i);
+				break;
+			}
 			
 			WriteString(output, "for(");
 			WriteInstruction(output, i->init);
 			WriteString(output, "; ");
 			
-			WriteExpression(output, i->condition);
+			if(output->instrument)
+			{
+				WriteString(output, "M64CountBranch(");
+				WriteInteger(output, i->branch_id);
+				WriteString(output, ", ");
+				WriteExpression(output, i->condition);
+				WriteString(output, ")");
+			}
+			else
+			{
+				WriteExpression(output, i->condition);
+			}
 			WriteString(output, "; ");
 			
 			WriteInstruction(output, i->update);
@@ -504,9 +824,23 @@ func WriteBlock(Output *output, BlockInstruction *block)
 	
 	output->tabs++;
 	
+	if(output->count_next_block)
+	{
+		output->count_next_block = false;
+		WriteTabs(output);
+		WriteString(output, "M64CountCall(");
+		WriteInteger(output, output->call_count_id);
+		WriteString(output, ");\n");
+	}
+	
 	Instruction *instruction = block->first;
 	while(instruction)
 	{
+		// Otherwise an instruction without a statement would be counted as the lines after the previous one.
+		if(instruction->offset == 0)
+			WriteOutputLine(output);
+		else
+			WriteSourceLine(output, instruction->offset);
 		WriteTabs(output);
 		WriteInstruction(output, instruction);
 
@@ -527,92 +861,789 @@ func WriteBlock(Output *output, BlockInstruction *block)
 }
 
 static void
-func WriteStructDefinition(Output *output, StructDefinition *def)
+func WriteVectorAddress(Output *output, VectorLoop *loop, VectorStream *stream)
 {
-	WriteString(output, "typedef struct ");
-	WriteToken(output, def->name);
-	
-	WriteString(output, "\n{\n");
-	
-	output->tabs++;
-	
-	for(StructVar *var = def->first_var; var; var = var->next)
+	if(stream->indexed)
 	{
-		WriteTabs(output);
-		WriteTypeAndVar(output, var->type, var->name);
-		WriteString(output, ";\n");
+		WriteString(output, "(");
+		WriteToken(output, stream->pointer);
+		WriteString(output, " + ");
+		WriteToken(output, loop->loop_var);
+		WriteString(output, ")");
+	}
+	else
+	{
+		WriteToken(output, stream->pointer);
 	}
-	
-	output->tabs--;
-	
-	WriteString(output, "} ");
-	WriteToken(output, def->name);
-	WriteString(output, ";\n");
 }
 
 static void
-func WriteDefinitionList(Output *output, DefinitionList *def_list)
+func WriteVectorOperand(Output *output, VectorLoop *loop, VectorOperand *operand)
 {
-	DefinitionListElem *elem = def_list;
-	bool first = true;
-	while(elem)
+	bool is_float = IsFloatBaseType(loop->element_type);
+	if(operand->stream)
 	{
-		if(!first)
+		WriteString(output, is_float ? "_mm_loadu_ps(" : "_mm_loadu_si128((__m128i *)");
+		WriteVectorAddress(output, loop, operand->stream);
+	}
+	else
+	{
+		WriteString(output, is_float ? "_mm_set1_ps(" : "_mm_set1_epi32((int)");
+		WriteExpression(output, operand->value);
+	}
+	WriteString(output, ")");
+}
+
+static void
+func WriteVectorStore(Output *output, VectorLoop *loop, VectorStream *stream)
+{
+	// Copies move the bits, so they use integer vectors for every element type.
+	bool is_float = (IsFloatBaseType(loop->element_type) && loop->kind != CopyVectorLoop);
+	WriteString(output, is_float ? "_mm_storeu_ps(" : "_mm_storeu_si128((__m128i *)");
+	WriteVectorAddress(output, loop, stream);
+	WriteString(output, ", ");
+}
+
+static void
+func WriteVectorLanes(Output *output, VectorLoop *loop)
+{
+	WriteTabs(output);
+	WriteType(output, loop->element_type);
+	WriteString(output, " ");
+	WriteToken(output, loop->lanes_name);
+	WriteString(output, "[4];\n");
+
+	WriteTabs(output);
+	WriteString(output, "_mm_storeu_si128((__m128i *)");
+	WriteToken(output, loop->lanes_name);
+	WriteString(output, ", ");
+	WriteToken(output, loop->vector_name);
+	WriteString(output, ");\n");
+}
+
+static void
+func WriteVectorLoop(Output *output, ForInstruction *for_loop)
+{
+	// The vector loop runs while four more iterations are left, the original loop does the rest.
+	VectorLoop *loop = for_loop->vector;
+	WriteString(output, "{\n");
+	output->tabs++;
+
+	WriteTabs(output);
+	WriteInstruction(output, for_loop->init);
+	WriteString(output, ";\n");
+
+	WriteString(output, "#ifdef M64_SSE2\n");
+
+	// Stores that are less than four elements ahead of a load would be read back by the scalar loop.
+	bool checks_overlap = false;
+	for(size_t i = 1; i < loop->stream_n; i++)
+	{
+		if(loop->kind != CopyVectorLoop && loop->kind != MapVectorLoop)
+			break;
+
+		WriteString(output, checks_overlap ? " &&\n" : "");
+		WriteTabs(output);
+		WriteString(output, checks_overlap ? "   " : "if(");
+		WriteString(output, "((char *)");
+		WriteVectorAddress(output, loop, &loop->streams[0]);
+		WriteString(output, " <= (char *)");
+		WriteVectorAddress(output, loop, &loop->streams[i]);
+		WriteString(output, " || (char *)");
+		WriteVectorAddress(output, loop, &loop->streams[0]);
+		WriteString(output, " >= (char *)(");
+		WriteVectorAddress(output, loop, &loop->streams[i]);
+		WriteString(output, " + 4))");
+		checks_overlap = true;
+	}
+	if(checks_overlap)
+		WriteString(output, ")\n");
+
+	WriteTabs(output);
+	WriteString(output, "{\n");
+	output->tabs++;
+
+	VectorOperand reduced = {};
+	reduced.stream = &loop->streams[0];
+	switch(loop->kind)
+	{
+		case SumVectorLoop:
 		{
-			WriteString(output, "\n");
+			WriteTabs(output);
+			WriteString(output, "__m128i ");
+			WriteToken(output, loop->vector_name);
+			WriteString(output, " = _mm_setzero_si128();\n");
+			break;
 		}
-		
-		Definition *definition = elem->definition;
-		switch(definition->id)
+		case MinVectorLoop:
+		case MaxVectorLoop:
 		{
-			case FuncDefinitionId:
-			{
-				FuncDefinition *def = (FuncDefinition *)definition;
-				
-				WriteFuncHeader(output, &def->header);
+			WriteTabs(output);
+			WriteString(output, "__m128i ");
+			WriteToken(output, loop->vector_name);
+			WriteString(output, " = _mm_set1_epi32(");
+			WriteToken(output, loop->accumulator);
+			WriteString(output, ");\n");
+			break;
+		}
+		default:
+			break;
+	}
 
-				if(!def->is_extern)
-				{
-					WriteString(output, "\n");
-					WriteBlock(output, def->body);
-					WriteString(output, "\n");
-				}
-				else
-				{
-					WriteString(output, ";\n");
-				}
-				
-				break;
-			}
-			case OperatorDefinitionId:
+	WriteTabs(output);
+	WriteString(output, "for(; (long long)");
+	WriteExpression(output, loop->end);
+	WriteString(output, " - ");
+	WriteToken(output, loop->loop_var);
+	WriteString(output, loop->end_inclusive ? " >= 3; " : " >= 4; ");
+	WriteToken(output, loop->loop_var);
+	WriteString(output, " += 4)\n");
+
+	WriteTabs(output);
+	WriteString(output, "{\n");
+	output->tabs++;
+
+	switch(loop->kind)
+	{
+		case FillVectorLoop:
+		case CopyVectorLoop:
+		{
+			WriteTabs(output);
+			WriteVectorStore(output, loop, &loop->streams[0]);
+			WriteVectorOperand(output, loop, &loop->left);
+			WriteString(output, ");\n");
+			break;
+		}
+		case MapVectorLoop:
+		{
+			bool is_float = IsFloatBaseType(loop->element_type);
+			WriteTabs(output);
+			WriteVectorStore(output, loop, &loop->streams[0]);
+			switch(loop->op)
 			{
-				OperatorDefinition *def = (OperatorDefinition *)definition;
-				
-				if(def->return_type)
-				{
-					WriteType(output, def->return_type);
-					WriteString(output, " ");
-				}
-				else
-				{
-					WriteString(output, "void ");
-				}
-				
-				WriteToken(output, def->name);
-				WriteString(output, "(");
-				
-				WriteTypeAndVar(output, def->left_type, def->left_name);
-				WriteString(output, ", ");
-				
-				WriteTypeAndVar(output, def->right_type, def->right_name);
-				WriteString(output, ")\n");
-				
-				WriteBlock(output, def->body);
-				WriteString(output, "\n");
-				
-				break;
+				case AddExpressionId:      WriteString(output, is_float ? "_mm_add_ps(" : "_mm_add_epi32("); break;
+				case SubtractExpressionId: WriteString(output, is_float ? "_mm_sub_ps(" : "_mm_sub_epi32("); break;
+				default:                   WriteString(output, "_mm_mul_ps("); break;
 			}
-			case StructDefinitionId:
+			WriteVectorOperand(output, loop, &loop->left);
+			WriteString(output, ", ");
+			WriteVectorOperand(output, loop, &loop->right);
+			WriteString(output, "));\n");
+			break;
+		}
+		case SumVectorLoop:
+		{
+			WriteTabs(output);
+			WriteToken(output, loop->vector_name);
+			WriteString(output, " = _mm_add_epi32(");
+			WriteToken(output, loop->vector_name);
+			WriteString(output, ", ");
+			WriteVectorOperand(output, loop, &reduced);
+			WriteString(output, ");\n");
+			break;
+		}
+		case MinVectorLoop:
+		case MaxVectorLoop:
+		{
+			// Keeps the smaller (or larger) value in each lane: (mask & element) | (~mask & current).
+			WriteTabs(output);
+			WriteString(output, "__m128i ");
+			WriteToken(output, loop->element_name);
+			WriteString(output, " = ");
+			WriteVectorOperand(output, loop, &reduced);
+			WriteString(output, ";\n");
+
+			WriteTabs(output);
+			WriteString(output, "__m128i ");
+			WriteToken(output, loop->mask_name);
+			WriteString(output, (loop->kind == MinVectorLoop) ? " = _mm_cmplt_epi32(" : " = _mm_cmpgt_epi32(");
+			WriteToken(output, loop->element_name);
+			WriteString(output, ", ");
+			WriteToken(output, loop->vector_name);
+			WriteString(output, ");\n");
+
+			WriteTabs(output);
+			WriteToken(output, loop->vector_name);
+			WriteString(output, " = _mm_or_si128(_mm_and_si128(");
+			WriteToken(output, loop->mask_name);
+			WriteString(output, ", ");
+			WriteToken(output, loop->element_name);
+			WriteString(output, "), _mm_andnot_si128(");
+			WriteToken(output, loop->mask_name);
+			WriteString(output, ", ");
+			WriteToken(output, loop->vector_name);
+			WriteString(output, "));\n");
+			break;
+		}
+	}
+
+	for(size_t i = 0; i < loop->moving_n; i++)
+	{
+		WriteTabs(output);
+		WriteToken(output, loop->moving[i]);
+		WriteString(output, " += 4;\n");
+	}
+
+	output->tabs--;
+	WriteTabs(output);
+	WriteString(output, "}\n");
+
+	if(loop->kind == SumVectorLoop)
+	{
+		WriteVectorLanes(output, loop);
+		WriteTabs(output);
+		WriteToken(output, loop->accumulator);
+		WriteString(output, " = ");
+		WriteToken(output, loop->accumulator);
+		for(int i = 0; i < 4; i++)
+		{
+			WriteString(output, " + ");
+			WriteToken(output, loop->lanes_name);
+			WriteString(output, "[");
+			WriteInteger(output, i);
+			WriteString(output, "]");
+		}
+		WriteString(output, ";\n");
+	}
+	else if(loop->kind == MinVectorLoop || loop->kind == MaxVectorLoop)
+	{
+		WriteVectorLanes(output, loop);
+		WriteTabs(output);
+		WriteString(output, "for(int ");
+		WriteToken(output, loop->lane_name);
+		WriteString(output, " = 0; ");
+		WriteToken(output, loop->lane_name);
+		WriteString(output, " < 4; ");
+		WriteToken(output, loop->lane_name);
+		WriteString(output, "++)\n");
+
+		WriteTabs(output);
+		WriteString(output, "{\n");
+		output->tabs++;
+		WriteTabs(output);
+		WriteString(output, "if(");
+		WriteToken(output, loop->lanes_name);
+		WriteString(output, "[");
+		WriteToken(output, loop->lane_name);
+		WriteString(output, (loop->kind == MinVectorLoop) ? "] < " : "] > ");
+		WriteToken(output, loop->accumulator);
+		WriteString(output, ")\n");
+
+		WriteTabs(output);
+		WriteString(output, "{\n");
+		output->tabs++;
+		WriteTabs(output);
+		WriteToken(output, loop->accumulator);
+		WriteString(output, " = ");
+		WriteToken(output, loop->lanes_name);
+		WriteString(output, "[");
+		WriteToken(output, loop->lane_name);
+		WriteString(output, "];\n");
+		output->tabs--;
+		WriteTabs(output);
+		WriteString(output, "}\n");
+		output->tabs--;
+		WriteTabs(output);
+		WriteString(output, "}\n");
+	}
+
+	output->tabs--;
+	WriteTabs(output);
+	WriteString(output, "}\n");
+	WriteString(output, "#endif\n");
+
+	WriteTabs(output);
+	WriteString(output, "for(; ");
+	WriteExpression(output, for_loop->condition);
+	WriteString(output, "; ");
+	WriteInstruction(output, for_loop->update);
+	WriteString(output, ")\n");
+	WriteBlock(output, for_loop->body);
+	WriteString(output, "\n");
+
+	output->tabs--;
+	WriteTabs(output);
+	WriteString(output, "}");
+}
+
+static void
+func WriteStructDefinition(Output *output, StructDefinition *def)
+{
+	// pragma pack is understood by GCC, Clang and MSVC.
+	if(def->packed)
+	{
+		WriteString(output, "#pragma pack(push, 1)\n");
+	}
+	
+	WriteString(output, "typedef struct ");
+	if(def->align_attribute)
+	{
+		WriteString(output, "M64_ALIGN(");
+		WriteInteger(output, def->align_attribute);
+		WriteString(output, ") ");
+	}
+	WriteToken(output, def->name);
+	
+	WriteString(output, "\n{\n");
+	
+	output->tabs++;
+	
+	for(StructVar *var = def->first_var; var; var = var->next)
+	{
+		WriteTabs(output);
+		WriteTypeAndVar(output, var->type, var->name);
+		WriteString(output, ";\n");
+	}
+	
+	output->tabs--;
+	
+	WriteString(output, "} ");
+	WriteToken(output, def->name);
+	WriteString(output, ";\n");
+	
+	if(def->packed)
+	{
+		WriteString(output, "#pragma pack(pop)\n");
+	}
+	
+	// The C compiler has to agree with the layout M64 computed, on x64.
+	if((def->packed || def->align_attribute) && def->has_layout)
+	{
+		WriteString(output, "typedef char M64LayoutCheck_");
+		WriteToken(output, def->name);
+		WriteString(output, "[(sizeof(void *) != 8 || sizeof(");
+		WriteToken(output, def->name);
+		WriteString(output, ") == ");
+		WriteInteger(output, (I64)def->size);
+		WriteString(output, ") ? 1 : -1];\n");
+	}
+}
+
+static void
+func WriteWrapperCall(Output *output, Token name, bool by_pointer, bool *is_first)
+{
+	if(!*is_first)
+	{
+		WriteString(output, ", ");
+	}
+	*is_first = false;
+	if(by_pointer)
+	{
+		WriteString(output, "&");
+	}
+	WriteToken(output, name);
+}
+
+static void
+func WriteFuncDefinition(Output *output, FuncDefinition *def, bool prototype_only)
+{
+	// Split output writes static inline bodies into the header, the other static functions lose static
+	// because the parts call each other.
+	bool is_static = (def->is_static || def->has_wrapper) && (output->split_n == 0 || def->is_static_inline);
+	if(!def->is_extern && !prototype_only)
+	{
+		WriteSourceLine(output, def->header.name.offset);
+	}
+	if(is_static)
+	{
+		WriteString(output, def->is_static_inline ? "static inline " : "static ");
+	}
+	// Cold functions are only static inline when nothing calls them, then the hint does not matter,
+	// and the noinline in M64_COLD would clash with inline.
+	if(def->is_cold && !def->is_static_inline && output->uses_profile)
+	{
+		WriteString(output, "M64_COLD ");
+	}
+	WriteFuncHeader(output, &def->header, def->has_wrapper ? def->wrapped_name : def->header.name, true);
+
+	if(!def->is_extern && !prototype_only)
+	{
+		WriteString(output, "\n");
+		output->count_next_block = output->instrument;
+		output->call_count_id = def->profile_id;
+		output->func_header = &def->header;
+		WriteBlock(output, def->body);
+		output->func_header = 0;
+		WriteString(output, "\n");
+		WriteOutputLine(output);
+	}
+	else
+	{
+		WriteString(output, ";\n");
+	}
+	
+	if(def->has_wrapper)
+	{
+		// The exported signature takes the structs by value and passes their address on.
+		if(!prototype_only)
+		{
+			WriteString(output, "\n");
+		}
+		WriteFuncHeader(output, &def->header, def->header.name, false);
+		if(prototype_only)
+		{
+			WriteString(output, ";\n");
+			return;
+		}
+		
+		WriteString(output, "\n{\n    ");
+		if(def->header.return_type)
+		{
+			WriteString(output, "return ");
+		}
+		WriteToken(output, def->wrapped_name);
+		WriteString(output, "(");
+		bool is_first = true;
+		for(FuncParam *param = def->header.first_param; param; param = param->next)
+		{
+			WriteWrapperCall(output, param->name, param->by_pointer, &is_first);
+		}
+		WriteString(output, ");\n}\n");
+	}
+}
+
+static void
+func WriteOperatorHeader(Output *output, OperatorDefinition *def, Token name, bool by_pointer)
+{
+	if(def->return_type)
+	{
+		WriteType(output, def->return_type);
+		WriteString(output, " ");
+	}
+	else
+	{
+		WriteString(output, "void ");
+	}
+	
+	WriteToken(output, name);
+	WriteString(output, "(");
+	
+	if(def->left_by_pointer && by_pointer)
+	{
+		WritePointerParam(output, def->left_type, def->left_name);
+	}
+	else
+	{
+		WriteTypeAndVar(output, def->left_type, def->left_name);
+	}
+	WriteString(output, ", ");
+	
+	if(def->right_by_pointer && by_pointer)
+	{
+		WritePointerParam(output, def->right_type, def->right_name);
+	}
+	else
+	{
+		WriteTypeAndVar(output, def->right_type, def->right_name);
+	}
+	WriteString(output, ")");
+}
+
+static void
+func WriteOperatorDefinition(Output *output, OperatorDefinition *def, bool prototype_only)
+{
+	bool is_static = (def->is_static || def->has_wrapper) && (output->split_n == 0 || def->is_static_inline);
+	if(!prototype_only)
+	{
+		WriteSourceLine(output, def->name.offset);
+	}
+	if(is_static)
+	{
+		WriteString(output, def->is_static_inline ? "static inline " : "static ");
+	}
+	WriteOperatorHeader(output, def, def->has_wrapper ? def->wrapped_name : def->name, true);
+	
+	if(prototype_only)
+	{
+		WriteString(output, ";\n");
+	}
+	else
+	{
+		WriteString(output, "\n");
+		output->operator_def = def;
+		WriteBlock(output, def->body);
+		output->operator_def = 0;
+		WriteString(output, "\n");
+		WriteOutputLine(output);
+	}
+	
+	if(def->has_wrapper)
+	{
+		if(!prototype_only)
+		{
+			WriteString(output, "\n");
+		}
+		WriteOperatorHeader(output, def, def->name, false);
+		if(prototype_only)
+		{
+			WriteString(output, ";\n");
+			return;
+		}
+		
+		WriteString(output, "\n{\n    ");
+		if(def->return_type)
+		{
+			WriteString(output, "return ");
+		}
+		WriteToken(output, def->wrapped_name);
+		WriteString(output, "(");
+		bool is_first = true;
+		WriteWrapperCall(output, def->left_name, def->left_by_pointer, &is_first);
+		WriteWrapperCall(output, def->right_name, def->right_by_pointer, &is_first);
+		WriteString(output, ");\n}\n");
+	}
+}
+
+static int
+func CompareProfileCallN(const void *a, const void *b)
+{
+	FuncDefinition *def1 = *(FuncDefinition **)a;
+	FuncDefinition *def2 = *(FuncDefinition **)b;
+	if(def1->profile_call_n != def2->profile_call_n)
+	{
+		return (def1->profile_call_n > def2->profile_call_n) ? -1 : 1;
+	}
+	return (def1->profile_id < def2->profile_id) ? -1 : (def1->profile_id > def2->profile_id);
+}
+
+static void
+func WriteFuncBodiesHotFirst(Output *output, DefinitionList *def_list)
+{
+	size_t def_n = 0;
+	for(DefinitionListElem *elem = def_list; elem; elem = elem->next)
+	{
+		Definition *definition = elem->definition;
+		if(definition->id == FuncDefinitionId && !((FuncDefinition *)definition)->is_extern && !IsCompileTimeOnly(definition))
+		{
+			def_n++;
+		}
+	}
+	
+	FuncDefinition **defs = (FuncDefinition **)malloc((def_n + 1) * sizeof(FuncDefinition *));
+	size_t index = 0;
+	for(DefinitionListElem *elem = def_list; elem; elem = elem->next)
+	{
+		Definition *definition = elem->definition;
+		if(definition->id == FuncDefinitionId && !((FuncDefinition *)definition)->is_extern && !IsCompileTimeOnly(definition))
+		{
+			defs[index] = (FuncDefinition *)definition;
+			index++;
+		}
+	}
+	
+	qsort(defs, def_n, sizeof(FuncDefinition *), CompareProfileCallN);
+	for(size_t i = 0; i < def_n; i++)
+	{
+		WriteString(output, "\n");
+		WriteFuncDefinition(output, defs[i], false);
+	}
+	free(defs);
+}
+
+static void
+func WriteProfileCounters(Output *output, DefinitionList *def_list)
+{
+	// The counts are written out when the program exits, after the first counted call.
+	char **names = (char **)malloc((output->profile_func_n + 1) * sizeof(char *));
+	U32 *name_lengths = (U32 *)malloc((output->profile_func_n + 1) * sizeof(U32));
+	for(U32 i = 0; i < output->profile_func_n; i++)
+	{
+		names[i] = "-";
+		name_lengths[i] = 1;
+	}
+	for(DefinitionListElem *elem = def_list; elem; elem = elem->next)
+	{
+		Definition *definition = elem->definition;
+		if(definition->id == FuncDefinitionId && !((FuncDefinition *)definition)->is_extern)
+		{
+			FuncDefinition *def = (FuncDefinition *)definition;
+			Atom *atom = &output->atoms->atoms[def->header.name.value];
+			names[def->profile_id] = atom->text;
+			name_lengths[def->profile_id] = atom->length;
+		}
+	}
+	
+	WriteString(output, "#include <stdio.h>\n");
+	WriteString(output, "#include <stdlib.h>\n");
+	WriteString(output, "#ifndef M64_PROFILE_PATH\n");
+	WriteString(output, "#define M64_PROFILE_PATH \"m64.profile\"\n");
+	WriteString(output, "#endif\n\n");
+	
+	WriteString(output, "#define M64_PROFILE_FUNC_N ");
+	WriteInteger(output, output->profile_func_n);
+	WriteString(output, "\n#define M64_PROFILE_BRANCH_N ");
+	WriteInteger(output, output->profile_branch_n);
+	WriteString(output, "\n\n");
+	
+	WriteString(output, "static unsigned long long m64_call_counts[M64_PROFILE_FUNC_N + 1];\n");
+	WriteString(output, "static unsigned long long m64_branch_counts[M64_PROFILE_BRANCH_N + 1][2];\n");
+	WriteString(output, "static int m64_profile_registered;\n");
+	WriteString(output, "static const char *m64_func_names[M64_PROFILE_FUNC_N + 1] =\n{\n");
+	for(U32 i = 0; i < output->profile_func_n; i++)
+	{
+		WriteString(output, "    \"");
+		for(U32 c = 0; c < name_lengths[i]; c++)
+		{
+			WriteChar(output, names[i][c]);
+		}
+		WriteString(output, "\",\n");
+	}
+	WriteString(output, "    0\n};\n\n");
+	free(names);
+	free(name_lengths);
+	
+	WriteString(output, "static void M64WriteProfile(void)\n");
+	WriteString(output, "{\n");
+	WriteString(output, "    FILE *file = fopen(M64_PROFILE_PATH, \"w\");\n");
+	WriteString(output, "    if(!file)\n");
+	WriteString(output, "    {\n");
+	WriteString(output, "        return;\n");
+	WriteString(output, "    }\n");
+	WriteString(output, "    fprintf(file, \"m64-profile %u %u\\n\", M64_PROFILE_FUNC_N, M64_PROFILE_BRANCH_N);\n");
+	WriteString(output, "    for(unsigned int i = 0; i < M64_PROFILE_FUNC_N; i++)\n");
+	WriteString(output, "    {\n");
+	WriteString(output, "        fprintf(file, \"f %u %llu %s\\n\", i, m64_call_counts[i], m64_func_names[i]);\n");
+	WriteString(output, "    }\n");
+	WriteString(output, "    for(unsigned int i = 0; i < M64_PROFILE_BRANCH_N; i++)\n");
+	WriteString(output, "    {\n");
+	WriteString(output, "        fprintf(file, \"b %u %llu %llu\\n\", i, m64_branch_counts[i][0], m64_branch_counts[i][1]);\n");
+	WriteString(output, "    }\n");
+	WriteString(output, "    fclose(file);\n");
+	WriteString(output, "}\n\n");
+	
+	WriteString(output, "static void M64CountCall(unsigned int id)\n");
+	WriteString(output, "{\n");
+	WriteString(output, "    if(!m64_profile_registered)\n");
+	WriteString(output, "    {\n");
+	WriteString(output, "        m64_profile_registered = 1;\n");
+	WriteString(output, "        atexit(M64WriteProfile);\n");
+	WriteString(output, "    }\n");
+	WriteString(output, "    m64_call_counts[id]++;\n");
+	WriteString(output, "}\n\n");
+	
+	WriteString(output, "static int M64CountBranch(unsigned int id, int value)\n");
+	WriteString(output, "{\n");
+	WriteString(output, "    m64_branch_counts[id][0]++;\n");
+	WriteString(output, "    m64_branch_counts[id][1] += (value != 0);\n");
+	WriteString(output, "    return value;\n");
+	WriteString(output, "}\n\n");
+}
+
+static void
+func WriteDefinitionList(Output *output, DefinitionList *def_list)
+{
+	if(output->uses_sse2)
+	{
+		WriteString(output, "#if defined(__SSE2__) || defined(_M_X64)\n");
+		WriteString(output, "#include <emmintrin.h>\n");
+		WriteString(output, "#define M64_SSE2\n");
+		WriteString(output, "#endif\n\n");
+	}
+	
+	if(output->uses_restrict)
+	{
+		WriteString(output, "#ifndef M64_RESTRICT\n");
+		WriteString(output, "#if defined(__cplusplus) || defined(_MSC_VER)\n");
+		WriteString(output, "#define M64_RESTRICT __restrict\n");
+		WriteString(output, "#else\n");
+		WriteString(output, "#define M64_RESTRICT restrict\n");
+		WriteString(output, "#endif\n");
+		WriteString(output, "#endif\n\n");
+	}
+	
+	if(output->uses_align)
+	{
+		WriteString(output, "#ifndef M64_ALIGN\n");
+		WriteString(output, "#if defined(_MSC_VER)\n");
+		WriteString(output, "#define M64_ALIGN(n) __declspec(align(n))\n");
+		WriteString(output, "#else\n");
+		WriteString(output, "#define M64_ALIGN(n) __attribute__((aligned(n)))\n");
+		WriteString(output, "#endif\n");
+		WriteString(output, "#endif\n\n");
+	}
+	
+	if(output->uses_bounds_check)
+	{
+		// A negative index turns into a large unsigned one and fails too.
+		// Define M64_BOUNDS_FAIL to report the failure some other way.
+		WriteString(output, "#ifndef M64_BOUNDS_FAIL\n");
+		WriteString(output, "#include <stdlib.h>\n");
+		WriteString(output, "#define M64_BOUNDS_FAIL(index, size) abort()\n");
+		WriteString(output, "#endif\n\n");
+		WriteString(output, "static inline unsigned int M64CheckIndex(unsigned int index, unsigned int size)\n");
+		WriteString(output, "{\n");
+		WriteString(output, "    if(index >= size)\n");
+		WriteString(output, "    {\n");
+		WriteString(output, "        M64_BOUNDS_FAIL(index, size);\n");
+		WriteString(output, "    }\n");
+		WriteString(output, "    return index;\n");
+		WriteString(output, "}\n\n");
+	}
+	
+	if(output->instrument)
+	{
+		WriteProfileCounters(output, def_list);
+	}
+	
+	if(output->uses_profile)
+	{
+		WriteString(output, "#if defined(__GNUC__)\n");
+		WriteString(output, "#define M64_LIKELY(x) __builtin_expect(!!(x), 1)\n");
+		WriteString(output, "#define M64_UNLIKELY(x) __builtin_expect(!!(x), 0)\n");
+		WriteString(output, "#define M64_COLD __attribute__((cold, noinline))\n");
+		WriteString(output, "#else\n");
+		WriteString(output, "#define M64_LIKELY(x) (x)\n");
+		WriteString(output, "#define M64_UNLIKELY(x) (x)\n");
+		WriteString(output, "#if defined(_MSC_VER)\n");
+		WriteString(output, "#define M64_COLD __declspec(noinline)\n");
+		WriteString(output, "#else\n");
+		WriteString(output, "#define M64_COLD\n");
+		WriteString(output, "#endif\n");
+		WriteString(output, "#endif\n\n");
+	}
+	
+	DefinitionListElem *elem = def_list;
+	bool first = true;
+	while(elem)
+	{
+		Definition *definition = elem->definition;
+		if(IsCompileTimeOnly(definition))
+		{
+			// Every call was evaluated, there is nothing left to run.
+			elem = elem->next;
+			continue;
+		}
+		
+		if(!first)
+		{
+			WriteString(output, "\n");
+		}
+		
+		switch(definition->id)
+		{
+			case FuncDefinitionId:
+			{
+				// Ordered by the profile, only the prototypes are written here and the bodies after everything else.
+				// Split output writes the bodies into the parts, except the static inline ones.
+				FuncDefinition *def = (FuncDefinition *)definition;
+				bool prototype_only = (output->split_n > 0) ? !def->is_static_inline : output->uses_profile;
+				WriteFuncDefinition(output, def, prototype_only && !def->is_extern);
+				break;
+			}
+			case OperatorDefinitionId:
+			{
+				OperatorDefinition *def = (OperatorDefinition *)definition;
+				WriteOperatorDefinition(output, def, output->split_n > 0 && !def->is_static_inline);
+				break;
+			}
+			case CCodeDefinitionId:
+			{
+				CCodeDefinition *def = (CCodeDefinition *)definition;
+				WriteToken(output, def->code);
+				WriteString(output, "\n");
+				break;
+			}
+			case StructDefinitionId:
 			{
 				StructDefinition *def = (StructDefinition *)definition;
 				WriteStructDefinition(output, def);
@@ -629,4 +1660,248 @@ func WriteDefinitionList(Output *output, DefinitionList *def_list)
 		elem = elem->next;
 		first = false;
 	}
-}
\ No newline at end of file
+	
+	if(output->uses_profile && output->split_n == 0)
+	{
+		WriteFuncBodiesHotFirst(output, def_list);
+	}
+}
+typedef struct tdef SplitBody
+{
+	Definition *definition;
+	size_t cost;
+	size_t index;
+	size_t part;
+} SplitBody;
+
+static int
+func CompareSplitBodyCost(const void *a, const void *b)
+{
+	SplitBody *body1 = (SplitBody *)a;
+	SplitBody *body2 = (SplitBody *)b;
+	if(body1->cost != body2->cost)
+	{
+		return (body1->cost > body2->cost) ? -1 : 1;
+	}
+	return (body1->index < body2->index) ? -1 : (body1->index > body2->index);
+}
+
+static int
+func CompareSplitBodyIndex(const void *a, const void *b)
+{
+	SplitBody *body1 = (SplitBody *)a;
+	SplitBody *body2 = (SplitBody *)b;
+	return (body1->index < body2->index) ? -1 : (body1->index > body2->index);
+}
+
+static bool
+func WriteOutputToFile(Output *output, char *path)
+{
+	FILE *file = fopen(path, "w");
+	if(!file)
+	{
+		printf("Cannot create file to write to <%s>\n", path);
+		return false;
+	}
+	
+	fwrite(output->arena.memory, 1, output->arena.used_size, file);
+	fclose(file);
+	return true;
+}
+
+static void
+func ResetOutput(Output *output, char *path)
+{
+	output->arena.used_size = 0;
+	output->tabs = 0;
+	output->output_path = path;
+	output->line_n = 0;
+	output->in_source = false;
+}
+
+static char *
+func CreateSplitPath(char *base, size_t base_length, char *suffix)
+{
+	size_t suffix_length = strlen(suffix);
+	char *path = (char *)malloc(base_length + suffix_length + 1);
+	memcpy(path, base, base_length);
+	memcpy(path + base_length, suffix, suffix_length + 1);
+	return path;
+}
+
+static void
+func WriteSplitObjectPath(Output *output, char *part_path)
+{
+	// The path of the part, with .o instead of .c.
+	size_t length = strlen(part_path);
+	for(size_t i = 0; i + 1 < length; i++)
+	{
+		WriteChar(output, part_path[i]);
+	}
+	WriteChar(output, 'o');
+}
+
+static bool
+func WriteSplitParts(Output *output, DefinitionList *def_list, char *header_path, bool makefile, bool report)
+{
+	// The bodies are spread over the parts by AST node count, the largest first into the smallest part.
+	// Each part includes the header, so the C code of #C blocks has to be declarations.
+	size_t part_n = output->split_n;
+	size_t body_n = 0;
+	for(DefinitionListElem *elem = def_list; elem; elem = elem->next)
+	{
+		Definition *definition = elem->definition;
+		bool has_body = (definition->id == OperatorDefinitionId && !((OperatorDefinition *)definition)->is_static_inline);
+		has_body |= (definition->id == FuncDefinitionId && !((FuncDefinition *)definition)->is_extern && !((FuncDefinition *)definition)->is_static_inline);
+		if(has_body && !IsCompileTimeOnly(definition))
+		{
+			body_n++;
+		}
+	}
+	
+	SplitBody *bodies = (SplitBody *)malloc((body_n + 1) * sizeof(SplitBody));
+	size_t index = 0;
+	for(DefinitionListElem *elem = def_list; elem; elem = elem->next)
+	{
+		Definition *definition = elem->definition;
+		BlockInstruction *body = 0;
+		// Static inline bodies are already in the header.
+		if(definition->id == OperatorDefinitionId && !((OperatorDefinition *)definition)->is_static_inline)
+		{
+			body = ((OperatorDefinition *)definition)->body;
+		}
+		else if(definition->id == FuncDefinitionId && !((FuncDefinition *)definition)->is_extern && !((FuncDefinition *)definition)->is_static_inline)
+		{
+			body = ((FuncDefinition *)definition)->body;
+		}
+		
+		if(body && !IsCompileTimeOnly(definition))
+		{
+			bodies[index].definition = definition;
+			bodies[index].cost = 1 + GetBlockCost(body);
+			bodies[index].index = index;
+			bodies[index].part = 0;
+			index++;
+		}
+	}
+	
+	size_t *part_costs = (size_t *)malloc(part_n * sizeof(size_t));
+	memset(part_costs, 0, part_n * sizeof(size_t));
+	qsort(bodies, body_n, sizeof(SplitBody), CompareSplitBodyCost);
+	for(size_t i = 0; i < body_n; i++)
+	{
+		size_t part = 0;
+		for(size_t p = 1; p < part_n; p++)
+		{
+			if(part_costs[p] < part_costs[part])
+			{
+				part = p;
+			}
+		}
+		bodies[i].part = part;
+		part_costs[part] += bodies[i].cost;
+	}
+	qsort(bodies, body_n, sizeof(SplitBody), CompareSplitBodyIndex);
+	
+	size_t header_length = strlen(header_path);
+	size_t base_length = header_length;
+	if(base_length > 2 && strcmp(header_path + base_length - 2, ".h") == 0)
+	{
+		base_length -= 2;
+	}
+	
+	char *header_name = header_path;
+	for(char *at = header_path; *at; at++)
+	{
+		if(*at == '/' || *at == '\\')
+		{
+			header_name = at + 1;
+		}
+	}
+	
+	if(report)
+	{
+		printf("Split output:\n");
+	}
+	
+	bool written = true;
+	char **part_paths = (char **)malloc(part_n * sizeof(char *));
+	memset(part_paths, 0, part_n * sizeof(char *));
+	for(size_t part = 0; part < part_n; part++)
+	{
+		char suffix[32];
+		snprintf(suffix, sizeof(suffix), "_%zu.c", part);
+		part_paths[part] = CreateSplitPath(header_path, base_length, suffix);
+		
+		ResetOutput(output, part_paths[part]);
+		WriteString(output, "#include \"");
+		WriteString(output, header_name);
+		WriteString(output, "\"\n");
+		
+		size_t part_body_n = 0;
+		for(size_t i = 0; i < body_n; i++)
+		{
+			if(bodies[i].part != part)
+			{
+				continue;
+			}
+			
+			WriteString(output, "\n");
+			if(bodies[i].definition->id == FuncDefinitionId)
+			{
+				WriteFuncDefinition(output, (FuncDefinition *)bodies[i].definition, false);
+			}
+			else
+			{
+				WriteOperatorDefinition(output, (OperatorDefinition *)bodies[i].definition, false);
+			}
+			part_body_n++;
+		}
+		
+		if(output->error || !WriteOutputToFile(output, part_paths[part]))
+		{
+			written = false;
+			break;
+		}
+		
+		if(report)
+		{
+			printf("  %s: %zu functions, %zu nodes\n", part_paths[part], part_body_n, part_costs[part]);
+		}
+	}
+	
+	if(written && makefile)
+	{
+		// Compiles the parts with make -j, the including makefile links $(M64_OBJECTS).
+		char *makefile_path = CreateSplitPath(header_path, base_length, ".mk");
+		ResetOutput(output, makefile_path);
+		WriteString(output, "M64_OBJECTS =");
+		for(size_t part = 0; part < part_n; part++)
+		{
+			WriteString(output, " ");
+			WriteSplitObjectPath(output, part_paths[part]);
+		}
+		WriteString(output, "\n");
+		for(size_t part = 0; part < part_n; part++)
+		{
+			WriteString(output, "\n");
+			WriteSplitObjectPath(output, part_paths[part]);
+			WriteString(output, ": ");
+			WriteString(output, part_paths[part]);
+			WriteString(output, " ");
+			WriteString(output, header_path);
+			WriteString(output, "\n\t$(CC) $(CFLAGS) -c $< -o $@\n");
+		}
+		written = WriteOutputToFile(output, makefile_path);
+		free(makefile_path);
+	}
+	
+	for(size_t part = 0; part < part_n; part++)
+	{
+		free(part_paths[part]);
+	}
+	free(part_paths);
+	free(part_costs);
+	free(bodies);
+	return written;
+}
@@ -1,7 +1,28 @@
+// x64 assembly output for NASM, written from the instructions that X64Alloc.h rewrote with registers.
+// Every function is lowered, allocated and written on its own, its instructions are reused for the next one.
+// The output is for elf64: extern functions are called through the PLT, so the program links as a PIE,
+// and the constant data of all functions goes to .rodata at the end, addressed relative to rip.
+// With an object set, the same instructions are encoded by X64Encode.h instead, for an ELF object or the JIT.
+
 typedef struct tdef
 {
 	MemoryArena arena;
-	FuncDefinition *in_func;
+	AtomTable *atoms;
+	ParseInput *input;
+	X64Object *object;
+
+	// Labels are numbered in each function, this makes them unique in the file.
+	U32 label_base;
+	bool error;
+
+	size_t func_n;
+	size_t instruction_n;
+	size_t virtual_reg_n;
+	size_t spilled_n;
+	size_t saved_n;
+
+	bool peephole;
+	X64PeepholeStats peephole_stats;
 } X64Output;
 
 static void
@@ -23,12 +44,21 @@ func X64WriteString(X64Output *output, char *string)
 static void
 func X64WriteToken(X64Output *output, Token token)
 {
-	for(size_t i = 0; i < token.length; i++)
+	Atom *atom = &output->atoms->atoms[token.value];
+	for(size_t i = 0; i < atom->length; i++)
 	{
-		X64WriteChar(output, token.text[i]);
+		X64WriteChar(output, atom->text[i]);
 	}
 }
 
+static void
+func X64WriteInteger(X64Output *output, I64 value)
+{
+	char buffer[32];
+	snprintf(buffer, sizeof(buffer), "%lld", value);
+	X64WriteString(output, buffer);
+}
+
 static void
 func X64WriteTabs(X64Output *output)
 {
@@ -47,138 +77,465 @@ func X64WriteAsmInstruction(X64Output *output, char *instruction)
 }
 
 static void
-func X64WriteExpression(X64Output *output, Expression *expression)
-{
-	// Puts the expression value on the top of the stack
-	switch(expression->id)
-	{
-		case AddExpressionId:
-		{
-			AddExpression *e = (AddExpression *)expression;
-			
-			X64WriteExpression(output, e->left);
-			X64WriteExpression(output, e->right);
-			
-			X64WriteAsmInstruction(output, "pop rax");
-			X64WriteAsmInstruction(output, "pop rbx");
-			X64WriteAsmInstruction(output, "add rax, rbx");
-			X64WriteAsmInstruction(output, "push rax");
-			
+func X64WriteRegName(X64Output *output, U32 reg, U32 size)
+{
+	static char *names64[] = {"rax", "rcx", "rdx", "rbx", "rsp", "rbp", "rsi", "rdi", "r8", "r9", "r10", "r11", "r12", "r13", "r14", "r15"};
+	static char *names32[] = {"eax", "ecx", "edx", "ebx", "esp", "ebp", "esi", "edi", "r8d", "r9d", "r10d", "r11d", "r12d", "r13d", "r14d", "r15d"};
+	static char *names8[] = {"al", "cl", "dl", "bl", "spl", "bpl", "sil", "dil", "r8b", "r9b", "r10b", "r11b", "r12b", "r13b", "r14b", "r15b"};
+	if(reg >= X64Xmm0)
+	{
+		X64WriteString(output, "xmm");
+		X64WriteInteger(output, reg - X64Xmm0);
+	}
+	else if(size == 8)
+		X64WriteString(output, names64[reg]);
+	else if(size == 4)
+		X64WriteString(output, names32[reg]);
+	else
+		X64WriteString(output, names8[reg]);
+}
+
+static void
+func X64WriteOperand(X64Output *output, X64Operand *op, bool with_size)
+{
+	switch(op->kind)
+	{
+		case X64RegOperand:
+		{
+			X64WriteRegName(output, op->reg, op->size);
 			break;
 		}
-		case IntegerConstantExpressionId:
+		case X64ImmOperand:
 		{
-			IntegerConstantExpression *e = (IntegerConstantExpression *)expression;
-			
-			X64WriteTabs(output);
-			X64WriteString(output, "push ");
-			X64WriteToken(output, e->token);
-			X64WriteString(output, "\n");
-			
+			X64WriteInteger(output, op->value);
+			break;
+		}
+		case X64MemOperand:
+		{
+			if(with_size)
+				X64WriteString(output, (op->size == 8) ? "qword " : "dword ");
+			X64WriteString(output, "[");
+			if(op->reg == X64RipReg)
+				X64WriteString(output, "M64Const");
+			else
+				X64WriteRegName(output, op->reg, 8);
+			if(op->index != X64NoReg)
+			{
+				X64WriteString(output, " + ");
+				X64WriteRegName(output, op->index, 8);
+				if(op->scale != 1)
+				{
+					X64WriteString(output, "*");
+					X64WriteInteger(output, op->scale);
+				}
+			}
+			if(op->value != 0)
+			{
+				X64WriteString(output, (op->value < 0) ? " - " : " + ");
+				X64WriteInteger(output, (op->value < 0) ? -op->value : op->value);
+			}
+			X64WriteString(output, "]");
 			break;
 		}
 		default:
 		{
-			// TODO: get expression name from its id
-			printf("Writing expression type %i to asm not yet implemented.\n", (int)expression->id);
 			break;
 		}
 	}
 }
 
 static void
-func X64WriteInstruction(X64Output *output, Instruction *instruction)
-{	
-	MemoryArena *arena = &output->arena;
-	switch(instruction->id)
+func X64WriteLabel(X64Output *output, U32 label)
+{
+	X64WriteString(output, ".L");
+	X64WriteInteger(output, output->label_base + label);
+}
+
+static char *
+func X64GetConditionName(X64Condition cond)
+{
+	switch(cond)
+	{
+		case X64Below:        return "b";
+		case X64AboveEqual:   return "ae";
+		case X64Equal:        return "e";
+		case X64NotEqual:     return "ne";
+		case X64BelowEqual:   return "be";
+		case X64Above:        return "a";
+		case X64Less:         return "l";
+		case X64GreaterEqual: return "ge";
+		case X64LessEqual:    return "le";
+		case X64Greater:      return "g";
+		default:              return "?";
+	}
+}
+
+static char *
+func X64GetOpcodeName(X64Instruction *instruction)
+{
+	// Float instructions are scalar for one float, and work on the whole register otherwise.
+	bool is_scalar = (instruction->dst.size == 4);
+	switch(instruction->op)
+	{
+		case X64MovOp:    return "mov";
+		case X64MovsxdOp: return "movsxd";
+		case X64LeaOp:    return "lea";
+		case X64AddOp:    return "add";
+		case X64SubOp:    return "sub";
+		case X64ImulOp:   return "imul";
+		case X64NegOp:    return "neg";
+		case X64AndOp:    return "and";
+		case X64CmpOp:    return "cmp";
+		case X64TestOp:   return "test";
+		case X64FAddOp:   return is_scalar ? "addss" : "addps";
+		case X64FSubOp:   return is_scalar ? "subss" : "subps";
+		case X64FMulOp:   return is_scalar ? "mulss" : "mulps";
+		case X64FCmpOp:   return "ucomiss";
+		case X64FXorOp:   return "xorps";
+		case X64PshufdOp: return "pshufd";
+		case X64MovssOp:  return "movss";
+		case X64UnpcklpsOp: return "unpcklps";
+		case X64CvtIntToFloatOp: return "cvtsi2ss";
+		case X64CvtFloatToIntOp: return "cvttss2si";
+		case X64FMovOp:
+		{
+			bool both_regs = (instruction->dst.kind == X64RegOperand && instruction->src.kind == X64RegOperand);
+			if(both_regs)
+				return "movaps";
+			return is_scalar ? "movss" : (instruction->dst.size == 8) ? "movsd" : "movups";
+		}
+		default:          return "?";
+	}
+}
+
+static void
+func X64WriteEpilogue(X64Output *output, X64Function *f)
+{
+	U32 saved_size = 0;
+	for(U32 reg = 0; reg < X64FirstVirtualReg; reg++)
+	{
+		if((f->saved_mask >> reg) & 1)
+			saved_size += 8;
+	}
+
+	if(!f->has_frame_pointer && f->frame_size > 0)
+	{
+		X64WriteTabs(output);
+		X64WriteString(output, "add rsp, ");
+		X64WriteInteger(output, f->frame_size);
+		X64WriteString(output, "\n");
+	}
+	else if(f->has_frame_pointer && saved_size == 0 && f->frame_size > 0)
 	{
-		case ReturnInstructionId:
+		X64WriteAsmInstruction(output, "mov rsp, rbp");
+	}
+	else if(f->has_frame_pointer && saved_size > 0)
+	{
+		X64WriteTabs(output);
+		X64WriteString(output, "lea rsp, [rbp - ");
+		X64WriteInteger(output, saved_size);
+		X64WriteString(output, "]\n");
+	}
+	for(U32 reg = X64FirstVirtualReg; reg > 0; reg--)
+	{
+		if((f->saved_mask >> (reg - 1)) & 1)
+		{
+			X64WriteTabs(output);
+			X64WriteString(output, "pop ");
+			X64WriteRegName(output, reg - 1, 8);
+			X64WriteString(output, "\n");
+		}
+	}
+	if(f->has_frame_pointer)
+		X64WriteAsmInstruction(output, "pop rbp");
+	X64WriteAsmInstruction(output, "ret");
+}
+
+static void
+func X64WriteInstruction(X64Output *output, X64Function *f, X64Instruction *instruction)
+{
+	switch(instruction->op)
+	{
+		case X64LabelOp:
+		{
+			X64WriteLabel(output, instruction->label);
+			X64WriteString(output, ":\n");
+			break;
+		}
+		case X64JmpOp:
+		case X64JccOp:
+		{
+			X64WriteTabs(output);
+			X64WriteString(output, "j");
+			X64WriteString(output, (instruction->op == X64JmpOp) ? "mp" : X64GetConditionName(instruction->cond));
+			X64WriteString(output, " ");
+			X64WriteLabel(output, instruction->label);
+			X64WriteString(output, "\n");
+			break;
+		}
+		case X64CallOp:
+		{
+			X64WriteTabs(output);
+			X64WriteString(output, "call ");
+			X64WriteToken(output, instruction->callee);
+			X64WriteString(output, instruction->is_extern ? " wrt ..plt\n" : "\n");
+			break;
+		}
+		case X64RetOp:
+		{
+			X64WriteEpilogue(output, f);
+			break;
+		}
+		case X64RepMovsOp:
+		{
+			X64WriteAsmInstruction(output, "rep movsq");
+			break;
+		}
+		case X64RepStosOp:
+		{
+			X64WriteAsmInstruction(output, "rep stosq");
+			break;
+		}
+		case X64Ud2Op:
+		{
+			X64WriteAsmInstruction(output, "ud2");
+			break;
+		}
+		case X64SetOp:
 		{
-			ReturnInstruction *i = (ReturnInstruction *)instruction;
+			// set writes one byte, the rest of the register is cleared after it.
+			X64Operand *dst = &instruction->dst;
 			X64WriteTabs(output);
-			X64WriteString(output, "; ");
-			WriteFormattedReturnInstruction(arena, i);
+			X64WriteString(output, "set");
+			X64WriteString(output, X64GetConditionName(instruction->cond));
+			X64WriteString(output, " ");
+			X64WriteRegName(output, dst->reg, 1);
 			X64WriteString(output, "\n");
-			
-			X64WriteExpression(output, i->value);
-			
-			X64WriteAsmInstruction(output, "pop rax");
-			
 			X64WriteTabs(output);
-			X64WriteString(output, "jmp ");
-			X64WriteToken(output, output->in_func->header.name);
-			X64WriteString(output, "_return\n");
+			X64WriteString(output, "movzx ");
+			X64WriteRegName(output, dst->reg, 4);
+			X64WriteString(output, ", ");
+			X64WriteRegName(output, dst->reg, 1);
+			X64WriteString(output, "\n");
 			break;
 		}
 		default:
 		{
-			// TODO: get instruction name from its id
-			printf("Writing instruction type %i to asm not yet implemented.\n", (int)instruction->id);
+			// The size is only needed when no register gives it.
+			X64Operand *dst = &instruction->dst;
+			X64Operand *src = &instruction->src;
+			bool needs_size = (dst->kind == X64MemOperand && src->kind != X64RegOperand) || (instruction->op == X64MovsxdOp);
+			X64WriteTabs(output);
+			X64WriteString(output, X64GetOpcodeName(instruction));
+			X64WriteString(output, " ");
+			X64WriteOperand(output, dst, needs_size && dst->kind == X64MemOperand);
+			if(src->kind != X64NoOperand)
+			{
+				X64WriteString(output, ", ");
+				X64WriteOperand(output, src, needs_size && instruction->op != X64LeaOp);
+			}
+			if(instruction->op == X64PshufdOp)
+			{
+				X64WriteString(output, ", ");
+				X64WriteInteger(output, instruction->lanes);
+			}
+			X64WriteString(output, "\n");
 			break;
 		}
 	}
-	X64WriteString(output, "\n");
 }
 
 static void
-func X64WriteBlock(X64Output *output, BlockInstruction *block)
+func X64WriteFuncText(X64Output *output, X64Function *f, X64Function *rewritten)
 {
-	Instruction *instruction = block->first;
-	while(instruction)
+	X64WriteString(output, "\n");
+	if(f->is_exported)
 	{
-		X64WriteInstruction(output, instruction);
-		instruction = instruction->next;
+		X64WriteString(output, "global ");
+		X64WriteToken(output, f->name);
+		X64WriteString(output, "\n");
 	}
+	X64WriteToken(output, f->name);
+	X64WriteString(output, ":\n");
+
+	if(f->has_frame_pointer)
+	{
+		X64WriteAsmInstruction(output, "push rbp");
+		X64WriteAsmInstruction(output, "mov rbp, rsp");
+	}
+	for(U32 reg = 0; reg < X64FirstVirtualReg; reg++)
+	{
+		if((f->saved_mask >> reg) & 1)
+		{
+			X64WriteTabs(output);
+			X64WriteString(output, "push ");
+			X64WriteRegName(output, reg, 8);
+			X64WriteString(output, "\n");
+		}
+	}
+	if(f->frame_size > 0)
+	{
+		X64WriteTabs(output);
+		X64WriteString(output, "sub rsp, ");
+		X64WriteInteger(output, f->frame_size);
+		X64WriteString(output, "\n");
+	}
+
+	for(size_t i = 0; i < rewritten->instruction_n; i++)
+		X64WriteInstruction(output, f, &rewritten->instructions[i]);
 }
 
 static void
-func X64WriteFunc(X64Output *output, FuncDefinition *func_def)
+func X64WriteFunc(X64Output *output, X64Function *f, X64Function *rewritten)
 {
-	output->in_func = func_def;
-	FuncHeader header = func_def->header;
-	X64WriteToken(output, header.name);
-	X64WriteString(output, ":\n");
-	
-	X64WriteAsmInstruction(output, "push rbp");
-	X64WriteAsmInstruction(output, "mov rbp, rsp");
-	X64WriteAsmInstruction(output, "sub rsp, 32");
-	X64WriteString(output, "\n");
-	
-	X64WriteBlock(output, func_def->body);
-	
-	X64WriteTabs(output);
-	X64WriteToken(output, header.name);
-	X64WriteString(output, "_return:\n");
-	
-	X64WriteAsmInstruction(output, "add rsp, 32");
-	X64WriteAsmInstruction(output, "pop rbp");
-	X64WriteAsmInstruction(output, "ret");
-	output->in_func = 0;
+	if(output->peephole)
+		X64FoldConstants(f, &output->peephole_stats);
+	X64AllocateRegisters(f);
+	X64LayoutFrame(f);
+	X64RewriteInstructions(f, rewritten);
+	if(output->peephole)
+		X64OptimizeInstructions(f, rewritten, &output->peephole_stats);
+
+	if(output->object)
+		X64EncodeFunc(output->object, f, rewritten);
+	else
+		X64WriteFuncText(output, f, rewritten);
+
+	output->label_base += f->label_n;
+	output->func_n++;
+	output->instruction_n += rewritten->instruction_n;
+	output->virtual_reg_n += f->reg_n - X64FirstVirtualReg;
+	output->spilled_n += f->spilled_n;
+	for(U32 reg = 0; reg < X64FirstVirtualReg; reg++)
+		output->saved_n += (f->saved_mask >> reg) & 1;
 }
 
 static void
-func X64WriteDefinitionList(X64Output *output, DefinitionList *def_list)
+func X64WriteData(X64Output *output, X64Lowering *l)
 {
-	X64WriteString(output, "global main\n");
+	if(l->data_size == 0)
+		return;
+
 	X64WriteString(output, "\n");
-	X64WriteString(output, "section .text\n");
-	
-	DefinitionListElem *elem = def_list;
-	bool first = true;
-	while(elem)
+	X64WriteString(output, "section .rodata\n");
+	X64WriteString(output, "align 16\n");
+	X64WriteString(output, "M64Const:\n");
+	for(size_t i = 0; i < l->data_size; i += 16)
+	{
+		X64WriteTabs(output);
+		X64WriteString(output, "db ");
+		for(size_t j = i; j < i + 16 && j < l->data_size; j++)
+		{
+			if(j > i)
+				X64WriteString(output, ", ");
+			X64WriteInteger(output, l->data[j]);
+		}
+		X64WriteString(output, "\n");
+	}
+}
+
+static void
+func X64WriteDefinitionList(X64Output *output, DefinitionList *def_list, bool report)
+{
+	// The C code of the program goes to a C file that is linked with the output, see M64.c.
+	if(!output->object)
+	{
+		X64WriteString(output, "default rel\n");
+		X64WriteString(output, "\n");
+		for(DefinitionListElem *elem = def_list; elem; elem = elem->next)
+		{
+			Definition *definition = elem->definition;
+			if(definition->id == FuncDefinitionId && ((FuncDefinition *)definition)->is_extern)
+			{
+				X64WriteString(output, "extern ");
+				X64WriteToken(output, ((FuncDefinition *)definition)->header.name);
+				X64WriteString(output, "\n");
+			}
+		}
+		X64WriteString(output, "\n");
+		X64WriteString(output, "section .text\n");
+	}
+
+	X64Lowering lowering = {};
+	lowering.input = output->input;
+	lowering.sign_mask_at = (size_t)-1;
+	X64Function f = {};
+	X64Function rewritten = {};
+
+	for(DefinitionListElem *elem = def_list; elem && !output->error; elem = elem->next)
 	{
 		Definition *definition = elem->definition;
+		if(IsCompileTimeOnly(definition))
+			continue;
+
+		bool lowered = true;
 		switch(definition->id)
 		{
 			case FuncDefinitionId:
 			{
 				FuncDefinition *def = (FuncDefinition *)definition;
-				
-				X64WriteFunc(output, def);
+				if(def->is_extern)
+					continue;
+				lowered = X64LowerFunc(&lowering, &f, def);
 				break;
 			}
+			case OperatorDefinitionId:
+			{
+				lowered = X64LowerOperator(&lowering, &f, (OperatorDefinition *)definition);
+				break;
+			}
+			default:
+			{
+				continue;
+			}
+		}
+
+		if(!lowered)
+		{
+			output->error = true;
+			break;
 		}
-		
-		elem = elem->next;
+		X64WriteFunc(output, &f, &rewritten);
+	}
+
+	// The object takes the constant data, it is written with it or linked by the JIT.
+	if(output->object)
+	{
+		output->object->data = lowering.data;
+		output->object->data_size = lowering.data_size;
+		lowering.data = 0;
 	}
-}
\ No newline at end of file
+	else
+	{
+		X64WriteData(output, &lowering);
+		X64WriteString(output, "\n");
+		X64WriteString(output, "section .note.GNU-stack noalloc noexec nowrite progbits\n");
+	}
+
+	free(lowering.locals);
+	free(lowering.field_writes);
+	free(lowering.data);
+	free(f.instructions);
+	free(f.classes);
+	free(f.slots);
+	free(f.assigned);
+	free(f.spill_slot);
+	free(rewritten.instructions);
+
+	if(report)
+	{
+		printf("x64:\n");
+		printf("%zu functions, %zu instructions, %zu virtual registers, %zu of them spilled, %zu callee-saved registers pushed.\n",
+		       output->func_n, output->instruction_n, output->virtual_reg_n, output->spilled_n, output->saved_n);
+		if(output->peephole)
+		{
+			X64PeepholeStats *stats = &output->peephole_stats;
+			printf("Peephole: removed %zu instructions, folded %zu immediates, rotated %zu loops, %zu of %zu functions without frame pointer.\n",
+			       stats->removed_n, stats->folded_n, stats->rotated_n, stats->frameless_n, output->func_n);
+		}
+		if(lowering.packed_local_n > 0 || lowering.packed_op_n > 0)
+			printf("Packed: %zu float struct locals in xmm registers, %zu operator calls as one instruction.\n", lowering.packed_local_n, lowering.packed_op_n);
+		if(output->object)
+			printf("%zu bytes of code, %zu relocations.\n", output->object->code_size, output->object->relocation_n);
+	}
+}
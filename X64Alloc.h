@@ -0,0 +1,803 @@
+// Linear scan register allocation for the x64 backend, after X64Ir.h lowered a function.
+// Liveness is computed on the basic blocks, and every virtual register gets one interval
+// from its first to its last live position. Intervals are given registers of their class in the order they start.
+// A register is taken only when no interval holding it overlaps, and when none of the places
+// that use it directly (arguments, return values, registers a call changes) overlap.
+// So a value that lives across a call ends up in a callee-saved register.
+// When no register is left, the interval that ends last goes to a stack slot.
+//
+// Each instruction has two positions: registers are read at 2 * i and written at 2 * i + 1,
+// so a value can move into the register that another one was read from.
+//
+// r10, r11, xmm14 and xmm15 are never given out: X64RewriteInstructions uses them to load and store
+// the values that went to stack slots.
+
+#define X64ScratchReg X64R10
+#define X64AddressScratchReg X64R11
+#define X64FloatScratchReg X64Xmm15
+#define X64FloatSrcScratchReg (X64Xmm0 + 14)
+
+// Caller-saved registers first, they cost nothing to use in a function that makes no calls.
+static U32 X64GeneralAllocOrder[] =
+{
+	X64Rax, X64Rcx, X64Rdx, X64Rsi, X64Rdi, X64R8, X64R9,
+	X64Rbx, X64R12, X64R13, X64R14, X64R15
+};
+
+static U32 X64FloatAllocOrder[] =
+{
+	X64Xmm0, X64Xmm0 + 1, X64Xmm0 + 2, X64Xmm0 + 3, X64Xmm0 + 4, X64Xmm0 + 5, X64Xmm0 + 6,
+	X64Xmm0 + 7, X64Xmm0 + 8, X64Xmm0 + 9, X64Xmm0 + 10, X64Xmm0 + 11, X64Xmm0 + 12, X64Xmm0 + 13
+};
+
+typedef struct tdef X64Range
+{
+	U32 start;
+	U32 end;
+} X64Range;
+
+typedef struct tdef X64FixedRanges
+{
+	X64Range *ranges;
+	size_t range_n;
+	size_t max_range_n;
+} X64FixedRanges;
+
+typedef struct tdef X64Liveness
+{
+	X64Function *f;
+	size_t word_n;
+
+	size_t block_n;
+	size_t *block_starts;
+	U32 *label_blocks;
+	U64 *uses;
+	U64 *defs;
+	U64 *live_in;
+	U64 *live_out;
+
+	// Hull of the live positions of every register.
+	U32 *starts;
+	U32 *ends;
+	U32 *hints;
+	// Where the physical registers are used directly.
+	X64FixedRanges fixed[X64FirstVirtualReg];
+} X64Liveness;
+
+typedef struct tdef X64RegList
+{
+	U32 regs[40];
+	size_t reg_n;
+} X64RegList;
+
+static void
+func X64AddReg(X64RegList *list, U32 reg)
+{
+	if(reg == X64NoReg || reg == X64RipReg || reg == X64Rsp || reg == X64Rbp)
+		return;
+	list->regs[list->reg_n] = reg;
+	list->reg_n++;
+}
+
+static void
+func X64AddOperandReads(X64RegList *reads, X64Operand *op)
+{
+	if(op->kind == X64RegOperand)
+	{
+		X64AddReg(reads, op->reg);
+	}
+	else if(op->kind == X64MemOperand)
+	{
+		X64AddReg(reads, op->reg);
+		X64AddReg(reads, op->index);
+	}
+}
+
+static bool
+func X64ReadsDst(X64Opcode op)
+{
+	switch(op)
+	{
+		case X64MovOp:
+		case X64MovsxdOp:
+		case X64LeaOp:
+		case X64SetOp:
+		case X64FMovOp:
+		case X64PshufdOp:
+		case X64CvtIntToFloatOp:
+		case X64CvtFloatToIntOp:
+		{
+			return false;
+		}
+		default:
+		{
+			return true;
+		}
+	}
+}
+
+static bool
+func X64WritesDst(X64Opcode op)
+{
+	return (op != X64CmpOp && op != X64TestOp && op != X64FCmpOp);
+}
+
+static void
+func X64GetInstructionRegs(X64Instruction *instruction, X64RegList *reads, X64RegList *writes, U32 *read_mask, U32 *write_mask)
+{
+	// Registers in operands go to the lists, the fixed registers of calls and returns to the masks.
+	reads->reg_n = 0;
+	writes->reg_n = 0;
+	*read_mask = instruction->reads;
+	*write_mask = instruction->writes;
+
+	X64Operand *dst = &instruction->dst;
+	X64Operand *src = &instruction->src;
+	if(instruction->op == X64FXorOp && src->kind == X64RegOperand && src->reg == dst->reg)
+	{
+		// xorps x, x clears x without reading it.
+		X64AddReg(writes, dst->reg);
+		return;
+	}
+	if(dst->kind == X64RegOperand)
+	{
+		if(X64ReadsDst(instruction->op))
+			X64AddReg(reads, dst->reg);
+		if(X64WritesDst(instruction->op))
+			X64AddReg(writes, dst->reg);
+	}
+	else
+	{
+		X64AddOperandReads(reads, dst);
+	}
+	X64AddOperandReads(reads, src);
+}
+
+#define X64TestBit(set, bit) (((set)[(bit) / 64] >> ((bit) % 64)) & 1)
+#define X64SetBit(set, bit) ((set)[(bit) / 64] |= ((U64)1 << ((bit) % 64)))
+#define X64ClearBit(set, bit) ((set)[(bit) / 64] &= ~((U64)1 << ((bit) % 64)))
+
+static void
+func X64AddFixedRange(X64Liveness *live, U32 reg, U32 start, U32 end)
+{
+	X64FixedRanges *fixed = &live->fixed[reg];
+	if(fixed->range_n == fixed->max_range_n)
+	{
+		fixed->max_range_n = 2 * fixed->max_range_n + 16;
+		fixed->ranges = (X64Range *)realloc(fixed->ranges, fixed->max_range_n * sizeof(X64Range));
+	}
+	fixed->ranges[fixed->range_n].start = start;
+	fixed->ranges[fixed->range_n].end = end;
+	fixed->range_n++;
+}
+
+static void
+func X64AddLiveRange(X64Liveness *live, U32 reg, U32 start, U32 end)
+{
+	if(reg < X64FirstVirtualReg)
+	{
+		X64AddFixedRange(live, reg, start, end);
+		return;
+	}
+	if(start < live->starts[reg])
+		live->starts[reg] = start;
+	if(end > live->ends[reg])
+		live->ends[reg] = end;
+}
+
+static bool
+func X64EndsBlock(X64Opcode op)
+{
+	return (op == X64JmpOp || op == X64JccOp || op == X64RetOp || op == X64Ud2Op);
+}
+
+static void
+func X64FindBlocks(X64Liveness *live)
+{
+	X64Function *f = live->f;
+	live->block_starts = (size_t *)malloc((f->instruction_n + 1) * sizeof(size_t));
+	live->label_blocks = (U32 *)malloc((f->label_n + 1) * sizeof(U32));
+	live->block_n = 0;
+
+	for(size_t i = 0; i < f->instruction_n; i++)
+	{
+		X64Instruction *instruction = &f->instructions[i];
+		bool starts_block = (i == 0 || instruction->op == X64LabelOp || X64EndsBlock(f->instructions[i - 1].op));
+		if(starts_block && (live->block_n == 0 || live->block_starts[live->block_n - 1] != i))
+		{
+			live->block_starts[live->block_n] = i;
+			live->block_n++;
+		}
+		if(instruction->op == X64LabelOp)
+			live->label_blocks[instruction->label] = (U32)(live->block_n - 1);
+	}
+	live->block_starts[live->block_n] = f->instruction_n;
+}
+
+static void
+func X64ComputeLiveness(X64Liveness *live)
+{
+	X64Function *f = live->f;
+	size_t word_n = live->word_n;
+	size_t set_size = live->block_n * word_n * sizeof(U64);
+	live->uses = (U64 *)calloc(1, set_size);
+	live->defs = (U64 *)calloc(1, set_size);
+	live->live_in = (U64 *)calloc(1, set_size);
+	live->live_out = (U64 *)calloc(1, set_size);
+
+	X64RegList reads = {};
+	X64RegList writes = {};
+	for(size_t b = 0; b < live->block_n; b++)
+	{
+		U64 *uses = live->uses + b * word_n;
+		U64 *defs = live->defs + b * word_n;
+		for(size_t i = live->block_starts[b]; i < live->block_starts[b + 1]; i++)
+		{
+			U32 read_mask = 0;
+			U32 write_mask = 0;
+			X64GetInstructionRegs(&f->instructions[i], &reads, &writes, &read_mask, &write_mask);
+			for(U32 reg = 0; reg < X64FirstVirtualReg; reg++)
+			{
+				if(((read_mask >> reg) & 1) && !X64TestBit(defs, reg))
+					X64SetBit(uses, reg);
+			}
+			for(size_t r = 0; r < reads.reg_n; r++)
+			{
+				if(!X64TestBit(defs, reads.regs[r]))
+					X64SetBit(uses, reads.regs[r]);
+			}
+			for(U32 reg = 0; reg < X64FirstVirtualReg; reg++)
+			{
+				if((write_mask >> reg) & 1)
+					X64SetBit(defs, reg);
+			}
+			for(size_t r = 0; r < writes.reg_n; r++)
+				X64SetBit(defs, writes.regs[r]);
+		}
+	}
+
+	// Backwards until nothing changes, the blocks are mostly in order so this takes few rounds.
+	bool changed = true;
+	while(changed)
+	{
+		changed = false;
+		for(size_t b = live->block_n; b > 0; b--)
+		{
+			size_t block = b - 1;
+			U64 *out = live->live_out + block * word_n;
+			U64 *in = live->live_in + block * word_n;
+			X64Instruction *last = &f->instructions[live->block_starts[block + 1] - 1];
+
+			U32 succs[2];
+			size_t succ_n = 0;
+			if(last->op == X64JmpOp || last->op == X64JccOp)
+			{
+				succs[succ_n] = live->label_blocks[last->label];
+				succ_n++;
+			}
+			if(last->op != X64JmpOp && last->op != X64RetOp && last->op != X64Ud2Op && block + 1 < live->block_n)
+			{
+				succs[succ_n] = (U32)(block + 1);
+				succ_n++;
+			}
+
+			for(size_t s = 0; s < succ_n; s++)
+			{
+				U64 *succ_in = live->live_in + succs[s] * word_n;
+				for(size_t w = 0; w < word_n; w++)
+					out[w] |= succ_in[w];
+			}
+
+			U64 *uses = live->uses + block * word_n;
+			U64 *defs = live->defs + block * word_n;
+			for(size_t w = 0; w < word_n; w++)
+			{
+				U64 new_in = uses[w] | (out[w] & ~defs[w]);
+				if(new_in != in[w])
+				{
+					in[w] = new_in;
+					changed = true;
+				}
+			}
+		}
+	}
+}
+
+static void
+func X64BuildIntervals(X64Liveness *live)
+{
+	X64Function *f = live->f;
+	size_t word_n = live->word_n;
+	live->starts = (U32 *)malloc(f->reg_n * sizeof(U32));
+	live->ends = (U32 *)malloc(f->reg_n * sizeof(U32));
+	live->hints = (U32 *)malloc(f->reg_n * sizeof(U32));
+	for(U32 reg = 0; reg < f->reg_n; reg++)
+	{
+		live->starts[reg] = UINT_MAX;
+		live->ends[reg] = 0;
+		live->hints[reg] = X64NoReg;
+	}
+
+	U32 *range_ends = (U32 *)malloc(f->reg_n * sizeof(U32));
+	U64 *live_now = (U64 *)malloc(word_n * sizeof(U64));
+	X64RegList reads = {};
+	X64RegList writes = {};
+
+	// Each block backwards: a range ends where a register is read last and starts where it is written.
+	for(size_t b = 0; b < live->block_n; b++)
+	{
+		size_t first = live->block_starts[b];
+		size_t last = live->block_starts[b + 1] - 1;
+		memcpy(live_now, live->live_out + b * word_n, word_n * sizeof(U64));
+		for(U32 reg = 0; reg < f->reg_n; reg++)
+		{
+			if(X64TestBit(live_now, reg))
+				range_ends[reg] = (U32)(2 * last + 1);
+		}
+
+		for(size_t i = last + 1; i > first; i--)
+		{
+			size_t at = i - 1;
+			X64Instruction *instruction = &f->instructions[at];
+			U32 read_mask = 0;
+			U32 write_mask = 0;
+			X64GetInstructionRegs(instruction, &reads, &writes, &read_mask, &write_mask);
+			U32 write_at = (U32)(2 * at + 1);
+			U32 read_at = (U32)(2 * at);
+
+			for(U32 reg = 0; reg < X64FirstVirtualReg; reg++)
+			{
+				if((write_mask >> reg) & 1)
+					X64AddReg(&writes, reg);
+			}
+			for(size_t r = 0; r < writes.reg_n; r++)
+			{
+				U32 reg = writes.regs[r];
+				U32 end = X64TestBit(live_now, reg) ? range_ends[reg] : write_at;
+				X64AddLiveRange(live, reg, write_at, end);
+				X64ClearBit(live_now, reg);
+			}
+
+			for(U32 reg = 0; reg < X64FirstVirtualReg; reg++)
+			{
+				if((read_mask >> reg) & 1)
+					X64AddReg(&reads, reg);
+			}
+			for(size_t r = 0; r < reads.reg_n; r++)
+			{
+				U32 reg = reads.regs[r];
+				if(!X64TestBit(live_now, reg))
+				{
+					range_ends[reg] = read_at;
+					X64SetBit(live_now, reg);
+				}
+			}
+
+			// A move suggests the same register for both sides.
+			bool is_move = (instruction->op == X64MovOp || instruction->op == X64FMovOp);
+			if(is_move && instruction->dst.kind == X64RegOperand && instruction->src.kind == X64RegOperand)
+			{
+				U32 dst = instruction->dst.reg;
+				U32 src = instruction->src.reg;
+				if(dst >= X64FirstVirtualReg && live->hints[dst] == X64NoReg)
+					live->hints[dst] = src;
+				if(src >= X64FirstVirtualReg && live->hints[src] == X64NoReg)
+					live->hints[src] = dst;
+			}
+		}
+
+		for(U32 reg = 0; reg < f->reg_n; reg++)
+		{
+			if(X64TestBit(live_now, reg))
+				X64AddLiveRange(live, reg, (U32)(2 * first), range_ends[reg]);
+		}
+	}
+
+	free(range_ends);
+	free(live_now);
+}
+
+static bool
+func X64OverlapsFixed(X64Liveness *live, U32 reg, U32 start, U32 end)
+{
+	X64FixedRanges *fixed = &live->fixed[reg];
+	for(size_t i = 0; i < fixed->range_n; i++)
+	{
+		if(fixed->ranges[i].start <= end && start <= fixed->ranges[i].end)
+			return true;
+	}
+	return false;
+}
+
+static X64Liveness *x64_sort_liveness;
+
+static int
+func X64CompareIntervalStart(const void *a, const void *b)
+{
+	U32 reg1 = *(const U32 *)a;
+	U32 reg2 = *(const U32 *)b;
+	U32 start1 = x64_sort_liveness->starts[reg1];
+	U32 start2 = x64_sort_liveness->starts[reg2];
+	if(start1 != start2)
+		return (start1 < start2) ? -1 : 1;
+	return (reg1 < reg2) ? -1 : (reg1 > reg2);
+}
+
+static void
+func X64Spill(X64Function *f, U32 reg)
+{
+	// Float slots take a whole xmm register.
+	U32 size = (X64GetRegClass(f, reg) == X64FloatClass) ? 16 : 8;
+	f->assigned[reg] = X64NoReg;
+	f->spill_slot[reg] = X64AddSlot(f, size, size);
+	f->spilled_n++;
+}
+
+static void
+func X64ScanIntervals(X64Liveness *live)
+{
+	X64Function *f = live->f;
+	U32 *order = (U32 *)malloc(f->reg_n * sizeof(U32));
+	size_t interval_n = 0;
+	for(U32 reg = X64FirstVirtualReg; reg < f->reg_n; reg++)
+	{
+		if(live->starts[reg] != UINT_MAX)
+		{
+			order[interval_n] = reg;
+			interval_n++;
+		}
+	}
+	x64_sort_liveness = live;
+	qsort(order, interval_n, sizeof(U32), X64CompareIntervalStart);
+
+	// The interval holding each register, X64NoReg when it is free.
+	U32 holders[X64FirstVirtualReg];
+	for(U32 reg = 0; reg < X64FirstVirtualReg; reg++)
+		holders[reg] = X64NoReg;
+
+	for(size_t i = 0; i < interval_n; i++)
+	{
+		U32 cur = order[i];
+		U32 start = live->starts[cur];
+		U32 end = live->ends[cur];
+		bool is_float = (X64GetRegClass(f, cur) == X64FloatClass);
+		U32 *alloc_order = is_float ? X64FloatAllocOrder : X64GeneralAllocOrder;
+		size_t alloc_n = is_float ? (sizeof(X64FloatAllocOrder) / sizeof(U32)) : (sizeof(X64GeneralAllocOrder) / sizeof(U32));
+
+		for(U32 reg = 0; reg < X64FirstVirtualReg; reg++)
+		{
+			if(holders[reg] != X64NoReg && live->ends[holders[reg]] < start)
+				holders[reg] = X64NoReg;
+		}
+
+		U32 chosen = X64NoReg;
+		U32 hint = live->hints[cur];
+		if(hint != X64NoReg && hint >= X64FirstVirtualReg)
+			hint = f->assigned[hint];
+		for(size_t r = 0; r <= alloc_n && chosen == X64NoReg; r++)
+		{
+			// The hint is tried first.
+			U32 reg = (r == 0) ? hint : alloc_order[r - 1];
+			if(reg == X64NoReg || reg == X64ScratchReg || reg == X64AddressScratchReg || reg == X64Rsp || reg == X64Rbp)
+				continue;
+			if(reg == X64FloatScratchReg || reg == X64FloatSrcScratchReg || X64GetRegClass(f, reg) != X64GetRegClass(f, cur))
+				continue;
+			if(holders[reg] == X64NoReg && !X64OverlapsFixed(live, reg, start, end))
+				chosen = reg;
+		}
+
+		if(chosen == X64NoReg)
+		{
+			// The interval that ends last gives up its register, unless that is this one.
+			U32 victim = X64NoReg;
+			for(size_t r = 0; r < alloc_n; r++)
+			{
+				U32 reg = alloc_order[r];
+				U32 holder = holders[reg];
+				if(holder == X64NoReg || X64OverlapsFixed(live, reg, start, end))
+					continue;
+				if(victim == X64NoReg || live->ends[holder] > live->ends[victim])
+					victim = holder;
+			}
+
+			if(victim != X64NoReg && live->ends[victim] > end)
+			{
+				chosen = f->assigned[victim];
+				X64Spill(f, victim);
+			}
+			else
+			{
+				X64Spill(f, cur);
+				continue;
+			}
+		}
+
+		f->assigned[cur] = chosen;
+		holders[chosen] = cur;
+		if(X64RegBit(chosen) & X64CalleeSavedMask)
+			f->saved_mask |= X64RegBit(chosen);
+	}
+
+	free(order);
+}
+
+static void
+func X64AllocateRegisters(X64Function *f)
+{
+	f->assigned = (U32 *)realloc(f->assigned, f->reg_n * sizeof(U32));
+	f->spill_slot = (U32 *)realloc(f->spill_slot, f->reg_n * sizeof(U32));
+	for(U32 reg = 0; reg < f->reg_n; reg++)
+	{
+		f->assigned[reg] = (reg < X64FirstVirtualReg) ? reg : X64NoReg;
+		f->spill_slot[reg] = X64NoSlot;
+	}
+
+	X64Liveness live = {};
+	live.f = f;
+	live.word_n = (f->reg_n + 63) / 64;
+	X64FindBlocks(&live);
+	X64ComputeLiveness(&live);
+	X64BuildIntervals(&live);
+	X64ScanIntervals(&live);
+
+	free(live.block_starts);
+	free(live.label_blocks);
+	free(live.uses);
+	free(live.defs);
+	free(live.live_in);
+	free(live.live_out);
+	free(live.starts);
+	free(live.ends);
+	free(live.hints);
+	for(U32 reg = 0; reg < X64FirstVirtualReg; reg++)
+		free(live.fixed[reg].ranges);
+}
+
+static void
+func X64LayoutFrame(X64Function *f)
+{
+	// Below rbp: the saved registers, the slots, then the stack arguments of calls.
+	// rsp stays a multiple of 16 at every call.
+	U32 saved_size = 0;
+	for(U32 reg = 0; reg < X64FirstVirtualReg; reg++)
+	{
+		if((f->saved_mask >> reg) & 1)
+			saved_size += 8;
+	}
+
+	U32 size = saved_size;
+	for(size_t i = 0; i < f->slot_n; i++)
+	{
+		X64Slot *slot = &f->slots[i];
+		size = (size + slot->size + slot->align - 1) & ~(slot->align - 1);
+		slot->offset = -(I32)size;
+	}
+	size += f->outgoing_size;
+	size = (size + 15) & ~15u;
+	f->frame_size = size - saved_size;
+	f->has_frame_pointer = true;
+}
+
+static X64Operand
+func X64MapOperand(X64Function *f, X64Operand op)
+{
+	// Registers to the allocated ones, spilled registers to their slots.
+	if(op.kind == X64RegOperand && op.reg != X64NoReg)
+	{
+		if(f->assigned[op.reg] != X64NoReg)
+		{
+			op.reg = f->assigned[op.reg];
+		}
+		else
+		{
+			U32 slot = f->spill_slot[op.reg];
+			op = X64MemOperandInit(X64Rbp, f->slots[slot].offset, op.size);
+		}
+	}
+	else if(op.kind == X64MemOperand && op.slot != X64NoSlot)
+	{
+		op.value += f->slots[op.slot].offset;
+		op.slot = X64NoSlot;
+		op.reg = X64Rbp;
+	}
+	return op;
+}
+
+static X64Operand
+func X64SpilledRegOperand(X64Function *f, U32 reg)
+{
+	return X64MemOperandInit(X64Rbp, f->slots[f->spill_slot[reg]].offset, 8);
+}
+
+static X64Instruction *
+func X64Rewrite(X64Function *out, X64Opcode op, X64Operand dst, X64Operand src)
+{
+	return X64Emit(out, op, dst, src);
+}
+
+static bool
+func X64NeedsRegDst(X64Opcode op)
+{
+	switch(op)
+	{
+		case X64ImulOp:
+		case X64LeaOp:
+		case X64MovsxdOp:
+		case X64SetOp:
+		case X64FAddOp:
+		case X64FSubOp:
+		case X64FMulOp:
+		case X64FCmpOp:
+		case X64FXorOp:
+		case X64PshufdOp:
+		case X64MovssOp:
+		case X64UnpcklpsOp:
+		case X64CvtIntToFloatOp:
+		case X64CvtFloatToIntOp:
+		{
+			return true;
+		}
+		default:
+		{
+			return false;
+		}
+	}
+}
+
+static bool
+func X64IsFloatOp(X64Opcode op)
+{
+	switch(op)
+	{
+		case X64FMovOp:
+		case X64FAddOp:
+		case X64FSubOp:
+		case X64FMulOp:
+		case X64FCmpOp:
+		case X64FXorOp:
+		case X64PshufdOp:
+		case X64MovssOp:
+		case X64UnpcklpsOp:
+		{
+			return true;
+		}
+		default:
+		{
+			return false;
+		}
+	}
+}
+
+static bool
+func X64HasFloatDst(X64Opcode op)
+{
+	return (X64IsFloatOp(op) || op == X64CvtIntToFloatOp);
+}
+
+static bool
+func X64HasFloatSrc(X64Opcode op)
+{
+	return (X64IsFloatOp(op) || op == X64CvtFloatToIntOp);
+}
+
+static void
+func X64RewriteAddress(X64Function *f, X64Function *out, X64Operand *mem)
+{
+	// Spilled base and index registers are loaded into r11, both of them combine into it.
+	if(mem->kind != X64MemOperand)
+	{
+		*mem = X64MapOperand(f, *mem);
+		return;
+	}
+	if(mem->slot != X64NoSlot)
+	{
+		mem->value += f->slots[mem->slot].offset;
+		mem->slot = X64NoSlot;
+		mem->reg = X64Rbp;
+	}
+
+	bool has_base = (mem->reg != X64NoReg && mem->reg != X64RipReg);
+	bool base_spilled = (has_base && f->assigned[mem->reg] == X64NoReg);
+	bool index_spilled = (mem->index != X64NoReg && f->assigned[mem->index] == X64NoReg);
+	X64Operand scratch = X64RegOperandInit(X64AddressScratchReg, 8);
+	if(base_spilled && index_spilled)
+	{
+		X64Operand index = X64RegOperandInit(X64ScratchReg, 8);
+		X64Rewrite(out, X64MovOp, scratch, X64SpilledRegOperand(f, mem->reg));
+		X64Rewrite(out, X64MovOp, index, X64SpilledRegOperand(f, mem->index));
+		X64Operand sum = X64MemOperandInit(X64AddressScratchReg, 0, 8);
+		sum.index = X64ScratchReg;
+		sum.scale = mem->scale;
+		X64Rewrite(out, X64LeaOp, scratch, sum);
+		mem->reg = X64AddressScratchReg;
+		mem->index = X64NoReg;
+		mem->scale = 1;
+		return;
+	}
+
+	if(base_spilled)
+	{
+		X64Rewrite(out, X64MovOp, scratch, X64SpilledRegOperand(f, mem->reg));
+		mem->reg = X64AddressScratchReg;
+	}
+	else if(has_base)
+	{
+		mem->reg = f->assigned[mem->reg];
+	}
+
+	if(index_spilled)
+	{
+		X64Rewrite(out, X64MovOp, scratch, X64SpilledRegOperand(f, mem->index));
+		mem->index = X64AddressScratchReg;
+	}
+	else if(mem->index != X64NoReg)
+	{
+		mem->index = f->assigned[mem->index];
+	}
+}
+
+static void
+func X64RewriteInstructions(X64Function *f, X64Function *out)
+{
+	// Writes the instructions of f to out with allocated registers only.
+	// x64 allows one memory operand, registers in some places, and 64 bit immediates only in a mov to a register,
+	// values that break this go through r10, floats through xmm14 and xmm15.
+	out->instruction_n = 0;
+	for(size_t i = 0; i < f->instruction_n; i++)
+	{
+		X64Instruction instruction = f->instructions[i];
+		X64Operand dst = instruction.dst;
+		X64Operand src = instruction.src;
+		X64RewriteAddress(f, out, &dst);
+		X64RewriteAddress(f, out, &src);
+
+		bool is_move = (instruction.op == X64MovOp || instruction.op == X64FMovOp);
+		if(is_move && dst.kind == X64RegOperand && src.kind == X64RegOperand && dst.reg == src.reg)
+			continue;
+
+		// cvtsi2ss reads eight bytes of a spill slot for an uint, only four of them are stored.
+		if(instruction.op == X64CvtIntToFloatOp && src.kind == X64MemOperand)
+		{
+			U32 size = src.size;
+			src.size = 4;
+			X64Rewrite(out, X64MovOp, X64RegOperandInit(X64ScratchReg, 4), src);
+			src = X64RegOperandInit(X64ScratchReg, size);
+		}
+
+		X64Operand scratch = X64RegOperandInit(X64HasFloatSrc(instruction.op) ? X64FloatSrcScratchReg : X64ScratchReg, (src.size != 0) ? src.size : dst.size);
+		bool wide_imm = (src.kind == X64ImmOperand && !X64FitsImm32(src.value) && !(instruction.op == X64MovOp && dst.kind == X64RegOperand));
+		bool loads_src = (instruction.op != X64LeaOp);
+		// movss from memory would clear the other lanes.
+		bool needs_reg_src = (instruction.op == X64MovssOp && src.kind == X64MemOperand);
+		if((dst.kind == X64MemOperand && src.kind == X64MemOperand && loads_src) || wide_imm || needs_reg_src)
+		{
+			X64Rewrite(out, X64HasFloatSrc(instruction.op) ? X64FMovOp : X64MovOp, scratch, src);
+			src = scratch;
+		}
+
+		if(X64NeedsRegDst(instruction.op) && dst.kind == X64MemOperand)
+		{
+			bool src_uses_scratch = (src.kind == X64RegOperand && src.reg == X64ScratchReg) || (src.kind == X64MemOperand && src.index == X64ScratchReg);
+			U32 general = src_uses_scratch ? X64AddressScratchReg : X64ScratchReg;
+			X64Opcode move = X64HasFloatDst(instruction.op) ? X64FMovOp : X64MovOp;
+			X64Operand reg = X64RegOperandInit(X64HasFloatDst(instruction.op) ? X64FloatScratchReg : general, dst.size);
+			if(X64ReadsDst(instruction.op))
+				X64Rewrite(out, move, reg, dst);
+			X64Instruction *rewritten = X64Rewrite(out, instruction.op, reg, src);
+			rewritten->cond = instruction.cond;
+			rewritten->lanes = instruction.lanes;
+			if(X64WritesDst(instruction.op))
+				X64Rewrite(out, move, dst, reg);
+			continue;
+		}
+
+		X64Instruction *rewritten = X64Rewrite(out, instruction.op, dst, src);
+		rewritten->cond = instruction.cond;
+		rewritten->label = instruction.label;
+		rewritten->callee = instruction.callee;
+		rewritten->is_extern = instruction.is_extern;
+		rewritten->reads = instruction.reads;
+		rewritten->writes = instruction.writes;
+		rewritten->lanes = instruction.lanes;
+	}
+}
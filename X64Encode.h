@@ -0,0 +1,782 @@
+// Machine code for the x64 backend: the instructions that X64Alloc.h rewrote with registers are encoded
+// into bytes and written as an ELF64 relocatable object, which gcc or ld link without an assembler.
+// The encoding matches what NASM picks for the text output of WriteX64.h, except that every jump
+// takes a 32 bit displacement, so jumps need no second pass.
+//
+// Jumps are patched at the end of every function. Calls and the constant data in .rodata
+// are left to the linker as relocations: calls through the PLT, constants relative to rip.
+
+#define X64NoSymbol 0xFFFFFFFFu
+// Relocations against the start of .rodata.
+#define X64RodataSymbol 0xFFFFFFFEu
+
+#define X64ElfRelocPc32 2
+#define X64ElfRelocPlt32 4
+
+typedef struct tdef X64JumpFixup
+{
+	size_t at;
+	U32 label;
+} X64JumpFixup;
+
+typedef struct tdef X64Relocation
+{
+	size_t offset;
+	U32 symbol;
+	U32 type;
+	I64 addend;
+} X64Relocation;
+
+typedef struct tdef X64Symbol
+{
+	Token name;
+	bool is_defined;
+	bool is_global;
+	size_t value;
+	size_t size;
+	// Index in the ELF symbol table, locals come first there.
+	U32 elf_index;
+} X64Symbol;
+
+typedef struct tdef X64Object
+{
+	U8 *code;
+	size_t code_size;
+	size_t max_code_size;
+
+	// Labels of the function being encoded, and the jumps to them.
+	size_t *label_offsets;
+	size_t max_label_n;
+	X64JumpFixup *fixups;
+	size_t fixup_n;
+	size_t max_fixup_n;
+
+	X64Relocation *relocations;
+	size_t relocation_n;
+	size_t max_relocation_n;
+
+	// The constant data of the lowering, for .rodata.
+	U8 *data;
+	size_t data_size;
+
+	X64Symbol *symbols;
+	U32 symbol_n;
+	U32 max_symbol_n;
+	// The symbol of every atom, X64NoSymbol for atoms that name no function.
+	U32 *atom_symbols;
+	U32 atom_n;
+
+	// The displacement of a rip-relative operand, its relocation is added when the instruction ends.
+	bool has_rip_operand;
+	size_t rip_disp_at;
+	I64 rip_offset;
+} X64Object;
+
+static void
+func X64EncodeByte(X64Object *o, U32 value)
+{
+	if(o->code_size == o->max_code_size)
+	{
+		o->max_code_size = 2 * o->max_code_size + 4096;
+		o->code = (U8 *)realloc(o->code, o->max_code_size);
+	}
+	o->code[o->code_size] = (U8)value;
+	o->code_size++;
+}
+
+static void
+func X64EncodeU32(X64Object *o, U32 value)
+{
+	for(U32 i = 0; i < 4; i++)
+		X64EncodeByte(o, value >> (8 * i));
+}
+
+static void
+func X64PatchU32(X64Object *o, size_t at, U32 value)
+{
+	for(U32 i = 0; i < 4; i++)
+		o->code[at + i] = (U8)(value >> (8 * i));
+}
+
+static U32
+func X64GetSymbol(X64Object *o, Token name)
+{
+	if(name.value >= o->atom_n)
+	{
+		U32 atom_n = 2 * o->atom_n + name.value + 64;
+		o->atom_symbols = (U32 *)realloc(o->atom_symbols, atom_n * sizeof(U32));
+		for(U32 i = o->atom_n; i < atom_n; i++)
+			o->atom_symbols[i] = X64NoSymbol;
+		o->atom_n = atom_n;
+	}
+	if(o->atom_symbols[name.value] != X64NoSymbol)
+		return o->atom_symbols[name.value];
+
+	if(o->symbol_n == o->max_symbol_n)
+	{
+		o->max_symbol_n = 2 * o->max_symbol_n + 32;
+		o->symbols = (X64Symbol *)realloc(o->symbols, o->max_symbol_n * sizeof(X64Symbol));
+	}
+	X64Symbol *symbol = &o->symbols[o->symbol_n];
+	symbol->name = name;
+	symbol->is_defined = false;
+	symbol->is_global = true;
+	symbol->value = 0;
+	symbol->size = 0;
+	symbol->elf_index = 0;
+	o->atom_symbols[name.value] = o->symbol_n;
+	o->symbol_n++;
+	return o->symbol_n - 1;
+}
+
+static void
+func X64AddRelocation(X64Object *o, size_t offset, U32 symbol, U32 type, I64 addend)
+{
+	if(o->relocation_n == o->max_relocation_n)
+	{
+		o->max_relocation_n = 2 * o->max_relocation_n + 64;
+		o->relocations = (X64Relocation *)realloc(o->relocations, o->max_relocation_n * sizeof(X64Relocation));
+	}
+	X64Relocation *relocation = &o->relocations[o->relocation_n];
+	relocation->offset = offset;
+	relocation->symbol = symbol;
+	relocation->type = type;
+	relocation->addend = addend;
+	o->relocation_n++;
+}
+
+static void
+func X64AddJumpFixup(X64Object *o, U32 label)
+{
+	if(o->fixup_n == o->max_fixup_n)
+	{
+		o->max_fixup_n = 2 * o->max_fixup_n + 64;
+		o->fixups = (X64JumpFixup *)realloc(o->fixups, o->max_fixup_n * sizeof(X64JumpFixup));
+	}
+	o->fixups[o->fixup_n].at = o->code_size;
+	o->fixups[o->fixup_n].label = label;
+	o->fixup_n++;
+	X64EncodeU32(o, 0);
+}
+
+static U32
+func X64GetRegCode(U32 reg)
+{
+	// The 4 bit number of the register in the encoding, xmm registers are numbered on their own.
+	return (reg >= X64Xmm0) ? (reg - X64Xmm0) : reg;
+}
+
+static bool
+func X64FitsImm8(I64 value)
+{
+	return (value >= -128 && value <= 127);
+}
+
+static void
+func X64EncodeModRM(X64Object *o, U32 reg_field, X64Operand *rm)
+{
+	U32 reg = (reg_field & 7) << 3;
+	if(rm->kind == X64RegOperand)
+	{
+		X64EncodeByte(o, 0xC0 | reg | (X64GetRegCode(rm->reg) & 7));
+		return;
+	}
+	if(rm->reg == X64RipReg)
+	{
+		X64EncodeByte(o, 0x05 | reg);
+		o->has_rip_operand = true;
+		o->rip_disp_at = o->code_size;
+		o->rip_offset = rm->value;
+		X64EncodeU32(o, 0);
+		return;
+	}
+
+	// rsp and r12 as base need a SIB byte, rbp and r13 without displacement mean rip or no base.
+	U32 base = rm->reg & 7;
+	bool has_sib = (rm->index != X64NoReg || base == 4);
+	I64 disp = rm->value;
+	U32 mod = (disp == 0 && base != 5) ? 0 : X64FitsImm8(disp) ? 1 : 2;
+	X64EncodeByte(o, (mod << 6) | reg | (has_sib ? 4 : base));
+	if(has_sib)
+	{
+		U32 scale = (rm->scale == 8) ? 3 : (rm->scale == 4) ? 2 : (rm->scale == 2) ? 1 : 0;
+		U32 index = (rm->index != X64NoReg) ? (rm->index & 7) : 4;
+		X64EncodeByte(o, (scale << 6) | (index << 3) | base);
+	}
+	if(mod == 1)
+		X64EncodeByte(o, (U32)disp);
+	else if(mod == 2)
+		X64EncodeU32(o, (U32)disp);
+}
+
+static void
+func X64EncodeOp(X64Object *o, U32 prefix, bool wide, U32 opcode, U32 reg_field, X64Operand *rm, bool byte_rm)
+{
+	// [prefix] [REX] [0F] opcode ModRM [SIB] [displacement], the immediate is written by the caller.
+	// byte_rm: the r/m operand is a byte register, spl, bpl, sil and dil need a REX prefix.
+	if(prefix)
+		X64EncodeByte(o, prefix);
+
+	U32 rex = 0x40 | (wide << 3) | (((reg_field >> 3) & 1) << 2);
+	bool needs_rex = false;
+	if(rm->kind == X64RegOperand)
+	{
+		U32 code = X64GetRegCode(rm->reg);
+		rex |= (code >> 3) & 1;
+		needs_rex = (byte_rm && code >= 4 && code < 8);
+	}
+	else if(rm->reg != X64RipReg)
+	{
+		if(rm->index != X64NoReg)
+			rex |= ((rm->index >> 3) & 1) << 1;
+		rex |= (rm->reg >> 3) & 1;
+	}
+	if(rex != 0x40 || needs_rex)
+		X64EncodeByte(o, rex);
+
+	if(opcode > 0xFF)
+		X64EncodeByte(o, opcode >> 8);
+	X64EncodeByte(o, opcode & 0xFF);
+	X64EncodeModRM(o, reg_field, rm);
+}
+
+static void
+func X64EndInstruction(X64Object *o)
+{
+	// The displacement of rip-relative operands counts from the end of the instruction.
+	if(o->has_rip_operand)
+	{
+		I64 addend = o->rip_offset - (I64)(o->code_size - o->rip_disp_at);
+		X64AddRelocation(o, o->rip_disp_at, X64RodataSymbol, X64ElfRelocPc32, addend);
+	}
+	o->has_rip_operand = false;
+}
+
+static void
+func X64EncodePushPop(X64Object *o, U32 opcode, U32 reg)
+{
+	if(reg >= 8)
+		X64EncodeByte(o, 0x41);
+	X64EncodeByte(o, opcode + (reg & 7));
+}
+
+static void
+func X64EncodeImmOp(X64Object *o, U32 group, X64Operand *dst, I64 value)
+{
+	// add, and, sub and cmp with an immediate, the short form takes a sign-extended byte.
+	bool is_short = X64FitsImm8(value);
+	X64EncodeOp(o, 0, dst->size == 8, is_short ? 0x83 : 0x81, group, dst, false);
+	if(is_short)
+		X64EncodeByte(o, (U32)value);
+	else
+		X64EncodeU32(o, (U32)value);
+}
+
+static void
+func X64EncodeArithmetic(X64Object *o, X64Instruction *instruction, U32 group)
+{
+	// The opcodes of add, and, sub and cmp are 8 * group + 1 for r/m, reg and 8 * group + 3 for reg, r/m.
+	X64Operand *dst = &instruction->dst;
+	X64Operand *src = &instruction->src;
+	bool wide = (dst->size == 8);
+	if(src->kind == X64ImmOperand)
+		X64EncodeImmOp(o, group, dst, src->value);
+	else if(src->kind == X64RegOperand)
+		X64EncodeOp(o, 0, wide, 8 * group + 1, src->reg, dst, false);
+	else
+		X64EncodeOp(o, 0, wide, 8 * group + 3, dst->reg, src, false);
+}
+
+static void
+func X64EncodeMov(X64Object *o, X64Operand *dst, X64Operand *src)
+{
+	bool wide = (dst->size == 8);
+	if(src->kind == X64ImmOperand)
+	{
+		I64 value = src->value;
+		if(dst->kind == X64RegOperand && (!wide || (value >= 0 && value <= UINT_MAX)))
+		{
+			// mov r32, imm32 clears the upper half.
+			if(dst->reg >= 8)
+				X64EncodeByte(o, 0x41);
+			X64EncodeByte(o, 0xB8 + (dst->reg & 7));
+			X64EncodeU32(o, (U32)value);
+		}
+		else if(X64FitsImm32(value))
+		{
+			X64EncodeOp(o, 0, wide, 0xC7, 0, dst, false);
+			X64EncodeU32(o, (U32)value);
+		}
+		else
+		{
+			X64EncodeByte(o, 0x48 | ((dst->reg >> 3) & 1));
+			X64EncodeByte(o, 0xB8 + (dst->reg & 7));
+			X64EncodeU32(o, (U32)value);
+			X64EncodeU32(o, (U32)((U64)value >> 32));
+		}
+	}
+	else if(src->kind == X64RegOperand)
+	{
+		X64EncodeOp(o, 0, wide, 0x89, src->reg, dst, false);
+	}
+	else
+	{
+		X64EncodeOp(o, 0, wide, 0x8B, dst->reg, src, false);
+	}
+}
+
+static void
+func X64EncodeFloatMov(X64Object *o, X64Operand *dst, X64Operand *src)
+{
+	// movaps between registers, movss, movsd and movups by size with memory.
+	U32 size = (dst->kind == X64MemOperand) ? src->size : dst->size;
+	U32 prefix = (size == 4) ? 0xF3 : (size == 8) ? 0xF2 : 0;
+	if(dst->kind == X64RegOperand && src->kind == X64RegOperand)
+		X64EncodeOp(o, 0, false, 0x0F28, X64GetRegCode(dst->reg), src, false);
+	else if(dst->kind == X64RegOperand)
+		X64EncodeOp(o, prefix, false, 0x0F10, X64GetRegCode(dst->reg), src, false);
+	else
+		X64EncodeOp(o, prefix, false, 0x0F11, X64GetRegCode(src->reg), dst, false);
+}
+
+static void
+func X64EncodeEpilogue(X64Object *o, X64Function *f)
+{
+	// The same instructions as X64WriteEpilogue.
+	U32 saved_size = 0;
+	for(U32 reg = 0; reg < X64FirstVirtualReg; reg++)
+	{
+		if((f->saved_mask >> reg) & 1)
+			saved_size += 8;
+	}
+
+	X64Operand rsp = X64RegOperandInit(X64Rsp, 8);
+	if(!f->has_frame_pointer && f->frame_size > 0)
+	{
+		X64EncodeImmOp(o, 0, &rsp, f->frame_size);
+	}
+	else if(f->has_frame_pointer && saved_size == 0 && f->frame_size > 0)
+	{
+		X64Operand rbp = X64RegOperandInit(X64Rbp, 8);
+		X64EncodeMov(o, &rsp, &rbp);
+	}
+	else if(f->has_frame_pointer && saved_size > 0)
+	{
+		X64Operand address = X64MemOperandInit(X64Rbp, -(I64)saved_size, 8);
+		X64EncodeOp(o, 0, true, 0x8D, X64Rsp, &address, false);
+	}
+	for(U32 reg = X64FirstVirtualReg; reg > 0; reg--)
+	{
+		if((f->saved_mask >> (reg - 1)) & 1)
+			X64EncodePushPop(o, 0x58, reg - 1);
+	}
+	if(f->has_frame_pointer)
+		X64EncodePushPop(o, 0x58, X64Rbp);
+	X64EncodeByte(o, 0xC3);
+}
+
+static void
+func X64EncodeInstruction(X64Object *o, X64Function *f, X64Instruction *instruction)
+{
+	X64Operand *dst = &instruction->dst;
+	X64Operand *src = &instruction->src;
+	bool scalar = (dst->size == 4);
+	switch(instruction->op)
+	{
+		case X64LabelOp:
+		{
+			o->label_offsets[instruction->label] = o->code_size;
+			break;
+		}
+		case X64MovOp:
+		{
+			X64EncodeMov(o, dst, src);
+			break;
+		}
+		case X64MovsxdOp:
+		{
+			X64EncodeOp(o, 0, true, 0x63, dst->reg, src, false);
+			break;
+		}
+		case X64LeaOp:
+		{
+			X64EncodeOp(o, 0, dst->size == 8, 0x8D, dst->reg, src, false);
+			break;
+		}
+		case X64AddOp:
+		{
+			X64EncodeArithmetic(o, instruction, 0);
+			break;
+		}
+		case X64AndOp:
+		{
+			X64EncodeArithmetic(o, instruction, 4);
+			break;
+		}
+		case X64SubOp:
+		{
+			X64EncodeArithmetic(o, instruction, 5);
+			break;
+		}
+		case X64CmpOp:
+		{
+			X64EncodeArithmetic(o, instruction, 7);
+			break;
+		}
+		case X64ImulOp:
+		{
+			if(src->kind == X64ImmOperand)
+			{
+				bool is_short = X64FitsImm8(src->value);
+				X64EncodeOp(o, 0, dst->size == 8, is_short ? 0x6B : 0x69, dst->reg, dst, false);
+				if(is_short)
+					X64EncodeByte(o, (U32)src->value);
+				else
+					X64EncodeU32(o, (U32)src->value);
+			}
+			else
+			{
+				X64EncodeOp(o, 0, dst->size == 8, 0x0FAF, dst->reg, src, false);
+			}
+			break;
+		}
+		case X64NegOp:
+		{
+			X64EncodeOp(o, 0, dst->size == 8, 0xF7, 3, dst, false);
+			break;
+		}
+		case X64TestOp:
+		{
+			X64EncodeOp(o, 0, dst->size == 8, 0x85, src->reg, dst, false);
+			break;
+		}
+		case X64SetOp:
+		{
+			// setcc on the low byte, then movzx clears the rest.
+			X64EncodeOp(o, 0, false, 0x0F90 + instruction->cond, 0, dst, true);
+			X64EncodeOp(o, 0, false, 0x0FB6, dst->reg, dst, true);
+			break;
+		}
+		case X64FMovOp:
+		{
+			X64EncodeFloatMov(o, dst, src);
+			break;
+		}
+		case X64FAddOp:
+		{
+			X64EncodeOp(o, scalar ? 0xF3 : 0, false, 0x0F58, X64GetRegCode(dst->reg), src, false);
+			break;
+		}
+		case X64FSubOp:
+		{
+			X64EncodeOp(o, scalar ? 0xF3 : 0, false, 0x0F5C, X64GetRegCode(dst->reg), src, false);
+			break;
+		}
+		case X64FMulOp:
+		{
+			X64EncodeOp(o, scalar ? 0xF3 : 0, false, 0x0F59, X64GetRegCode(dst->reg), src, false);
+			break;
+		}
+		case X64FCmpOp:
+		{
+			X64EncodeOp(o, 0, false, 0x0F2E, X64GetRegCode(dst->reg), src, false);
+			break;
+		}
+		case X64FXorOp:
+		{
+			X64EncodeOp(o, 0, false, 0x0F57, X64GetRegCode(dst->reg), src, false);
+			break;
+		}
+		case X64MovssOp:
+		{
+			X64EncodeOp(o, 0xF3, false, 0x0F10, X64GetRegCode(dst->reg), src, false);
+			break;
+		}
+		case X64UnpcklpsOp:
+		{
+			X64EncodeOp(o, 0, false, 0x0F14, X64GetRegCode(dst->reg), src, false);
+			break;
+		}
+		case X64PshufdOp:
+		{
+			X64EncodeOp(o, 0x66, false, 0x0F70, X64GetRegCode(dst->reg), src, false);
+			X64EncodeByte(o, instruction->lanes);
+			break;
+		}
+		case X64CvtIntToFloatOp:
+		{
+			X64EncodeOp(o, 0xF3, src->size == 8, 0x0F2A, X64GetRegCode(dst->reg), src, false);
+			break;
+		}
+		case X64CvtFloatToIntOp:
+		{
+			X64EncodeOp(o, 0xF3, dst->size == 8, 0x0F2C, dst->reg, src, false);
+			break;
+		}
+		case X64RepMovsOp:
+		case X64RepStosOp:
+		{
+			X64EncodeByte(o, 0xF3);
+			X64EncodeByte(o, 0x48);
+			X64EncodeByte(o, (instruction->op == X64RepMovsOp) ? 0xA5 : 0xAB);
+			break;
+		}
+		case X64Ud2Op:
+		{
+			X64EncodeByte(o, 0x0F);
+			X64EncodeByte(o, 0x0B);
+			break;
+		}
+		case X64JmpOp:
+		{
+			X64EncodeByte(o, 0xE9);
+			X64AddJumpFixup(o, instruction->label);
+			break;
+		}
+		case X64JccOp:
+		{
+			X64EncodeByte(o, 0x0F);
+			X64EncodeByte(o, 0x80 + instruction->cond);
+			X64AddJumpFixup(o, instruction->label);
+			break;
+		}
+		case X64CallOp:
+		{
+			X64EncodeByte(o, 0xE8);
+			X64AddRelocation(o, o->code_size, X64GetSymbol(o, instruction->callee), X64ElfRelocPlt32, -4);
+			X64EncodeU32(o, 0);
+			break;
+		}
+		case X64RetOp:
+		{
+			X64EncodeEpilogue(o, f);
+			break;
+		}
+		default:
+		{
+			break;
+		}
+	}
+	X64EndInstruction(o);
+}
+
+static void
+func X64EncodeFunc(X64Object *o, X64Function *f, X64Function *rewritten)
+{
+	U32 symbol = X64GetSymbol(o, f->name);
+	o->symbols[symbol].is_defined = true;
+	o->symbols[symbol].is_global = f->is_exported;
+	o->symbols[symbol].value = o->code_size;
+
+	if(f->label_n > o->max_label_n)
+	{
+		o->max_label_n = 2 * o->max_label_n + f->label_n;
+		o->label_offsets = (size_t *)realloc(o->label_offsets, o->max_label_n * sizeof(size_t));
+	}
+	o->fixup_n = 0;
+	o->has_rip_operand = false;
+
+	// push rbp, mov rbp, rsp, the saved registers, sub rsp, frame_size.
+	X64Operand rbp = X64RegOperandInit(X64Rbp, 8);
+	X64Operand rsp = X64RegOperandInit(X64Rsp, 8);
+	if(f->has_frame_pointer)
+	{
+		X64EncodePushPop(o, 0x50, X64Rbp);
+		X64EncodeMov(o, &rbp, &rsp);
+	}
+	for(U32 reg = 0; reg < X64FirstVirtualReg; reg++)
+	{
+		if((f->saved_mask >> reg) & 1)
+			X64EncodePushPop(o, 0x50, reg);
+	}
+	if(f->frame_size > 0)
+		X64EncodeImmOp(o, 5, &rsp, f->frame_size);
+
+	for(size_t i = 0; i < rewritten->instruction_n; i++)
+		X64EncodeInstruction(o, f, &rewritten->instructions[i]);
+
+	for(size_t i = 0; i < o->fixup_n; i++)
+	{
+		X64JumpFixup *fixup = &o->fixups[i];
+		X64PatchU32(o, fixup->at, (U32)(o->label_offsets[fixup->label] - (fixup->at + 4)));
+	}
+	o->symbols[symbol].size = o->code_size - o->symbols[symbol].value;
+}
+
+static size_t
+func X64AlignOffset(size_t offset, size_t align)
+{
+	return (offset + align - 1) & ~(align - 1);
+}
+
+// Only the compiler writes object files, hosts that include M64.c run the code in memory (X64Jit.h).
+#ifndef M64_NO_MAIN
+static void
+func X64PutBytes(MemoryArena *arena, void *bytes, size_t size)
+{
+	char *mem = ArenaPushArray(arena, size, char);
+	if(mem)
+		memcpy(mem, bytes, size);
+}
+
+static void
+func X64PutInt(MemoryArena *arena, U64 value, U32 size)
+{
+	// Little endian, like x64.
+	U8 bytes[8];
+	for(U32 i = 0; i < size; i++)
+		bytes[i] = (U8)(value >> (8 * i));
+	X64PutBytes(arena, bytes, size);
+}
+
+static void
+func X64PadTo(MemoryArena *arena, size_t start, size_t at)
+{
+	while(arena->used_size - start < at)
+		X64PutInt(arena, 0, 1);
+}
+
+static void
+func X64PutSectionHeader(MemoryArena *arena, U32 name, U32 type, U64 flags, U64 offset, U64 size, U32 link, U32 info, U64 align, U64 entry_size)
+{
+	X64PutInt(arena, name, 4);
+	X64PutInt(arena, type, 4);
+	X64PutInt(arena, flags, 8);
+	X64PutInt(arena, 0, 8);
+	X64PutInt(arena, offset, 8);
+	X64PutInt(arena, size, 8);
+	X64PutInt(arena, link, 4);
+	X64PutInt(arena, info, 4);
+	X64PutInt(arena, align, 8);
+	X64PutInt(arena, entry_size, 8);
+}
+
+static void
+func X64PutSymbol(MemoryArena *arena, U32 name, U32 info, U32 section, U64 value, U64 size)
+{
+	X64PutInt(arena, name, 4);
+	X64PutInt(arena, info, 1);
+	X64PutInt(arena, 0, 1);
+	X64PutInt(arena, section, 2);
+	X64PutInt(arena, value, 8);
+	X64PutInt(arena, size, 8);
+}
+
+static void
+func X64WriteObject(X64Object *o, AtomTable *atoms, MemoryArena *arena)
+{
+	// Sections: 1 .text, 2 .rodata, 3 .rela.text, 4 .symtab, 5 .strtab, 6 .shstrtab, 7 .note.GNU-stack.
+	// The symbol table has the null symbol, the two section symbols, the local functions, then the global ones.
+	static char section_names[] = "\0.text\0.rodata\0.rela.text\0.symtab\0.strtab\0.shstrtab\0.note.GNU-stack";
+	U32 name_at[8] = {0, 1, 7, 15, 26, 34, 42, 52};
+
+	U32 elf_symbol_n = 3;
+	for(U32 pass = 0; pass < 2; pass++)
+	{
+		for(U32 i = 0; i < o->symbol_n; i++)
+		{
+			if(o->symbols[i].is_global == (pass == 1))
+			{
+				o->symbols[i].elf_index = elf_symbol_n;
+				elf_symbol_n++;
+			}
+		}
+	}
+	U32 first_global = 3;
+	for(U32 i = 0; i < o->symbol_n; i++)
+		first_global += !o->symbols[i].is_global;
+
+	size_t strtab_size = 1;
+	for(U32 i = 0; i < o->symbol_n; i++)
+		strtab_size += atoms->atoms[o->symbols[i].name.value].length + 1;
+
+	size_t text_at = 64;
+	size_t rodata_at = X64AlignOffset(text_at + o->code_size, 16);
+	size_t rela_at = X64AlignOffset(rodata_at + o->data_size, 8);
+	size_t symtab_at = rela_at + 24 * o->relocation_n;
+	size_t strtab_at = symtab_at + 24 * elf_symbol_n;
+	size_t shstrtab_at = strtab_at + strtab_size;
+	size_t headers_at = X64AlignOffset(shstrtab_at + sizeof(section_names), 8);
+
+	size_t start = arena->used_size;
+	U8 ident[16] = {0x7F, 'E', 'L', 'F', 2, 1, 1};
+	X64PutBytes(arena, ident, sizeof(ident));
+	X64PutInt(arena, 1, 2);
+	X64PutInt(arena, 62, 2);
+	X64PutInt(arena, 1, 4);
+	X64PutInt(arena, 0, 8);
+	X64PutInt(arena, 0, 8);
+	X64PutInt(arena, headers_at, 8);
+	X64PutInt(arena, 0, 4);
+	X64PutInt(arena, 64, 2);
+	X64PutInt(arena, 0, 2);
+	X64PutInt(arena, 0, 2);
+	X64PutInt(arena, 64, 2);
+	X64PutInt(arena, 8, 2);
+	X64PutInt(arena, 6, 2);
+
+	X64PutBytes(arena, o->code, o->code_size);
+	X64PadTo(arena, start, rodata_at);
+	X64PutBytes(arena, o->data, o->data_size);
+	X64PadTo(arena, start, rela_at);
+
+	for(size_t i = 0; i < o->relocation_n; i++)
+	{
+		X64Relocation *relocation = &o->relocations[i];
+		U64 symbol = (relocation->symbol == X64RodataSymbol) ? 2 : o->symbols[relocation->symbol].elf_index;
+		X64PutInt(arena, relocation->offset, 8);
+		X64PutInt(arena, (symbol << 32) | relocation->type, 8);
+		X64PutInt(arena, (U64)relocation->addend, 8);
+	}
+
+	// Local symbols have binding 0, global ones 1, functions type 2, sections type 3.
+	X64PutSymbol(arena, 0, 0, 0, 0, 0);
+	X64PutSymbol(arena, 0, 3, 1, 0, 0);
+	X64PutSymbol(arena, 0, 3, 2, 0, 0);
+	for(U32 pass = 0; pass < 2; pass++)
+	{
+		U32 name = 1;
+		for(U32 i = 0; i < o->symbol_n; i++)
+		{
+			X64Symbol *symbol = &o->symbols[i];
+			if(symbol->is_global == (pass == 1))
+			{
+				U32 info = ((U32)symbol->is_global << 4) | (symbol->is_defined ? 2 : 0);
+				X64PutSymbol(arena, name, info, symbol->is_defined ? 1 : 0, symbol->value, symbol->size);
+			}
+			name += atoms->atoms[symbol->name.value].length + 1;
+		}
+	}
+
+	X64PutInt(arena, 0, 1);
+	for(U32 i = 0; i < o->symbol_n; i++)
+	{
+		Atom *atom = &atoms->atoms[o->symbols[i].name.value];
+		X64PutBytes(arena, atom->text, atom->length);
+		X64PutInt(arena, 0, 1);
+	}
+	X64PutBytes(arena, section_names, sizeof(section_names));
+	X64PadTo(arena, start, headers_at);
+
+	X64PutSectionHeader(arena, 0, 0, 0, 0, 0, 0, 0, 0, 0);
+	X64PutSectionHeader(arena, name_at[1], 1, 0x6, text_at, o->code_size, 0, 0, 16, 0);
+	X64PutSectionHeader(arena, name_at[2], 1, 0x2, rodata_at, o->data_size, 0, 0, 16, 0);
+	X64PutSectionHeader(arena, name_at[3], 4, 0x40, rela_at, 24 * o->relocation_n, 4, 1, 8, 24);
+	X64PutSectionHeader(arena, name_at[4], 2, 0, symtab_at, 24 * elf_symbol_n, 5, first_global, 8, 24);
+	X64PutSectionHeader(arena, name_at[5], 3, 0, strtab_at, strtab_size, 0, 0, 1, 0);
+	X64PutSectionHeader(arena, name_at[6], 3, 0, shstrtab_at, sizeof(section_names), 0, 0, 1, 0);
+	X64PutSectionHeader(arena, name_at[7], 1, 0, headers_at, 0, 0, 0, 1, 0);
+}
+#endif
+
+static void
+func X64FreeObject(X64Object *o)
+{
+	free(o->code);
+	free(o->data);
+	free(o->label_offsets);
+	free(o->fixups);
+	free(o->relocations);
+	free(o->symbols);
+	free(o->atom_symbols);
+}
@@ -0,0 +1,2061 @@
+// Lowering of the M64 tree to x64 instructions, one function at a time, for the x64 backend.
+// The instructions take two operands like x64 itself, but values live in virtual registers,
+// numbered after the 16 general purpose and the 16 xmm registers. The physical registers appear directly
+// only where the calling convention fixes them. X64Alloc.h then gives every virtual register
+// a register of its class or a stack slot.
+//
+// Locals other than structs and arrays never have their address taken in M64,
+// so each of them is a single virtual register, floats in the xmm class.
+// Struct and array values live in memory: locals in stack slots, results of calls in temporary slots,
+// constants in the constant data of the file. Their value is a memory operand, copied eight bytes at a time.
+// Packed structs of two or four floats, see Packed.h, are the exception: their locals are in an xmm register,
+// except four floats with a field that is assigned on its own, and packed operators work on the whole register.
+// Where a struct has to be in memory, the register is stored to a temporary slot.
+//
+// Calls follow the System V AMD64 convention, x.sh assembles for elf64.
+
+typedef enum tdef X64Reg
+{
+	X64Rax,
+	X64Rcx,
+	X64Rdx,
+	X64Rbx,
+	X64Rsp,
+	X64Rbp,
+	X64Rsi,
+	X64Rdi,
+	X64R8,
+	X64R9,
+	X64R10,
+	X64R11,
+	X64R12,
+	X64R13,
+	X64R14,
+	X64R15,
+	X64Xmm0,
+	X64Xmm15 = X64Xmm0 + 15,
+	X64FirstVirtualReg
+} X64Reg;
+
+#define X64NoReg 0xFFFFFFFFu
+#define X64NoSlot 0xFFFFFFFFu
+#define X64NoLabel 0xFFFFFFFFu
+// The base of memory operands in the constant data, addressed relative to rip.
+#define X64RipReg 0xFFFFFFFEu
+#define X64RegBit(reg) (1u << (reg))
+
+#define X64IntArgRegN 6
+#define X64FloatArgRegN 8
+#define X64XmmMask 0xFFFF0000u
+#define X64CallerSavedMask (X64RegBit(X64Rax) | X64RegBit(X64Rcx) | X64RegBit(X64Rdx) | X64RegBit(X64Rsi) | X64RegBit(X64Rdi) | \
+                            X64RegBit(X64R8) | X64RegBit(X64R9) | X64RegBit(X64R10) | X64RegBit(X64R11) | X64XmmMask)
+#define X64CalleeSavedMask (X64RegBit(X64Rbx) | X64RegBit(X64R12) | X64RegBit(X64R13) | X64RegBit(X64R14) | X64RegBit(X64R15))
+// Struct and array copies longer than this use rep movsq instead of a move for every eight bytes.
+#define X64MaxUnrolledCopySize 64
+
+static U32 X64IntArgRegs[X64IntArgRegN] = {X64Rdi, X64Rsi, X64Rdx, X64Rcx, X64R8, X64R9};
+static U32 X64IntReturnRegs[2] = {X64Rax, X64Rdx};
+
+typedef enum tdef X64Opcode
+{
+	X64LabelOp,
+	X64MovOp,
+	X64MovsxdOp,
+	X64LeaOp,
+	X64AddOp,
+	X64SubOp,
+	X64ImulOp,
+	X64NegOp,
+	X64AndOp,
+	X64CmpOp,
+	X64TestOp,
+	// dst = condition ? 1 : 0
+	X64SetOp,
+	// Moves and arithmetic of floats, scalar with size 4, on every lane with a larger size.
+	X64FMovOp,
+	X64FAddOp,
+	X64FSubOp,
+	X64FMulOp,
+	// ucomiss, sets the flags like an unsigned compare.
+	X64FCmpOp,
+	X64FXorOp,
+	// pshufd, lanes picks the source lane of every lane.
+	X64PshufdOp,
+	// movss between registers, which only replaces the first lane, and unpcklps, which interleaves the first two lanes.
+	// With them a field is assigned in the register of a packed struct.
+	X64MovssOp,
+	X64UnpcklpsOp,
+	// cvtsi2ss and cvttss2si, the size of the general purpose register picks 32 or 64 bits.
+	X64CvtIntToFloatOp,
+	X64CvtFloatToIntOp,
+	// rep movsq and rep stosq, with rdi, rsi, rcx and rax fixed.
+	X64RepMovsOp,
+	X64RepStosOp,
+	X64JmpOp,
+	X64JccOp,
+	X64CallOp,
+	// Leaves the function, the epilogue is written here.
+	X64RetOp,
+	// Failed bounds check.
+	X64Ud2Op
+} X64Opcode;
+
+// Numbered like the condition field of the x64 encoding.
+typedef enum tdef X64Condition
+{
+	X64Below = 0x2,
+	X64AboveEqual = 0x3,
+	X64Equal = 0x4,
+	X64NotEqual = 0x5,
+	X64BelowEqual = 0x6,
+	X64Above = 0x7,
+	X64Less = 0xC,
+	X64GreaterEqual = 0xD,
+	X64LessEqual = 0xE,
+	X64Greater = 0xF
+} X64Condition;
+
+typedef enum tdef X64RegClass
+{
+	X64GeneralClass,
+	X64FloatClass
+} X64RegClass;
+
+typedef enum tdef X64OperandKind
+{
+	X64NoOperand,
+	X64RegOperand,
+	X64ImmOperand,
+	X64MemOperand
+} X64OperandKind;
+
+typedef struct tdef X64Operand
+{
+	X64OperandKind kind;
+	// In bytes: 4 or 8, 16 for a whole xmm register.
+	U32 size;
+	// The register, or the base register of a memory operand, X64NoReg for none.
+	U32 reg;
+	U32 index;
+	U32 scale;
+	// A memory operand in this stack slot, at value bytes from its start.
+	// Slots only get their offset from rbp after allocation.
+	U32 slot;
+	// The immediate, or the displacement of a memory operand.
+	I64 value;
+} X64Operand;
+
+typedef struct tdef X64Instruction
+{
+	X64Opcode op;
+	X64Condition cond;
+	X64Operand dst;
+	X64Operand src;
+	// X64LabelOp, X64JmpOp and X64JccOp.
+	U32 label;
+	// X64CallOp: the callee, extern ones are called through the PLT.
+	Token callee;
+	bool is_extern;
+	// Fixed registers read and written by calls, returns and rep instructions.
+	U32 reads;
+	U32 writes;
+	// X64PshufdOp: two bits for every lane of the result.
+	U32 lanes;
+} X64Instruction;
+
+typedef struct tdef X64Slot
+{
+	U32 size;
+	U32 align;
+	// From rbp, set after allocation.
+	I32 offset;
+} X64Slot;
+
+typedef struct tdef X64Function
+{
+	Token name;
+	bool is_exported;
+
+	X64Instruction *instructions;
+	size_t instruction_n;
+	size_t max_instruction_n;
+
+	// Including the physical registers, with the class of every virtual one.
+	U32 reg_n;
+	U32 max_reg_n;
+	U8 *classes;
+	U32 label_n;
+	U32 return_label;
+	// The ud2 that failed bounds checks jump to, X64NoLabel when there are none.
+	U32 fail_label;
+
+	X64Slot *slots;
+	size_t slot_n;
+	size_t max_slot_n;
+	// Stack arguments of the calls, at the bottom of the frame.
+	U32 outgoing_size;
+
+	// Set by the allocator: the register of each virtual register, or its stack slot.
+	U32 *assigned;
+	U32 *spill_slot;
+	U32 spilled_n;
+	U32 saved_mask;
+	U32 frame_size;
+	// Cleared by X64Peephole.h when no operand uses rbp.
+	bool has_frame_pointer;
+} X64Function;
+
+// Where a value of some type is passed and returned: in up to two eight byte parts,
+// each in a general purpose or an xmm register, or in memory.
+typedef struct tdef X64PassClass
+{
+	bool in_memory;
+	U32 part_n;
+	bool is_float[2];
+	U32 sizes[2];
+} X64PassClass;
+
+typedef struct tdef X64Local
+{
+	U32 name;
+	// A register for scalars, a memory operand for structs and arrays.
+	X64Operand home;
+} X64Local;
+
+typedef struct tdef X64Lowering
+{
+	ParseInput *input;
+	X64Function *f;
+
+	// Scoped like the blocks of the function, inner locals last.
+	X64Local *locals;
+	size_t local_n;
+	size_t max_local_n;
+
+	// Locals of the function with a field that is assigned on its own, packed structs of four floats stay in memory.
+	U32 *field_writes;
+	size_t field_write_n;
+	size_t max_field_write_n;
+	size_t packed_local_n;
+	size_t packed_op_n;
+
+	// Return value of the function being lowered, structs returned in memory are written through return_pointer.
+	VarType *return_type;
+	X64PassClass return_class;
+	U32 return_pointer;
+
+	// Constant data of the whole file, written to .rodata after the functions.
+	U8 *data;
+	size_t data_size;
+	size_t max_data_size;
+	size_t sign_mask_at;
+
+	bool error;
+} X64Lowering;
+
+static X64Operand
+func X64RegOperandInit(U32 reg, U32 size)
+{
+	X64Operand op = {};
+	op.kind = X64RegOperand;
+	op.size = size;
+	op.reg = reg;
+	op.index = X64NoReg;
+	op.scale = 1;
+	op.slot = X64NoSlot;
+	op.value = 0;
+	return op;
+}
+
+static X64Operand
+func X64ImmOperandInit(I64 value, U32 size)
+{
+	X64Operand op = X64RegOperandInit(X64NoReg, size);
+	op.kind = X64ImmOperand;
+	op.value = value;
+	return op;
+}
+
+static X64Operand
+func X64MemOperandInit(U32 base, I64 disp, U32 size)
+{
+	X64Operand op = X64RegOperandInit(base, size);
+	op.kind = X64MemOperand;
+	op.value = disp;
+	return op;
+}
+
+static X64Operand
+func X64SlotOperandInit(U32 slot, U32 size)
+{
+	X64Operand op = X64MemOperandInit(X64NoReg, 0, size);
+	op.slot = slot;
+	return op;
+}
+
+static X64Operand
+func X64NoOperandInit(void)
+{
+	X64Operand op = X64RegOperandInit(X64NoReg, 0);
+	op.kind = X64NoOperand;
+	return op;
+}
+
+static bool
+func X64FitsImm32(I64 value)
+{
+	return (value >= INT_MIN && value <= INT_MAX);
+}
+
+static X64Instruction *
+func X64Emit(X64Function *f, X64Opcode op, X64Operand dst, X64Operand src)
+{
+	if(f->instruction_n == f->max_instruction_n)
+	{
+		f->max_instruction_n = 2 * f->max_instruction_n + 64;
+		f->instructions = (X64Instruction *)realloc(f->instructions, f->max_instruction_n * sizeof(X64Instruction));
+	}
+
+	X64Instruction *instruction = &f->instructions[f->instruction_n];
+	f->instruction_n++;
+	instruction->op = op;
+	instruction->cond = X64Equal;
+	instruction->dst = dst;
+	instruction->src = src;
+	instruction->label = 0;
+	instruction->callee = (Token){};
+	instruction->is_extern = false;
+	instruction->reads = 0;
+	instruction->writes = 0;
+	instruction->lanes = 0;
+	return instruction;
+}
+
+static void
+func X64EmitLabel(X64Function *f, U32 label)
+{
+	X64Emit(f, X64LabelOp, X64NoOperandInit(), X64NoOperandInit())->label = label;
+}
+
+static void
+func X64EmitJump(X64Function *f, U32 label)
+{
+	X64Emit(f, X64JmpOp, X64NoOperandInit(), X64NoOperandInit())->label = label;
+}
+
+static void
+func X64EmitJcc(X64Function *f, X64Condition cond, U32 label)
+{
+	X64Instruction *instruction = X64Emit(f, X64JccOp, X64NoOperandInit(), X64NoOperandInit());
+	instruction->cond = cond;
+	instruction->label = label;
+}
+
+static U32
+func X64NewLabel(X64Function *f)
+{
+	U32 label = f->label_n;
+	f->label_n++;
+	return label;
+}
+
+static U32
+func X64NewReg(X64Function *f, X64RegClass reg_class)
+{
+	if(f->reg_n >= f->max_reg_n)
+	{
+		f->max_reg_n = 2 * f->max_reg_n + 64;
+		f->classes = (U8 *)realloc(f->classes, f->max_reg_n * sizeof(U8));
+	}
+	U32 reg = f->reg_n;
+	f->classes[reg] = (U8)reg_class;
+	f->reg_n++;
+	return reg;
+}
+
+static X64RegClass
+func X64GetRegClass(X64Function *f, U32 reg)
+{
+	if(reg < X64FirstVirtualReg)
+		return (reg >= X64Xmm0) ? X64FloatClass : X64GeneralClass;
+	return (X64RegClass)f->classes[reg];
+}
+
+static X64Opcode
+func X64GetMoveOp(X64RegClass reg_class)
+{
+	return (reg_class == X64FloatClass) ? X64FMovOp : X64MovOp;
+}
+
+static X64Condition
+func X64InvertCondition(X64Condition cond)
+{
+	// The encoding pairs every condition with its inverse in the lowest bit.
+	return (X64Condition)(cond ^ 1);
+}
+
+static X64Condition
+func X64SwapCondition(X64Condition cond)
+{
+	// The condition after swapping the operands of the compare.
+	switch(cond)
+	{
+		case X64Below:        return X64Above;
+		case X64AboveEqual:   return X64BelowEqual;
+		case X64BelowEqual:   return X64AboveEqual;
+		case X64Above:        return X64Below;
+		case X64Less:         return X64Greater;
+		case X64GreaterEqual: return X64LessEqual;
+		case X64LessEqual:    return X64GreaterEqual;
+		case X64Greater:      return X64Less;
+		default:              return cond;
+	}
+}
+
+static bool
+func X64IsUnsigned(VarType *type)
+{
+	return (type->id == PointerTypeId || (type->id == BaseTypeId && ((BaseType *)type)->base_id == UInt32BaseTypeId));
+}
+
+static bool
+func X64IsFloat(VarType *type)
+{
+	return (type->id == BaseTypeId && ((BaseType *)type)->base_id == Float32BaseTypeId);
+}
+
+static bool
+func X64IsAggregate(VarType *type)
+{
+	return (type->id == StructTypeId || type->id == ArrayTypeId);
+}
+
+static X64RegClass
+func X64GetTypeClass(VarType *type)
+{
+	return X64IsFloat(type) ? X64FloatClass : X64GeneralClass;
+}
+
+static void
+func X64LoweringError(X64Lowering *l, char *what)
+{
+	if(!l->error)
+	{
+		Atom *atom = &l->input->atoms.atoms[l->f->name.value];
+		printf("Error: %s cannot be written as x64 assembly, in <%.*s>.\n", what, (int)atom->length, atom->text);
+	}
+	l->error = true;
+}
+
+static U32
+func X64GetTypeSize(X64Lowering *l, VarType *type)
+{
+	U64 size = 0;
+	if(!GetTypeSize(type, &size) || size > UINT_MAX)
+	{
+		X64LoweringError(l, "A type without a known size");
+		return 4;
+	}
+	return (U32)size;
+}
+
+static U32
+func X64GetValueSize(X64Lowering *l, VarType *type)
+{
+	// The operand size of a scalar, structs and arrays only have an address.
+	if(X64IsAggregate(type))
+		return 0;
+	return X64GetTypeSize(l, type);
+}
+
+static X64Operand
+func X64NewValue(X64Lowering *l, VarType *type)
+{
+	return X64RegOperandInit(X64NewReg(l->f, X64GetTypeClass(type)), X64GetValueSize(l, type));
+}
+
+static U32
+func X64AddSlot(X64Function *f, U32 size, U32 align)
+{
+	if(f->slot_n == f->max_slot_n)
+	{
+		f->max_slot_n = 2 * f->max_slot_n + 16;
+		f->slots = (X64Slot *)realloc(f->slots, f->max_slot_n * sizeof(X64Slot));
+	}
+	X64Slot *slot = &f->slots[f->slot_n];
+	slot->size = size;
+	slot->align = align;
+	slot->offset = 0;
+	f->slot_n++;
+	return (U32)(f->slot_n - 1);
+}
+
+static X64Operand
+func X64NewMemoryValue(X64Lowering *l, VarType *type)
+{
+	// Stack slots are rounded up to eight bytes, so every part of a struct can be stored whole.
+	U32 size = X64GetTypeSize(l, type);
+	U32 align = (U32)GetTypeAlign(type);
+	if(align < 8)
+		align = 8;
+	return X64SlotOperandInit(X64AddSlot(l->f, (size + 7) & ~7u, align), 0);
+}
+
+static size_t
+func X64AddData(X64Lowering *l, size_t size, size_t align)
+{
+	// Zeroed, the caller writes the bytes.
+	size_t at = (l->data_size + align - 1) & ~(align - 1);
+	if(at + size > l->max_data_size)
+	{
+		l->max_data_size = 2 * l->max_data_size + at + size + 256;
+		l->data = (U8 *)realloc(l->data, l->max_data_size);
+	}
+	memset(l->data + l->data_size, 0, at + size - l->data_size);
+	l->data_size = at + size;
+	return at;
+}
+
+static void
+func X64WriteDataScalar(X64Lowering *l, size_t at, VarType *type, ConstantScalar value)
+{
+	if(X64IsFloat(type))
+	{
+		float f = (float)value.f;
+		memcpy(l->data + at, &f, 4);
+	}
+	else if(type->id == PointerTypeId)
+	{
+		memcpy(l->data + at, &value.i, 8);
+	}
+	else
+	{
+		U32 i = (U32)value.i;
+		memcpy(l->data + at, &i, 4);
+	}
+}
+
+static void
+func X64WriteDataValues(X64Lowering *l, size_t at, VarType *type, ConstantScalar *values, size_t value_n, size_t *value_at)
+{
+	// The values are in memory order without the padding, like WriteConstantData reads them.
+	switch(type->id)
+	{
+		case StructTypeId:
+		{
+			StructDefinition *def = ((StructType *)type)->def;
+			for(StructVar *var = def->first_var; var; var = var->next)
+			{
+				U64 offset = 0;
+				GetFieldOffset(def, var->name, &offset);
+				X64WriteDataValues(l, at + offset, var->type, values, value_n, value_at);
+			}
+			break;
+		}
+		case ArrayTypeId:
+		{
+			ArrayType *array = (ArrayType *)type;
+			U32 element_size = X64GetTypeSize(l, array->element_type);
+			I64 n = ((IntegerConstantExpression *)array->size)->value;
+			for(I64 i = 0; i < n; i++)
+				X64WriteDataValues(l, at + i * element_size, array->element_type, values, value_n, value_at);
+			break;
+		}
+		default:
+		{
+			if(*value_at < value_n)
+				X64WriteDataScalar(l, at, type, values[*value_at]);
+			(*value_at)++;
+			break;
+		}
+	}
+}
+
+static X64Operand
+func X64DataOperandInit(size_t at, U32 size)
+{
+	return X64MemOperandInit(X64RipReg, (I64)at, size);
+}
+
+static X64Operand
+func X64GetSignMask(X64Lowering *l)
+{
+	// Four float sign bits for xorps, which needs 16 byte alignment.
+	if(l->sign_mask_at == (size_t)-1)
+	{
+		l->sign_mask_at = X64AddData(l, 16, 16);
+		for(size_t i = 0; i < 4; i++)
+			l->data[l->sign_mask_at + 4 * i + 3] = 0x80;
+	}
+	return X64DataOperandInit(l->sign_mask_at, 16);
+}
+
+static void
+func X64ClassifyScalars(X64Lowering *l, VarType *type, U64 offset, bool has_int[2], bool *is_aligned)
+{
+	switch(type->id)
+	{
+		case StructTypeId:
+		{
+			StructDefinition *def = ((StructType *)type)->def;
+			for(StructVar *var = def->first_var; var; var = var->next)
+			{
+				U64 field_offset = 0;
+				GetFieldOffset(def, var->name, &field_offset);
+				X64ClassifyScalars(l, var->type, offset + field_offset, has_int, is_aligned);
+			}
+			break;
+		}
+		case ArrayTypeId:
+		{
+			ArrayType *array = (ArrayType *)type;
+			U32 element_size = X64GetTypeSize(l, array->element_type);
+			I64 n = ((IntegerConstantExpression *)array->size)->value;
+			for(I64 i = 0; i < n; i++)
+				X64ClassifyScalars(l, array->element_type, offset + i * element_size, has_int, is_aligned);
+			break;
+		}
+		default:
+		{
+			U32 size = X64GetTypeSize(l, type);
+			if(offset % size != 0)
+				*is_aligned = false;
+			else if(!X64IsFloat(type))
+				has_int[offset / 8] = true;
+			break;
+		}
+	}
+}
+
+static X64PassClass
+func X64ClassifyType(X64Lowering *l, VarType *type)
+{
+	// An eight byte part goes in an xmm register when it only holds floats.
+	// Structs over 16 bytes and packed structs with unaligned fields go in memory.
+	X64PassClass result = {};
+	U32 size = X64GetTypeSize(l, type);
+	if(!X64IsAggregate(type))
+	{
+		result.part_n = 1;
+		result.is_float[0] = X64IsFloat(type);
+		result.sizes[0] = size;
+		return result;
+	}
+	if(size > 16 || size == 0)
+	{
+		result.in_memory = true;
+		return result;
+	}
+
+	bool has_int[2] = {false, false};
+	bool is_aligned = true;
+	X64ClassifyScalars(l, type, 0, has_int, &is_aligned);
+	result.in_memory = !is_aligned;
+	result.part_n = (size + 7) / 8;
+	for(U32 i = 0; i < result.part_n; i++)
+	{
+		result.is_float[i] = !has_int[i];
+		result.sizes[i] = (size - 8 * i >= 8) ? 8 : 4;
+	}
+	return result;
+}
+
+static void
+func X64AddLocal(X64Lowering *l, Token name, X64Operand home)
+{
+	if(l->local_n == l->max_local_n)
+	{
+		l->max_local_n = 2 * l->max_local_n + 32;
+		l->locals = (X64Local *)realloc(l->locals, l->max_local_n * sizeof(X64Local));
+	}
+
+	X64Local *local = &l->locals[l->local_n];
+	l->local_n++;
+	local->name = name.value;
+	local->home = home;
+}
+
+static X64Operand
+func X64GetLocal(X64Lowering *l, Token name)
+{
+	for(size_t i = l->local_n; i > 0; i--)
+	{
+		if(l->locals[i - 1].name == name.value)
+			return l->locals[i - 1].home;
+	}
+	X64LoweringError(l, "A global variable");
+	return X64RegOperandInit(X64Rax, 4);
+}
+
+static void
+func X64FindFieldWrites(X64Lowering *l, Instruction *instruction)
+{
+	Expression *target = 0;
+	switch(instruction->id)
+	{
+		case AssignInstructionId:
+		{
+			target = ((AssignInstruction *)instruction)->left;
+			break;
+		}
+		case AndEqualsInstructionId:
+		{
+			target = ((AndEqualsInstruction *)instruction)->left;
+			break;
+		}
+		case IncrementInstructionId:
+		{
+			target = ((IncrementInstruction *)instruction)->value;
+			break;
+		}
+		case BlockInstructionId:
+		{
+			for(Instruction *i = ((BlockInstruction *)instruction)->first; i; i = i->next)
+				X64FindFieldWrites(l, i);
+			return;
+		}
+		case IfInstructionId:
+		{
+			X64FindFieldWrites(l, (Instruction *)((IfInstruction *)instruction)->body);
+			return;
+		}
+		case ForInstructionId:
+		{
+			ForInstruction *i = (ForInstruction *)instruction;
+			if(i->init)
+				X64FindFieldWrites(l, i->init);
+			if(i->update)
+				X64FindFieldWrites(l, i->update);
+			X64FindFieldWrites(l, (Instruction *)i->body);
+			return;
+		}
+		default:
+		{
+			return;
+		}
+	}
+
+	while(target->id == ParenExpressionId)
+		target = ((ParenExpression *)target)->in;
+	Var *var = (target->id != VarExpressionId) ? GetWrittenVar(target) : 0;
+	if(!var)
+		return;
+	if(l->field_write_n == l->max_field_write_n)
+	{
+		l->max_field_write_n = 2 * l->max_field_write_n + 16;
+		l->field_writes = (U32 *)realloc(l->field_writes, l->max_field_write_n * sizeof(U32));
+	}
+	l->field_writes[l->field_write_n] = var->name.value;
+	l->field_write_n++;
+}
+
+static U32
+func X64GetPackedSize(X64Lowering *l, VarType *type)
+{
+	// 8 or 16 for packed structs, 0 for every other type.
+	U32 lane_n = GetPackedLaneN(type);
+	if(lane_n == 0 || X64GetTypeSize(l, type) != 4 * lane_n)
+		return 0;
+	return 4 * lane_n;
+}
+
+static U32
+func X64GetPackedLocalSize(X64Lowering *l, VarType *type, Token name)
+{
+	// The size of the register of a packed local, 0 for locals in memory.
+	// Only the first two fields can be assigned in a register.
+	U32 size = X64GetPackedSize(l, type);
+	for(size_t i = 0; i < l->field_write_n && size == 16; i++)
+	{
+		if(l->field_writes[i] == name.value)
+			size = 0;
+	}
+	return size;
+}
+
+static X64Operand
+func X64ToMemory(X64Lowering *l, X64Operand value, VarType *type)
+{
+	// A packed struct in a register to a new slot, memory operands stay as they are.
+	if(value.kind != X64RegOperand)
+		return value;
+	X64Operand memory = X64NewMemoryValue(l, type);
+	X64Operand to = memory;
+	to.size = value.size;
+	X64Emit(l->f, X64FMovOp, to, value);
+	return memory;
+}
+
+static X64Operand
+func X64ToPacked(X64Lowering *l, X64Operand value, VarType *type)
+{
+	// A packed struct in memory to a new register, with movsd or movups.
+	if(value.kind == X64RegOperand)
+		return value;
+	X64Operand reg = X64RegOperandInit(X64NewReg(l->f, X64FloatClass), X64GetPackedSize(l, type));
+	value.size = reg.size;
+	X64Emit(l->f, X64FMovOp, reg, value);
+	return reg;
+}
+
+static X64Operand
+func X64GetPackedLane(X64Lowering *l, X64Operand value, U32 lane)
+{
+	// The first lane is the float in the low bits of the register, pshufd moves the others there.
+	if(lane == 0)
+		return X64RegOperandInit(value.reg, 4);
+	X64Operand result = X64RegOperandInit(X64NewReg(l->f, X64FloatClass), 4);
+	X64Emit(l->f, X64PshufdOp, result, value)->lanes = lane;
+	return result;
+}
+
+static X64Operand
+func X64GetPackedField(X64Lowering *l, Expression *e, U32 *lane)
+{
+	// The register of the packed local that the field e is in, X64NoOperand for everything else.
+	while(e->id == ParenExpressionId)
+		e = ((ParenExpression *)e)->in;
+	if(e->id != StructVarExpressionId)
+		return X64NoOperandInit();
+	StructVarExpression *s = (StructVarExpression *)e;
+	Expression *base = s->base;
+	while(base->id == ParenExpressionId)
+		base = ((ParenExpression *)base)->in;
+	U64 offset = 0;
+	if(base->id != VarExpressionId || X64GetPackedSize(l, base->type) == 0 || !GetFieldOffset(((StructType *)base->type)->def, s->var_name, &offset))
+		return X64NoOperandInit();
+	X64Operand home = X64GetLocal(l, ((VarExpression *)base)->var.name);
+	*lane = (U32)(offset / 4);
+	return (home.kind == X64RegOperand) ? home : X64NoOperandInit();
+}
+
+static X64Operand decl X64LowerExpression(X64Lowering *, Expression *);
+static X64Operand decl X64LowerAddress(X64Lowering *, Expression *);
+
+static X64Operand
+func X64ToReg(X64Lowering *l, X64Operand value, X64RegClass reg_class)
+{
+	if(value.kind == X64RegOperand)
+		return value;
+	X64Operand reg = X64RegOperandInit(X64NewReg(l->f, reg_class), value.size);
+	X64Emit(l->f, X64GetMoveOp(reg_class), reg, value);
+	return reg;
+}
+
+static X64Operand
+func X64LowerCopy(X64Lowering *l, Expression *e)
+{
+	// A new register the caller can change, locals are only changed by assignments.
+	X64Operand value = X64LowerExpression(l, e);
+	X64Operand reg = X64NewValue(l, e->type);
+	X64Emit(l->f, X64GetMoveOp(X64GetTypeClass(e->type)), reg, value);
+	return reg;
+}
+
+static void
+func X64CopyMemory(X64Lowering *l, X64Operand dst, X64Operand src, U32 size)
+{
+	X64Function *f = l->f;
+	if(size > X64MaxUnrolledCopySize && size % 8 == 0)
+	{
+		X64Emit(f, X64LeaOp, X64RegOperandInit(X64Rdi, 8), dst);
+		X64Emit(f, X64LeaOp, X64RegOperandInit(X64Rsi, 8), src);
+		X64Emit(f, X64MovOp, X64RegOperandInit(X64Rcx, 4), X64ImmOperandInit(size / 8, 4));
+		X64Instruction *rep = X64Emit(f, X64RepMovsOp, X64NoOperandInit(), X64NoOperandInit());
+		rep->reads = X64RegBit(X64Rdi) | X64RegBit(X64Rsi) | X64RegBit(X64Rcx);
+		rep->writes = rep->reads;
+		return;
+	}
+
+	for(U32 at = 0; at < size; at += 8)
+	{
+		U32 part = (size - at >= 8) ? 8 : 4;
+		X64Operand reg = X64RegOperandInit(X64NewReg(f, X64GeneralClass), part);
+		X64Operand from = src;
+		X64Operand to = dst;
+		from.value += at;
+		from.size = part;
+		to.value += at;
+		to.size = part;
+		X64Emit(f, X64MovOp, reg, from);
+		X64Emit(f, X64MovOp, to, reg);
+	}
+}
+
+static void
+func X64ZeroMemory(X64Lowering *l, X64Operand dst, U32 size)
+{
+	X64Function *f = l->f;
+	if(size > X64MaxUnrolledCopySize && size % 8 == 0)
+	{
+		X64Emit(f, X64LeaOp, X64RegOperandInit(X64Rdi, 8), dst);
+		X64Emit(f, X64MovOp, X64RegOperandInit(X64Rax, 4), X64ImmOperandInit(0, 4));
+		X64Emit(f, X64MovOp, X64RegOperandInit(X64Rcx, 4), X64ImmOperandInit(size / 8, 4));
+		X64Instruction *rep = X64Emit(f, X64RepStosOp, X64NoOperandInit(), X64NoOperandInit());
+		rep->reads = X64RegBit(X64Rdi) | X64RegBit(X64Rcx) | X64RegBit(X64Rax);
+		rep->writes = X64RegBit(X64Rdi) | X64RegBit(X64Rcx);
+		return;
+	}
+
+	for(U32 at = 0; at < size; at += 8)
+	{
+		U32 part = (size - at >= 8) ? 8 : 4;
+		X64Operand to = dst;
+		to.value += at;
+		to.size = part;
+		X64Emit(f, X64MovOp, to, X64ImmOperandInit(0, part));
+	}
+}
+
+static X64Operand
+func X64Load(X64Lowering *l, X64Operand address, VarType *type)
+{
+	X64Operand reg = X64NewValue(l, type);
+	address.size = reg.size;
+	X64Emit(l->f, X64GetMoveOp(X64GetTypeClass(type)), reg, address);
+	return reg;
+}
+
+static void
+func X64Store(X64Lowering *l, X64Operand address, X64Operand value, VarType *type)
+{
+	if(X64IsAggregate(type) && value.kind == X64RegOperand)
+	{
+		address.size = value.size;
+		X64Emit(l->f, X64FMovOp, address, value);
+		return;
+	}
+	if(X64IsAggregate(type))
+	{
+		X64CopyMemory(l, address, value, X64GetTypeSize(l, type));
+		return;
+	}
+	address.size = X64GetValueSize(l, type);
+	X64Emit(l->f, X64GetMoveOp(X64GetTypeClass(type)), address, value);
+}
+
+static U32
+func X64GetFailLabel(X64Function *f)
+{
+	if(f->fail_label == X64NoLabel)
+		f->fail_label = X64NewLabel(f);
+	return f->fail_label;
+}
+
+static void
+func X64AddIndex(X64Lowering *l, X64Operand *address, Expression *index, U32 element_size, bool negative, bool checked, I64 bound)
+{
+	// address + index * element_size, the index is an int, sign-extended to 64 bits.
+	X64Function *f = l->f;
+	while(index->id == ParenExpressionId)
+		index = ((ParenExpression *)index)->in;
+	if(index->id == IntegerConstantExpressionId && !checked)
+	{
+		I64 value = ((IntegerConstantExpression *)index)->value;
+		address->value += (negative ? -value : value) * (I64)element_size;
+		return;
+	}
+
+	X64Operand value = X64ToReg(l, X64LowerExpression(l, index), X64GeneralClass);
+	if(checked)
+	{
+		// An unsigned compare also catches negative indices.
+		X64Emit(f, X64CmpOp, value, X64ImmOperandInit(bound, 4));
+		X64EmitJcc(f, X64AboveEqual, X64GetFailLabel(f));
+	}
+
+	X64Operand wide = X64RegOperandInit(X64NewReg(f, X64GeneralClass), 8);
+	value.size = 4;
+	X64Emit(f, X64MovsxdOp, wide, value);
+	if(negative)
+		X64Emit(f, X64NegOp, wide, X64NoOperandInit());
+	U32 scale = element_size;
+	if(scale != 1 && scale != 2 && scale != 4 && scale != 8)
+	{
+		X64Emit(f, X64ImulOp, wide, X64ImmOperandInit(element_size, 8));
+		scale = 1;
+	}
+
+	if(address->index != X64NoReg)
+	{
+		X64Operand base = X64RegOperandInit(X64NewReg(f, X64GeneralClass), 8);
+		X64Operand full = *address;
+		full.size = 8;
+		X64Emit(f, X64LeaOp, base, full);
+		*address = X64MemOperandInit(base.reg, 0, address->size);
+	}
+	address->index = wide.reg;
+	address->scale = scale;
+}
+
+static X64Operand
+func X64LowerPointerOffset(X64Lowering *l, Expression *pointer, Expression *offset, bool negative)
+{
+	// pointer + offset, in elements of the pointed type.
+	U32 element_size = X64GetTypeSize(l, ((PointerType *)pointer->type)->pointed_type);
+	X64Operand base = X64ToReg(l, X64LowerExpression(l, pointer), X64GeneralClass);
+	X64Operand address = X64MemOperandInit(base.reg, 0, 8);
+	X64AddIndex(l, &address, offset, element_size, negative, false, 0);
+	X64Operand result = X64RegOperandInit(X64NewReg(l->f, X64GeneralClass), 8);
+	X64Emit(l->f, X64LeaOp, result, address);
+	return result;
+}
+
+static X64Opcode
+func X64GetArithmeticOp(ExpressionId id, bool is_float)
+{
+	switch(id)
+	{
+		case AddExpressionId:      return is_float ? X64FAddOp : X64AddOp;
+		case SubtractExpressionId: return is_float ? X64FSubOp : X64SubOp;
+		default:                   return is_float ? X64FMulOp : X64ImulOp;
+	}
+}
+
+static X64Operand
+func X64LowerArithmetic(X64Lowering *l, ExpressionId id, Expression *left, Expression *right, VarType *type)
+{
+	if(type->id == PointerTypeId && id != MultiplyExpressionId && !X64IsAggregate(right->type) && right->type->id != PointerTypeId)
+		return X64LowerPointerOffset(l, left, right, id == SubtractExpressionId);
+	if(X64IsAggregate(type) || type->id == PointerTypeId)
+	{
+		X64LoweringError(l, "Arithmetic on this type");
+		return X64ImmOperandInit(0, 4);
+	}
+
+	X64Operand result = X64LowerCopy(l, left);
+	X64Operand value = X64LowerExpression(l, right);
+	X64Emit(l->f, X64GetArithmeticOp(id, X64IsFloat(type)), result, value);
+	return result;
+}
+
+static X64Operand
+func X64LowerPackedOperand(X64Lowering *l, Expression *e, bool is_packed, U32 size)
+{
+	// A float goes to every lane.
+	X64Operand value = X64LowerExpression(l, e);
+	if(is_packed)
+		return X64ToPacked(l, value, e->type);
+	X64Operand lanes = X64RegOperandInit(X64NewReg(l->f, X64FloatClass), size);
+	X64Emit(l->f, X64PshufdOp, lanes, X64ToReg(l, value, X64FloatClass))->lanes = 0;
+	return lanes;
+}
+
+static X64Operand
+func X64LowerPackedOperator(X64Lowering *l, OperatorCallExpression *e, PackedInfo *info, U32 size)
+{
+	X64Operand left = X64LowerPackedOperand(l, e->left, info->left_is_packed, size);
+	X64Operand right = X64LowerPackedOperand(l, e->right, info->right_is_packed, size);
+	X64Operand result = X64RegOperandInit(X64NewReg(l->f, X64FloatClass), size);
+	X64Emit(l->f, X64FMovOp, result, left);
+	X64Emit(l->f, X64GetArithmeticOp(info->op, true), result, right);
+	l->packed_op_n++;
+	return result;
+}
+
+static X64Condition
+func X64LowerCompare(X64Lowering *l, ExpressionId id, Expression *left, Expression *right)
+{
+	// Emits the compare and returns the condition that holds when the expression is true.
+	X64Operand a = X64LowerExpression(l, left);
+	X64Operand b = X64LowerExpression(l, right);
+	if(X64IsFloat(left->type))
+	{
+		// ucomiss sets below for NaN too, so the operands are ordered to test above or above-equal,
+		// which are false for NaN like the comparison in C.
+		X64Condition cond = (id == LessThanEqualExpressionId) ? X64AboveEqual : X64Above;
+		if(id != GreaterThanExpressionId)
+		{
+			X64Operand t = a;
+			a = b;
+			b = t;
+		}
+		X64Emit(l->f, X64FCmpOp, X64ToReg(l, a, X64FloatClass), b);
+		return cond;
+	}
+
+	X64Condition cond = X64Less;
+	bool is_unsigned = X64IsUnsigned(left->type);
+	switch(id)
+	{
+		case LessThanExpressionId:      cond = is_unsigned ? X64Below : X64Less; break;
+		case LessThanEqualExpressionId: cond = is_unsigned ? X64BelowEqual : X64LessEqual; break;
+		case GreaterThanExpressionId:   cond = is_unsigned ? X64Above : X64Greater; break;
+		default: break;
+	}
+
+	if(a.kind == X64ImmOperand && b.kind == X64RegOperand)
+	{
+		X64Operand t = a;
+		a = b;
+		b = t;
+		cond = X64SwapCondition(cond);
+	}
+	X64Emit(l->f, X64CmpOp, X64ToReg(l, a, X64GeneralClass), b);
+	return cond;
+}
+
+static bool
+func X64GetCompareOperands(Expression *e, Expression **left, Expression **right)
+{
+	switch(e->id)
+	{
+		case LessThanExpressionId:
+		{
+			*left = ((LessThanExpression *)e)->left;
+			*right = ((LessThanExpression *)e)->right;
+			return true;
+		}
+		case LessThanEqualExpressionId:
+		{
+			*left = ((LessThanEqualExpression *)e)->left;
+			*right = ((LessThanEqualExpression *)e)->right;
+			return true;
+		}
+		case GreaterThanExpressionId:
+		{
+			*left = ((GreaterThanExpression *)e)->left;
+			*right = ((GreaterThanExpression *)e)->right;
+			return true;
+		}
+		default:
+		{
+			return false;
+		}
+	}
+}
+
+static void
+func X64LowerBranch(X64Lowering *l, Expression *e, U32 false_label)
+{
+	// Jumps to false_label when the condition does not hold.
+	while(e->id == ParenExpressionId)
+		e = ((ParenExpression *)e)->in;
+
+	Expression *left = 0;
+	Expression *right = 0;
+	if(X64GetCompareOperands(e, &left, &right))
+	{
+		X64Condition cond = X64LowerCompare(l, e->id, left, right);
+		X64EmitJcc(l->f, X64InvertCondition(cond), false_label);
+		return;
+	}
+
+	X64Operand value = X64ToReg(l, X64LowerExpression(l, e), X64GeneralClass);
+	X64Emit(l->f, X64TestOp, value, value);
+	X64EmitJcc(l->f, X64Equal, false_label);
+}
+
+static void
+func X64LoadParts(X64Lowering *l, X64PassClass *pass, X64Operand address, U32 *int_regs, U32 *int_n, U32 *float_n, U32 *mask)
+{
+	// The eight byte parts of a struct in memory to the next registers of their class.
+	for(U32 i = 0; i < pass->part_n; i++)
+	{
+		X64Operand part = address;
+		part.value += 8 * i;
+		part.size = pass->sizes[i];
+		U32 reg = pass->is_float[i] ? (X64Xmm0 + *float_n) : int_regs[*int_n];
+		*(pass->is_float[i] ? float_n : int_n) += 1;
+		X64Emit(l->f, pass->is_float[i] ? X64FMovOp : X64MovOp, X64RegOperandInit(reg, pass->sizes[i]), part);
+		*mask |= X64RegBit(reg);
+	}
+}
+
+static void
+func X64StoreParts(X64Lowering *l, X64PassClass *pass, X64Operand address, U32 *int_regs, U32 *int_n, U32 *float_n)
+{
+	for(U32 i = 0; i < pass->part_n; i++)
+	{
+		X64Operand part = address;
+		part.value += 8 * i;
+		part.size = pass->sizes[i];
+		U32 reg = pass->is_float[i] ? (X64Xmm0 + *float_n) : int_regs[*int_n];
+		*(pass->is_float[i] ? float_n : int_n) += 1;
+		X64Emit(l->f, pass->is_float[i] ? X64FMovOp : X64MovOp, part, X64RegOperandInit(reg, pass->sizes[i]));
+	}
+}
+
+static void
+func X64CountParts(X64PassClass *pass, U32 *int_n, U32 *float_n)
+{
+	*int_n = 0;
+	*float_n = 0;
+	for(U32 i = 0; i < pass->part_n; i++)
+		*(pass->is_float[i] ? float_n : int_n) += 1;
+}
+
+#define X64MaxArgN 64
+
+static X64Operand
+func X64LowerCall(X64Lowering *l, Token name, bool is_extern, Expression **args, size_t arg_n, VarType *return_type)
+{
+	X64Function *f = l->f;
+	if(arg_n > X64MaxArgN)
+	{
+		X64LoweringError(l, "A call with more than 64 arguments");
+		return X64ImmOperandInit(0, 4);
+	}
+
+	// Structs returned in memory are written to a slot of the caller, its address goes in rdi.
+	// Packed structs returned in xmm0 alone stay in a register.
+	X64PassClass return_class = {};
+	X64Operand result_memory = X64NoOperandInit();
+	U32 packed_size = 0;
+	if(return_type)
+	{
+		return_class = X64ClassifyType(l, return_type);
+		packed_size = (return_class.part_n == 1) ? X64GetPackedSize(l, return_type) : 0;
+		if(X64IsAggregate(return_type) && packed_size == 0)
+			result_memory = X64NewMemoryValue(l, return_type);
+	}
+
+	// Every argument is computed before any is moved to its register, the later ones can contain calls.
+	// Arrays are passed by their address like in C.
+	X64Operand values[X64MaxArgN];
+	X64PassClass classes[X64MaxArgN];
+	I32 stack_at[X64MaxArgN];
+	for(size_t i = 0; i < arg_n; i++)
+	{
+		VarType *type = args[i]->type;
+		if(type->id == ArrayTypeId)
+		{
+			X64Operand address = X64LowerAddress(l, args[i]);
+			address.size = 8;
+			values[i] = X64RegOperandInit(X64NewReg(f, X64GeneralClass), 8);
+			X64Emit(f, X64LeaOp, values[i], address);
+			classes[i] = X64ClassifyType(l, ((ArrayType *)type)->element_type);
+			classes[i].in_memory = false;
+			classes[i].part_n = 1;
+			classes[i].is_float[0] = false;
+			classes[i].sizes[0] = 8;
+		}
+		else
+		{
+			values[i] = X64LowerExpression(l, args[i]);
+			classes[i] = X64ClassifyType(l, type);
+			// A packed struct in a register is passed in one xmm register when it has a single part.
+			if(values[i].kind == X64RegOperand && X64IsAggregate(type) && classes[i].part_n != 1)
+				values[i] = X64ToMemory(l, values[i], type);
+		}
+	}
+
+	U32 int_n = (return_class.in_memory && return_type) ? 1 : 0;
+	U32 float_n = 0;
+	U32 stack_size = 0;
+	for(size_t i = 0; i < arg_n; i++)
+	{
+		U32 part_int_n = 0;
+		U32 part_float_n = 0;
+		X64CountParts(&classes[i], &part_int_n, &part_float_n);
+		bool in_regs = !classes[i].in_memory && int_n + part_int_n <= X64IntArgRegN && float_n + part_float_n <= X64FloatArgRegN;
+		stack_at[i] = -1;
+		if(in_regs)
+		{
+			int_n += part_int_n;
+			float_n += part_float_n;
+		}
+		else
+		{
+			stack_at[i] = (I32)stack_size;
+			stack_size += (args[i]->type->id == ArrayTypeId) ? 8 : ((X64GetTypeSize(l, args[i]->type) + 7) & ~7u);
+		}
+	}
+	if(stack_size > f->outgoing_size)
+		f->outgoing_size = stack_size;
+
+	for(size_t i = 0; i < arg_n; i++)
+	{
+		if(stack_at[i] < 0)
+			continue;
+		X64Operand slot = X64MemOperandInit(X64Rsp, stack_at[i], values[i].size);
+		if(X64IsAggregate(args[i]->type) && args[i]->type->id != ArrayTypeId && values[i].kind == X64RegOperand)
+		{
+			X64Emit(f, X64FMovOp, slot, values[i]);
+		}
+		else if(X64IsAggregate(args[i]->type) && args[i]->type->id != ArrayTypeId)
+		{
+			X64CopyMemory(l, slot, values[i], X64GetTypeSize(l, args[i]->type));
+		}
+		else
+		{
+			X64RegClass reg_class = X64GetTypeClass(args[i]->type);
+			X64Emit(f, X64GetMoveOp(reg_class), slot, X64ToReg(l, values[i], reg_class));
+		}
+	}
+
+	U32 reads = 0;
+	int_n = 0;
+	float_n = 0;
+	if(return_class.in_memory && return_type)
+	{
+		X64Operand address = result_memory;
+		address.size = 8;
+		X64Emit(f, X64LeaOp, X64RegOperandInit(X64Rdi, 8), address);
+		reads |= X64RegBit(X64Rdi);
+		int_n = 1;
+	}
+	for(size_t i = 0; i < arg_n; i++)
+	{
+		if(stack_at[i] >= 0)
+			continue;
+		if(values[i].kind == X64MemOperand)
+		{
+			X64LoadParts(l, &classes[i], values[i], X64IntArgRegs, &int_n, &float_n, &reads);
+		}
+		else
+		{
+			bool is_float = classes[i].is_float[0];
+			U32 reg = is_float ? (X64Xmm0 + float_n) : X64IntArgRegs[int_n];
+			*(is_float ? &float_n : &int_n) += 1;
+			X64Emit(f, X64GetMoveOp(is_float ? X64FloatClass : X64GeneralClass), X64RegOperandInit(reg, values[i].size), values[i]);
+			reads |= X64RegBit(reg);
+		}
+	}
+	if(is_extern)
+	{
+		// al holds the number of xmm arguments for functions with variable arguments.
+		X64Emit(f, X64MovOp, X64RegOperandInit(X64Rax, 4), X64ImmOperandInit(float_n, 4));
+		reads |= X64RegBit(X64Rax);
+	}
+
+	X64Instruction *call = X64Emit(f, X64CallOp, X64NoOperandInit(), X64NoOperandInit());
+	call->callee = name;
+	call->is_extern = is_extern;
+	call->reads = reads;
+	call->writes = X64CallerSavedMask;
+
+	if(!return_type)
+		return X64NoOperandInit();
+	if(packed_size > 0)
+	{
+		X64Operand result = X64RegOperandInit(X64NewReg(f, X64FloatClass), packed_size);
+		X64Emit(f, X64FMovOp, result, X64RegOperandInit(X64Xmm0, packed_size));
+		return result;
+	}
+	if(!X64IsAggregate(return_type))
+	{
+		X64Operand result = X64NewValue(l, return_type);
+		U32 reg = X64IsFloat(return_type) ? X64Xmm0 : X64Rax;
+		X64Emit(f, X64GetMoveOp(X64GetTypeClass(return_type)), result, X64RegOperandInit(reg, result.size));
+		return result;
+	}
+	if(!return_class.in_memory)
+	{
+		U32 result_int_n = 0;
+		U32 result_float_n = 0;
+		X64StoreParts(l, &return_class, result_memory, X64IntReturnRegs, &result_int_n, &result_float_n);
+	}
+	return result_memory;
+}
+
+static X64Operand
+func X64LowerFuncCall(X64Lowering *l, FuncCallExpression *e)
+{
+	Expression *args[X64MaxArgN];
+	size_t arg_n = 0;
+	for(FuncCallArgument *arg = e->first_call_arg; arg; arg = arg->next)
+	{
+		if(arg_n < X64MaxArgN)
+			args[arg_n] = arg->arg;
+		arg_n++;
+	}
+	FuncDefinition *def = e->func_def;
+	return X64LowerCall(l, def->header.name, def->is_extern, args, arg_n, def->header.return_type);
+}
+
+static X64Operand
+func X64LowerCast(X64Lowering *l, CastExpression *e)
+{
+	X64Function *f = l->f;
+	VarType *to = e->type;
+	VarType *from = e->value->type;
+	X64Operand value = X64LowerExpression(l, e->value);
+	if(X64IsAggregate(to) || X64IsAggregate(from))
+	{
+		X64LoweringError(l, "A cast of a struct or array");
+		return value;
+	}
+
+	if(X64IsFloat(to) && !X64IsFloat(from))
+	{
+		// An uint is zero-extended by the 32 bit move and converted as a 64 bit integer.
+		X64Operand result = X64RegOperandInit(X64NewReg(f, X64FloatClass), 4);
+		X64Operand source = X64RegOperandInit(X64NewReg(f, X64GeneralClass), 4);
+		X64Emit(f, X64MovOp, source, value);
+		source.size = X64IsUnsigned(from) ? 8 : 4;
+		X64Emit(f, X64CvtIntToFloatOp, result, source);
+		return result;
+	}
+	if(!X64IsFloat(to) && X64IsFloat(from))
+	{
+		X64Operand result = X64RegOperandInit(X64NewReg(f, X64GeneralClass), X64IsUnsigned(to) ? 8 : 4);
+		X64Emit(f, X64CvtFloatToIntOp, result, X64ToReg(l, value, X64FloatClass));
+		result.size = X64GetValueSize(l, to);
+		return result;
+	}
+
+	// Between bool, int, uint and pointers the low bits stay the same, ints are sign-extended to pointers.
+	U32 size = X64GetValueSize(l, to);
+	if(size == 8 && value.size == 4)
+	{
+		X64Operand result = X64RegOperandInit(X64NewReg(f, X64GeneralClass), 8);
+		X64Emit(f, X64IsUnsigned(from) ? X64MovOp : X64MovsxdOp, X64IsUnsigned(from) ? X64RegOperandInit(result.reg, 4) : result, X64ToReg(l, value, X64GeneralClass));
+		return result;
+	}
+	value.size = size;
+	return value;
+}
+
+static X64Operand
+func X64LowerExpression(X64Lowering *l, Expression *expression)
+{
+	// A register or an immediate with the value, registers of locals must not be changed.
+	// Structs and arrays give their memory operand.
+	X64Function *f = l->f;
+	switch(expression->id)
+	{
+		case AddExpressionId:
+		{
+			AddExpression *e = (AddExpression *)expression;
+			return X64LowerArithmetic(l, expression->id, e->left, e->right, expression->type);
+		}
+		case SubtractExpressionId:
+		{
+			SubtractExpression *e = (SubtractExpression *)expression;
+			return X64LowerArithmetic(l, expression->id, e->left, e->right, expression->type);
+		}
+		case MultiplyExpressionId:
+		{
+			MultiplyExpression *e = (MultiplyExpression *)expression;
+			return X64LowerArithmetic(l, expression->id, e->left, e->right, expression->type);
+		}
+		case NegativeExpressionId:
+		{
+			NegativeExpression *e = (NegativeExpression *)expression;
+			X64Operand result = X64LowerCopy(l, e->value);
+			if(X64IsFloat(expression->type))
+				X64Emit(f, X64FXorOp, result, X64GetSignMask(l));
+			else
+				X64Emit(f, X64NegOp, result, X64NoOperandInit());
+			return result;
+		}
+		case LessThanExpressionId:
+		case LessThanEqualExpressionId:
+		case GreaterThanExpressionId:
+		{
+			Expression *left = 0;
+			Expression *right = 0;
+			X64GetCompareOperands(expression, &left, &right);
+			X64Condition cond = X64LowerCompare(l, expression->id, left, right);
+			X64Operand result = X64RegOperandInit(X64NewReg(f, X64GeneralClass), 4);
+			X64Emit(f, X64SetOp, result, X64NoOperandInit())->cond = cond;
+			return result;
+		}
+		case IntegerConstantExpressionId:
+		{
+			IntegerConstantExpression *e = (IntegerConstantExpression *)expression;
+			return X64ImmOperandInit(e->value, 4);
+		}
+		case BoolConstantExpressionId:
+		{
+			BoolConstantExpression *e = (BoolConstantExpression *)expression;
+			return X64ImmOperandInit(e->token.id == TrueTokenId, 4);
+		}
+		case FloatConstantExpressionId:
+		{
+			FloatConstantExpression *e = (FloatConstantExpression *)expression;
+			size_t at = X64AddData(l, 4, 4);
+			ConstantScalar value = {};
+			value.f = e->value;
+			X64WriteDataScalar(l, at, expression->type, value);
+			return X64Load(l, X64DataOperandInit(at, 4), expression->type);
+		}
+		case ConstantDataExpressionId:
+		{
+			ConstantDataExpression *e = (ConstantDataExpression *)expression;
+			size_t at = X64AddData(l, X64GetTypeSize(l, expression->type), 16);
+			size_t value_at = 0;
+			X64WriteDataValues(l, at, expression->type, e->values, e->value_n, &value_at);
+			X64Operand address = X64DataOperandInit(at, 0);
+			return X64IsAggregate(expression->type) ? address : X64Load(l, address, expression->type);
+		}
+		case CastExpressionId:
+		{
+			return X64LowerCast(l, (CastExpression *)expression);
+		}
+		case ParenExpressionId:
+		{
+			return X64LowerExpression(l, ((ParenExpression *)expression)->in);
+		}
+		case VarExpressionId:
+		{
+			VarExpression *e = (VarExpression *)expression;
+			return X64GetLocal(l, e->var.name);
+		}
+		case StructVarExpressionId:
+		{
+			// A field of a packed struct is a lane of its register.
+			StructVarExpression *e = (StructVarExpression *)expression;
+			VarType *type = e->base->type;
+			U64 offset = 0;
+			if(X64GetPackedSize(l, type) > 0 && GetFieldOffset(((StructType *)type)->def, e->var_name, &offset))
+			{
+				X64Operand base = X64LowerExpression(l, e->base);
+				if(base.kind == X64RegOperand)
+					return X64GetPackedLane(l, base, (U32)(offset / 4));
+				base.value += (I64)offset;
+				return X64Load(l, base, expression->type);
+			}
+			X64Operand address = X64LowerAddress(l, expression);
+			return X64IsAggregate(expression->type) ? address : X64Load(l, address, expression->type);
+		}
+		case DereferenceExpressionId:
+		case ArrayIndexExpressionId:
+		{
+			X64Operand address = X64LowerAddress(l, expression);
+			return X64IsAggregate(expression->type) ? address : X64Load(l, address, expression->type);
+		}
+		case FuncCallExpressionId:
+		{
+			X64Operand result = X64LowerFuncCall(l, (FuncCallExpression *)expression);
+			if(result.kind == X64NoOperand)
+			{
+				X64LoweringError(l, "A call without a value used as a value");
+				return X64ImmOperandInit(0, 4);
+			}
+			return result;
+		}
+		case OperatorCallExpressionId:
+		{
+			OperatorCallExpression *e = (OperatorCallExpression *)expression;
+			U32 size = X64GetPackedSize(l, expression->type);
+			if(size > 0 && GetPackedInfo(l->input, e->def)->is_packed)
+				return X64LowerPackedOperator(l, e, e->def->packed_info, size);
+			Expression *args[2] = {e->left, e->right};
+			return X64LowerCall(l, e->def->name, false, args, 2, e->def->return_type);
+		}
+		default:
+		{
+			X64LoweringError(l, "An expression");
+			return X64ImmOperandInit(0, 4);
+		}
+	}
+}
+
+static X64Operand
+func X64LowerAddress(X64Lowering *l, Expression *expression)
+{
+	// The memory operand of a value that lives in memory: struct and array values and what pointers point to.
+	switch(expression->id)
+	{
+		case DereferenceExpressionId:
+		{
+			DereferenceExpression *e = (DereferenceExpression *)expression;
+			X64Operand pointer = X64ToReg(l, X64LowerExpression(l, e->pointer), X64GeneralClass);
+			return X64MemOperandInit(pointer.reg, 0, X64GetValueSize(l, expression->type));
+		}
+		case StructVarExpressionId:
+		{
+			StructVarExpression *e = (StructVarExpression *)expression;
+			VarType *type = e->base->type;
+			X64Operand address = X64NoOperandInit();
+			if(type->id == PointerTypeId)
+			{
+				type = ((PointerType *)type)->pointed_type;
+				X64Operand pointer = X64ToReg(l, X64LowerExpression(l, e->base), X64GeneralClass);
+				address = X64MemOperandInit(pointer.reg, 0, 0);
+			}
+			else
+			{
+				address = X64LowerAddress(l, e->base);
+			}
+
+			U64 offset = 0;
+			if(type->id != StructTypeId || !GetFieldOffset(((StructType *)type)->def, e->var_name, &offset))
+				X64LoweringError(l, "A field without a layout");
+			address.value += (I64)offset;
+			address.size = X64GetValueSize(l, expression->type);
+			return address;
+		}
+		case ArrayIndexExpressionId:
+		{
+			ArrayIndexExpression *e = (ArrayIndexExpression *)expression;
+			VarType *type = e->array->type;
+			X64Operand address = X64NoOperandInit();
+			if(type->id == PointerTypeId)
+			{
+				X64Operand pointer = X64ToReg(l, X64LowerExpression(l, e->array), X64GeneralClass);
+				address = X64MemOperandInit(pointer.reg, 0, 0);
+			}
+			else
+			{
+				address = X64LowerAddress(l, e->array);
+				if(type->id == StructTypeId)
+				{
+					// The array of the struct's use field.
+					StructDefinition *def = ((StructType *)type)->def;
+					U64 offset = 0;
+					GetFieldOffset(def, def->used_var->name, &offset);
+					address.value += (I64)offset;
+				}
+			}
+
+			I64 bound = 0;
+			if(e->checked)
+				bound = ((IntegerConstantExpression *)GetIndexedArrayType(e)->size)->value;
+			X64AddIndex(l, &address, e->index, X64GetTypeSize(l, expression->type), false, e->checked, bound);
+			address.size = X64GetValueSize(l, expression->type);
+			return address;
+		}
+		case ParenExpressionId:
+		{
+			return X64LowerAddress(l, ((ParenExpression *)expression)->in);
+		}
+		default:
+		{
+			X64Operand value = X64LowerExpression(l, expression);
+			if(value.kind == X64RegOperand && X64IsAggregate(expression->type))
+				value = X64ToMemory(l, value, expression->type);
+			if(value.kind != X64MemOperand)
+				X64LoweringError(l, "A value without an address");
+			return value;
+		}
+	}
+}
+
+static void decl X64LowerBlock(X64Lowering *, BlockInstruction *);
+
+static bool
+func X64IsLocalUpdate(X64Lowering *l, Expression *e, X64Operand home, X64Opcode *op, Expression **value)
+{
+	// x = x + y is written as add x, y, without a copy of x.
+	Expression *left = 0;
+	switch(e->id)
+	{
+		case AddExpressionId:
+		{
+			left = ((AddExpression *)e)->left;
+			*value = ((AddExpression *)e)->right;
+			break;
+		}
+		case SubtractExpressionId:
+		{
+			left = ((SubtractExpression *)e)->left;
+			*value = ((SubtractExpression *)e)->right;
+			break;
+		}
+		case MultiplyExpressionId:
+		{
+			left = ((MultiplyExpression *)e)->left;
+			*value = ((MultiplyExpression *)e)->right;
+			break;
+		}
+		default:
+		{
+			return false;
+		}
+	}
+	if(e->type->id != BaseTypeId || left->id != VarExpressionId)
+		return false;
+	*op = X64GetArithmeticOp(e->id, X64IsFloat(e->type));
+	X64Operand left_home = X64GetLocal(l, ((VarExpression *)left)->var.name);
+	return (left_home.kind == X64RegOperand && left_home.reg == home.reg);
+}
+
+static X64Operand
+func X64GetScalarLocal(X64Lowering *l, Expression *e)
+{
+	// The register of a scalar or packed local that is assigned, X64NoOperand for everything in memory.
+	while(e->id == ParenExpressionId)
+		e = ((ParenExpression *)e)->in;
+	if(e->id != VarExpressionId)
+		return X64NoOperandInit();
+	X64Operand home = X64GetLocal(l, ((VarExpression *)e)->var.name);
+	return (home.kind == X64RegOperand) ? home : X64NoOperandInit();
+}
+
+static void
+func X64LowerInstruction(X64Lowering *l, Instruction *instruction)
+{
+	X64Function *f = l->f;
+	switch(instruction->id)
+	{
+		case AssignInstructionId:
+		{
+			AssignInstruction *i = (AssignInstruction *)instruction;
+			U32 lane = 0;
+			X64Operand packed = X64GetPackedField(l, i->left, &lane);
+			if(packed.kind == X64RegOperand)
+			{
+				X64Operand value = X64ToReg(l, X64LowerExpression(l, i->right), X64FloatClass);
+				X64Emit(f, (lane == 0) ? X64MovssOp : X64UnpcklpsOp, packed, value);
+				break;
+			}
+
+			X64Operand home = X64GetScalarLocal(l, i->left);
+			if(home.kind != X64RegOperand)
+			{
+				X64Operand value = X64LowerExpression(l, i->right);
+				X64Store(l, X64LowerAddress(l, i->left), value, i->left->type);
+				break;
+			}
+			if(X64IsAggregate(i->left->type))
+			{
+				X64Emit(f, X64FMovOp, home, X64ToPacked(l, X64LowerExpression(l, i->right), i->left->type));
+				break;
+			}
+
+			X64Opcode op = X64GetMoveOp(X64GetTypeClass(i->left->type));
+			Expression *right = i->right;
+			if(!X64IsLocalUpdate(l, i->right, home, &op, &right))
+			{
+				op = X64GetMoveOp(X64GetTypeClass(i->left->type));
+				right = i->right;
+			}
+			X64Operand value = X64LowerExpression(l, right);
+			X64Emit(f, op, home, value);
+			break;
+		}
+		case AndEqualsInstructionId:
+		{
+			AndEqualsInstruction *i = (AndEqualsInstruction *)instruction;
+			X64Operand value = X64LowerExpression(l, i->right);
+			X64Operand target = X64GetScalarLocal(l, i->left);
+			if(target.kind != X64RegOperand)
+			{
+				target = X64LowerAddress(l, i->left);
+				value = X64ToReg(l, value, X64GeneralClass);
+			}
+			target.size = 4;
+			X64Emit(f, X64AndOp, target, value);
+			break;
+		}
+		case IncrementInstructionId:
+		{
+			IncrementInstruction *i = (IncrementInstruction *)instruction;
+			VarType *type = i->value->type;
+			I64 step = 1;
+			if(type->id == PointerTypeId)
+				step = X64GetTypeSize(l, ((PointerType *)type)->pointed_type);
+			X64Operand target = X64GetScalarLocal(l, i->value);
+			if(target.kind != X64RegOperand)
+				target = X64LowerAddress(l, i->value);
+			target.size = X64GetValueSize(l, type);
+			X64Emit(f, X64AddOp, target, X64ImmOperandInit(step, target.size));
+			break;
+		}
+		case CreateVariableInstructionId:
+		{
+			CreateVariableInstruction *i = (CreateVariableInstruction *)instruction;
+			U32 packed_size = X64GetPackedLocalSize(l, i->type, i->name);
+			if(packed_size > 0)
+			{
+				X64Operand home = X64RegOperandInit(X64NewReg(f, X64FloatClass), packed_size);
+				if(i->init)
+					X64Emit(f, X64FMovOp, home, X64ToPacked(l, X64LowerExpression(l, i->init), i->type));
+				else
+					X64Emit(f, X64FXorOp, home, home);
+				X64AddLocal(l, i->name, home);
+				l->packed_local_n++;
+				break;
+			}
+			if(X64IsAggregate(i->type))
+			{
+				// A struct returned by a call already has its own slot, like a packed struct stored from its register.
+				X64Operand value = i->init ? X64LowerExpression(l, i->init) : X64NoOperandInit();
+				bool owns_value = i->init && (i->init->id == FuncCallExpressionId || i->init->id == OperatorCallExpressionId || value.kind == X64RegOperand);
+				value = X64ToMemory(l, value, i->type);
+				X64Operand home = owns_value ? value : X64NewMemoryValue(l, i->type);
+				if(!i->init)
+					X64ZeroMemory(l, home, X64GetTypeSize(l, i->type));
+				else if(!owns_value)
+					X64CopyMemory(l, home, value, X64GetTypeSize(l, i->type));
+				X64AddLocal(l, i->name, home);
+				break;
+			}
+
+			X64Operand home = X64NewValue(l, i->type);
+			if(i->init)
+				X64Emit(f, X64GetMoveOp(X64GetTypeClass(i->type)), home, X64LowerExpression(l, i->init));
+			else if(X64IsFloat(i->type))
+				X64Emit(f, X64FXorOp, home, home);
+			else
+				X64Emit(f, X64MovOp, home, X64ImmOperandInit(0, home.size));
+			X64AddLocal(l, i->name, home);
+			break;
+		}
+		case BlockInstructionId:
+		{
+			X64LowerBlock(l, (BlockInstruction *)instruction);
+			break;
+		}
+		case FuncCallInstructionId:
+		{
+			X64LowerFuncCall(l, ((FuncCallInstruction *)instruction)->e);
+			break;
+		}
+		case IfInstructionId:
+		{
+			IfInstruction *i = (IfInstruction *)instruction;
+			U32 end_label = X64NewLabel(f);
+			X64LowerBranch(l, i->condition, end_label);
+			X64LowerBlock(l, i->body);
+			X64EmitLabel(f, end_label);
+			break;
+		}
+		case ForInstructionId:
+		{
+			ForInstruction *i = (ForInstruction *)instruction;
+			size_t local_n = l->local_n;
+			if(i->init)
+				X64LowerInstruction(l, i->init);
+
+			U32 top_label = X64NewLabel(f);
+			U32 end_label = X64NewLabel(f);
+			X64EmitLabel(f, top_label);
+			if(i->condition)
+				X64LowerBranch(l, i->condition, end_label);
+			X64LowerBlock(l, i->body);
+			if(i->update)
+				X64LowerInstruction(l, i->update);
+			X64EmitJump(f, top_label);
+			X64EmitLabel(f, end_label);
+
+			l->local_n = local_n;
+			break;
+		}
+		case ReturnInstructionId:
+		{
+			ReturnInstruction *i = (ReturnInstruction *)instruction;
+			if(i->value)
+			{
+				VarType *type = l->return_type;
+				X64Operand value = X64LowerExpression(l, i->value);
+				if(!X64IsAggregate(type))
+				{
+					U32 reg = X64IsFloat(type) ? X64Xmm0 : X64Rax;
+					X64Emit(f, X64GetMoveOp(X64GetTypeClass(type)), X64RegOperandInit(reg, value.size), value);
+				}
+				else if(l->return_class.in_memory)
+				{
+					X64Operand pointer = X64RegOperandInit(l->return_pointer, 8);
+					X64CopyMemory(l, X64MemOperandInit(l->return_pointer, 0, 0), X64ToMemory(l, value, type), X64GetTypeSize(l, type));
+					X64Emit(f, X64MovOp, X64RegOperandInit(X64Rax, 8), pointer);
+				}
+				else if(value.kind == X64RegOperand && l->return_class.part_n == 1)
+				{
+					X64Emit(f, X64FMovOp, X64RegOperandInit(X64Xmm0, value.size), value);
+				}
+				else
+				{
+					U32 int_n = 0;
+					U32 float_n = 0;
+					U32 mask = 0;
+					X64LoadParts(l, &l->return_class, X64ToMemory(l, value, type), X64IntReturnRegs, &int_n, &float_n, &mask);
+				}
+			}
+			X64EmitJump(f, f->return_label);
+			break;
+		}
+		default:
+		{
+			X64LoweringError(l, "An instruction");
+			break;
+		}
+	}
+}
+
+static void
+func X64LowerBlock(X64Lowering *l, BlockInstruction *block)
+{
+	size_t local_n = l->local_n;
+	for(Instruction *instruction = block->first; instruction && !l->error; instruction = instruction->next)
+		X64LowerInstruction(l, instruction);
+	l->local_n = local_n;
+}
+
+static void
+func X64LowerParams(X64Lowering *l, Token *names, VarType **types, size_t param_n)
+{
+	// Stack arguments are above the saved rbp and the return address.
+	X64Function *f = l->f;
+	U32 int_n = 0;
+	U32 float_n = 0;
+	I64 stack_at = 16;
+	if(l->return_type && l->return_class.in_memory)
+	{
+		l->return_pointer = X64NewReg(f, X64GeneralClass);
+		X64Emit(f, X64MovOp, X64RegOperandInit(l->return_pointer, 8), X64RegOperandInit(X64Rdi, 8));
+		int_n = 1;
+	}
+
+	for(size_t i = 0; i < param_n; i++)
+	{
+		VarType *type = types[i];
+		if(type->id == ArrayTypeId)
+		{
+			// Arrays come as a pointer.
+			X64Operand pointer = X64RegOperandInit(X64NewReg(f, X64GeneralClass), 8);
+			X64Operand from = (int_n < X64IntArgRegN) ? X64RegOperandInit(X64IntArgRegs[int_n], 8) : X64MemOperandInit(X64Rbp, stack_at, 8);
+			if(int_n < X64IntArgRegN)
+				int_n++;
+			else
+				stack_at += 8;
+			X64Emit(f, X64MovOp, pointer, from);
+			X64AddLocal(l, names[i], X64MemOperandInit(pointer.reg, 0, 0));
+			continue;
+		}
+
+		X64PassClass pass = X64ClassifyType(l, type);
+		U32 part_int_n = 0;
+		U32 part_float_n = 0;
+		X64CountParts(&pass, &part_int_n, &part_float_n);
+		bool in_regs = !pass.in_memory && int_n + part_int_n <= X64IntArgRegN && float_n + part_float_n <= X64FloatArgRegN;
+		if(!in_regs)
+		{
+			X64Operand from = X64MemOperandInit(X64Rbp, stack_at, X64GetValueSize(l, type));
+			stack_at += (X64GetTypeSize(l, type) + 7) & ~7u;
+			if(X64GetPackedLocalSize(l, type, names[i]) > 0)
+			{
+				X64AddLocal(l, names[i], X64ToPacked(l, from, type));
+				l->packed_local_n++;
+			}
+			else if(X64IsAggregate(type))
+			{
+				X64AddLocal(l, names[i], from);
+			}
+			else
+			{
+				X64Operand home = X64NewValue(l, type);
+				X64Emit(f, X64GetMoveOp(X64GetTypeClass(type)), home, from);
+				X64AddLocal(l, names[i], home);
+			}
+		}
+		else if(X64IsAggregate(type))
+		{
+			// A packed struct in one xmm register is copied from it, one in two of them through memory.
+			U32 packed_size = X64GetPackedLocalSize(l, type, names[i]);
+			X64Operand home = X64NoOperandInit();
+			if(packed_size > 0 && pass.part_n == 1)
+			{
+				home = X64RegOperandInit(X64NewReg(f, X64FloatClass), packed_size);
+				X64Emit(f, X64FMovOp, home, X64RegOperandInit(X64Xmm0 + float_n, packed_size));
+				float_n++;
+			}
+			else
+			{
+				home = X64NewMemoryValue(l, type);
+				X64StoreParts(l, &pass, home, X64IntArgRegs, &int_n, &float_n);
+				if(packed_size > 0)
+					home = X64ToPacked(l, home, type);
+			}
+			l->packed_local_n += (packed_size > 0);
+			X64AddLocal(l, names[i], home);
+		}
+		else
+		{
+			X64Operand home = X64NewValue(l, type);
+			U32 reg = pass.is_float[0] ? (X64Xmm0 + float_n) : X64IntArgRegs[int_n];
+			*(pass.is_float[0] ? &float_n : &int_n) += 1;
+			X64Emit(f, X64GetMoveOp(X64GetTypeClass(type)), home, X64RegOperandInit(reg, home.size));
+			X64AddLocal(l, names[i], home);
+		}
+	}
+}
+
+static void
+func X64InitFunction(X64Lowering *l, X64Function *f, Token name, bool is_exported, VarType *return_type)
+{
+	f->name = name;
+	f->is_exported = is_exported;
+	f->instruction_n = 0;
+	f->reg_n = X64FirstVirtualReg;
+	f->label_n = 0;
+	f->slot_n = 0;
+	f->outgoing_size = 0;
+	f->spilled_n = 0;
+	f->saved_mask = 0;
+	f->frame_size = 0;
+	f->return_label = X64NewLabel(f);
+	f->fail_label = X64NoLabel;
+
+	l->f = f;
+	l->local_n = 0;
+	l->field_write_n = 0;
+	l->error = false;
+	l->return_type = return_type;
+	l->return_class = return_type ? X64ClassifyType(l, return_type) : (X64PassClass){};
+	l->return_pointer = X64NoReg;
+}
+
+static bool
+func X64LowerBody(X64Lowering *l, BlockInstruction *body)
+{
+	X64Function *f = l->f;
+	X64LowerBlock(l, body);
+	X64EmitLabel(f, f->return_label);
+	X64Instruction *ret = X64Emit(f, X64RetOp, X64NoOperandInit(), X64NoOperandInit());
+
+	// The return registers stay live until the end.
+	VarType *type = l->return_type;
+	if(type && (!X64IsAggregate(type) || l->return_class.in_memory))
+	{
+		ret->reads = X64RegBit(X64IsFloat(type) ? X64Xmm0 : X64Rax);
+	}
+	else if(type)
+	{
+		U32 int_n = 0;
+		U32 float_n = 0;
+		for(U32 i = 0; i < l->return_class.part_n; i++)
+		{
+			U32 reg = l->return_class.is_float[i] ? (X64Xmm0 + float_n) : X64IntReturnRegs[int_n];
+			*(l->return_class.is_float[i] ? &float_n : &int_n) += 1;
+			ret->reads |= X64RegBit(reg);
+		}
+	}
+
+	if(f->fail_label != X64NoLabel)
+	{
+		X64EmitLabel(f, f->fail_label);
+		X64Emit(f, X64Ud2Op, X64NoOperandInit(), X64NoOperandInit());
+	}
+	return !l->error;
+}
+
+static bool
+func X64LowerFunc(X64Lowering *l, X64Function *f, FuncDefinition *def)
+{
+	X64InitFunction(l, f, def->header.name, !def->is_static, def->header.return_type);
+	X64FindFieldWrites(l, (Instruction *)def->body);
+
+	Token names[X64MaxArgN];
+	VarType *types[X64MaxArgN];
+	size_t param_n = 0;
+	for(FuncParam *param = def->header.first_param; param; param = param->next)
+	{
+		if(param_n == X64MaxArgN)
+		{
+			X64LoweringError(l, "A function with more than 64 parameters");
+			return false;
+		}
+		names[param_n] = param->name;
+		types[param_n] = param->type;
+		param_n++;
+	}
+
+	X64LowerParams(l, names, types, param_n);
+	return X64LowerBody(l, def->body);
+}
+
+static bool
+func X64LowerOperator(X64Lowering *l, X64Function *f, OperatorDefinition *def)
+{
+	X64InitFunction(l, f, def->name, !def->is_static, def->return_type);
+	X64FindFieldWrites(l, (Instruction *)def->body);
+
+	Token names[2] = {def->left_name, def->right_name};
+	VarType *types[2] = {def->left_type, def->right_type};
+	X64LowerParams(l, names, types, 2);
+	return X64LowerBody(l, def->body);
+}
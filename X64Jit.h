@@ -0,0 +1,279 @@
+// In-memory execution for the x64 backend: --jit runs a program without writing any file,
+// and a host program can load M64 code into its own process and call it.
+// The functions are encoded as for the ELF object of X64Encode.h, then linked into a single mapping:
+// the code, the constant data, and a jump for every extern function, which dlsym finds in the process.
+// The mapping is only made executable after it is written.
+//
+// A host defines M64_NO_MAIN, includes M64.c, and calls M64JitLoad, M64JitGetFunction and M64JitFree:
+//   M64Jit *jit = M64JitLoad("Code.m64");
+//   void (*update)(Input *, Bitmap *) = (void (*)(Input *, Bitmap *))M64JitGetFunction(jit, "Update");
+// Extern functions that the host defines itself are only found when it is linked with -rdynamic.
+// The C code of a program is not compiled here, so programs with C code cannot be loaded.
+
+// jmp [rip + 0] followed by the address.
+#define X64JitStubSize 16
+#define X64JitMathLibrary "libm.so.6"
+
+// In a host the API has external linkage, so a host that does not call all of it gets no unused warnings.
+// The compiler itself only uses M64JitGetFunction, for --jit.
+#ifdef M64_NO_MAIN
+#define M64JitApi
+#else
+#define M64JitApi static
+#endif
+
+typedef struct tdef M64Jit
+{
+	// Only used by M64JitLoad, --jit runs on the input of main.
+	char *code;
+	ParseInput input;
+
+	AtomTable *atoms;
+	X64Object object;
+	U8 *memory;
+	size_t memory_size;
+	U32 extern_n;
+	void *math_library;
+} M64Jit;
+
+static bool
+func X64JitLink(M64Jit *jit)
+{
+#ifdef _WIN32
+	printf("Error: The JIT calls functions with the System V convention, it cannot run on Windows.\n");
+	return false;
+#else
+	X64Object *o = &jit->object;
+	jit->extern_n = 0;
+	for(U32 i = 0; i < o->symbol_n; i++)
+		jit->extern_n += !o->symbols[i].is_defined;
+
+	size_t data_at = X64AlignOffset(o->code_size, 16);
+	size_t stubs_at = X64AlignOffset(data_at + o->data_size, 16);
+	size_t page_size = (size_t)sysconf(_SC_PAGESIZE);
+	size_t size = X64AlignOffset(stubs_at + jit->extern_n * X64JitStubSize + 1, page_size);
+	U8 *memory = (U8 *)mmap(0, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if(memory == MAP_FAILED)
+	{
+		printf("Error: Cannot map %zu bytes for the JIT.\n", size);
+		return false;
+	}
+	jit->memory = memory;
+	jit->memory_size = size;
+	memcpy(memory, o->code, o->code_size);
+	memcpy(memory + data_at, o->data, o->data_size);
+
+	// Extern functions can be further than 2 GB from the mapping, calls reach them through a jump to the absolute address.
+	// The offset of the jump replaces the value of the undefined symbol.
+	// M64 programs call the math functions, which the process may not have loaded.
+	void *process = dlopen(0, RTLD_NOW);
+	size_t stub_at = stubs_at;
+	for(U32 i = 0; i < o->symbol_n; i++)
+	{
+		X64Symbol *symbol = &o->symbols[i];
+		if(symbol->is_defined)
+			continue;
+
+		char name[256];
+		Atom *atom = &jit->atoms->atoms[symbol->name.value];
+		snprintf(name, sizeof(name), "%.*s", (int)atom->length, atom->text);
+		void *address = process ? dlsym(process, name) : 0;
+		if(!address && !jit->math_library)
+			jit->math_library = dlopen(X64JitMathLibrary, RTLD_NOW);
+		if(!address && jit->math_library)
+			address = dlsym(jit->math_library, name);
+		if(!address)
+		{
+			printf("Error: Cannot find the extern function <%s> in the process.\n", name);
+			if(process)
+				dlclose(process);
+			return false;
+		}
+
+		U8 *stub = memory + stub_at;
+		memset(stub, 0, X64JitStubSize);
+		stub[0] = 0xFF;
+		stub[1] = 0x25;
+		memcpy(stub + 6, &address, sizeof(address));
+		symbol->value = stub_at;
+		stub_at += X64JitStubSize;
+	}
+	if(process)
+		dlclose(process);
+
+	for(size_t i = 0; i < o->relocation_n; i++)
+	{
+		X64Relocation *relocation = &o->relocations[i];
+		size_t target = (relocation->symbol == X64RodataSymbol) ? data_at : o->symbols[relocation->symbol].value;
+		I32 value = (I32)((I64)target + relocation->addend - (I64)relocation->offset);
+		memcpy(memory + relocation->offset, &value, sizeof(value));
+	}
+
+	if(mprotect(memory, size, PROT_READ | PROT_EXEC) != 0)
+	{
+		printf("Error: Cannot make the JIT code executable.\n");
+		return false;
+	}
+	return true;
+#endif
+}
+
+static bool
+func X64JitCompile(M64Jit *jit, ParseInput *input, DefinitionList *def_list, CompileOptions *options)
+{
+	for(DefinitionListElem *elem = def_list; elem; elem = elem->next)
+	{
+		if(elem->definition->id == CCodeDefinitionId)
+		{
+			printf("Error: The JIT cannot run the C code of the program.\n");
+			return false;
+		}
+	}
+
+	X64Output output = {};
+	output.arena = CreateArena(0);
+	output.atoms = &input->atoms;
+	output.input = input;
+	output.object = &jit->object;
+	output.label_base = 0;
+	output.error = false;
+	output.peephole = !options->no_peephole;
+	X64WriteDefinitionList(&output, def_list, options->report);
+	free(output.arena.memory);
+
+	jit->atoms = &input->atoms;
+	return (!output.error && X64JitLink(jit));
+}
+
+M64JitApi void *
+func M64JitGetFunction(M64Jit *jit, char *name)
+{
+	// 0 when the program defines no function with this name.
+	X64Object *o = &jit->object;
+	for(U32 i = 0; i < o->symbol_n; i++)
+	{
+		X64Symbol *symbol = &o->symbols[i];
+		Atom *atom = &jit->atoms->atoms[symbol->name.value];
+		if(symbol->is_defined && TextEquals(atom->text, atom->length, name))
+			return jit->memory + symbol->value;
+	}
+	return 0;
+}
+
+#ifdef M64_NO_MAIN
+M64JitApi void
+func M64JitFree(M64Jit *jit)
+{
+#ifndef _WIN32
+	if(jit->memory)
+		munmap(jit->memory, jit->memory_size);
+	if(jit->math_library)
+		dlclose(jit->math_library);
+#endif
+	X64FreeObject(&jit->object);
+	FreeParseInput(&jit->input);
+	free(jit->code);
+	free(jit);
+}
+
+M64JitApi M64Jit *
+func M64JitLoad(char *path)
+{
+	// Compiles with the default passes, errors are printed and give 0.
+	FILE *file = fopen(path, "r");
+	if(!file)
+	{
+		printf("Cannot open file <%s>\n", path);
+		return 0;
+	}
+
+	M64Jit *jit = (M64Jit *)calloc(1, sizeof(M64Jit));
+	jit->code = ReadFileToMemory(file);
+	fclose(file);
+
+	jit->input.code = jit->code;
+	jit->input.code_size = strlen(jit->code);
+	InitParseInput(&jit->input);
+	DefinitionList *def_list = ReadDefinitionList(&jit->input);
+
+	CompileOptions options = {};
+	options.jit = true;
+	options.no_vectorize = true;
+	PassCounts counts = {};
+	if(jit->input.any_error || !RunPasses(&jit->input, def_list, &options, &counts) || !X64JitCompile(jit, &jit->input, def_list, &options))
+	{
+		M64JitFree(jit);
+		return 0;
+	}
+	return jit;
+}
+#else
+
+static double
+func GetWallSeconds(void)
+{
+#ifdef _WIN32
+	LARGE_INTEGER counter;
+	LARGE_INTEGER frequency;
+	QueryPerformanceCounter(&counter);
+	QueryPerformanceFrequency(&frequency);
+	return (double)counter.QuadPart / (double)frequency.QuadPart;
+#else
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (double)now.tv_sec + 1e-9 * (double)now.tv_nsec;
+#endif
+}
+
+static int
+func X64JitRun(ParseInput *input, DefinitionList *def_list, CompileOptions *options, double start_seconds)
+{
+	// Calls the entry function, its result is the exit code. It takes no parameters and returns an integer or nothing.
+	char *entry = options->entry ? options->entry : "main";
+	FuncDefinition *def = 0;
+	for(DefinitionListElem *elem = def_list; elem; elem = elem->next)
+	{
+		Definition *definition = elem->definition;
+		if(definition->id != FuncDefinitionId || ((FuncDefinition *)definition)->is_extern)
+			continue;
+		Atom *atom = &input->atoms.atoms[((FuncDefinition *)definition)->header.name.value];
+		if(TextEquals(atom->text, atom->length, entry))
+			def = (FuncDefinition *)definition;
+	}
+
+	VarType *return_type = def ? def->header.return_type : 0;
+	if(!def)
+	{
+		printf("Error: There is no function <%s> to run.\n", entry);
+		return -1;
+	}
+	if(def->header.first_param || (return_type && (return_type->id != BaseTypeId || X64IsFloat(return_type))))
+	{
+		printf("Error: The function <%s> to run has to take no parameters and return an integer or nothing.\n", entry);
+		return -1;
+	}
+
+	M64Jit jit = {};
+	double compile_seconds = GetWallSeconds();
+	if(!X64JitCompile(&jit, input, def_list, options))
+	{
+		return -1;
+	}
+
+	void *address = M64JitGetFunction(&jit, entry);
+	if(options->report)
+	{
+		double now = GetWallSeconds();
+		printf("JIT:\n");
+		printf("%zu bytes of code, %u extern functions, encoded and linked in %.2f ms, first call %.2f ms after start.\n",
+		       jit.object.code_size, jit.extern_n, 1000.0 * (now - compile_seconds), 1000.0 * (now - start_seconds));
+	}
+
+	if(!return_type)
+	{
+		((void (*)(void))address)();
+		return 0;
+	}
+	return ((int (*)(void))address)();
+}
+#endif
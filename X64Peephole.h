@@ -0,0 +1,518 @@
+// Peephole optimization and block layout for the x64 backend, on the instructions that X64Alloc.h rewrote with registers.
+// Loops are rotated first: the test moves to the bottom, so each iteration runs the body straight through
+// and takes a single conditional jump back. A short test is copied above the loop, a long one is jumped to.
+// Then, until nothing changes:
+// - jumps to the next instruction are removed, a conditional jump over a jump becomes the inverse jump,
+//   jumps to jumps go to the final target, and jumps to the epilogue become the epilogue;
+// - code that no jump reaches is removed, with the labels that no jump uses;
+// - copies between registers that already hold the same value are removed;
+// - in every basic block, moves to registers that are not read before they are written again are removed.
+// Finally, functions that never address rbp go without the frame pointer.
+// X64FoldConstants runs before allocation, on the virtual registers, and replaces registers that hold a constant by it.
+//
+// Registers that the function reads count as live at the end of a basic block, and instructions that set the flags are never removed.
+
+// Tests of at most this many instructions are copied above the rotated loop.
+#define X64MaxCopiedTestN 8
+#define X64MaxPeepholeRoundN 8
+#define X64MaxJumpChainN 8
+#define X64AllRegsMask 0xFFFFFFFFu
+
+typedef struct tdef X64PeepholeStats
+{
+	size_t removed_n;
+	size_t folded_n;
+	size_t rotated_n;
+	size_t frameless_n;
+} X64PeepholeStats;
+
+static void
+func X64CopyInstruction(X64Function *out, X64Instruction *instruction)
+{
+	*X64Emit(out, instruction->op, instruction->dst, instruction->src) = *instruction;
+}
+
+static size_t *
+func X64FindLabels(X64Function *f, X64Function *code)
+{
+	// The index of every label in code, instruction_n for labels that are not placed.
+	size_t *label_at = (size_t *)malloc((f->label_n + 1) * sizeof(size_t));
+	for(U32 label = 0; label < f->label_n; label++)
+		label_at[label] = code->instruction_n;
+	for(size_t i = 0; i < code->instruction_n; i++)
+	{
+		if(code->instructions[i].op == X64LabelOp)
+			label_at[code->instructions[i].label] = i;
+	}
+	return label_at;
+}
+
+static size_t
+func X64SkipLabels(X64Function *code, size_t i)
+{
+	while(i < code->instruction_n && code->instructions[i].op == X64LabelOp)
+		i++;
+	return i;
+}
+
+static bool
+func X64IsLabelAt(X64Function *code, size_t i, U32 label)
+{
+	// Whether label is one of the labels that start at i.
+	for(; i < code->instruction_n && code->instructions[i].op == X64LabelOp; i++)
+	{
+		if(code->instructions[i].label == label)
+			return true;
+	}
+	return false;
+}
+
+static size_t
+func X64RemoveMarked(X64Function *code, bool *removed)
+{
+	size_t kept_n = 0;
+	for(size_t i = 0; i < code->instruction_n; i++)
+	{
+		if(!removed[i])
+		{
+			code->instructions[kept_n] = code->instructions[i];
+			kept_n++;
+		}
+	}
+	size_t removed_n = code->instruction_n - kept_n;
+	code->instruction_n = kept_n;
+	return removed_n;
+}
+
+static void
+func X64RotateLoops(X64Function *f, X64Function *code, X64PeepholeStats *stats)
+{
+	// Loops are lowered as  top: test, jcc end, body, jmp top, end:
+	// and written as        test, jcc end, body_label: body, top: test, jncc body_label, end:
+	size_t n = code->instruction_n;
+	size_t *label_at = X64FindLabels(f, code);
+	// For the top label and the jump back of a rotated loop: the index of the jcc that ends its test.
+	size_t *test_ends = (size_t *)malloc((n + 1) * sizeof(size_t));
+	U32 *body_labels = (U32 *)malloc((n + 1) * sizeof(U32));
+	for(size_t i = 0; i < n; i++)
+		test_ends[i] = n;
+
+	size_t loop_n = 0;
+	for(size_t back = 0; back < n; back++)
+	{
+		X64Instruction *jump = &code->instructions[back];
+		size_t top = (jump->op == X64JmpOp) ? label_at[jump->label] : n;
+		if(top >= back || test_ends[top] != n)
+			continue;
+
+		size_t test_end = top + 1;
+		while(test_end < back)
+		{
+			X64Opcode op = code->instructions[test_end].op;
+			if(X64EndsBlock(op) || op == X64LabelOp || op == X64CallOp)
+				break;
+			test_end++;
+		}
+		X64Instruction *exit = &code->instructions[test_end];
+		if(test_end == back || exit->op != X64JccOp || !X64IsLabelAt(code, back + 1, exit->label))
+			continue;
+
+		test_ends[top] = test_end;
+		test_ends[back] = test_end;
+		body_labels[top] = X64NewLabel(f);
+		body_labels[back] = body_labels[top];
+		loop_n++;
+	}
+
+	if(loop_n > 0)
+	{
+		X64Instruction *in = (X64Instruction *)malloc(n * sizeof(X64Instruction));
+		memcpy(in, code->instructions, n * sizeof(X64Instruction));
+		code->instruction_n = 0;
+		for(size_t i = 0; i < n; i++)
+		{
+			size_t test_end = test_ends[i];
+			if(test_end == n)
+			{
+				X64CopyInstruction(code, &in[i]);
+			}
+			else if(in[i].op == X64LabelOp)
+			{
+				if(test_end - i - 1 <= X64MaxCopiedTestN)
+				{
+					for(size_t j = i + 1; j <= test_end; j++)
+						X64CopyInstruction(code, &in[j]);
+				}
+				else
+				{
+					X64EmitJump(code, in[i].label);
+				}
+				X64EmitLabel(code, body_labels[i]);
+				i = test_end;
+			}
+			else
+			{
+				size_t top = label_at[in[i].label];
+				for(size_t j = top; j < test_end; j++)
+					X64CopyInstruction(code, &in[j]);
+				X64EmitJcc(code, X64InvertCondition(in[test_end].cond), body_labels[i]);
+			}
+		}
+		free(in);
+	}
+	stats->rotated_n += loop_n;
+
+	free(label_at);
+	free(test_ends);
+	free(body_labels);
+}
+
+static bool
+func X64CleanJumps(X64Function *f, X64Function *code, bool *removed, X64PeepholeStats *stats)
+{
+	size_t *label_at = X64FindLabels(f, code);
+	for(size_t i = 0; i < code->instruction_n; i++)
+		removed[i] = false;
+
+	bool changed = false;
+	for(size_t i = 0; i < code->instruction_n; i++)
+	{
+		X64Instruction *instruction = &code->instructions[i];
+		if(removed[i] || (instruction->op != X64JmpOp && instruction->op != X64JccOp))
+			continue;
+
+		for(U32 hop = 0; hop < X64MaxJumpChainN; hop++)
+		{
+			size_t target = X64SkipLabels(code, label_at[instruction->label]);
+			if(target == code->instruction_n || code->instructions[target].op != X64JmpOp || code->instructions[target].label == instruction->label)
+				break;
+			instruction->label = code->instructions[target].label;
+			changed = true;
+		}
+
+		size_t target = X64SkipLabels(code, label_at[instruction->label]);
+		if(X64IsLabelAt(code, i + 1, instruction->label))
+		{
+			removed[i] = true;
+			changed = true;
+		}
+		else if(instruction->op == X64JccOp && i + 1 < code->instruction_n && code->instructions[i + 1].op == X64JmpOp &&
+		        X64IsLabelAt(code, i + 2, instruction->label))
+		{
+			instruction->cond = X64InvertCondition(instruction->cond);
+			instruction->label = code->instructions[i + 1].label;
+			removed[i + 1] = true;
+			changed = true;
+		}
+		else if(instruction->op == X64JmpOp && target < code->instruction_n && code->instructions[target].op == X64RetOp)
+		{
+			*instruction = code->instructions[target];
+			changed = true;
+		}
+	}
+
+	stats->removed_n += X64RemoveMarked(code, removed);
+	free(label_at);
+	return changed;
+}
+
+static bool
+func X64RemoveUnreachable(X64Function *f, X64Function *code, bool *removed, X64PeepholeStats *stats)
+{
+	U32 *jump_ns = (U32 *)calloc(f->label_n + 1, sizeof(U32));
+	for(size_t i = 0; i < code->instruction_n; i++)
+	{
+		X64Instruction *instruction = &code->instructions[i];
+		if(instruction->op == X64JmpOp || instruction->op == X64JccOp)
+			jump_ns[instruction->label]++;
+	}
+
+	bool reachable = true;
+	for(size_t i = 0; i < code->instruction_n; i++)
+	{
+		X64Instruction *instruction = &code->instructions[i];
+		if(instruction->op == X64LabelOp)
+		{
+			reachable |= (jump_ns[instruction->label] > 0);
+			removed[i] = (jump_ns[instruction->label] == 0);
+		}
+		else
+		{
+			removed[i] = !reachable;
+		}
+		if(instruction->op == X64JmpOp || instruction->op == X64RetOp || instruction->op == X64Ud2Op)
+			reachable = false;
+	}
+	free(jump_ns);
+
+	size_t removed_n = X64RemoveMarked(code, removed);
+	stats->removed_n += removed_n;
+	return (removed_n > 0);
+}
+
+static bool
+func X64IsRegCopy(X64Instruction *instruction)
+{
+	// Copies of the whole register: movaps, and mov of eight bytes. mov of four bytes clears the upper half.
+	bool is_copy = (instruction->op == X64FMovOp || (instruction->op == X64MovOp && instruction->dst.size == 8));
+	return (is_copy && instruction->dst.kind == X64RegOperand && instruction->src.kind == X64RegOperand);
+}
+
+static U32
+func X64GetRegMask(X64RegList *list)
+{
+	U32 mask = 0;
+	for(size_t i = 0; i < list->reg_n; i++)
+		mask |= X64RegBit(list->regs[i]);
+	return mask;
+}
+
+static bool
+func X64RemoveRedundantCopies(X64Function *code, bool *removed, X64PeepholeStats *stats)
+{
+	// copy_of[reg] is a register that holds the same value as reg, from a copy earlier in the block.
+	// copy_mask has the registers on both sides of these copies.
+	U32 copy_of[X64FirstVirtualReg];
+	for(U32 reg = 0; reg < X64FirstVirtualReg; reg++)
+		copy_of[reg] = X64NoReg;
+	U32 copy_mask = 0;
+
+	X64RegList reads = {};
+	X64RegList writes = {};
+	for(size_t i = 0; i < code->instruction_n; i++)
+	{
+		X64Instruction *instruction = &code->instructions[i];
+		removed[i] = false;
+		if(instruction->op == X64LabelOp)
+		{
+			for(U32 reg = 0; reg < X64FirstVirtualReg; reg++)
+				copy_of[reg] = X64NoReg;
+			copy_mask = 0;
+			continue;
+		}
+
+		bool is_copy = X64IsRegCopy(instruction);
+		U32 dst = instruction->dst.reg;
+		U32 src = instruction->src.reg;
+		if(is_copy && (copy_of[dst] == src || copy_of[src] == dst))
+		{
+			removed[i] = true;
+			continue;
+		}
+
+		U32 read_mask = 0;
+		U32 write_mask = 0;
+		X64GetInstructionRegs(instruction, &reads, &writes, &read_mask, &write_mask);
+		write_mask |= X64GetRegMask(&writes);
+		if(write_mask & copy_mask)
+		{
+			copy_mask = 0;
+			for(U32 reg = 0; reg < X64FirstVirtualReg; reg++)
+			{
+				bool copies_written = (copy_of[reg] != X64NoReg && ((write_mask >> copy_of[reg]) & 1));
+				if(((write_mask >> reg) & 1) || copies_written)
+					copy_of[reg] = X64NoReg;
+				if(copy_of[reg] != X64NoReg)
+					copy_mask |= X64RegBit(reg) | X64RegBit(copy_of[reg]);
+			}
+		}
+		if(is_copy)
+		{
+			copy_of[dst] = src;
+			copy_mask |= X64RegBit(dst) | X64RegBit(src);
+		}
+	}
+
+	size_t removed_n = X64RemoveMarked(code, removed);
+	stats->removed_n += removed_n;
+	return (removed_n > 0);
+}
+
+static bool
+func X64RemoveDeadWrites(X64Function *code, bool *removed, X64PeepholeStats *stats)
+{
+	// Backwards through every block, live holds the registers that are read before they are written again.
+	// At the end of a block these are all registers that the function reads anywhere.
+	X64RegList reads = {};
+	X64RegList writes = {};
+	U32 read_mask = 0;
+	U32 write_mask = 0;
+	U32 read_anywhere = 0;
+	for(size_t i = 0; i < code->instruction_n; i++)
+	{
+		X64GetInstructionRegs(&code->instructions[i], &reads, &writes, &read_mask, &write_mask);
+		read_anywhere |= read_mask | X64GetRegMask(&reads);
+	}
+
+	U32 live = read_anywhere;
+	for(size_t i = code->instruction_n; i > 0; i--)
+	{
+		X64Instruction *instruction = &code->instructions[i - 1];
+		removed[i - 1] = false;
+		if(instruction->op == X64LabelOp || X64EndsBlock(instruction->op))
+			live = read_anywhere;
+		// The epilogue restores the callee-saved registers.
+		if(instruction->op == X64RetOp)
+			live = instruction->reads;
+
+		bool is_move = (instruction->op == X64MovOp || instruction->op == X64FMovOp || instruction->op == X64MovsxdOp || instruction->op == X64LeaOp);
+		if(is_move && instruction->dst.kind == X64RegOperand && !((live >> instruction->dst.reg) & 1))
+		{
+			removed[i - 1] = true;
+			continue;
+		}
+
+		X64GetInstructionRegs(instruction, &reads, &writes, &read_mask, &write_mask);
+		live &= ~(write_mask | X64GetRegMask(&writes));
+		live |= read_mask | X64GetRegMask(&reads);
+	}
+
+	size_t removed_n = X64RemoveMarked(code, removed);
+	stats->removed_n += removed_n;
+	return (removed_n > 0);
+}
+
+static bool
+func X64TakesImmSrc(X64Opcode op)
+{
+	switch(op)
+	{
+		case X64MovOp:
+		case X64AddOp:
+		case X64SubOp:
+		case X64AndOp:
+		case X64CmpOp:
+		case X64ImulOp:
+		{
+			return true;
+		}
+		default:
+		{
+			return false;
+		}
+	}
+}
+
+static void
+func X64FoldConstants(X64Function *f, X64PeepholeStats *stats)
+{
+	// Before allocation: a virtual register that is only written by a mov of an immediate in the first block
+	// holds the immediate in every later instruction. Its uses as a source take the immediate,
+	// and the mov goes when nothing else reads the register. This frees the register for other values.
+	U32 *write_ns = (U32 *)calloc(f->reg_n, sizeof(U32));
+	U32 *read_ns = (U32 *)calloc(f->reg_n, sizeof(U32));
+	size_t *write_at = (size_t *)malloc(f->reg_n * sizeof(size_t));
+	X64RegList reads = {};
+	X64RegList writes = {};
+	U32 read_mask = 0;
+	U32 write_mask = 0;
+
+	size_t first_block_end = f->instruction_n;
+	for(size_t i = 0; i < f->instruction_n; i++)
+	{
+		X64Instruction *instruction = &f->instructions[i];
+		if(first_block_end == f->instruction_n && (instruction->op == X64LabelOp || X64EndsBlock(instruction->op)))
+			first_block_end = i;
+		X64GetInstructionRegs(instruction, &reads, &writes, &read_mask, &write_mask);
+		for(size_t j = 0; j < writes.reg_n; j++)
+		{
+			write_ns[writes.regs[j]]++;
+			write_at[writes.regs[j]] = i;
+		}
+	}
+
+	for(size_t i = 0; i < f->instruction_n; i++)
+	{
+		X64Instruction *instruction = &f->instructions[i];
+		X64Operand *src = &instruction->src;
+		U32 reg = src->reg;
+		if(src->kind == X64RegOperand && reg >= X64FirstVirtualReg && write_ns[reg] == 1 && write_at[reg] < first_block_end && write_at[reg] < i)
+		{
+			X64Instruction *load = &f->instructions[write_at[reg]];
+			bool is_constant = (load->op == X64MovOp && load->src.kind == X64ImmOperand && X64FitsImm32(load->src.value));
+			if(is_constant && X64TakesImmSrc(instruction->op) && load->dst.size == src->size && instruction->dst.reg != reg && instruction->dst.index != reg)
+			{
+				*src = X64ImmOperandInit(load->src.value, src->size);
+				stats->folded_n++;
+			}
+		}
+
+		X64GetInstructionRegs(instruction, &reads, &writes, &read_mask, &write_mask);
+		for(size_t j = 0; j < reads.reg_n; j++)
+			read_ns[reads.regs[j]]++;
+	}
+
+	size_t kept_n = 0;
+	for(size_t i = 0; i < f->instruction_n; i++)
+	{
+		X64Instruction *instruction = &f->instructions[i];
+		U32 reg = instruction->dst.reg;
+		bool is_unread = (instruction->op == X64MovOp && instruction->dst.kind == X64RegOperand && instruction->src.kind == X64ImmOperand &&
+		                  reg >= X64FirstVirtualReg && read_ns[reg] == 0);
+		if(!is_unread)
+		{
+			f->instructions[kept_n] = *instruction;
+			kept_n++;
+		}
+	}
+	stats->removed_n += f->instruction_n - kept_n;
+	f->instruction_n = kept_n;
+
+	free(write_ns);
+	free(read_ns);
+	free(write_at);
+}
+
+static void
+func X64TrimFrame(X64Function *f, X64Function *code, X64PeepholeStats *stats)
+{
+	// Without rbp in any operand, rsp only moves in the prologue and the epilogue, and the frame pointer is not needed.
+	// The frame then only holds the stack arguments of calls, and keeps rsp a multiple of 16 at them.
+	bool has_call = false;
+	for(size_t i = 0; i < code->instruction_n; i++)
+	{
+		X64Instruction *instruction = &code->instructions[i];
+		X64Operand *operands[2] = {&instruction->dst, &instruction->src};
+		for(U32 j = 0; j < 2; j++)
+		{
+			if(operands[j]->reg == X64Rbp || operands[j]->index == X64Rbp)
+				return;
+		}
+		has_call |= (instruction->op == X64CallOp);
+	}
+
+	U32 saved_size = 0;
+	for(U32 reg = 0; reg < X64FirstVirtualReg; reg++)
+	{
+		if((f->saved_mask >> reg) & 1)
+			saved_size += 8;
+	}
+
+	// rsp is 8 more than a multiple of 16 at the entry, from the return address.
+	U32 size = f->outgoing_size;
+	if(has_call)
+		size += (16 - (8 + saved_size + size) % 16) % 16;
+	f->has_frame_pointer = false;
+	f->frame_size = size;
+	stats->frameless_n++;
+}
+
+static void
+func X64OptimizeInstructions(X64Function *f, X64Function *code, X64PeepholeStats *stats)
+{
+	X64RotateLoops(f, code, stats);
+
+	bool *removed = (bool *)malloc((code->instruction_n + 1) * sizeof(bool));
+	for(U32 round = 0; round < X64MaxPeepholeRoundN; round++)
+	{
+		bool changed = X64CleanJumps(f, code, removed, stats);
+		changed |= X64RemoveUnreachable(f, code, removed, stats);
+		changed |= X64RemoveRedundantCopies(code, removed, stats);
+		changed |= X64RemoveDeadWrites(code, removed, stats);
+		if(!changed)
+			break;
+	}
+	free(removed);
+
+	X64TrimFrame(f, code, stats);
+}
@@ -1,17 +1,15 @@
 #Build and Run
-gcc M64.c -o M64.exe
-if [ $? != 0 ] ; then
-	exit 1
-fi
-
-./M64.exe Example/$1.m64 Example/$1.m64.c
+#Usage: br.sh example_name [M64 options], like br.sh BoundsCheck --bounds-check
+name=$1
+shift
 
+gcc M64.c -o M64.exe
 if [ $? != 0 ] ; then
 	exit 1
 fi
 
-echo Compiling c code...
-gcc Example/$1.m64.c -o Example/$1.exe
+echo Compiling m64 code...
+./M64.exe "$@" --build Example/$name.exe Example/$name.m64
 
 if [ $? != 0 ] ; then
 	exit 1
@@ -19,5 +17,4 @@ fi
 
 echo Running exe...
 echo --------------
-./Example/$1.exe
-
+./Example/$name.exe
@@ -0,0 +1,21 @@
+# Parser performance fuzzer, see Fuzz/Fuzz.c
+# fuzz.sh check           re-measure the regression corpus
+# fuzz.sh run [n]         fuzz for n iterations, seeded with the test code
+# fuzz.sh libfuzzer       build the libFuzzer target with clang
+mkdir -p Fuzz/Corpus
+
+if [ "$1" = "libfuzzer" ] ; then
+	clang -g -O1 -DFUZZ_LIBFUZZER -fsanitize=fuzzer,address Fuzz/Fuzz.c -o Fuzz/FuzzLib.exe -lm -lpthread
+	exit $?
+fi
+
+gcc -O2 Fuzz/Fuzz.c -o Fuzz/Fuzz.exe -lm -lpthread
+if [ $? != 0 ] ; then
+	exit 1
+fi
+
+if [ "$1" = "run" ] ; then
+	./Fuzz/Fuzz.exe run Fuzz/Corpus ${2:-1000} Test/Code.m64 Example/XHello.m64 Example/ToC.m64 Example/Generic.m64
+else
+	./Fuzz/Fuzz.exe check Fuzz/Corpus
+fi
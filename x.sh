@@ -7,15 +7,7 @@ fi
 
 echo Compiling to x64...
 
-./M64.exe Example/$1.m64 Example/$1.asm
-
-if [ $? != 0 ] ; then
-	exit 1
-fi
-
-echo Assembling...
-
-nasm -f win64 Example/$1.asm -o Example/$1.obj
+./M64.exe --x64 Example/$1.m64 Example/$1.o Example/$1.x64.c
 
 if [ $? != 0 ] ; then
 	exit 1
@@ -23,7 +15,7 @@ fi
 
 echo Linking...
 
-gcc Example/$1.obj -o Example/$1.exe
+gcc Example/$1.o Example/$1.x64.c -o Example/$1.exe -lm
 
 if [ $? != 0 ] ; then
 	exit 1